@@ -18,6 +18,10 @@
 #endif
 #include "esp_log.h"
 #include "esp_netif.h"
+#include "esp_timer.h"
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+#include "nvs.h"
+#endif
 #include "driver/gpio.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -37,6 +41,7 @@
 static EventGroupHandle_t s_connect_event_group;
 static esp_ip4_addr_t s_ip_addr;
 static const char *s_connection_name;
+static bool s_auto_reconnect = true;
 static esp_netif_t *s_example_esp_netif = NULL;
 
 #ifdef CONFIG_EXAMPLE_CONNECT_IPV6
@@ -45,18 +50,30 @@ static esp_ip6_addr_t s_ipv6_addr;
 
 static const char *TAG = "example_connect";
 
+/* when start() was called, to tell how long it took to get the address */
+static int64_t s_connect_started;
+
 /* set up connection, Wi-Fi or Ethernet */
 static void start(void);
 
 /* tear down connection, release resources */
 static void stop(void);
 
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+/* remember the access point we're associated with, for the next start() */
+static void wifi_cache_update(void);
+#endif
+
 static void on_got_ip(void *arg, esp_event_base_t event_base,
                       int32_t event_id, void *event_data)
 {
     ESP_LOGI(TAG, "Got IP event!");
     ip_event_got_ip_t *event = (ip_event_got_ip_t *)event_data;
     memcpy(&s_ip_addr, &event->ip_info.ip, sizeof(s_ip_addr));
+    ESP_LOGI(TAG, "Got IPv4 address %dms after start", (int) ((esp_timer_get_time() - s_connect_started) / 1000));
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+    wifi_cache_update();
+#endif
     xEventGroupSetBits(s_connect_event_group, GOT_IPV4_BIT);
 }
 
@@ -79,6 +96,7 @@ esp_err_t example_connect(void)
         return ESP_ERR_INVALID_STATE;
     }
     s_connect_event_group = xEventGroupCreate();
+    s_connect_started = esp_timer_get_time();
     start();
     ESP_ERROR_CHECK(esp_register_shutdown_handler(&stop));
     ESP_LOGI(TAG, "Waiting for IP");
@@ -106,9 +124,161 @@ esp_err_t example_disconnect(void)
 
 #ifdef CONFIG_EXAMPLE_CONNECT_WIFI
 
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+
+#define WIFI_CACHE_NAMESPACE "hcc_wifi"
+#define WIFI_CACHE_KEY "ap"
+#define WIFI_CACHE_VERSION 1
+
+/* The access point of the last successful connection. The SSID is kept to tell
+   if the configuration changed since. */
+typedef struct {
+    uint8_t version;
+    uint8_t channel;
+    uint8_t bssid[6];
+    char ssid[33];
+} wifi_cache_t;
+
+static wifi_cache_t s_wifi_cache;
+
+/* true from pinning the station configuration to the cached channel and BSSID until they give an IP address */
+static bool s_wifi_pinned;
+
+static bool wifi_cache_load(void)
+{
+    nvs_handle_t handle;
+    if (nvs_open(WIFI_CACHE_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t size = sizeof(s_wifi_cache);
+    esp_err_t err = nvs_get_blob(handle, WIFI_CACHE_KEY, &s_wifi_cache, &size);
+    nvs_close(handle);
+    if (err != ESP_OK || size != sizeof(s_wifi_cache) || s_wifi_cache.version != WIFI_CACHE_VERSION) {
+        memset(&s_wifi_cache, 0, sizeof(s_wifi_cache));
+        return false;
+    }
+    s_wifi_cache.ssid[sizeof(s_wifi_cache.ssid) - 1] = 0;
+    if (strcmp(s_wifi_cache.ssid, CONFIG_EXAMPLE_WIFI_SSID) != 0) {
+        ESP_LOGI(TAG, "Cached access point is for %s, ignored", s_wifi_cache.ssid);
+        memset(&s_wifi_cache, 0, sizeof(s_wifi_cache));
+        return false;
+    }
+    return true;
+}
+
+static void wifi_cache_store(void)
+{
+    nvs_handle_t handle;
+    esp_err_t err = nvs_open(WIFI_CACHE_NAMESPACE, NVS_READWRITE, &handle);
+    if (err == ESP_OK) {
+        err = s_wifi_cache.version == WIFI_CACHE_VERSION
+              ? nvs_set_blob(handle, WIFI_CACHE_KEY, &s_wifi_cache, sizeof(s_wifi_cache))
+              : nvs_erase_key(handle, WIFI_CACHE_KEY);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+        if (err == ESP_OK) {
+            err = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store the cached access point: %s", esp_err_to_name(err));
+    }
+}
+
+static void wifi_cache_update(void)
+{
+    // The cached access point worked, losing it later is no reason to forget it
+    s_wifi_pinned = false;
+
+    wifi_ap_record_t ap;
+    if (esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+        return;
+    }
+    if (s_wifi_cache.version == WIFI_CACHE_VERSION && s_wifi_cache.channel == ap.primary
+            && memcmp(s_wifi_cache.bssid, ap.bssid, sizeof(ap.bssid)) == 0) {
+        // Unchanged, spare the flash
+        return;
+    }
+    memset(&s_wifi_cache, 0, sizeof(s_wifi_cache));
+    s_wifi_cache.version = WIFI_CACHE_VERSION;
+    s_wifi_cache.channel = ap.primary;
+    memcpy(s_wifi_cache.bssid, ap.bssid, sizeof(ap.bssid));
+    strncpy(s_wifi_cache.ssid, CONFIG_EXAMPLE_WIFI_SSID, sizeof(s_wifi_cache.ssid) - 1);
+    ESP_LOGI(TAG, "Caching access point " MACSTR " on channel %d", MAC2STR(s_wifi_cache.bssid), s_wifi_cache.channel);
+    wifi_cache_store();
+}
+
+/* Let the driver scan for any access point with the SSID on the next connect */
+static void wifi_config_unpin(void)
+{
+    wifi_config_t wifi_config;
+    ESP_ERROR_CHECK(esp_wifi_get_config(ESP_IF_WIFI_STA, &wifi_config));
+    if (!wifi_config.sta.bssid_set) {
+        return;
+    }
+    wifi_config.sta.channel = 0;
+    wifi_config.sta.bssid_set = false;
+    memset(wifi_config.sta.bssid, 0, sizeof(wifi_config.sta.bssid));
+    ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+}
+
+/* The cached access point didn't work out: forget it, and scan */
+static void wifi_cache_unpin(void)
+{
+    s_wifi_pinned = false;
+
+    wifi_config_unpin();
+
+    memset(&s_wifi_cache, 0, sizeof(s_wifi_cache));
+    wifi_cache_store();
+}
+
+#endif // CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+
+#if CONFIG_EXAMPLE_WIFI_STATIC_IP
+
+static void set_static_ip(esp_netif_t *netif)
+{
+    esp_err_t err = esp_netif_dhcpc_stop(netif);
+    if (err != ESP_OK && err != ESP_ERR_ESP_NETIF_DHCP_ALREADY_STOPPED) {
+        ESP_ERROR_CHECK(err);
+    }
+
+    esp_netif_ip_info_t ip_info = { 0 };
+    ip_info.ip.addr = esp_ip4addr_aton(CONFIG_EXAMPLE_WIFI_STATIC_IP_ADDR);
+    ip_info.netmask.addr = esp_ip4addr_aton(CONFIG_EXAMPLE_WIFI_STATIC_NETMASK);
+    ip_info.gw.addr = esp_ip4addr_aton(CONFIG_EXAMPLE_WIFI_STATIC_GATEWAY);
+    ESP_ERROR_CHECK(esp_netif_set_ip_info(netif, &ip_info));
+
+    esp_netif_dns_info_t dns = { 0 };
+    dns.ip.type = ESP_IPADDR_TYPE_V4;
+    dns.ip.u_addr.ip4.addr = esp_ip4addr_aton(CONFIG_EXAMPLE_WIFI_STATIC_DNS);
+    ESP_ERROR_CHECK(esp_netif_set_dns_info(netif, ESP_NETIF_DNS_MAIN, &dns));
+
+    ESP_LOGI(TAG, "Static address " IPSTR ", gateway " IPSTR, IP2STR(&ip_info.ip), IP2STR(&ip_info.gw));
+}
+
+#endif // CONFIG_EXAMPLE_WIFI_STATIC_IP
+
 static void on_wifi_disconnect(void *arg, esp_event_base_t event_base,
                                int32_t event_id, void *event_data)
 {
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+    if (s_wifi_pinned) {
+        wifi_event_sta_disconnected_t *event = (wifi_event_sta_disconnected_t *)event_data;
+        ESP_LOGI(TAG, "Cached access point failed, reason %d, scanning for %s", event->reason, CONFIG_EXAMPLE_WIFI_SSID);
+        wifi_cache_unpin();
+    } else {
+        // Connected through the cache earlier, keep it for the next start(), but don't insist on that access point
+        wifi_config_unpin();
+    }
+#endif
+    if (!s_auto_reconnect) {
+        ESP_LOGI(TAG, "Wi-Fi disconnected");
+        return;
+    }
     ESP_LOGI(TAG, "Wi-Fi disconnected, trying to reconnect...");
     esp_err_t err = esp_wifi_connect();
     if (err == ESP_ERR_WIFI_NOT_STARTED) {
@@ -157,7 +327,21 @@ static void start(void)
             .password = CONFIG_EXAMPLE_WIFI_PASSWORD,
         },
     };
+#if CONFIG_EXAMPLE_WIFI_FAST_RECONNECT
+    if (wifi_cache_load()) {
+        // Skip the scan, go straight to the access point that worked last time
+        wifi_config.sta.channel = s_wifi_cache.channel;
+        wifi_config.sta.bssid_set = true;
+        memcpy(wifi_config.sta.bssid, s_wifi_cache.bssid, sizeof(wifi_config.sta.bssid));
+        s_wifi_pinned = true;
+        ESP_LOGI(TAG, "Trying cached access point " MACSTR " on channel %d",
+                 MAC2STR(s_wifi_cache.bssid), s_wifi_cache.channel);
+    }
+#endif
     ESP_LOGI(TAG, "Connecting to %s...", wifi_config.sta.ssid);
+#if CONFIG_EXAMPLE_WIFI_STATIC_IP
+    set_static_ip(netif);
+#endif
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
@@ -302,6 +486,11 @@ static void stop(void)
 
 #endif // CONFIG_EXAMPLE_CONNECT_ETHERNET
 
+void example_set_auto_reconnect(bool enable)
+{
+    s_auto_reconnect = enable;
+}
+
 esp_netif_t *get_example_netif(void)
 {
     return s_example_esp_netif;
@@ -46,6 +46,16 @@ esp_err_t example_connect(void);
  */
 esp_err_t example_disconnect(void);
 
+/**
+ * @brief Enable or disable reconnecting Wi-Fi automatically
+ *
+ * Enabled by default: the station reconnects right away whenever it gets
+ * disconnected. When disabled, the application is expected to register its
+ * own WIFI_EVENT_STA_DISCONNECTED handler, and call esp_wifi_connect() when
+ * it sees fit.
+ */
+void example_set_auto_reconnect(bool enable);
+
 /**
  * @brief Configure stdin and stdout to use blocking I/O
  *
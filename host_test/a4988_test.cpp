@@ -0,0 +1,144 @@
+#include "a4988.h"
+#include "check.h"
+#include "simulated_bus.h"
+#include "simulated_stepper.h"
+
+using namespace stepper;
+
+#define PIN_DIR 26
+#define PIN_MS1 14
+#define PIN_MS2 32
+#define PIN_MS3 15
+#define PIN_SLP 33
+
+/**
+ * A driver with every pin connected, on the simulated clock.
+ */
+struct Rig {
+
+    hcc_onewire::SimulatedClock clock;
+    SimulatedOutputPins pins;
+    SimulatedPulseGenerator pulses;
+    A4988 driver;
+
+    Rig() :
+        pins(&clock),
+        pulses(&clock),
+        driver({ PIN_DIR, PIN_MS1, PIN_MS2, PIN_MS3, PIN_SLP }, &pins, &pulses, 1000)
+    {
+        CHECK(driver.initialize());
+    }
+};
+
+static void test_microstep()
+{
+    Rig rig;
+
+    CHECK(rig.driver.getMaxMicrostep() == A4988::MAX_MICROSTEP);
+    CHECK(rig.driver.setMicrostep(3) == -2);
+    CHECK(rig.driver.setMicrostep(16) == 16);
+    CHECK(rig.pins.get(PIN_MS1) && rig.pins.get(PIN_MS2) && rig.pins.get(PIN_MS3));
+
+    // The position is in sixteenths whatever the setting
+    CHECK(rig.driver.step(Direction::up) == 1);
+
+    CHECK(rig.driver.setMicrostep(4) == 4);
+    CHECK(!rig.pins.get(PIN_MS1) && rig.pins.get(PIN_MS2) && !rig.pins.get(PIN_MS3));
+    CHECK(rig.driver.step(Direction::up) == 5);
+
+    CHECK(rig.driver.setMicrostep(1) == 1);
+    CHECK(rig.driver.step(Direction::down) == -11);
+}
+
+static void test_move()
+{
+    Rig rig;
+    ConstantTiming timing(250);
+
+    // Full steps, and the wake up delay out of the way
+    rig.driver.step(Direction::up);
+
+    int64_t dirChanged = rig.clock.micros();
+    size_t first = rig.pulses.getPulseTimes().size();
+
+    CHECK(rig.driver.move(Direction::down, 100, &timing));
+    CHECK(!rig.pins.get(PIN_DIR));
+
+    // One move at a time
+    CHECK(!rig.driver.move(Direction::down, 1, &timing));
+    CHECK(rig.driver.isMoving());
+    CHECK(rig.driver.wait(-1));
+    CHECK(!rig.driver.isMoving());
+
+    const std::vector<int64_t> &times = rig.pulses.getPulseTimes();
+
+    CHECK(times.size() - first == 100);
+    CHECK(times[first] - dirChanged >= A4988::DIR_SETUP_MICROS);
+
+    for (size_t pulse = first + 1; pulse < times.size(); pulse++) {
+        CHECK(times[pulse] - times[pulse - 1] == 250);
+    }
+
+    CHECK(rig.driver.getPosition() == 16 - 100 * 16);
+}
+
+static void test_stop()
+{
+    Rig rig;
+    ConstantTiming timing(250);
+
+    rig.driver.step(Direction::up);
+
+    size_t first = rig.pulses.getPulseTimes().size();
+
+    CHECK(rig.driver.move(Direction::up, 100, &timing));
+    CHECK(!rig.driver.wait(10000));
+
+    rig.driver.stop();
+
+    // The position counts the pulses that made it out, however far the generator rendered ahead
+    uint32_t taken = rig.pulses.getPulseTimes().size() - first;
+
+    CHECK(taken >= 39 && taken <= 41);
+    CHECK(rig.driver.getPosition() == 16 + 16 * (int) taken);
+    CHECK(rig.pulses.getPulseTimes().back() <= rig.clock.micros());
+    CHECK(!rig.driver.isMoving());
+
+    // And the next move starts from there
+    CHECK(rig.driver.move(Direction::up, 10, &timing));
+    CHECK(rig.driver.wait(-1));
+    CHECK(rig.driver.getPosition() == 16 + 16 * (int) taken + 160);
+}
+
+static void test_power_save()
+{
+    Rig rig;
+    ConstantTiming timing(250);
+
+    rig.driver.step(Direction::up);
+
+    CHECK(rig.driver.powerSave(true));
+    CHECK(!rig.pins.get(PIN_SLP));
+    CHECK(!rig.driver.move(Direction::up, 1, &timing));
+
+    CHECK(rig.driver.powerSave(false));
+    CHECK(rig.pins.get(PIN_SLP));
+
+    int64_t woken = rig.clock.micros();
+
+    rig.driver.step(Direction::up);
+
+    // The charge pump gets its time before the first pulse
+    CHECK(rig.pulses.getPulseTimes().back() - woken >= A4988::WAKE_MICROS);
+    CHECK(rig.driver.getPosition() == 32);
+}
+
+int main()
+{
+    RUN(test_microstep);
+    RUN(test_move);
+    RUN(test_stop);
+    RUN(test_power_save);
+
+    return 0;
+}
@@ -0,0 +1,108 @@
+#include <string.h>
+
+#include "cbor_payload.h"
+#include "check.h"
+
+using namespace hcc_mqtt;
+
+static const char *DEVICE_ID = "ESP32-246F28A7C53C";
+static const uint64_t ROM_CODE = 0xD90301A2792B0528ULL;
+
+/**
+ * 1: "ESP32-246F28A7C53C"
+ */
+static const uint8_t DEVICE_ID_FIELD[] = { 0x01, 0x72, 'E', 'S', 'P', '3', '2', '-', '2', '4', '6', 'F', '2', '8', 'A', '7', 'C', '5', '3', 'C' };
+
+/**
+ * 2: h'28052B79A20103D9', the ROM code in the bus order
+ */
+static const uint8_t ROM_CODE_FIELD[] = { 0x02, 0x48, 0x28, 0x05, 0x2B, 0x79, 0xA2, 0x01, 0x03, 0xD9 };
+
+/**
+ * 3: 394, 24.625C in 1/16C
+ */
+static const uint8_t SIGNAL_FIELD[] = { 0x03, 0x19, 0x01, 0x8A };
+
+static void test_sample()
+{
+    CborSamplePayload payload;
+
+    CHECK(payload.setup(ROM_CODE, DEVICE_ID));
+    CHECK(payload.render(24.625f) == 1 + sizeof(DEVICE_ID_FIELD) + sizeof(ROM_CODE_FIELD) + sizeof(SIGNAL_FIELD));
+
+    const uint8_t *data = payload.data();
+
+    CHECK(data[0] == 0xA3);
+    CHECK(memcmp(data + 1, DEVICE_ID_FIELD, sizeof(DEVICE_ID_FIELD)) == 0);
+    CHECK(memcmp(data + 1 + sizeof(DEVICE_ID_FIELD), ROM_CODE_FIELD, sizeof(ROM_CODE_FIELD)) == 0);
+    CHECK(memcmp(data + 1 + sizeof(DEVICE_ID_FIELD) + sizeof(ROM_CODE_FIELD), SIGNAL_FIELD, sizeof(SIGNAL_FIELD)) == 0);
+
+    // 4: 1596240000123, the timestamp makes it a map of four
+    CHECK(payload.render(24.625f, 1596240000123LL) == 1 + sizeof(DEVICE_ID_FIELD) + sizeof(ROM_CODE_FIELD) + sizeof(SIGNAL_FIELD) + 1 + 9);
+    CHECK(payload.data()[0] == 0xA4);
+}
+
+static void test_batch()
+{
+    CborSamplePayload payload;
+    CborBatchPayload batch;
+
+    CHECK(payload.setup(ROM_CODE, DEVICE_ID));
+    CHECK(batch.setup(DEVICE_ID, 2));
+
+    CHECK(batch.begin(0));
+    CHECK(batch.add(payload, 24.625f));
+    CHECK(batch.add(payload, 24.625f));
+    CHECK(batch.getSampleCount() == 2);
+
+    size_t length = batch.finish();
+    const uint8_t *data = batch.data();
+
+    // {1: ..., 4: 0, 5: [_ {2: ..., 3: 394}, {2: ..., 3: 394}]}
+    size_t sample = 1 + sizeof(ROM_CODE_FIELD) + sizeof(SIGNAL_FIELD);
+
+    CHECK(length == 1 + sizeof(DEVICE_ID_FIELD) + 2 + 2 + 2 * sample + 1);
+    CHECK(data[0] == 0xA3);
+    CHECK(memcmp(data + 1, DEVICE_ID_FIELD, sizeof(DEVICE_ID_FIELD)) == 0);
+
+    const uint8_t *samples = data + 1 + sizeof(DEVICE_ID_FIELD) + 2;
+
+    CHECK(samples[0] == 0x05 && samples[1] == 0x9F);
+    CHECK(samples[2] == 0xA2);
+    CHECK(memcmp(samples + 3, ROM_CODE_FIELD, sizeof(ROM_CODE_FIELD)) == 0);
+    CHECK(memcmp(samples + 3 + sizeof(ROM_CODE_FIELD), SIGNAL_FIELD, sizeof(SIGNAL_FIELD)) == 0);
+    CHECK(data[length - 1] == 0xFF);
+}
+
+static void test_batch_not_set_up()
+{
+    CborSamplePayload payload;
+    CborBatchPayload batch;
+
+    CHECK(payload.setup(ROM_CODE, DEVICE_ID));
+
+    // Never set up, and a device ID that doesn't fit
+    CHECK(!batch.begin(0));
+    CHECK(!batch.add(payload, 1));
+    CHECK(batch.finish() == 0);
+
+    CHECK(!batch.setup("ESP32-246F28A7C53C-much-too-long", 2));
+    CHECK(!batch.begin(0));
+    CHECK(!batch.add(payload, 1));
+
+    // A buffer alone doesn't make a message
+    CHECK(batch.reserve(2));
+    CHECK(!batch.begin(0));
+    CHECK(!batch.add(payload, 1));
+    CHECK(batch.finish() == 0);
+    CHECK(batch.getSampleCount() == 0);
+}
+
+int main()
+{
+    RUN(test_sample);
+    RUN(test_batch);
+    RUN(test_batch_not_set_up);
+
+    return 0;
+}
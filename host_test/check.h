@@ -0,0 +1,44 @@
+#ifndef _HCC_ESP32_HOST_CHECK_H_
+#define _HCC_ESP32_HOST_CHECK_H_
+
+#include <chrono>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Fail the test, and say where, unless the condition holds. Unlike {@code assert()}, not compiled out
+ * in the release builds.
+ */
+#define CHECK(condition) do { \
+        if (!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            exit(1); \
+        } \
+    } while (0)
+
+/**
+ * Run a test case, by the function name.
+ */
+#define RUN(test) do { \
+        printf("[%s]\n", #test); \
+        test(); \
+    } while (0)
+
+/**
+ * Wall clock time, to print what the host run took next to the simulated time.
+ */
+class Stopwatch {
+private:
+
+    std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+
+public:
+
+    int64_t micros()
+    {
+        return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+    }
+};
+
+#endif /* _HCC_ESP32_HOST_CHECK_H_ */
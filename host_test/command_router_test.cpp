@@ -0,0 +1,81 @@
+#include <string.h>
+
+#include "check.h"
+#include "command_router.h"
+
+using namespace hcc_mqtt;
+
+static const char *ROOT = "hcc/esp32-0011223344556677/";
+
+static int match(const CommandRouter &router, const char *topic, Command &command)
+{
+    return router.match(topic, strlen(topic), command);
+}
+
+static void test_match()
+{
+    CommandRouter router;
+    Command command;
+
+    router.setRoot(ROOT);
+
+    CHECK(router.add("hello") == 0);
+    CHECK(router.add("sensor/+/deadband") == 1);
+
+    CHECK(match(router, "hcc/esp32-0011223344556677/hello", command) == 0);
+    CHECK(command.route == 0);
+
+    CHECK(match(router, "hcc/esp32-0011223344556677/sensor/28FF4A1B33160387/deadband", command) == 1);
+    CHECK(command.route == 1);
+    CHECK(strcmp(command.arguments[0], "28FF4A1B33160387") == 0);
+
+    // Not ours, too short, too long, an empty wildcard
+    CHECK(match(router, "hcc/esp32-ffffffffffffffff/hello", command) < 0);
+    CHECK(match(router, "hcc/esp32-0011223344556677/sensor", command) < 0);
+    CHECK(match(router, "hcc/esp32-0011223344556677/hello/there", command) < 0);
+    CHECK(match(router, "hcc/esp32-0011223344556677/sensor//deadband", command) < 0);
+
+    // Doesn't fit the arguments
+    CHECK(match(router, "hcc/esp32-0011223344556677/sensor/0123456789012345678901234/deadband", command) < 0);
+}
+
+static void test_failed_add()
+{
+    CommandRouter router;
+    Command command;
+
+    router.setRoot(ROOT);
+
+    CHECK(router.add("hello") == 0);
+
+    // Malformed, and too deep; neither takes a number
+    CHECK(router.add("sensor//deadband") < 0);
+    CHECK(router.add("a/b/c/d/e") < 0);
+
+    // The routes after them are not shifted
+    CHECK(router.add("stepper/move") == 1);
+    CHECK(match(router, "hcc/esp32-0011223344556677/stepper/move", command) == 1);
+    CHECK(command.route == 1);
+}
+
+static void test_capacity()
+{
+    CommandRouter router;
+
+    router.setRoot(ROOT);
+
+    for (int route = 0; route < CommandRouter::MAX_ROUTES; route++) {
+        CHECK(router.add("hello") == route);
+    }
+
+    CHECK(router.add("hello") < 0);
+}
+
+int main()
+{
+    RUN(test_match);
+    RUN(test_failed_add);
+    RUN(test_capacity);
+
+    return 0;
+}
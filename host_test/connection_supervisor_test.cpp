@@ -0,0 +1,199 @@
+#include "check.h"
+#include "connection_supervisor.h"
+
+using namespace hcc_mqtt;
+
+#define SECOND 1000000LL
+
+static void test_backoff()
+{
+    Backoff backoff(500000, 60 * SECOND, 42);
+
+    for (int attempt = 0; attempt < 12; attempt++) {
+
+        int64_t delay = backoff.next();
+        int64_t cap = 500000LL << attempt;
+
+        if (cap > 60 * SECOND) {
+            cap = 60 * SECOND;
+        }
+
+        // The upper half of the doubled delay, never over the maximum
+        CHECK(delay >= cap / 2 && delay <= cap);
+    }
+
+    CHECK(backoff.getAttempts() == 12);
+
+    backoff.reset();
+
+    CHECK(backoff.getAttempts() == 0);
+    CHECK(backoff.next() <= 500000);
+}
+
+static void test_backoff_jitter()
+{
+    // The nodes that lost the connection at the same time shouldn't all come back at the same time
+    Backoff a(SECOND, 60 * SECOND, 1);
+    Backoff b(SECOND, 60 * SECOND, 2);
+
+    int same = 0;
+
+    for (int attempt = 0; attempt < 8; attempt++) {
+        same += a.next() == b.next();
+    }
+
+    CHECK(same < 2);
+
+    // Deterministic for the seed
+    Backoff c(SECOND, 60 * SECOND, 1);
+    Backoff d(SECOND, 60 * SECOND, 1);
+
+    for (int attempt = 0; attempt < 8; attempt++) {
+        CHECK(c.next() == d.next());
+    }
+}
+
+static void test_outage()
+{
+    ConnectionSupervisor supervisor(SECOND, 8 * SECOND, 7);
+    int64_t now = 0;
+
+    CHECK(supervisor.poll(now) == ConnectionAction::none);
+    CHECK(supervisor.getDue() == -1);
+
+    // The first connect failed
+    supervisor.networkDown(now);
+
+    CHECK(!supervisor.isOnline());
+    CHECK(supervisor.getDue() > 0 && supervisor.getDue() <= SECOND);
+
+    now = supervisor.getDue();
+
+    CHECK(supervisor.poll(now) == ConnectionAction::reconnectNetwork);
+
+    supervisor.networkUp(now);
+
+    // The application makes the first broker connection itself
+    CHECK(supervisor.getDue() == -1);
+    CHECK(supervisor.getState() == ConnectionState::network);
+
+    supervisor.brokerUp(now);
+
+    CHECK(supervisor.isOnline());
+    CHECK(supervisor.getReconnects() == 0);
+    CHECK(supervisor.getDisconnectedMicros(now) == 0);
+
+    now += 10 * SECOND;
+    int64_t outage = now;
+
+    supervisor.networkDown(now);
+
+    CHECK(!supervisor.isOnline());
+    CHECK(supervisor.poll(now) == ConnectionAction::dropBroker);
+
+    // The broker client reports the drop
+    supervisor.brokerDown(now + 1);
+
+    CHECK(supervisor.getDue() > now);
+
+    now = supervisor.getDue();
+
+    CHECK(supervisor.poll(now) == ConnectionAction::reconnectNetwork);
+
+    // Failed again, backs off further
+    supervisor.networkDown(now);
+
+    int64_t delay = supervisor.getDue() - now;
+
+    CHECK(delay >= SECOND && delay <= 2 * SECOND);
+
+    now = supervisor.getDue();
+
+    CHECK(supervisor.poll(now) == ConnectionAction::reconnectNetwork);
+
+    // The broker is retried as soon as the network is back
+    supervisor.networkUp(now);
+
+    CHECK(supervisor.poll(now) == ConnectionAction::reconnectBroker);
+
+    // The broker refused
+    supervisor.brokerDown(now);
+
+    delay = supervisor.getDue() - now;
+
+    CHECK(delay >= SECOND / 2 && delay <= SECOND);
+
+    now = supervisor.getDue();
+
+    CHECK(supervisor.poll(now) == ConnectionAction::reconnectBroker);
+
+    supervisor.brokerUp(now);
+
+    CHECK(supervisor.isOnline());
+    CHECK(supervisor.getReconnects() == 1);
+    CHECK(supervisor.getDisconnectedMicros(now) == now - outage);
+
+    // A duplicate changes nothing
+    supervisor.brokerUp(now);
+
+    CHECK(supervisor.poll(now) == ConnectionAction::none);
+    CHECK(supervisor.getReconnects() == 1);
+}
+
+static void test_broker_outage()
+{
+    ConnectionSupervisor supervisor(SECOND, 8 * SECOND, 7);
+    int64_t now = 0;
+
+    supervisor.networkUp(now);
+    supervisor.brokerUp(now);
+
+    now += SECOND;
+    int64_t outage = now;
+
+    supervisor.brokerDown(now);
+
+    CHECK(supervisor.getState() == ConnectionState::network);
+
+    // The network didn't go anywhere
+    CHECK(supervisor.poll(now) == ConnectionAction::none);
+
+    now = supervisor.getDue();
+
+    CHECK(supervisor.poll(now) == ConnectionAction::reconnectBroker);
+
+    supervisor.brokerUp(now);
+
+    CHECK(supervisor.getReconnects() == 1);
+    CHECK(supervisor.getDisconnectedMicros(now + SECOND) == now - outage);
+}
+
+static void test_broker_up_offline()
+{
+    ConnectionSupervisor supervisor(SECOND, 8 * SECOND, 7);
+    int64_t now = 0;
+
+    supervisor.networkUp(now);
+    supervisor.brokerUp(now);
+    supervisor.networkDown(now);
+
+    CHECK(supervisor.poll(now) == ConnectionAction::dropBroker);
+
+    // Made it just before the network went down, it's not going to last
+    supervisor.brokerUp(now);
+
+    CHECK(!supervisor.isOnline());
+    CHECK(supervisor.poll(now) == ConnectionAction::dropBroker);
+    CHECK(supervisor.poll(now) == ConnectionAction::none);
+}
+
+int main()
+{
+    RUN(test_backoff);
+    RUN(test_backoff_jitter);
+    RUN(test_outage);
+    RUN(test_broker_outage);
+    RUN(test_broker_up_offline);
+
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include <string.h>
+
+#include "check.h"
+#include "duty_cycle.h"
+#include "simulated_bus.h"
+
+using namespace hcc_power;
+
+#define SECOND 1000000LL
+
+static const int64_t PERIOD = 30 * SECOND;
+
+/**
+ * Where the cold boot happened, the grid the wakes are on.
+ */
+static const int64_t BOOT = 300000;
+
+static void test_cold_boot()
+{
+    hcc_onewire::SimulatedClock clock;
+    DutyState state;
+
+    // Whatever the RTC memory held before the power up
+    memset(&state, 0xA5, sizeof(state));
+
+    DutyCycle dutyCycle(&clock, &state, PERIOD, 3);
+
+    CHECK(!dutyCycle.begin(true));
+    CHECK(dutyCycle.getWakes() == 0);
+
+    // Announce the node right away
+    CHECK(dutyCycle.shouldConnect(0, 3, 128));
+
+    // A reset is a cold boot, whatever the state
+    dutyCycle.end(0);
+
+    CHECK(!dutyCycle.begin(false));
+}
+
+static void test_schedule()
+{
+    hcc_onewire::SimulatedClock clock;
+    DutyState state = {};
+    DutyCycle dutyCycle(&clock, &state, PERIOD, 3);
+
+    clock.advance(BOOT);
+
+    CHECK(!dutyCycle.begin(true));
+
+    int connects = 0;
+
+    for (int wake = 0; wake < 12; wake++) {
+
+        if (wake > 0) {
+            CHECK(dutyCycle.begin(true));
+            CHECK(dutyCycle.getWakes() == (uint32_t) wake);
+        }
+
+        bool connect = dutyCycle.shouldConnect(5, 3, 128);
+
+        if (connect) {
+            connects++;
+            dutyCycle.connected();
+            clock.advance(3 * SECOND);
+        } else {
+            clock.advance(800000);
+        }
+
+        // Overrun by two periods, the missed cycles are skipped
+        if (wake == 7) {
+            clock.advance(65 * SECOND);
+        }
+
+        int64_t sleep = dutyCycle.end(100000);
+
+        CHECK(sleep >= 100000);
+        CHECK(sleep <= PERIOD);
+
+        clock.advance(sleep);
+
+        // The next wake is back on the grid, however long this one took
+        CHECK((clock.micros() - BOOT) % PERIOD == 0);
+    }
+
+    // The cold boot, and every third wake after it
+    CHECK(connects == 4);
+
+    printf("%u wakes, awake %.2f%% of the time\n", dutyCycle.getWakes(), dutyCycle.getAwakeRatio() * 100);
+
+    CHECK(dutyCycle.getAwakeRatio() > 0.01f && dutyCycle.getAwakeRatio() < 0.25f);
+}
+
+static void test_buffer_full()
+{
+    hcc_onewire::SimulatedClock clock;
+    DutyState state = {};
+    DutyCycle dutyCycle(&clock, &state, PERIOD, 100);
+
+    dutyCycle.begin(true);
+    dutyCycle.connected();
+    dutyCycle.end(0);
+
+    dutyCycle.begin(true);
+
+    CHECK(!dutyCycle.shouldConnect(100, 3, 128));
+
+    // Another wake's samples wouldn't fit
+    CHECK(dutyCycle.shouldConnect(126, 3, 128));
+}
+
+static void test_awake_meter()
+{
+    AwakeMeter meter(0);
+
+    CHECK(meter.getRatio(0) == 1.0f);
+
+    meter.sleep(100);
+    meter.wake(900);
+    meter.sleep(1000);
+
+    // Awake for 100 + 100 of 2000
+    CHECK(meter.getRatio(2000) > 0.099f && meter.getRatio(2000) < 0.101f);
+
+    // Repeated transitions don't count twice
+    meter.sleep(1500);
+    meter.wake(2000);
+    meter.wake(2500);
+
+    CHECK(meter.getRatio(3000) > 0.399f && meter.getRatio(3000) < 0.401f);
+}
+
+int main()
+{
+    RUN(test_cold_boot);
+    RUN(test_schedule);
+    RUN(test_buffer_full);
+    RUN(test_awake_meter);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "check.h"
+#include "homing.h"
+#include "simulated_bus.h"
+#include "simulated_stepper.h"
+
+using namespace stepper;
+
+#define DIR_PIN 26
+
+static const HomingConfig CONFIG = { Direction::down, 500, 5000, 100, 20000 };
+
+/**
+ * A stepper, and a limit switch {@code distance} steps down from where it starts.
+ */
+struct Rig {
+
+    hcc_onewire::SimulatedClock clock;
+    SimulatedOutputPins pins;
+    SimulatedPulseGenerator pulses;
+    A4988 driver;
+    SimulatedLimitSwitch limit;
+    Homing homing;
+
+    Rig(int distance) :
+        pins(&clock),
+        pulses(&clock),
+        driver({ DIR_PIN, -1, -1, -1, -1 }, &pins, &pulses, 1000),
+        limit(&pulses, &pins, DIR_PIN, false, distance),
+        homing(&driver, &pulses, &limit)
+    {
+        CHECK(driver.initialize());
+        CHECK(limit.initialize());
+    }
+};
+
+static void test_found()
+{
+    Rig rig(5000);
+
+    CHECK(!rig.limit.isPressed());
+    CHECK(rig.homing.home(CONFIG) == HomingResult::ok);
+
+    // Position zero is exactly where the switch closes, on the slow approach
+    CHECK(rig.driver.getPosition() == 0);
+    CHECK(rig.limit.getPosition() == 5000);
+    CHECK(rig.limit.isPressed());
+
+    printf("homed in %.3fs, the fast approach was %d steps off\n", rig.clock.micros() / 1e6, rig.homing.getApproachError());
+}
+
+static void test_pressed_at_boot()
+{
+    // Already on the switch
+    Rig rig(-3);
+
+    CHECK(rig.limit.isPressed());
+    CHECK(rig.homing.home(CONFIG) == HomingResult::ok);
+
+    // Backed off, and came back to the same place
+    CHECK(rig.driver.getPosition() == 0);
+    CHECK(rig.limit.getPosition() == -3);
+    CHECK(rig.limit.isPressed());
+}
+
+static void test_not_found()
+{
+    // Further than the travel
+    Rig rig(30000);
+
+    CHECK(rig.homing.home(CONFIG) == HomingResult::notFound);
+
+    // Gave up after the travel, and didn't pretend to know where it is
+    CHECK(rig.limit.getPosition() == (int) CONFIG.travel);
+    CHECK(rig.driver.getPosition() == -(int) CONFIG.travel);
+    CHECK(!rig.limit.isPressed());
+
+    // At the fast approach speed
+    CHECK(rig.clock.micros() >= (int64_t) CONFIG.travel * CONFIG.fastMicros);
+}
+
+int main()
+{
+    RUN(test_found);
+    RUN(test_pressed_at_boot);
+    RUN(test_not_found);
+
+    return 0;
+}
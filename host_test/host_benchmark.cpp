@@ -0,0 +1,15 @@
+/*
+ * The sample pipeline benchmarks on the host, the same stages app_main() runs on the boot console with
+ * CONFIG_HCC_ESP32_BENCHMARK, minus the ones that need the application, and the cJSON ones if the build found
+ * no cJSON. The lines starting with "bench," can be compared between builds the same way, the cycle counts are
+ * the host's time stamp counter. Fails if the sample payload doesn't match cJSON's output.
+ */
+
+#include "benchmark.h"
+
+int main()
+{
+    hcc_benchmark::Hooks hooks = {};
+
+    return hcc_benchmark::run("benchmark", "D90301A2792B0528", "ESP32-246F28A7C53C", hooks) ? 0 : 1;
+}
@@ -0,0 +1,298 @@
+/*
+ * Drives the ConnectionSupervisor against a TCP broker stand-in, in real time, the way the link task does.
+ * The stand-in is a child process that accepts the connections and swallows whatever comes in; it is killed
+ * in the middle of the run, and started again a few seconds later.
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "check.h"
+#include "connection_supervisor.h"
+
+using namespace hcc_mqtt;
+
+#define SECOND 1000000LL
+
+static int64_t micros()
+{
+    timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * SECOND + ts.tv_nsec / 1000;
+}
+
+/**
+ * Return a port nobody listens on right now.
+ */
+static uint16_t free_port()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    socklen_t length = sizeof(address);
+
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    CHECK(bind(fd, (sockaddr *) &address, sizeof(address)) == 0);
+    CHECK(getsockname(fd, (sockaddr *) &address, &length) == 0);
+
+    close(fd);
+
+    return ntohs(address.sin_port);
+}
+
+/**
+ * Start the broker stand-in, and return its PID when it's listening.
+ */
+static pid_t broker_start(uint16_t port)
+{
+    int ready[2];
+
+    CHECK(pipe(ready) == 0);
+
+    pid_t pid = fork();
+
+    CHECK(pid >= 0);
+
+    if (pid > 0) {
+
+        char c;
+
+        close(ready[1]);
+        CHECK(read(ready[0], &c, 1) == 1);
+        close(ready[0]);
+
+        return pid;
+    }
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    sockaddr_in address = {};
+
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 4) != 0) {
+        _exit(1);
+    }
+
+    CHECK(write(ready[1], "r", 1) == 1);
+
+    std::vector<pollfd> fds = { { listener, POLLIN, 0 } };
+
+    while (1) {
+
+        poll(fds.data(), fds.size(), -1);
+
+        for (size_t offset = fds.size(); offset-- > 1; ) {
+
+            char buffer[256];
+
+            if ((fds[offset].revents & (POLLIN | POLLHUP)) && read(fds[offset].fd, buffer, sizeof(buffer)) <= 0) {
+                close(fds[offset].fd);
+                fds.erase(fds.begin() + offset);
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            fds.push_back({ accept(listener, NULL, NULL), POLLIN, 0 });
+        }
+    }
+}
+
+/**
+ * Kill the stand-in, the way a crashing broker goes: the kernel closes the connections.
+ */
+static void broker_kill(pid_t pid)
+{
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+/**
+ * The broker client: a TCP connection, and the events it reports.
+ */
+struct Client {
+
+    uint16_t port;
+    int fd = -1;
+
+    ConnectionSupervisor &supervisor;
+    int64_t started;
+
+    int hellos = 0;
+    int attempts = 0;
+
+    Client(uint16_t port, ConnectionSupervisor &supervisor, int64_t started) : port(port), supervisor(supervisor), started(started) {}
+
+    void connect()
+    {
+        attempts++;
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+
+        sockaddr_in address = {};
+
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        int64_t now = micros();
+
+        if (::connect(fd, (sockaddr *) &address, sizeof(address)) != 0) {
+
+            close(fd);
+            fd = -1;
+
+            supervisor.brokerDown(now);
+            printf("%6.2fs connect failed, next attempt in %lldms\n", (now - started) / 1e6, (long long) (supervisor.getDue() - now) / 1000);
+
+            return;
+        }
+
+        supervisor.brokerUp(now);
+
+        // Every connection is a new session
+        hellos++;
+
+        printf("%6.2fs connected, %u reconnects, %lldms disconnected\n",
+            (now - started) / 1e6, supervisor.getReconnects(), (long long) supervisor.getDisconnectedMicros(now) / 1000);
+    }
+
+    /**
+     * Notice the broker going away.
+     */
+    void check()
+    {
+        if (fd < 0) {
+            return;
+        }
+
+        pollfd p = { fd, POLLIN, 0 };
+        char buffer[16];
+
+        if (poll(&p, 1, 0) > 0 && read(fd, buffer, sizeof(buffer)) <= 0) {
+
+            close(fd);
+            fd = -1;
+
+            int64_t now = micros();
+
+            supervisor.brokerDown(now);
+            printf("%6.2fs disconnected, next attempt in %lldms\n", (now - started) / 1e6, (long long) (supervisor.getDue() - now) / 1000);
+        }
+    }
+
+    bool publish()
+    {
+        return fd >= 0 && send(fd, "x", 1, MSG_NOSIGNAL) == 1;
+    }
+};
+
+int main()
+{
+    const int64_t killAt = 1 * SECOND;
+    const int64_t restartAt = 3500000;
+    const int64_t endAt = 6 * SECOND;
+
+    uint16_t port = free_port();
+    pid_t broker = broker_start(port);
+
+    ConnectionSupervisor supervisor(100000, SECOND, 1234);
+    int64_t started = micros();
+    Client client(port, supervisor, started);
+
+    int sent = 0;
+    int gated = 0;
+    int gatedWhileUp = 0;
+    bool killed = false;
+    bool restarted = false;
+    int64_t nextSample = started;
+
+    supervisor.networkUp(started);
+
+    // The application makes the first connection itself
+    client.connect();
+
+    CHECK(supervisor.isOnline());
+
+    while (micros() < started + endAt) {
+
+        int64_t now = micros();
+
+        if (!killed && now >= started + killAt) {
+            broker_kill(broker);
+            killed = true;
+            printf("%6.2fs broker killed\n", (now - started) / 1e6);
+        }
+
+        if (!restarted && now >= started + restartAt) {
+            broker = broker_start(port);
+            restarted = true;
+            printf("%6.2fs broker restarted\n", (now - started) / 1e6);
+        }
+
+        client.check();
+
+        ConnectionAction action;
+
+        while ((action = supervisor.poll(micros())) != ConnectionAction::none) {
+            if (action == ConnectionAction::reconnectBroker) {
+                client.connect();
+            }
+        }
+
+        // Sample every 50ms, publish only if the message has a way out
+        if (now >= nextSample) {
+
+            nextSample += 50000;
+
+            if (supervisor.isOnline()) {
+                CHECK(client.publish());
+                sent++;
+            } else {
+                gated++;
+                gatedWhileUp += !killed;
+            }
+        }
+
+        usleep(5000);
+    }
+
+    broker_kill(broker);
+
+    int64_t disconnected = supervisor.getDisconnectedMicros(micros());
+
+    printf("%d published, %d gated, %d connect attempts, %d hellos, %u reconnects, %lldms disconnected\n",
+        sent, gated, client.attempts, client.hellos, supervisor.getReconnects(), (long long) disconnected / 1000);
+
+    CHECK(supervisor.isOnline());
+    CHECK(supervisor.getReconnects() == 1);
+    CHECK(client.hellos == 2);
+
+    // Backed off while the broker was down, rather than hammering it
+    CHECK(client.attempts > 2 && client.attempts < 12);
+
+    // Back within the longest backoff from the restart
+    CHECK(disconnected >= restartAt - killAt);
+    CHECK(disconnected <= restartAt - killAt + SECOND + 200000);
+
+    // Nothing was held back while the broker was up, and nothing went out while it was down
+    CHECK(gatedWhileUp == 0);
+    CHECK(gated >= (restartAt - killAt) / 50000 - 2);
+
+    return 0;
+}
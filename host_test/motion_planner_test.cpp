@@ -0,0 +1,250 @@
+#include <vector>
+
+#include "check.h"
+#include "motion_planner.h"
+#include "simulated_bus.h"
+#include "simulated_stepper.h"
+
+using namespace stepper;
+
+#define DIR_PIN 26
+
+/**
+ * 2000 steps per second, reached in half a second, 500 steps.
+ */
+#define MAX_SPEED 2000
+#define ACCELERATION 4000
+
+/**
+ * A full stepping driver, and the planner moving it, on the simulated clock.
+ */
+struct Rig {
+
+    hcc_onewire::SimulatedClock clock;
+    SimulatedOutputPins pins;
+    SimulatedPulseGenerator pulses;
+    A4988 driver;
+    MotionPlanner planner;
+
+    Rig(Profile profile) :
+        pins(&clock),
+        pulses(&clock),
+        driver({ DIR_PIN, -1, -1, -1, -1 }, &pins, &pulses, 1000),
+        planner(&driver)
+    {
+        CHECK(driver.initialize());
+        CHECK(planner.setup(MAX_SPEED, ACCELERATION, profile));
+
+        // The wake up delay out of the way
+        driver.step(Direction::up);
+        driver.step(Direction::down);
+    }
+
+    /**
+     * Offset of the next pulse, to tell the runs apart.
+     */
+    size_t mark()
+    {
+        return pulses.getPulseTimes().size();
+    }
+
+    /**
+     * Intervals between the pulses since the {@code mark}.
+     */
+    std::vector<int64_t> intervals(size_t mark)
+    {
+        const std::vector<int64_t> &times = pulses.getPulseTimes();
+        std::vector<int64_t> result;
+
+        for (size_t pulse = mark + 1; pulse < times.size(); pulse++) {
+            result.push_back(times[pulse] - times[pulse - 1]);
+        }
+
+        return result;
+    }
+};
+
+/**
+ * Check that the run speeds up, possibly cruises, and slows down, and never the other way around.
+ * Returns the shortest interval.
+ */
+static int64_t check_ramp(const std::vector<int64_t> &intervals)
+{
+    bool slowingDown = false;
+    int64_t shortest = INT64_MAX;
+
+    for (size_t offset = 1; offset < intervals.size(); offset++) {
+
+        if (intervals[offset] > intervals[offset - 1]) {
+            slowingDown = true;
+        }
+
+        CHECK(!slowingDown || intervals[offset] >= intervals[offset - 1]);
+
+        shortest = intervals[offset] < shortest ? intervals[offset] : shortest;
+    }
+
+    // From rest, to rest
+    if (!intervals.empty()) {
+        CHECK(intervals.front() == intervals.back());
+    }
+
+    return shortest;
+}
+
+static void test_move(Profile profile)
+{
+    Rig rig(profile);
+
+    size_t mark = rig.mark();
+
+    rig.planner.moveTo(2000);
+
+    CHECK(!rig.planner.isAtTarget());
+    CHECK(rig.planner.update());
+    CHECK(rig.driver.wait(-1));
+
+    CHECK(rig.driver.getPosition() == 2000);
+    CHECK(rig.planner.isAtTarget());
+    CHECK(!rig.planner.update());
+
+    std::vector<int64_t> intervals = rig.intervals(mark);
+
+    CHECK(intervals.size() == 1999);
+    CHECK(check_ramp(intervals) == rig.planner.getCruiseMicros());
+
+    printf("%d steps ramp, %lldus to %uus, 2000 steps in %.3fs\n", rig.planner.getRampLength(),
+        (long long) intervals.front(), rig.planner.getCruiseMicros(), (rig.pulses.getPulseTimes().back() - rig.pulses.getPulseTimes()[mark]) / 1e6);
+
+    // And back, the same way
+    mark = rig.mark();
+
+    rig.planner.moveBy(-2000);
+
+    CHECK(rig.planner.update());
+    CHECK(rig.driver.wait(-1));
+    CHECK(rig.driver.getPosition() == 0);
+    CHECK(rig.intervals(mark) == intervals);
+}
+
+static void test_trapezoidal()
+{
+    test_move(Profile::trapezoidal);
+}
+
+static void test_s_curve()
+{
+    test_move(Profile::sCurve);
+}
+
+static void test_extended()
+{
+    Rig rig(Profile::trapezoidal);
+
+    size_t mark = rig.mark();
+    uint32_t runs = rig.pulses.getStats().runs;
+
+    // Too short to get to the top speed
+    rig.planner.moveTo(600);
+
+    CHECK(rig.planner.update());
+    CHECK(!rig.driver.wait(200000));
+
+    // Further away while it's still speeding up, it just keeps going
+    rig.planner.moveTo(3000);
+
+    CHECK(rig.driver.wait(-1));
+    CHECK(rig.driver.getPosition() == 3000);
+    CHECK(rig.pulses.getStats().runs == runs + 1);
+
+    CHECK(check_ramp(rig.intervals(mark)) == rig.planner.getCruiseMicros());
+}
+
+static void test_reversed()
+{
+    Rig rig(Profile::trapezoidal);
+
+    size_t mark = rig.mark();
+
+    rig.planner.moveTo(2000);
+
+    CHECK(rig.planner.update());
+    CHECK(!rig.driver.wait(300000));
+
+    // Behind by the time it's going at 1200 steps per second, which takes 180 steps to stop from
+    rig.planner.moveTo(100);
+
+    CHECK(rig.driver.wait(-1));
+
+    int overshoot = rig.driver.getPosition();
+
+    CHECK(overshoot > 300);
+    CHECK(!rig.planner.isAtTarget());
+
+    check_ramp(rig.intervals(mark));
+
+    // The way back is a move of its own
+    mark = rig.mark();
+
+    CHECK(rig.planner.update());
+    CHECK(!rig.pins.get(DIR_PIN));
+    CHECK(rig.driver.wait(-1));
+
+    CHECK(rig.driver.getPosition() == 100);
+    CHECK(rig.planner.isAtTarget());
+    CHECK((int) rig.intervals(mark).size() == overshoot - 100 - 1);
+
+    check_ramp(rig.intervals(mark));
+}
+
+static void test_single_steps()
+{
+    Rig rig(Profile::trapezoidal);
+
+    for (int step = 0; step < 3; step++) {
+
+        size_t mark = rig.mark();
+
+        rig.planner.moveBy(1);
+
+        CHECK(rig.planner.update());
+        CHECK(rig.driver.wait(-1));
+
+        CHECK(rig.driver.getPosition() == step + 1);
+        CHECK(rig.mark() == mark + 1);
+        CHECK(rig.planner.isAtTarget());
+    }
+
+    size_t mark = rig.mark();
+
+    rig.planner.moveBy(-1);
+
+    CHECK(rig.planner.update());
+    CHECK(rig.driver.wait(-1));
+    CHECK(rig.driver.getPosition() == 2);
+    CHECK(rig.mark() == mark + 1);
+
+    // Two steps, both as slow as it gets
+    mark = rig.mark();
+
+    rig.planner.moveBy(2);
+
+    CHECK(rig.planner.update());
+    CHECK(rig.driver.wait(-1));
+    CHECK(rig.driver.getPosition() == 4);
+    CHECK(rig.intervals(mark).size() == 1);
+
+    // Nowhere to go
+    CHECK(!rig.planner.update());
+}
+
+int main()
+{
+    RUN(test_trapezoidal);
+    RUN(test_s_curve);
+    RUN(test_extended);
+    RUN(test_reversed);
+    RUN(test_single_steps);
+
+    return 0;
+}
@@ -0,0 +1,531 @@
+#include <math.h>
+#include <string.h>
+
+#include "check.h"
+#include "onewire.h"
+#include "simulated_bus.h"
+
+using namespace hcc_onewire;
+
+static const char *TAG = "onewire_test";
+
+/**
+ * {@link Led} that only counts the flashes.
+ */
+class CountingLed : public Led {
+public:
+
+    int flashes = 0;
+
+    void flash(long millis) override
+    {
+        flashes++;
+    }
+};
+
+static SimulatedBus::Config config(int devices, float crcFailureRate)
+{
+    SimulatedBus::Config c = {};
+
+    c.devices = devices;
+    c.crcFailureRate = crcFailureRate;
+    c.conversionScale = 1.0f;
+    c.seed = 7;
+
+    return c;
+}
+
+/**
+ * The simulated device behind the device at {@code offset}, the bus may have found them in any order.
+ */
+static SimulatedDevice &simulated(SimulatedBus &bus, OneWire &oneWire, int offset)
+{
+    int index = 0;
+
+    while (memcmp(bus.getDevice(index).romCode.bytes, oneWire.getRomCodeAt(offset).bytes, sizeof(RomCode)) != 0) {
+        index++;
+    }
+
+    return bus.getDevice(index);
+}
+
+static void test_browse()
+{
+    SimulatedClock clock;
+    SimulatedBus bus("sim0", &clock, config(3, 0));
+    OneWire oneWire(TAG, &bus, &clock, NULL, 0);
+
+    CHECK(oneWire.getDeviceCount() == -1);
+    CHECK(oneWire.browse() == 3);
+    CHECK(oneWire.getDeviceCount() == 3);
+
+    // The settle delay
+    CHECK(clock.micros() >= 2000000);
+
+    for (int offset = 0; offset < 3; offset++) {
+        CHECK(oneWire.isPresentAt(offset));
+        CHECK(oneWire.getAddressAt(offset).length() == 16);
+    }
+}
+
+static void test_poll()
+{
+    SimulatedClock clock;
+    SimulatedBus bus("sim0", &clock, config(3, 0));
+    CountingLed led;
+    OneWire oneWire(TAG, &bus, &clock, &led, 50);
+
+    oneWire.browse();
+
+    // The power on value in the scratchpad doesn't count
+    oneWire.poll();
+
+    int64_t started = clock.micros();
+    std::vector<Reading> readings = oneWire.poll();
+
+    CHECK(readings.size() == 3);
+
+    for (auto &r : readings) {
+        CHECK(r.status == ReadingStatus::ok);
+        CHECK(r.error == BusError::ok);
+        CHECK(r.resolution == RESOLUTION_12_BIT);
+        CHECK(r.value > 15 && r.value < 35);
+    }
+
+    // Blocks for the whole 12 bit conversion, and no more than that
+    CHECK(clock.micros() - started == oneWire.getConversionMillis() * 1000);
+    CHECK(oneWire.getLastTiming().waitMicros == oneWire.getConversionMillis() * 1000);
+
+    // Once when the conversion starts, and once when the readings are in
+    CHECK(led.flashes == 4);
+}
+
+static void test_rom_cache()
+{
+    SimulatedClock clock;
+    SimulatedBus bus("sim0", &clock, config(2, 0));
+    MemoryRomCache cache;
+
+    OneWire first(TAG, &bus, &clock, NULL, 0);
+
+    CHECK(first.browse(&cache) == 2);
+    CHECK(cache.stores == 1);
+
+    // Next boot, the same devices are there: no settle delay, no search
+    SimulatedClock rebootClock;
+    SimulatedBus rebooted("sim0", &rebootClock, config(2, 0));
+    OneWire second(TAG, &rebooted, &rebootClock, NULL, 0);
+
+    CHECK(second.browse(&cache) == 2);
+    CHECK(rebootClock.micros() < 2000000);
+    CHECK(rebooted.getStats().searches == 0);
+
+    for (int offset = 0; offset < 2; offset++) {
+        CHECK(second.getAddressAt(offset) == first.getAddressAt(offset));
+    }
+
+    // A cached device is gone, it's the full search again
+    SimulatedClock goneClock;
+    SimulatedBus gone("sim0", &goneClock, config(2, 0));
+    gone.setPresent(1, false);
+    OneWire third(TAG, &gone, &goneClock, NULL, 0);
+
+    CHECK(third.browse(&cache) == 1);
+    CHECK(goneClock.micros() >= 2000000);
+
+    std::vector<CachedDevice> cached;
+
+    CHECK(cache.load("sim0", cached));
+    CHECK(cached.size() == 1);
+}
+
+static void test_rom_cache_writes()
+{
+    SimulatedClock clock;
+    SimulatedBus bus("sim0", &clock, config(2, 0));
+    MemoryRomCache cache;
+    OneWire first(TAG, &bus, &clock, NULL, 0);
+
+    first.browse(&cache);
+
+    CHECK(cache.stores == 1);
+
+    // Restored as is, nothing to write
+    SimulatedClock rebootClock;
+    SimulatedBus rebooted("sim0", &rebootClock, config(2, 0));
+    OneWire second(TAG, &rebooted, &rebootClock, NULL, 0);
+
+    second.browse(&cache);
+    second.setResolutionPolicy(0, ResolutionPolicy::fixed, RESOLUTION_12_BIT, RESOLUTION_10_BIT);
+
+    bool changed = false;
+
+    while (!(changed = second.rescan(1)) && second.isRescanInProgress()) {
+    }
+
+    CHECK(cache.stores == 1);
+
+    // This one is worth remembering
+    second.setResolutionPolicy(0, ResolutionPolicy::adaptive, RESOLUTION_12_BIT, RESOLUTION_9_BIT);
+
+    CHECK(cache.stores == 2);
+
+    // The cache holds a device that is gone, what the full search found replaces it
+    SimulatedClock glitchClock;
+    SimulatedBus glitch("sim0", &glitchClock, config(2, 0));
+    OneWire third(TAG, &glitch, &glitchClock, NULL, 0);
+
+    std::vector<CachedDevice> cached;
+
+    cache.load("sim0", cached);
+    cached[1].romCode.bytes[1] ^= 0xFF;
+    cache.store("sim0", cached);
+    cache.stores = 0;
+
+    CHECK(third.browse(&cache) == 2);
+    CHECK(cache.stores == 1);
+}
+
+static void test_rescan()
+{
+    SimulatedClock clock;
+    SimulatedBus bus("sim0", &clock, config(3, 0));
+    MemoryRomCache cache;
+    OneWire oneWire(TAG, &bus, &clock, NULL, 0);
+
+    oneWire.browse(&cache);
+
+    // Nothing changed
+    bool changed = false;
+
+    while (!(changed = oneWire.rescan(1)) && oneWire.isRescanInProgress()) {
+    }
+
+    CHECK(!changed);
+
+    bus.setPresent(1, false);
+    bus.plug(30.0f);
+
+    while (!(changed = oneWire.rescan(1)) && oneWire.isRescanInProgress()) {
+    }
+
+    CHECK(changed);
+    CHECK(oneWire.getDeviceCount() == 4);
+    CHECK(!oneWire.isPresentAt(1));
+
+    std::vector<Reading> readings = oneWire.poll();
+
+    CHECK(readings[1].status == ReadingStatus::retired);
+    CHECK(isnan(readings[1].value));
+    CHECK(readings[3].status == ReadingStatus::ok);
+
+    std::vector<CachedDevice> cached;
+
+    CHECK(cache.load("sim0", cached));
+    CHECK(cached.size() == 3);
+}
+
+static void test_crc_retries()
+{
+    SimulatedClock clock;
+    SimulatedBus bus("sim0", &clock, config(4, 0.2f));
+    OneWire oneWire(TAG, &bus, &clock, NULL, 0);
+
+    oneWire.browse();
+
+    int good = 0;
+    int total = 0;
+
+    for (int cycle = 0; cycle < 50; cycle++) {
+
+        for (auto &r : oneWire.poll()) {
+            total++;
+            good += r.status == ReadingStatus::ok;
+        }
+
+        clock.advance(1000000);
+    }
+
+    uint32_t retries = 0;
+    uint32_t recovered = 0;
+
+    for (int offset = 0; offset < 4; offset++) {
+        retries += oneWire.getStatsAt(offset).retries;
+        recovered += oneWire.getStatsAt(offset).recovered;
+    }
+
+    printf("%d/%d good readings, %u/%u retries recovered\n", good, total, recovered, retries);
+
+    CHECK(retries > 0);
+    CHECK(recovered > 0);
+
+    // Two retries make a 20% CRC failure rate a sub 1% one
+    CHECK(good >= total * 95 / 100);
+}
+
+/**
+ * A device that never responds is quarantined after a few polls, for twice as long every time it fails again,
+ * up to a cap; it isn't read meanwhile, and doesn't hold the others up. Once it responds, it's back.
+ */
+static void test_quarantine()
+{
+    const int64_t read = 6000;
+
+    SimulatedClock clock;
+    SimulatedBus::Config c = config(3, 0);
+    c.readMicros = read;
+
+    SimulatedBus bus("sim0", &clock, c);
+    OneWire oneWire(TAG, &bus, &clock, NULL, 0);
+
+    oneWire.browse();
+
+    const int failing = 1;
+    SimulatedDevice &d = simulated(bus, oneWire, failing);
+
+    d.failing = true;
+
+    // Not retried, it didn't respond
+    for (int poll = 0; poll < 5; poll++) {
+        CHECK(oneWire.poll()[failing].status == ReadingStatus::failed);
+        CHECK(oneWire.getLastTiming().readMicros == 3 * read);
+    }
+
+    CHECK(oneWire.getStatsAt(failing).consecutiveFailures == 5);
+    CHECK(oneWire.getStatsAt(failing).quarantines == 1);
+
+    // Doubled every time, up to 2^5 times the first one
+    const int quarantines[] = { 10, 20, 40, 80, 160, 320, 320 };
+    const int count = sizeof(quarantines) / sizeof(quarantines[0]);
+
+    for (int quarantine = 0; quarantine < count; quarantine++) {
+
+        CHECK(oneWire.getStatsAt(failing).quarantineLeft == quarantines[quarantine]);
+
+        uint32_t deviceFailures = bus.getStats().deviceFailures;
+
+        for (int poll = 0; poll < quarantines[quarantine]; poll++) {
+
+            std::vector<Reading> readings = oneWire.poll();
+
+            CHECK(readings[failing].status == ReadingStatus::quarantined);
+            CHECK(readings[0].status == ReadingStatus::ok && readings[2].status == ReadingStatus::ok);
+            CHECK(oneWire.getLastTiming().readMicros == 2 * read);
+            CHECK(oneWire.getStatsAt(failing).quarantineLeft == quarantines[quarantine] - poll - 1);
+
+            clock.advance(1000000);
+        }
+
+        CHECK(bus.getStats().deviceFailures == deviceFailures);
+
+        // Fixed during the last one
+        if (quarantine == count - 1) {
+            break;
+        }
+
+        CHECK(oneWire.poll()[failing].status == ReadingStatus::failed);
+        CHECK(oneWire.getStatsAt(failing).quarantines == (uint32_t) quarantine + 2);
+    }
+
+    d.failing = false;
+
+    for (int poll = 0; poll < 3; poll++) {
+        CHECK(oneWire.poll()[failing].status == ReadingStatus::ok);
+        CHECK(oneWire.getLastTiming().readMicros == 3 * read);
+    }
+
+    CHECK(oneWire.getStatsAt(failing).consecutiveFailures == 0);
+    CHECK(oneWire.getStatsAt(failing).quarantineLeft == 0);
+    CHECK(oneWire.getStatsAt(failing).quarantines == (uint32_t) count);
+}
+
+/**
+ * A device with stable readings drops to the low resolution, and is back at the high one on a change.
+ * The devices at the lower resolution are read first, as soon as their conversion is done, while the ones
+ * at the higher resolution are still converting.
+ */
+static void test_adaptive_resolution()
+{
+    const int64_t read = 6000;
+    const int64_t high = OneWire::getConversionMillis(RESOLUTION_12_BIT) * 1000;
+    const int64_t low = OneWire::getConversionMillis(RESOLUTION_10_BIT) * 1000;
+
+    SimulatedClock clock;
+    SimulatedBus::Config c = config(2, 0);
+    c.readMicros = read;
+
+    SimulatedBus bus("sim0", &clock, c);
+    OneWire oneWire(TAG, &bus, &clock, NULL, 0, ResolutionPolicy::adaptive, RESOLUTION_12_BIT, RESOLUTION_10_BIT, 3);
+
+    oneWire.browse();
+
+    SimulatedDevice &a = simulated(bus, oneWire, 0);
+    SimulatedDevice &b = simulated(bus, oneWire, 1);
+
+    // Mid step at the low resolution, the drift doesn't make it across
+    a.temperature = 20.125f;
+    b.temperature = 20.125f;
+
+    // The first reading, then three stable ones
+    for (int poll = 0; poll < 4; poll++) {
+
+        oneWire.poll();
+
+        CHECK(oneWire.getLastTiming().waitMicros == high);
+        CHECK(oneWire.getLastTiming().readMicros == 2 * read);
+
+        Resolution expected = poll < 3 ? RESOLUTION_12_BIT : RESOLUTION_10_BIT;
+
+        CHECK(oneWire.getResolutionAt(0).current == expected);
+        CHECK(oneWire.getResolutionAt(1).current == expected);
+
+        a.temperature = b.temperature = 20.125f;
+    }
+
+    // Both low, only the short conversion is waited for
+    std::vector<Reading> readings = oneWire.poll();
+
+    CHECK(oneWire.getLastTiming().waitMicros == low);
+    CHECK(readings[0].resolution == RESOLUTION_10_BIT && readings[0].value == 20.0f);
+    CHECK(readings[1].resolution == RESOLUTION_10_BIT && readings[1].value == 20.0f);
+
+    // One changes, and is back at the high resolution for the next conversion
+    a.temperature = 20.125f;
+    b.temperature = 25.125f;
+
+    oneWire.poll();
+
+    CHECK(oneWire.getLastTiming().waitMicros == low);
+    CHECK(oneWire.getResolutionAt(0).current == RESOLUTION_10_BIT);
+    CHECK(oneWire.getResolutionAt(1).current == RESOLUTION_12_BIT);
+
+    // Mixed: the low one is read while the high one is still converting, and the high one when it's done.
+    // Three stable readings later, it's back to low.
+    for (int poll = 0; poll < 3; poll++) {
+
+        a.temperature = 20.125f;
+        b.temperature = 25.125f;
+
+        readings = oneWire.poll();
+
+        CHECK(oneWire.getLastTiming().waitMicros == high - read);
+        CHECK(oneWire.getLastTiming().readMicros == 2 * read);
+        CHECK(readings[0].resolution == RESOLUTION_10_BIT);
+        CHECK(readings[1].resolution == RESOLUTION_12_BIT);
+
+        // What this conversion left in the scratchpad, both were waited for
+        CHECK(readings[0].value == a.converting);
+        CHECK(readings[1].value == b.converting);
+    }
+
+    CHECK(oneWire.getResolutionAt(1).current == RESOLUTION_10_BIT);
+
+    oneWire.poll();
+
+    CHECK(oneWire.getLastTiming().waitMicros == low);
+}
+
+/**
+ * The bus task's schedule: the conversion is started ahead of the cycle, so the readings are collected
+ * right as it begins, and the cycle period is not stretched by the conversion or the LED flashes.
+ */
+static void test_cycle_period()
+{
+    SimulatedClock clock;
+    SimulatedBus bus("sim0", &clock, config(4, 0));
+    CountingLed led;
+    OneWire oneWire(TAG, &bus, &clock, &led, 50);
+
+    oneWire.browse();
+
+    const int64_t period = 5000000;
+    const int cycles = 20;
+    const int64_t lead = oneWire.getConversionMillis() * 1000;
+    int64_t origin = clock.micros();
+
+    oneWire.startConversion();
+
+    for (int cycle = 0; cycle < cycles; cycle++) {
+
+        CHECK(oneWire.collect().size() == 4);
+
+        // Only the very first conversion is waited for, the rest were done by the time the cycle began
+        if (cycle == 0) {
+            CHECK(clock.micros() == origin + lead);
+        } else {
+            CHECK(clock.micros() == origin + cycle * period);
+            CHECK(oneWire.getLastTiming().waitMicros == 0);
+        }
+
+        clock.sleepUntil(origin + (cycle + 1) * period - lead);
+        oneWire.startConversion();
+        clock.sleepUntil(origin + (cycle + 1) * period);
+    }
+
+    // A flash for every conversion started, and every one collected
+    CHECK(led.flashes == 2 * cycles + 1);
+
+    // The blocking poll, then a delay of a whole period, as the loop used to go: every cycle is a conversion longer
+    origin = clock.micros();
+
+    for (int cycle = 0; cycle < cycles; cycle++) {
+        oneWire.poll();
+        clock.advance(period);
+    }
+
+    CHECK(clock.micros() - origin == cycles * (period + lead));
+}
+
+/**
+ * Poll a busy bus for a simulated day, and say how long it took.
+ */
+static void test_timing()
+{
+    SimulatedClock clock;
+    SimulatedBus bus("sim0", &clock, config(16, 0.01f));
+    OneWire oneWire(TAG, &bus, &clock, NULL, 0);
+
+    oneWire.browse();
+
+    const int cycles = 24 * 60 * 2;
+    Stopwatch stopwatch;
+    int64_t started = clock.micros();
+    int64_t waitMicros = 0;
+    int64_t readMicros = 0;
+
+    for (int cycle = 0; cycle < cycles; cycle++) {
+
+        oneWire.poll();
+
+        waitMicros += oneWire.getLastTiming().waitMicros;
+        readMicros += oneWire.getLastTiming().readMicros;
+
+        clock.sleepUntil(started + (cycle + 1) * 30000000LL);
+    }
+
+    int64_t elapsed = stopwatch.micros();
+
+    printf("%d polls of %d devices: %lldms host time, %.1fus per poll; simulated %llds, conversion wait %.1fms per poll\n",
+        cycles, oneWire.getDeviceCount(), (long long) elapsed / 1000, (double) elapsed / cycles,
+        (long long) (clock.micros() - started) / 1000000, waitMicros / 1000.0 / cycles);
+
+    // Every poll waits for exactly one conversion, the simulated reads take no time
+    CHECK(waitMicros == cycles * OneWire::getConversionMillis(RESOLUTION_12_BIT) * 1000);
+    CHECK(readMicros == 0);
+}
+
+int main()
+{
+    RUN(test_browse);
+    RUN(test_poll);
+    RUN(test_rom_cache);
+    RUN(test_rom_cache_writes);
+    RUN(test_rescan);
+    RUN(test_crc_retries);
+    RUN(test_quarantine);
+    RUN(test_adaptive_resolution);
+    RUN(test_cycle_period);
+    RUN(test_timing);
+
+    return 0;
+}
@@ -0,0 +1,154 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "sample_payload.h"
+
+#ifdef HAVE_CJSON
+#include "cJSON.h"
+#endif
+
+using namespace hcc_mqtt;
+
+static const char *DEVICE_ID = "ESP32-246F28A7C53C";
+
+static void test_sample()
+{
+    SamplePayload payload;
+
+    CHECK(payload.setup("D90301A2792B0528", DEVICE_ID));
+
+    payload.render(24.625f);
+
+    CHECK(strcmp(payload.c_str(), "{\"entity_type\":\"sensor\",\"name\":\"D90301A2792B0528\",\"signature\":\"TD90301A2792B0528\","
+        "\"signal\":24.625,\"device_id\":\"ESP32-246F28A7C53C\"}") == 0);
+
+    payload.render(-0.5f, 1596240000123LL);
+
+    CHECK(strcmp(payload.c_str(), "{\"entity_type\":\"sensor\",\"name\":\"D90301A2792B0528\",\"signature\":\"TD90301A2792B0528\","
+        "\"signal\":-0.5,\"device_id\":\"ESP32-246F28A7C53C\",\"timestamp\":1596240000123}") == 0);
+}
+
+static void test_batch()
+{
+    SamplePayload a;
+    SamplePayload b;
+    BatchPayload batch;
+
+    CHECK(a.setup("D90301A2792B0528", DEVICE_ID));
+    CHECK(b.setup("E40300A27970F728", DEVICE_ID));
+    CHECK(batch.setup(DEVICE_ID, 2));
+
+    CHECK(batch.begin(1596240000123LL));
+    CHECK(batch.add(a, 24.625f));
+    CHECK(batch.add(b, 26.1875f));
+    CHECK(batch.getSampleCount() == 2);
+
+    size_t length = batch.finish();
+
+    CHECK(length == strlen(batch.c_str()));
+    CHECK(strcmp(batch.c_str(), "{\"entity_type\":\"sensor\",\"device_id\":\"ESP32-246F28A7C53C\",\"timestamp\":1596240000123,\"samples\":["
+        "{\"name\":\"D90301A2792B0528\",\"signature\":\"TD90301A2792B0528\",\"signal\":24.625},"
+        "{\"name\":\"E40300A27970F728\",\"signature\":\"TE40300A27970F728\",\"signal\":26.1875}]}") == 0);
+
+    // More than it was set up for, until it grows; what's rendered so far is kept
+    CHECK(batch.begin(0));
+
+    int added = 0;
+
+    while (batch.add(a, added)) {
+        added++;
+    }
+
+    CHECK(added >= 2);
+    CHECK(batch.reserve(added + 1));
+    CHECK(batch.add(b, 1));
+    CHECK(batch.getSampleCount() == added + 1);
+
+    batch.finish();
+
+    const char *head = "{\"entity_type\":\"sensor\",\"device_id\":\"ESP32-246F28A7C53C\",\"timestamp\":0,\"samples\":[{";
+
+    CHECK(strncmp(batch.c_str(), head, strlen(head)) == 0);
+    CHECK(strstr(batch.c_str(), "\"signal\":1}]}") != NULL);
+}
+
+static void test_batch_not_set_up()
+{
+    SamplePayload a;
+    BatchPayload batch;
+
+    CHECK(a.setup("D90301A2792B0528", DEVICE_ID));
+
+    // Never set up, and a device ID that doesn't fit
+    CHECK(!batch.begin(0));
+    CHECK(!batch.add(a, 1));
+    CHECK(batch.finish() == 0);
+
+    CHECK(!batch.setup("ESP32-246F28A7C53C-with-a-suffix-much-too-long-for-the-header-buffer", 2));
+    CHECK(!batch.begin(0));
+    CHECK(!batch.add(a, 1));
+
+    // A buffer alone doesn't make a message
+    CHECK(batch.reserve(2));
+    CHECK(!batch.begin(0));
+    CHECK(!batch.add(a, 1));
+    CHECK(batch.finish() == 0);
+    CHECK(batch.getSampleCount() == 0);
+}
+
+#ifdef HAVE_CJSON
+
+static void check_number(double value)
+{
+    cJSON *number = cJSON_CreateNumber(value);
+    char *expected = cJSON_PrintUnformatted(number);
+
+    char actual[NUMBER_CAPACITY];
+    size_t length = render_number(actual, value);
+
+    if (strcmp(expected, actual) != 0) {
+        fprintf(stderr, "%.17g: cJSON says %s, got %s\n", value, expected, actual);
+    }
+
+    CHECK(strcmp(expected, actual) == 0);
+    CHECK(length == strlen(expected));
+
+    free(expected);
+    cJSON_Delete(number);
+}
+
+/**
+ * Everything a DS18B20 can say, -55C to 125C in 1/16C steps, against the renderer the payloads replaced.
+ */
+static void test_number_cjson()
+{
+    for (int step = 0; step <= 180 * 16; step++) {
+
+        // The samples are floats, widened to double the same way on both sides
+        check_number(-55 + step * 0.0625f);
+    }
+
+    // Not a sensor reading, but still a number
+    check_number(0.1f);
+    check_number(-1.0 / 3);
+    check_number(1e-7);
+    check_number(3e9);
+    check_number(NAN);
+}
+
+#endif
+
+int main()
+{
+    RUN(test_sample);
+    RUN(test_batch);
+    RUN(test_batch_not_set_up);
+
+#ifdef HAVE_CJSON
+    RUN(test_number_cjson);
+#endif
+
+    return 0;
+}
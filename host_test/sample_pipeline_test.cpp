@@ -0,0 +1,420 @@
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "check.h"
+#include "sample_pipeline.h"
+#include "simulated_bus.h"
+
+using namespace hcc_pipeline;
+
+static const char *TAG = "sample_pipeline_test";
+static const char *DEVICE_ID = "ESP32-246F28A7C53C";
+
+#define SENSORS 3
+
+/**
+ * {@link MessageSink} that keeps everything published.
+ */
+class RecordingSink : public MessageSink {
+public:
+
+    bool online = true;
+
+    std::vector<std::string> topics;
+    std::vector<std::string> messages;
+
+    bool isOnline() override
+    {
+        return online;
+    }
+
+    void publish(const char *topic, const char *data, size_t length) override
+    {
+        topics.push_back(topic);
+        messages.push_back(std::string(data, length));
+    }
+
+    void rendered(int64_t micros) override
+    {
+    }
+};
+
+static PipelineConfig json(bool perSensor, bool batch)
+{
+    PipelineConfig config = {};
+
+    config.perSensor = perSensor;
+    config.batch = batch;
+    config.json = true;
+    config.drainBatch = 4;
+
+    return config;
+}
+
+/**
+ * Three sensors, reporting half a degree changes, or every minute.
+ */
+struct Rig {
+
+    hcc_onewire::SimulatedClock clock;
+    SensorRegistry<8> sensors;
+    SampleRing<16> ring;
+    RecordingSink sink;
+    SamplePipeline pipeline;
+
+    std::vector<int> sensorOffsets;
+
+    Rig(const PipelineConfig &config, SampleStore *store = NULL, OverflowPolicy policy = OverflowPolicy::dropOldest) :
+        ring(policy),
+        pipeline(TAG, &sensors, &ring, store, &sink, &clock, config)
+    {
+        for (int offset = 0; offset < SENSORS; offset++) {
+
+            Sensor *s = sensors.add(0x28FF4A1B33160300ULL + offset, "hcc/sensor/");
+
+            CHECK(s != NULL);
+            CHECK(s->payload.setup(s->address, DEVICE_ID));
+            CHECK(s->cborPayload.setup(s->romCode, DEVICE_ID));
+
+            s->filter.configure(0.5f, 60000);
+            sensorOffsets.push_back(offset);
+        }
+
+        CHECK(pipeline.setup(DEVICE_ID, "hcc/batch", "hcc/batch/cbor", SENSORS));
+    }
+
+    /**
+     * Sample one poll cycle, {@code now} milliseconds into the run, and take it through the publisher side.
+     */
+    void cycle(uint32_t cycle, int64_t now, const std::vector<hcc_onewire::Reading> &readings, bool process = true)
+    {
+        SampleRecord record = {};
+
+        record.timestamp = 1596240000000LL + now;
+        record.cycle = cycle;
+
+        pipeline.sample(sensorOffsets, readings, record, now);
+        pipeline.endCycle(record);
+
+        if (process) {
+            pipeline.process();
+        }
+    }
+};
+
+static hcc_onewire::Reading ok(float value)
+{
+    return { value, hcc_onewire::ReadingStatus::ok, hcc_onewire::BusError::ok, hcc_onewire::RESOLUTION_12_BIT };
+}
+
+static hcc_onewire::Reading failed()
+{
+    return { NAN, hcc_onewire::ReadingStatus::failed, hcc_onewire::BusError::crc, hcc_onewire::RESOLUTION_12_BIT };
+}
+
+static int count(const std::string &haystack, const char *needle)
+{
+    int found = 0;
+
+    for (size_t at = haystack.find(needle); at != std::string::npos; at = haystack.find(needle, at + 1)) {
+        found++;
+    }
+
+    return found;
+}
+
+static void test_filter()
+{
+    Rig rig(json(true, false));
+
+    rig.cycle(0, 0, { ok(20), ok(21), ok(22) });
+
+    CHECK(rig.sink.messages.size() == 3);
+    CHECK(rig.sink.topics[0] == "hcc/sensor/28FF4A1B33160300");
+    CHECK(rig.sink.messages[1].find("\"signal\":21,") != std::string::npos);
+
+    // Only the change past the deadband, the failed reading is counted and not published
+    rig.cycle(1, 30000, { ok(20.25f), ok(21.5f), failed() });
+
+    CHECK(rig.sink.messages.size() == 4);
+    CHECK(rig.sink.topics[3] == "hcc/sensor/28FF4A1B33160301");
+    CHECK(rig.sensors.at(0)->lastValue == 20.25f);
+    CHECK(rig.sensors.at(0)->filter.getSuppressedCount() == 1);
+    CHECK(rig.sensors.at(2)->failures == 1);
+
+    // Nothing changed, until the heartbeat
+    rig.cycle(2, 59999, { ok(20.25f), ok(21.5f), ok(22) });
+    CHECK(rig.sink.messages.size() == 4);
+
+    rig.cycle(3, 60000, { ok(20.25f), ok(21.5f), ok(22) });
+    CHECK(rig.sink.messages.size() == 6);
+
+    // Published on time, no timestamp
+    for (auto &message : rig.sink.messages) {
+        CHECK(message.find("timestamp") == std::string::npos);
+    }
+}
+
+static void test_batch()
+{
+    Rig rig(json(false, true));
+
+    rig.cycle(0, 0, { ok(20), ok(21), ok(22) });
+
+    CHECK(rig.sink.messages.size() == 1);
+    CHECK(rig.sink.topics[0] == "hcc/batch");
+    CHECK(rig.sink.messages[0].find("\"timestamp\":1596240000000,") != std::string::npos);
+    CHECK(count(rig.sink.messages[0], "\"name\":") == 3);
+
+    // All suppressed, nothing to say
+    rig.cycle(1, 30000, { ok(20), ok(21), ok(22) });
+    CHECK(rig.sink.messages.size() == 1);
+
+    // The end of a cycle lost to overflow, the next cycle closes its batch
+    SampleRecord record = {};
+
+    record.timestamp = 1596240060000LL;
+    record.cycle = 2;
+    rig.pipeline.sample(rig.sensorOffsets, { ok(25), ok(21), ok(22) }, record, 60000);
+
+    rig.cycle(3, 90000, { ok(20), ok(26), ok(27) });
+
+    CHECK(rig.sink.messages.size() == 3);
+    CHECK(rig.sink.messages[1].find("\"timestamp\":1596240060000,") != std::string::npos);
+    CHECK(count(rig.sink.messages[1], "\"name\":") == 3);
+    CHECK(rig.sink.messages[2].find("\"timestamp\":1596240090000,") != std::string::npos);
+    CHECK(count(rig.sink.messages[2], "\"name\":") == 3);
+}
+
+static void test_both_encodings()
+{
+    PipelineConfig config = json(true, true);
+
+    config.cbor = true;
+
+    Rig rig(config);
+
+    rig.cycle(0, 0, { ok(20), ok(21), ok(22) });
+
+    // Every sample twice, and the batch twice
+    CHECK(rig.sink.messages.size() == 8);
+    CHECK(rig.sink.topics[1] == "hcc/sensor/28FF4A1B33160300/cbor");
+    CHECK(rig.sink.topics[6] == "hcc/batch");
+    CHECK(rig.sink.topics[7] == "hcc/batch/cbor");
+}
+
+static void test_ring_handoff()
+{
+    Rig rig(json(true, true));
+
+    // The publisher falls behind, the ring holds the cycles in order
+    rig.cycle(0, 0, { ok(20), ok(21), ok(22) }, false);
+    rig.cycle(1, 30000, { ok(23), ok(21), ok(22) }, false);
+
+    CHECK(rig.ring.size() == 6);
+    CHECK(rig.sink.messages.empty());
+
+    CHECK(!rig.pipeline.process());
+
+    CHECK(rig.ring.size() == 0);
+    CHECK(rig.sink.messages.size() == 6);
+    CHECK(rig.sink.topics[3] == "hcc/batch");
+    CHECK(rig.sink.messages[4].find("\"signal\":23,") != std::string::npos);
+    CHECK(count(rig.sink.messages[5], "\"name\":") == 1);
+}
+
+static void test_store()
+{
+    SampleStore store(64);
+    Rig rig(json(true, false), &store);
+
+    // Offline, everything goes to the store, the ends of the cycles included
+    rig.sink.online = false;
+
+    for (uint32_t cycle = 0; cycle < 5; cycle++) {
+        rig.cycle(cycle, cycle * 30000LL, { ok(20 + cycle), ok(30 + cycle), ok(40 + cycle) });
+    }
+
+    CHECK(rig.sink.messages.empty());
+    CHECK(store.size() == 20);
+
+    // Back online, drained a few at a time; what comes in meanwhile waits its turn
+    rig.sink.online = true;
+
+    rig.cycle(5, 150000, { ok(25), ok(35), ok(45) });
+
+    // That was the first call
+    int calls = 1;
+
+    do {
+        calls++;
+    } while (rig.pipeline.process());
+
+    CHECK(calls == 6);
+    CHECK(store.empty());
+    CHECK(store.getStats().drained == 24);
+    CHECK(rig.sink.messages.size() == 18);
+
+    for (int offset = 0; offset < 18; offset++) {
+
+        char signal[32];
+        snprintf(signal, sizeof(signal), "\"signal\":%d,", 20 + offset % 3 * 10 + offset / 3);
+
+        CHECK(rig.sink.messages[offset].find(signal) != std::string::npos);
+
+        // Stored samples are late, they carry their timestamp
+        char timestamp[32];
+        snprintf(timestamp, sizeof(timestamp), "\"timestamp\":%lld}", 1596240000000LL + offset / 3 * 30000LL);
+
+        CHECK(rig.sink.messages[offset].find(timestamp) != std::string::npos);
+    }
+
+    // Drained, back to publishing right away
+    rig.cycle(6, 180000, { ok(26), ok(36), ok(46) });
+
+    CHECK(rig.sink.messages.size() == 21);
+    CHECK(rig.sink.messages[20].find("timestamp") == std::string::npos);
+}
+
+static void test_offline_without_store()
+{
+    Rig rig(json(true, false));
+
+    rig.sink.online = false;
+    rig.cycle(0, 0, { ok(20), ok(21), ok(22) });
+
+    CHECK(rig.ring.size() == 0);
+    CHECK(rig.sink.messages.empty());
+
+    rig.sink.online = true;
+    rig.cycle(1, 30000, { ok(25), ok(26), ok(27) });
+
+    CHECK(rig.sink.messages.size() == 3);
+}
+
+static void test_lost_samples_not_reported()
+{
+    // The ring full, the samples of the last cycle are lost, the filters wound back to the cycle before
+    Rig newest(json(true, false), NULL, OverflowPolicy::dropNewest);
+
+    for (uint32_t cycle = 0; cycle < 5; cycle++) {
+        newest.cycle(cycle, cycle * 30000LL, { ok(20 + cycle), ok(30 + cycle), ok(40 + cycle) }, false);
+    }
+
+    CHECK(newest.ring.getOverflowCount() == 4);
+
+    newest.pipeline.process();
+    CHECK(newest.sink.messages.size() == 12);
+
+    // Within the deadband of what was lost, not of what was published
+    newest.cycle(5, 150000, { ok(24.25f), ok(34.25f), ok(44.25f) });
+    CHECK(newest.sink.messages.size() == 15);
+
+    // The oldest samples lost instead, no telling whose, everybody reports again
+    Rig oldest(json(true, false));
+
+    for (uint32_t cycle = 0; cycle < 5; cycle++) {
+        oldest.cycle(cycle, cycle * 30000LL, { ok(20 + cycle), ok(30 + cycle), ok(40 + cycle) }, false);
+    }
+
+    oldest.pipeline.process();
+    CHECK(oldest.sink.messages.size() == 12);
+
+    oldest.cycle(5, 150000, { ok(24), ok(34), ok(44) });
+    CHECK(oldest.sink.messages.size() == 15);
+
+    // Sampled online, dropped by the publisher offline
+    Rig dropped(json(true, false));
+
+    dropped.cycle(0, 0, { ok(20), ok(21), ok(22) });
+    dropped.cycle(1, 30000, { ok(25), ok(26), ok(27) }, false);
+
+    dropped.sink.online = false;
+    dropped.pipeline.process();
+    dropped.sink.online = true;
+
+    CHECK(dropped.sink.messages.size() == 3);
+
+    dropped.cycle(2, 60000, { ok(25.25f), ok(26.25f), ok(27.25f) });
+    CHECK(dropped.sink.messages.size() == 6);
+
+    // Offline, nothing is taken as reported
+    Rig offline(json(true, false));
+
+    offline.cycle(0, 0, { ok(20), ok(21), ok(22) });
+
+    offline.sink.online = false;
+    offline.cycle(1, 30000, { ok(25), ok(26), ok(27) });
+    offline.sink.online = true;
+
+    offline.cycle(2, 50000, { ok(20.25f), ok(21.25f), ok(22.25f) });
+
+    CHECK(offline.sink.messages.size() == 3);
+    CHECK(offline.sensors.at(0)->filter.getSuppressedCount() == 1);
+}
+
+static void test_simulated_bus()
+{
+    hcc_onewire::SimulatedClock clock;
+
+    hcc_onewire::SimulatedBus::Config config = {};
+    config.devices = 4;
+    config.conversionScale = 1.0f;
+    config.seed = 3;
+
+    hcc_onewire::SimulatedBus bus("sim0", &clock, config);
+    hcc_onewire::OneWire oneWire(TAG, &bus, &clock, NULL, 0);
+
+    CHECK(oneWire.browse() == 4);
+
+    SensorRegistry<8> sensors;
+    SampleRing<16> ring(OverflowPolicy::dropOldest);
+    RecordingSink sink;
+    SamplePipeline pipeline(TAG, &sensors, &ring, NULL, &sink, &clock, json(false, true));
+    std::vector<int> sensorOffsets;
+
+    for (int device = 0; device < oneWire.getDeviceCount(); device++) {
+
+        Sensor *s = sensors.add(hcc_onewire::rom_code_to_uint64(oneWire.getRomCodeAt(device)), "hcc/sensor/");
+
+        CHECK(s->payload.setup(s->address, DEVICE_ID));
+        sensorOffsets.push_back(sensors.offsetOf(s));
+    }
+
+    CHECK(pipeline.setup(DEVICE_ID, "hcc/batch", NULL, sensors.size()));
+
+    // No deadband, every cycle is a batch of every sensor
+    for (uint32_t cycle = 0; cycle < 10; cycle++) {
+
+        SampleRecord record = {};
+        record.timestamp = clock.micros() / 1000;
+        record.cycle = cycle;
+
+        pipeline.sample(sensorOffsets, oneWire.poll(), record, clock.micros() / 1000);
+        pipeline.endCycle(record);
+        pipeline.process();
+
+        clock.advance(30 * 1000000LL);
+    }
+
+    CHECK(sink.messages.size() == 10);
+
+    for (auto &message : sink.messages) {
+        CHECK(count(message, "\"name\":") == 4);
+    }
+}
+
+int main()
+{
+    RUN(test_filter);
+    RUN(test_batch);
+    RUN(test_both_encodings);
+    RUN(test_ring_handoff);
+    RUN(test_store);
+    RUN(test_offline_without_store);
+    RUN(test_lost_samples_not_reported);
+    RUN(test_simulated_bus);
+
+    return 0;
+}
@@ -0,0 +1,172 @@
+#include "check.h"
+#include "sample_store.h"
+
+using namespace hcc_pipeline;
+
+/**
+ * Small sectors, so that a few hundred records go round the log.
+ */
+#define SECTOR 256
+
+static SampleRecord record(uint32_t cycle)
+{
+    SampleRecord r = {};
+
+    r.timestamp = 1596240000000LL + cycle * 30000LL;
+    r.signal = 20 + (cycle % 100) * 0.0625f;
+    r.cycle = cycle;
+    r.sensor = cycle % 8;
+
+    return r;
+}
+
+static void test_ram_only()
+{
+    SampleStore store(16);
+    SampleRecord r;
+
+    for (uint32_t cycle = 0; cycle < 20; cycle++) {
+        store.push(record(cycle));
+    }
+
+    // The oldest are dropped
+    CHECK(store.size() == 16);
+    CHECK(store.getStats().dropped == 4);
+
+    for (uint32_t cycle = 4; cycle < 20; cycle++) {
+        CHECK(store.pop(r));
+        CHECK(r.cycle == cycle);
+    }
+
+    CHECK(!store.pop(r));
+}
+
+static void test_spill_and_drain()
+{
+    // The 256K partition the spill option suggests
+    const size_t slotsPerSector = 4096 / sizeof(SampleRecord);
+
+    MemoryStorage storage(64 * 4096);
+    SampleStore store(16, &storage);
+    SampleRecord r;
+
+    // An outage: more than the RAM holds, less than the log
+    const uint32_t count = 16 + 50 * slotsPerSector;
+
+    for (uint32_t cycle = 0; cycle < count; cycle++) {
+        store.push(record(cycle));
+    }
+
+    CHECK(store.size() == count);
+    CHECK(store.getStats().dropped == 0);
+    // What's not in RAM is in the log
+    uint32_t spilled = store.getStats().spilled;
+    size_t spillBytes = store.getSpillBytes();
+
+    CHECK(spilled >= count - 16);
+    CHECK(spillBytes == spilled * sizeof(SampleRecord));
+
+    // Back online, everything comes out in order, the spilled ones first
+    Stopwatch stopwatch;
+
+    for (uint32_t cycle = 0; cycle < count; cycle++) {
+        CHECK(store.pop(r));
+        CHECK(r.cycle == cycle);
+        CHECK(r.timestamp == record(cycle).timestamp);
+        CHECK(r.signal == record(cycle).signal);
+    }
+
+    int64_t elapsed = stopwatch.micros();
+
+    CHECK(!store.pop(r));
+    CHECK(store.getStats().drained == count);
+
+    printf("drained %u records in %lldus, %.0f records/ms; %d bytes of RAM, %d of %d spill bytes in use at the peak, %u erases, %u writes\n",
+        count, (long long) elapsed, elapsed > 0 ? count * 1000.0 / elapsed : 0.0,
+        (int) store.getRamBytes(), (int) spillBytes, (int) storage.size(), storage.erases, storage.writes);
+
+    // One write per record, one erase per sector started
+    CHECK(storage.writes == spilled);
+    CHECK(storage.erases == (spilled + slotsPerSector - 1) / slotsPerSector);
+}
+
+static void test_log_full()
+{
+    const size_t slotsPerSector = SECTOR / sizeof(SampleRecord);
+    const size_t slotCount = 4 * slotsPerSector;
+
+    MemoryStorage storage(4 * SECTOR, SECTOR);
+    SampleStore store(16, &storage);
+    SampleRecord r;
+
+    const uint32_t count = 16 + 2 * slotCount;
+
+    for (uint32_t cycle = 0; cycle < count; cycle++) {
+        store.push(record(cycle));
+    }
+
+    // Whole sectors of the oldest were erased to make room, what's left is still in order
+    CHECK(store.getStats().dropped > 0);
+    CHECK(store.size() + store.getStats().dropped == count);
+    CHECK(store.size() > slotCount - slotsPerSector);
+
+    uint32_t expected = store.getStats().dropped;
+
+    while (store.pop(r)) {
+        CHECK(r.cycle == expected);
+        expected++;
+    }
+
+    CHECK(expected == count);
+}
+
+static void test_go_round()
+{
+    const size_t slotsPerSector = SECTOR / sizeof(SampleRecord);
+
+    MemoryStorage storage(3 * SECTOR, SECTOR);
+    SampleStore store(8, &storage);
+    SampleRecord r;
+
+    uint32_t pushed = 0;
+    uint32_t popped = 0;
+
+    // Outages and recoveries over and over, the log goes round many times
+    for (int outage = 0; outage < 200; outage++) {
+
+        uint32_t length = 8 + (outage * 7) % slotsPerSector;
+
+        for (uint32_t offset = 0; offset < length; offset++) {
+            store.push(record(pushed++));
+        }
+
+        // Every other time, part of the backlog is left for after the next outage
+        uint32_t drain = outage % 2 == 0 ? length - 3 : UINT32_MAX;
+
+        for (uint32_t offset = 0; offset < drain && store.pop(r); offset++) {
+            CHECK(r.cycle == popped);
+            popped++;
+        }
+
+        CHECK(store.size() == pushed - popped);
+    }
+
+    while (store.pop(r)) {
+        CHECK(r.cycle == popped);
+        popped++;
+    }
+
+    CHECK(popped == pushed);
+    CHECK(store.getStats().dropped == 0);
+    CHECK(store.getStats().spilled > 10 * 3 * slotsPerSector);
+}
+
+int main()
+{
+    RUN(test_ram_only);
+    RUN(test_spill_and_drain);
+    RUN(test_log_full);
+    RUN(test_go_round);
+
+    return 0;
+}
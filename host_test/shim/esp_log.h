@@ -0,0 +1,43 @@
+#ifndef _HCC_ESP32_HOST_ESP_LOG_H_
+#define _HCC_ESP32_HOST_ESP_LOG_H_
+
+/*
+ * Just enough of esp_log.h for the host build: the log lines go to stdout, the debug ones are compiled,
+ * but not printed.
+ */
+
+#include <stdio.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+/**
+ * One level for every tag on the host, shared by all the translation units.
+ */
+inline esp_log_level_t &esp_log_level()
+{
+    static esp_log_level_t level = ESP_LOG_INFO;
+    return level;
+}
+
+#define ESP_LOGE(tag, format, ...) do { if (esp_log_level() >= ESP_LOG_ERROR) printf("E %s: " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGW(tag, format, ...) do { if (esp_log_level() >= ESP_LOG_WARN) printf("W %s: " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGI(tag, format, ...) do { if (esp_log_level() >= ESP_LOG_INFO) printf("I %s: " format "\n", tag, ##__VA_ARGS__); } while (0)
+#define ESP_LOGD(tag, format, ...) do { if (0) printf(format, ##__VA_ARGS__); } while (0)
+#define ESP_LOGV(tag, format, ...) do { if (0) printf(format, ##__VA_ARGS__); } while (0)
+
+/**
+ * The tag is ignored, the level is capped at info.
+ */
+inline void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    esp_log_level() = level < ESP_LOG_INFO ? level : ESP_LOG_INFO;
+}
+
+#endif /* _HCC_ESP32_HOST_ESP_LOG_H_ */
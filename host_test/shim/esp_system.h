@@ -0,0 +1,23 @@
+#ifndef _HCC_ESP32_HOST_ESP_SYSTEM_H_
+#define _HCC_ESP32_HOST_ESP_SYSTEM_H_
+
+/*
+ * Just enough of esp_system.h for the host build of the benchmarks.
+ */
+
+#include <malloc.h>
+#include <stdint.h>
+
+/**
+ * The free heap goes down as the allocated bytes go up, which is all the benchmarks look at. Reads 0 without glibc.
+ */
+static inline uint32_t esp_get_free_heap_size()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    return (uint32_t) (INT32_MAX - mallinfo2().uordblks);
+#else
+    return 0;
+#endif
+}
+
+#endif /* _HCC_ESP32_HOST_ESP_SYSTEM_H_ */
@@ -0,0 +1,16 @@
+#ifndef _HCC_ESP32_HOST_ESP_TIMER_H_
+#define _HCC_ESP32_HOST_ESP_TIMER_H_
+
+/*
+ * Just enough of esp_timer.h for the host build of the benchmarks: the monotonic clock, in microseconds.
+ */
+
+#include <chrono>
+#include <stdint.h>
+
+static inline int64_t esp_timer_get_time()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif /* _HCC_ESP32_HOST_ESP_TIMER_H_ */
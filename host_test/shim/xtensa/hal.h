@@ -0,0 +1,24 @@
+#ifndef _HCC_ESP32_HOST_XTENSA_HAL_H_
+#define _HCC_ESP32_HOST_XTENSA_HAL_H_
+
+/*
+ * Just enough of xtensa/hal.h for the host build of the benchmarks. The CPU cycle counter is the time stamp counter
+ * on x86, which runs at a fixed rate rather than the core clock; it reads 0 elsewhere.
+ */
+
+#include <stdint.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline uint32_t xthal_get_ccount()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t) __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+#endif /* _HCC_ESP32_HOST_XTENSA_HAL_H_ */
@@ -0,0 +1,209 @@
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include "check.h"
+#include "sleep_retainer.h"
+#include "simulated_bus.h"
+
+using namespace hcc_power;
+using namespace hcc_pipeline;
+
+static const char *TAG = "sleep_retainer_test";
+static const char *DEVICE_ID = "ESP32-246F28A7C53C";
+
+#define SECOND 1000000LL
+
+static const uint64_t ROM_CODE = 0x28FF4A1B33160300ULL;
+
+/**
+ * Plain data, the way the application keeps it in RTC memory.
+ */
+struct Retained {
+    RetainedCounts counts;
+    RetainedSensor sensors[4];
+    SampleRecord samples[8];
+};
+
+/**
+ * {@link MessageSink} that comes online at the given time, and keeps everything published.
+ */
+class LateSink : public MessageSink {
+public:
+
+    hcc_onewire::Clock *clock;
+    int64_t onlineAt;
+
+    std::vector<std::string> messages;
+
+    LateSink(hcc_onewire::Clock *clock, int64_t onlineAt) : clock(clock), onlineAt(onlineAt) {}
+
+    bool isOnline() override
+    {
+        return clock->micros() >= onlineAt;
+    }
+
+    void publish(const char *topic, const char *data, size_t length) override
+    {
+        messages.push_back(std::string(data, length));
+    }
+
+    void rendered(int64_t micros) override
+    {
+    }
+};
+
+static SampleRecord sample(uint32_t cycle, uint16_t sensor, float signal)
+{
+    SampleRecord record = {};
+
+    record.timestamp = 1596240000000LL + cycle * 30000LL;
+    record.cycle = cycle;
+    record.sensor = sensor;
+    record.signal = signal;
+
+    return record;
+}
+
+static Sensor *add(SensorRegistry<4> &sensors, uint64_t romCode)
+{
+    Sensor *s = sensors.add(romCode, "hcc/sensor/");
+
+    CHECK(s != NULL);
+    CHECK(s->payload.setup(s->address, DEVICE_ID));
+
+    s->filter.configure(0.5f, 60000);
+
+    return s;
+}
+
+static void test_round_trip()
+{
+    hcc_onewire::SimulatedClock clock;
+    Retained retained;
+
+    // Whatever the RTC memory held before the power up
+    memset(&retained, 0xA5, sizeof(retained));
+
+    SampleStore store(16);
+
+    {
+        SleepRetainer retainer(TAG, &clock, &retained.counts, retained.sensors, 4, retained.samples, 8);
+        retainer.reset();
+
+        SensorRegistry<4> sensors;
+
+        for (int offset = 0; offset < 3; offset++) {
+            CHECK(add(sensors, ROM_CODE + offset)->filter.accept(20 + offset, 0));
+        }
+
+        for (uint16_t sensor = 0; sensor < 3; sensor++) {
+            store.push(sample(0, sensor, 20 + sensor));
+        }
+
+        store.push(sample(0, SampleRecord::CYCLE_END, 0));
+
+        retainer.retain(&sensors, &store);
+
+        CHECK(store.empty());
+        CHECK(retainer.getSampleCount() == 4);
+    }
+
+    // The next wake: the registry is built anew, in a different order, and one of the sensors is gone
+    SleepRetainer retainer(TAG, &clock, &retained.counts, retained.sensors, 4, retained.samples, 8);
+    SensorRegistry<4> sensors;
+
+    Sensor *third = add(sensors, ROM_CODE + 2);
+    Sensor *first = add(sensors, ROM_CODE);
+
+    retainer.restore(&sensors, &store);
+
+    CHECK(retainer.getSampleCount() == 0);
+
+    // The filters picked up where they left off
+    CHECK(!first->filter.accept(20.25f, 30000));
+    CHECK(!third->filter.accept(22.25f, 30000));
+
+    // The samples follow their sensors, the missing one's are dropped
+    CHECK(store.size() == 3);
+
+    SampleRecord record;
+
+    CHECK(store.pop(record) && record.sensor == 1 && record.signal == 20);
+    CHECK(store.pop(record) && record.sensor == 0 && record.signal == 22);
+    CHECK(store.pop(record) && record.sensor == SampleRecord::CYCLE_END);
+}
+
+static void test_excess_dropped()
+{
+    hcc_onewire::SimulatedClock clock;
+    Retained retained = {};
+
+    SleepRetainer retainer(TAG, &clock, &retained.counts, retained.sensors, 4, retained.samples, 8);
+    SensorRegistry<4> sensors;
+    SampleStore store(16);
+
+    add(sensors, ROM_CODE);
+
+    for (uint32_t cycle = 0; cycle < 6; cycle++) {
+        store.push(sample(cycle, 0, 20 + cycle));
+        store.push(sample(cycle, SampleRecord::CYCLE_END, 0));
+    }
+
+    retainer.retain(&sensors, &store);
+
+    // The oldest don't fit
+    CHECK(retainer.getSampleCount() == 8);
+    CHECK(retained.samples[0].cycle == 2);
+    CHECK(retained.samples[7].cycle == 5);
+}
+
+static void test_publish()
+{
+    hcc_onewire::SimulatedClock clock;
+    Retained retained = {};
+
+    SleepRetainer retainer(TAG, &clock, &retained.counts, retained.sensors, 4, retained.samples, 8);
+    SensorRegistry<4> sensors;
+    SampleStore store(16);
+    SampleRing<16> ring(OverflowPolicy::dropOldest);
+
+    add(sensors, ROM_CODE);
+
+    PipelineConfig config = {};
+    config.perSensor = true;
+    config.json = true;
+    config.drainBatch = 4;
+
+    // The network doesn't make it in time, everything stays
+    LateSink never(&clock, 60 * SECOND);
+    SamplePipeline offline(TAG, &sensors, &ring, &store, &never, &clock, config);
+
+    store.push(sample(0, 0, 20));
+    store.push(sample(1, 0, 21));
+
+    CHECK(!retainer.publish(&offline, &store, &never, 1, 10 * SECOND));
+    CHECK(clock.micros() == 10 * SECOND);
+    CHECK(never.messages.empty());
+    CHECK(store.size() == 2);
+
+    // The network comes up while waiting, the earlier cycle is late
+    LateSink late(&clock, 12 * SECOND);
+    SamplePipeline online(TAG, &sensors, &ring, &store, &late, &clock, config);
+
+    CHECK(retainer.publish(&online, &store, &late, 1, 20 * SECOND));
+    CHECK(clock.micros() >= 12 * SECOND && clock.micros() < 20 * SECOND);
+    CHECK(store.empty());
+    CHECK(late.messages.size() == 2);
+    CHECK(late.messages[0].find("\"timestamp\":1596240000000}") != std::string::npos);
+    CHECK(late.messages[1].find("timestamp") == std::string::npos);
+}
+
+int main()
+{
+    RUN(test_round_trip);
+    RUN(test_excess_dropped);
+    RUN(test_publish);
+
+    return 0;
+}
@@ -0,0 +1,163 @@
+#include "a4988.h"
+
+namespace stepper {
+
+A4988::A4988(const A4988Pins &pins, OutputPins *outputs, PulseGenerator *pulses, uint32_t stepMicros) :
+    pins(pins), outputs(outputs), pulses(pulses), stepTiming(stepMicros)
+{
+}
+
+bool A4988::initialize()
+{
+    outputs->setup(pins.dir, false);
+
+    if (pins.ms1 >= 0) {
+        outputs->setup(pins.ms1, false);
+        outputs->setup(pins.ms2, false);
+        outputs->setup(pins.ms3, false);
+    }
+
+    if (pins.slp >= 0) {
+        // SLP is active low
+        outputs->setup(pins.slp, true);
+    }
+
+    return pulses->initialize();
+}
+
+bool A4988::update()
+{
+    if (!moving || pulses->isBusy()) {
+        return moving;
+    }
+
+    position += (int) moveDirection * (int) pulses->getPulses() * getStepSize();
+    moving = false;
+
+    return false;
+}
+
+int A4988::step(Direction d)
+{
+    if (move(d, 1, &stepTiming)) {
+        wait(-1);
+    }
+
+    return position;
+}
+
+bool A4988::move(Direction d, uint32_t steps, StepTiming *timing)
+{
+    if (steps == 0 || sleeping || update()) {
+        return false;
+    }
+
+    outputs->set(pins.dir, d == Direction::up);
+
+    if (!pulses->start(steps, timing, waking ? WAKE_MICROS : DIR_SETUP_MICROS)) {
+        return false;
+    }
+
+    waking = false;
+    moving = true;
+    moveDirection = d;
+
+    return true;
+}
+
+bool A4988::wait(int64_t timeoutMicros)
+{
+    if (!moving) {
+        return true;
+    }
+
+    if (!pulses->wait(timeoutMicros)) {
+        return false;
+    }
+
+    update();
+
+    return true;
+}
+
+void A4988::stop()
+{
+    if (!update()) {
+        return;
+    }
+
+    uint32_t taken = pulses->stop();
+
+    position += (int) moveDirection * (int) taken * getStepSize();
+    moving = false;
+}
+
+bool A4988::isMoving()
+{
+    return update();
+}
+
+int A4988::getMaxMicrostep()
+{
+    return pins.ms1 < 0 ? 0 : MAX_MICROSTEP;
+}
+
+int A4988::getMicrostep()
+{
+    return microstep;
+}
+
+int A4988::setMicrostep(int divider)
+{
+    if (pins.ms1 < 0) {
+        return 0;
+    }
+
+    if (update()) {
+        return -2;
+    }
+
+    // MS1, MS2, MS3 from the datasheet microstep resolution truth table
+    bool ms1, ms2, ms3;
+
+    switch (divider) {
+        case 1: ms1 = false; ms2 = false; ms3 = false; break;
+        case 2: ms1 = true; ms2 = false; ms3 = false; break;
+        case 4: ms1 = false; ms2 = true; ms3 = false; break;
+        case 8: ms1 = true; ms2 = true; ms3 = false; break;
+        case 16: ms1 = true; ms2 = true; ms3 = true; break;
+        default: return -2;
+    }
+
+    outputs->set(pins.ms1, ms1);
+    outputs->set(pins.ms2, ms2);
+    outputs->set(pins.ms3, ms3);
+
+    microstep = divider;
+
+    return divider;
+}
+
+bool A4988::powerSave(bool enable)
+{
+    if (pins.slp < 0) {
+        return false;
+    }
+
+    if (enable == sleeping) {
+        return true;
+    }
+
+    if (enable) {
+        stop();
+    } else {
+        waking = true;
+    }
+
+    outputs->set(pins.slp, !enable);
+    sleeping = enable;
+
+    return true;
+}
+
+}
@@ -7,21 +7,29 @@
  * 1-Wire code based on https://github.com/DavidAntliff/esp32-ds18b20-example
  */
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <string.h>
+#include <sys/time.h>
 #include "esp_wifi.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 #include "esp_event.h"
 #include "esp_netif.h"
 #include "protocol_examples_common.h"
+#ifdef CONFIG_EXAMPLE_CONNECT_ETHERNET
+#include "esp_eth.h"
+#endif
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
+#include "freertos/event_groups.h"
 #include "freertos/queue.h"
 #include "driver/gpio.h"
 
@@ -35,6 +43,35 @@
 #include "cJSON.h"
 
 #include "stepper_api.h"
+#include "sample_payload.h"
+#include "sample_ring.h"
+#include "sample_store.h"
+#include "sample_pipeline.h"
+#include "partition_storage.h"
+#include "report_filter.h"
+#include "command_router.h"
+#include "connection_supervisor.h"
+
+#ifdef CONFIG_HCC_ESP32_BENCHMARK
+#include "benchmark.h"
+#endif
+
+#ifdef CONFIG_HCC_ESP32_METRICS
+#include "metrics.h"
+#endif
+
+#ifdef CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP
+#include "esp_pm.h"
+#include "duty_cycle.h"
+#endif
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+#include "esp_attr.h"
+#include "esp_sleep.h"
+#include "duty_cycle.h"
+#include "rtc_clock.h"
+#include "sleep_retainer.h"
+#endif
 
 #if !(CONFIG_HCC_ESP32_ONE_WIRE_ENABLE || CONFIG_HCC_ESP32_A4988_ENABLE)
 #error "No components enabled, configuration doesn't make sense. Run 'idf.py menuconfig' to enable."
@@ -49,18 +86,227 @@ static const char *TAG = "hcc-esp32";
 #define CONFIG_HCC_ESP32_FLASH_LED_MILLIS 0
 #endif
 
+#if CONFIG_HCC_ESP32_MQTT_ENCODING_JSON || CONFIG_HCC_ESP32_MQTT_ENCODING_BOTH
+#define ENCODE_JSON 1
+#endif
+
+#if CONFIG_HCC_ESP32_MQTT_ENCODING_CBOR || CONFIG_HCC_ESP32_MQTT_ENCODING_BOTH
+#define ENCODE_CBOR 1
+#endif
+
 #ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
 #include "onewire.h"
-hcc_onewire::OneWire oneWire(TAG, (gpio_num_t)CONFIG_ONE_WIRE_GPIO, GPIO_LED, CONFIG_HCC_ESP32_FLASH_LED_MILLIS);
+#include "ds18b20_bus.h"
+#include "simulated_bus.h"
+#include "nvs_rom_cache.h"
+#include "gpio_led.h"
+#include "sensor_registry.h"
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ADAPTIVE_RESOLUTION
+#define ONE_WIRE_RESOLUTION_POLICY hcc_onewire::ResolutionPolicy::adaptive
+#else
+#define ONE_WIRE_RESOLUTION_POLICY hcc_onewire::ResolutionPolicy::fixed
+#define CONFIG_HCC_ESP32_ONE_WIRE_STABLE_RESOLUTION CONFIG_HCC_ESP32_ONE_WIRE_RESOLUTION
+#define CONFIG_HCC_ESP32_ONE_WIRE_STABLE_CYCLES 0
+#endif
+
+#if CONFIG_HCC_ESP32_ONE_WIRE_BUS_COUNT < 2
+#define CONFIG_HCC_ESP32_ONE_WIRE_GPIO_1 -1
+#endif
+
+#if CONFIG_HCC_ESP32_ONE_WIRE_BUS_COUNT < 3
+#define CONFIG_HCC_ESP32_ONE_WIRE_GPIO_2 -1
+#endif
+
+#define ONE_WIRE_BUS_COUNT CONFIG_HCC_ESP32_ONE_WIRE_BUS_COUNT
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ROM_CACHE
+#define ONE_WIRE_ROM_CACHE (&rom_cache)
+#else
+#define ONE_WIRE_ROM_CACHE NULL
+#endif
+
+#ifdef CONFIG_HCC_ESP32_FLASH_LED
+#define ONE_WIRE_LED (&one_wire_led)
+#else
+#define ONE_WIRE_LED NULL
+#endif
+
+const gpio_num_t one_wire_gpio[] = {
+    (gpio_num_t) CONFIG_ONE_WIRE_GPIO,
+    (gpio_num_t) CONFIG_HCC_ESP32_ONE_WIRE_GPIO_1,
+    (gpio_num_t) CONFIG_HCC_ESP32_ONE_WIRE_GPIO_2
+};
+
+typedef struct bus_t {
+
+    /**
+     * Created by onewire_start().
+     */
+    hcc_onewire::OneWire *oneWire;
+
+    /**
+     * Offsets of the bus devices in {@code sensors}, -1 for the devices that didn't fit. Guarded by {@code sensors_lock}.
+     */
+    std::vector<int> sensorOffsets;
+
+    /**
+     * Readings of the last conversion. Written by the bus task, read by the sampler task, both holding the lock.
+     */
+    std::vector<hcc_onewire::Reading> readings;
+    SemaphoreHandle_t lock;
+
+    /**
+     * Created by onewire_poll().
+     */
+    TaskHandle_t task;
+} bus;
+
+bus buses[ONE_WIRE_BUS_COUNT];
+
+hcc_onewire::SystemClock system_clock;
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ROM_CACHE
+hcc_onewire::NvsRomCache rom_cache("hcc_onewire");
+#endif
+
+#ifdef CONFIG_HCC_ESP32_FLASH_LED
+hcc_onewire::GpioLed one_wire_led(GPIO_LED);
+#endif
+
+/**
+ * Every bus task sets its bit here when its readings are ready.
+ */
+EventGroupHandle_t bus_events;
+
+#define BUS_READY(offset) (1 << (offset))
+#define ALL_BUSES_READY ((1 << ONE_WIRE_BUS_COUNT) - 1)
+
+/**
+ * Number of devices the rescan looks for between two conversions.
+ */
+#define RESCAN_BUDGET 4
 
 #define SAMPLE_PERIOD_MILLIS (1000 * CONFIG_ONE_WIRE_POLL_SECONDS)
 
-typedef struct sensor_t {
-    std::string address;
-    std::string topic;
-} sensor;
+#if CONFIG_HCC_ESP32_MQTT_PUBLISH_PER_SENSOR || CONFIG_HCC_ESP32_MQTT_PUBLISH_BOTH
+#define PUBLISH_PER_SENSOR 1
+#endif
+
+#if CONFIG_HCC_ESP32_MQTT_PUBLISH_BATCH || CONFIG_HCC_ESP32_MQTT_PUBLISH_BOTH
+#define PUBLISH_BATCH 1
+#endif
+
+typedef hcc_pipeline::Sensor sensor;
+
+hcc_pipeline::SensorRegistry<CONFIG_HCC_ESP32_ONE_WIRE_SENSOR_CAPACITY> sensors;
+
+/**
+ * Serializes adding sensors, and guards the bus sensor offsets and the sensor bus bindings; the bus tasks
+ * add sensors as they are found. The sensors themselves are never deleted nor moved, and can be used
+ * without holding the lock.
+ */
+SemaphoreHandle_t sensors_lock;
+
+#ifdef PUBLISH_BATCH
+
+#ifdef ENCODE_JSON
+char *batch_pub_topic;
+#endif
+
+#ifdef ENCODE_CBOR
+char *cbor_batch_pub_topic;
+#endif
+
+#endif
+
+#ifdef CONFIG_HCC_ESP32_SAMPLE_RING_DROP_NEWEST
+#define SAMPLE_RING_OVERFLOW_POLICY hcc_pipeline::OverflowPolicy::dropNewest
+#else
+#define SAMPLE_RING_OVERFLOW_POLICY hcc_pipeline::OverflowPolicy::dropOldest
+#endif
+
+// The ring takes powers of two only, the option is rounded up
+#define SAMPLE_RING_CAPACITY hcc_pipeline::ring_capacity(CONFIG_HCC_ESP32_SAMPLE_RING_CAPACITY)
+
+/**
+ * Samples on their way from the sampler task to the publisher task.
+ */
+hcc_pipeline::SampleRing<SAMPLE_RING_CAPACITY> sample_ring(SAMPLE_RING_OVERFLOW_POLICY);
+
+/**
+ * Takes the samples from the bus readings to the broker, created by pipeline_start().
+ */
+hcc_pipeline::SamplePipeline *pipeline;
+
+#ifdef CONFIG_FREERTOS_UNICORE
+#define SAMPLER_CORE 0
+#define PUBLISHER_CORE 0
+#else
+// The network stack lives on the PRO CPU, keep the bus away from it
+#define SAMPLER_CORE APP_CPU_NUM
+#define PUBLISHER_CORE PRO_CPU_NUM
+#endif
+
+#define SAMPLER_STACK_SIZE 4096
+#define BUS_STACK_SIZE 4096
+#define DISCOVERY_STACK_SIZE 4096
+#define PUBLISHER_STACK_SIZE 4096
+
+TaskHandle_t publisher_task_handle;
+TaskHandle_t sampler_task_handle;
+
+#ifdef CONFIG_HCC_ESP32_STORE_ENABLE
+/**
+ * Samples waiting for the broker connection, created by onewire_poll().
+ */
+hcc_pipeline::SampleStore *sample_store;
+
+/**
+ * How often the publisher wakes up to drain the store, and how many samples it publishes every time.
+ */
+#define STORE_DRAIN_INTERVAL_MILLIS 100
+#define STORE_DRAIN_BATCH ((CONFIG_HCC_ESP32_STORE_DRAIN_RATE * STORE_DRAIN_INTERVAL_MILLIS + 999) / 1000)
+#endif
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+/**
+ * Everything the deep sleep must not wipe out: the wake schedule, the report filters of the sensors, in the registry
+ * order at the time, with their ROM codes to find them again, and the samples the network wasn't up for.
+ * Plain data only, no constructors, or they would run on every wake.
+ */
+typedef struct {
+    hcc_power::DutyState duty;
+    uint32_t cycle;
+    hcc_power::RetainedCounts counts;
+    hcc_power::RetainedSensor sensors[CONFIG_HCC_ESP32_ONE_WIRE_SENSOR_CAPACITY];
+    hcc_pipeline::SampleRecord samples[CONFIG_HCC_ESP32_POWER_RTC_CAPACITY];
+} retained;
+
+#ifdef CONFIG_ESP32_ULP_COPROC_ENABLED
+#define RTC_ULP_RESERVE CONFIG_ESP32_ULP_COPROC_RESERVE_MEM
+#else
+#define RTC_ULP_RESERVE 0
+#endif
+
+// 8K of RTC slow memory, less the ULP reserve, and some room for what ESP-IDF keeps there itself
+#define RTC_RETAINED_MAX (8 * 1024 - RTC_ULP_RESERVE - 1024)
+
+static_assert(sizeof(retained) <= RTC_RETAINED_MAX,
+    "Doesn't fit in RTC memory, lower HCC_ESP32_ONE_WIRE_SENSOR_CAPACITY or HCC_ESP32_POWER_RTC_CAPACITY");
+
+RTC_DATA_ATTR retained rtc_state;
 
-std::vector<sensor *> sensors;
+hcc_power::RtcClock rtc_clock;
+hcc_power::DutyCycle duty_cycle(&rtc_clock, &rtc_state.duty, SAMPLE_PERIOD_MILLIS * 1000LL, CONFIG_HCC_ESP32_POWER_CONNECT_WAKES);
+hcc_power::SleepRetainer sleep_retainer(TAG, &system_clock, &rtc_state.counts,
+    rtc_state.sensors, CONFIG_HCC_ESP32_ONE_WIRE_SENSOR_CAPACITY, rtc_state.samples, CONFIG_HCC_ESP32_POWER_RTC_CAPACITY);
+
+/**
+ * Shortest sleep worth going to sleep for, in microseconds.
+ */
+#define DEEP_SLEEP_MIN_MICROS 100000
+#endif
 
 struct sensor_sample {
     const char *entity_type;
@@ -73,10 +319,78 @@ struct sensor_sample {
 
 #endif
 
+#ifdef CONFIG_HCC_ESP32_A4988_ENABLE
+#include "a4988.h"
+#include "homing.h"
+#include "motion_planner.h"
+#include "nvs_record_storage.h"
+#include "position_store.h"
+#include "rmt_pulse_generator.h"
+
+#ifndef CONFIG_HCC_ESP32_A4988_MICROSTEPPING
+#define CONFIG_HCC_ESP32_A4988_PIN_MS1 -1
+#define CONFIG_HCC_ESP32_A4988_PIN_MS2 -1
+#define CONFIG_HCC_ESP32_A4988_PIN_MS3 -1
+#endif
+
+#ifndef CONFIG_HCC_ESP32_A4988_POWERSAVE
+#define CONFIG_HCC_ESP32_A4988_PIN_SLP -1
+#endif
+
+// The 1-Wire buses take the RMT channels two at a time from the bottom, this one is out of their reach
+#define A4988_RMT_CHANNEL RMT_CHANNEL_7
+
+#define A4988_STEP_MICROS (1000000 / CONFIG_HCC_ESP32_A4988_STEP_RATE)
+
+stepper::GpioOutputPins stepper_outputs;
+stepper::RmtPulseGenerator stepper_pulses((gpio_num_t) CONFIG_HCC_ESP32_A4988_PIN_STEP, A4988_RMT_CHANNEL);
+
+#ifdef CONFIG_HCC_ESP32_A4988_LIMIT_SWITCH_ENABLE
+stepper::GpioLimitSwitch limit_switch((gpio_num_t) CONFIG_HCC_ESP32_A4988_PIN_LIMIT);
+#endif
+
+#ifdef CONFIG_HCC_ESP32_A4988_PROFILE_S_CURVE
+#define A4988_PROFILE stepper::Profile::sCurve
+#else
+#define A4988_PROFILE stepper::Profile::trapezoidal
+#endif
+
+#ifdef CONFIG_HCC_ESP32_A4988_PERSIST
+stepper::NvsRecordStorage position_storage("hcc_stepper", "position");
+stepper::PositionStore position_store(&position_storage,
+    1000000LL * CONFIG_HCC_ESP32_A4988_PERSIST_SETTLE_SECONDS, 1000000LL * CONFIG_HCC_ESP32_A4988_PERSIST_INTERVAL_SECONDS);
+#endif
+
+#define MOTION_STACK_SIZE 3072
+
+/**
+ * Created by stepper_start(), {@code NULL} if the driver failed to initialize.
+ * The driver belongs to the motion task, everyone else only talks to the planner.
+ */
+stepper::A4988 *a4988;
+stepper::MotionPlanner *motion_planner;
+TaskHandle_t motion_task_handle;
+
+/**
+ * Whether stepper_start() took the position from NVS, in which case there's no need to home.
+ */
+bool stepper_resumed;
+
+/**
+ * Whether the position means anything, cleared if homing fails. Only a known position is worth remembering.
+ */
+bool stepper_known = true;
+#endif
+
 char device_id[19];
 char *edge_pub_topic;
 char *mqtt_hello;
 
+/**
+ * Guards {@code mqtt_hello}, it is re-rendered when the sensor set changes.
+ */
+SemaphoreHandle_t hello_lock;
+
 struct hello {
     const char *entity_type;
     const char *device_id;
@@ -85,6 +399,202 @@ struct hello {
 
 esp_mqtt_client_handle_t mqtt_client;
 
+/**
+ * Set by mqtt_start(). The sampling starts before the MQTT client exists.
+ */
+std::atomic<bool> mqtt_started(false);
+
+/**
+ * When mqtt_start() was called, to tell how long the broker took.
+ */
+int64_t mqtt_start_time;
+
+/**
+ * The boot phases run concurrently, and set their bits here when done, see boot_phase().
+ */
+EventGroupHandle_t boot_events;
+
+#define BOOT_IDENTITY (1 << 0)
+#define BOOT_NETWORK (1 << 1)
+#define BOOT_BROKER (1 << 2)
+#define BOOT_FIRST_READING (1 << 3)
+
+/**
+ * The sensors, the hello message and the command routes are all set up; the MQTT client waits for this.
+ */
+#define BOOT_READY (1 << 4)
+
+#define BOOT_BUS_FOUND(offset) (1 << (5 + (offset)))
+#define BOOT_ALL_BUSES_FOUND (((1 << ONE_WIRE_BUS_COUNT) - 1) << 5)
+
+#define NETWORK_STACK_SIZE 4096
+
+/**
+ * Decides when to bring the network and the broker connection back, created by link_start(). Guarded by
+ * {@code link_lock}, the events come in on the event loop and the MQTT tasks, and the link task acts on them.
+ */
+hcc_mqtt::ConnectionSupervisor *link_supervisor;
+SemaphoreHandle_t link_lock;
+TaskHandle_t link_task_handle;
+
+/**
+ * Set by link_stop() to have the link task wind down, and given by the link task when it has.
+ */
+std::atomic<bool> link_stopping(false);
+SemaphoreHandle_t link_stopped;
+
+/**
+ * Whether the messages have a way out: both the network and the broker connection are up. Publishing is gated
+ * on this; the broker client alone takes until the keepalive times out to notice that the network is gone.
+ */
+std::atomic<bool> link_online(false);
+
+#define LINK_STACK_SIZE 3072
+
+/**
+ * Marks the boot phase done, and logs how long it took since it {@code started}, and since the boot.
+ */
+void boot_phase(EventBits_t bit, const char *name, int64_t started)
+{
+    int64_t now = esp_timer_get_time();
+
+    ESP_LOGI(TAG, "[boot] %s: %dms, %dms since boot", name, (int) ((now - started) / 1000), (int) (now / 1000));
+
+    xEventGroupSetBits(boot_events, bit);
+}
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+/**
+ * QoS 1 messages published and not acknowledged yet, the hello included. The wake is not over until they are.
+ * Counted before the message is handed over, the acknowledgement may come in before the publish call returns.
+ */
+std::atomic<int> mqtt_unacked(0);
+
+/**
+ * Counts the acknowledgement off, never below zero: a message from a previous session the client redelivered
+ * may be acknowledged too.
+ */
+void mqtt_acknowledged(void)
+{
+    int unacked = mqtt_unacked;
+
+    while (unacked > 0 && !mqtt_unacked.compare_exchange_weak(unacked, unacked - 1)) {
+    }
+}
+#endif
+
+#ifdef CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP
+/**
+ * Keeps the chip out of light sleep while held, see power_busy(). Created by power_start(), {@code NULL}
+ * if the power management couldn't be configured.
+ */
+esp_pm_lock_handle_t power_lock;
+
+/**
+ * Time power_lock was held for, and by how many at the moment, guarded by {@code power_meter_lock}.
+ */
+hcc_power::AwakeMeter power_meter(0);
+int power_holders;
+SemaphoreHandle_t power_meter_lock;
+#endif
+
+/**
+ * Keeps the chip out of light sleep until power_idle(), for as long as a peripheral is doing timed work that
+ * the sleep would break: bus transactions, and stepper moves. Calls nest, and can be made from any task.
+ * Does nothing unless the light sleep is enabled.
+ */
+void power_busy(void)
+{
+#ifdef CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP
+    if (power_lock == NULL) {
+        return;
+    }
+
+    esp_pm_lock_acquire(power_lock);
+
+    xSemaphoreTake(power_meter_lock, portMAX_DELAY);
+
+    if (power_holders++ == 0) {
+        power_meter.wake(esp_timer_get_time());
+    }
+
+    xSemaphoreGive(power_meter_lock);
+#endif
+}
+
+void power_idle(void)
+{
+#ifdef CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP
+    if (power_lock == NULL) {
+        return;
+    }
+
+    xSemaphoreTake(power_meter_lock, portMAX_DELAY);
+
+    if (--power_holders == 0) {
+        power_meter.sleep(esp_timer_get_time());
+    }
+
+    xSemaphoreGive(power_meter_lock);
+
+    esp_pm_lock_release(power_lock);
+#endif
+}
+
+/**
+ * Returns the share of the time the chip was awake since the boot, in the light sleep mode; or since the cold boot,
+ * up to the end of the last wake, in the deep sleep mode; 1 otherwise.
+ *
+ * The light sleep mode only knows about the time it was kept awake by power_busy(), the chip also wakes up for
+ * the timers and the Wi-Fi beacons, so the actual ratio is somewhat higher.
+ */
+float power_awake_ratio(void)
+{
+#if defined(CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP)
+    if (power_lock == NULL) {
+        return 1;
+    }
+
+    xSemaphoreTake(power_meter_lock, portMAX_DELAY);
+    float ratio = power_meter.getRatio(esp_timer_get_time());
+    xSemaphoreGive(power_meter_lock);
+
+    return ratio;
+#elif defined(CONFIG_HCC_ESP32_POWER_DEEP_SLEEP)
+    return duty_cycle.getAwakeRatio();
+#else
+    return 1;
+#endif
+}
+
+#ifdef CONFIG_HCC_ESP32_METRICS
+char *metrics_pub_topic;
+
+#define METRICS_STACK_SIZE 4096
+
+/**
+ * Where the time goes in the poll cycle, and how long the broker takes to acknowledge what was published.
+ * Published and reset every CONFIG_HCC_ESP32_METRICS_SECONDS, see create_metrics().
+ */
+struct metrics_t {
+    hcc_metrics::Histogram conversionWait;
+    hcc_metrics::Histogram scratchpadRead;
+    hcc_metrics::Histogram serialization;
+    hcc_metrics::Histogram publishEnqueue;
+    hcc_metrics::Histogram publishAck;
+    hcc_metrics::Histogram command;
+    hcc_metrics::AckTracker acks;
+} metrics;
+
+#define METRICS_START(start) int64_t start = esp_timer_get_time()
+#define METRICS_RECORD(histogram, start) metrics.histogram.record(esp_timer_get_time() - (start))
+#define METRICS_SENT(msg_id) metrics.acks.sent(msg_id, esp_timer_get_time())
+#else
+#define METRICS_START(start)
+#define METRICS_RECORD(histogram, start)
+#define METRICS_SENT(msg_id)
+#endif
+
 void log_component_setup()
 {
 #ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
@@ -104,8 +614,16 @@ void log_onewire_configuration()
 {
 #ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
 
-    ESP_LOGI(TAG, "[conf/1-Wire] GPIO pin: %d", CONFIG_ONE_WIRE_GPIO);
+    for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+        ESP_LOGI(TAG, "[conf/1-Wire] bus %d GPIO pin: %d", offset, one_wire_gpio[offset]);
+    }
+
     ESP_LOGI(TAG, "[conf/1-Wire] sampling interval: %ds", CONFIG_ONE_WIRE_POLL_SECONDS);
+    ESP_LOGI(TAG, "[conf/1-Wire] resolution: %d bits", CONFIG_HCC_ESP32_ONE_WIRE_RESOLUTION);
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ADAPTIVE_RESOLUTION
+    ESP_LOGI(TAG, "[conf/1-Wire] resolution when stable for %d cycles: %d bits", CONFIG_HCC_ESP32_ONE_WIRE_STABLE_CYCLES, CONFIG_HCC_ESP32_ONE_WIRE_STABLE_RESOLUTION);
+#endif
 
 #ifdef CONFIG_HCC_ESP32_FLASH_LED
     ESP_LOGI(TAG, "[conf/1-Wire] LED flash duration: %dms", CONFIG_HCC_ESP32_FLASH_LED_MILLIS);
@@ -120,6 +638,8 @@ void log_a4988_configuration()
 
     ESP_LOGI(TAG, "[conf/A4988] DIR pin:  %d", CONFIG_HCC_ESP32_A4988_PIN_DIR);
     ESP_LOGI(TAG, "[conf/A4988] STEP pin: %d", CONFIG_HCC_ESP32_A4988_PIN_STEP);
+    ESP_LOGI(TAG, "[conf/A4988] step rate: %d/s", CONFIG_HCC_ESP32_A4988_STEP_RATE);
+    ESP_LOGI(TAG, "[conf/A4988] max speed: %d/s, acceleration: %d/s^2", CONFIG_HCC_ESP32_A4988_MAX_SPEED, CONFIG_HCC_ESP32_A4988_ACCELERATION);
 
 #ifdef CONFIG_HCC_ESP32_A4988_MICROSTEPPING
     ESP_LOGI(TAG, "[conf/A4988] microstepping enabled");
@@ -137,6 +657,13 @@ void log_a4988_configuration()
     ESP_LOGI(TAG, "[conf/A4988] power save disabled");
 #endif
 
+#ifdef CONFIG_HCC_ESP32_A4988_PERSIST
+    ESP_LOGI(TAG, "[conf/A4988] position persisted after %ds idle, at most every %ds",
+        CONFIG_HCC_ESP32_A4988_PERSIST_SETTLE_SECONDS, CONFIG_HCC_ESP32_A4988_PERSIST_INTERVAL_SECONDS);
+#else
+    ESP_LOGI(TAG, "[conf/A4988] position not persisted");
+#endif
+
 #endif
 }
 
@@ -157,11 +684,20 @@ void log_configuration(void)
 
     log_onewire_configuration();
     log_a4988_configuration();
+
+#if defined(CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP)
+    ESP_LOGI(TAG, "[conf/power] automatic light sleep");
+#elif defined(CONFIG_HCC_ESP32_POWER_DEEP_SLEEP)
+    ESP_LOGI(TAG, "[conf/power] deep sleep between polls, network every %d wakes, %d samples kept in RTC memory",
+        CONFIG_HCC_ESP32_POWER_CONNECT_WAKES, CONFIG_HCC_ESP32_POWER_RTC_CAPACITY);
+#else
+    ESP_LOGI(TAG, "[conf/power] always on");
+#endif
 }
 
 /**
- * Allocates memory and returns the MQTT message rendered as follows in the example below,
- * but in one line (multiline for readability).
+ * Renders the hello message as follows in the example below, but in one line (multiline for readability),
+ * into memory the caller must free.
  *
  * {
  *  "device_id": "ESP32-246F28A7C53C",
@@ -169,10 +705,14 @@ void log_configuration(void)
  *  "sources": [
  *      "D90301A2792B0528",
  *      "E40300A27970F728"
+ *  ],
+ *  "encodings": [
+ *      "json",
+ *      "cbor"
  *  ]
  * }
  */
-void create_hello()
+char *render_hello()
 {
 
     cJSON *json_root = cJSON_CreateObject();
@@ -180,10 +720,13 @@ void create_hello()
     cJSON_AddItemToObject(json_root, "device_id", cJSON_CreateString(device_id));
 
 #ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
-    int count = oneWire.getDeviceCount();
-    const char *sources[count];
-    for (int offset = 0; offset < count; offset++) {
-        sources[offset] = sensors[offset]->address.c_str();
+    // The caller holds sensors_lock, unless the sampling hasn't started yet
+    const char *sources[sensors.size()];
+    int count = 0;
+    for (auto &s : sensors) {
+        if (s.present) {
+            sources[count++] = s.address;
+        }
     }
 
     cJSON *json_sources = cJSON_CreateStringArray(sources, count);
@@ -194,125 +737,1550 @@ void create_hello()
 
     cJSON_AddItemToObject(json_root, "sources", json_sources);
 
-    // VT: NOTE: Careful, this allocates memory, need to delete it if we're going to re-render it
-    mqtt_hello = cJSON_PrintUnformatted(json_root);
-    ESP_LOGI(TAG, "[mqtt] %s %s", edge_pub_topic, mqtt_hello);
-
-    cJSON_Delete(json_root);
-}
-
-/**
- * Sets device_id to "ESP32-${esp_read_mac()}";
- * Sets edge_pub_topic to "{@CONFIG_BROKER_PUB_ROOT}/edge/".
- */
-void create_identity()
-{
+    // Consumers pick the encoding they understand, see the MQTT menu
+    const char *encodings[2];
+    int encoding_count = 0;
 
-    uint8_t id[6] = {0};
-    ESP_ERROR_CHECK(esp_read_mac(id, ESP_MAC_WIFI_STA));
+#ifdef ENCODE_JSON
+    encodings[encoding_count++] = "json";
+#endif
 
-    strcpy(device_id, "ESP32-");
-    sprintf(device_id + 6, "%02X%02X%02X%02X%02X%02X", id[0], id[1], id[2], id[3], id[4], id[5]);
+#ifdef ENCODE_CBOR
+    encodings[encoding_count++] = "cbor";
+#endif
 
-    edge_pub_topic = (char *)malloc(strlen(CONFIG_BROKER_PUB_ROOT) + 5 + 1);
+    cJSON_AddItemToObject(json_root, "encodings", cJSON_CreateStringArray(encodings, encoding_count));
 
-    strcpy(edge_pub_topic, CONFIG_BROKER_PUB_ROOT);
-    strcpy(edge_pub_topic + strlen(CONFIG_BROKER_PUB_ROOT), "/edge");
+    char *hello = cJSON_PrintUnformatted(json_root);
+    ESP_LOGI(TAG, "[mqtt] %s %s", edge_pub_topic, hello);
 
-    ESP_LOGI(TAG, "[id] device id: %s", device_id);
+    cJSON_Delete(json_root);
 
-    create_hello();
+    return hello;
 }
 
-#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
 /**
- * Allocates memory and returns the sensor topic rendered as "${CONFIG_BROKER_PUB_ROOT}/sensor/${ADDRESS}"
+ * Makes the rendered hello message the one to publish, and frees the previous one, if any.
  */
-std::string create_topic_from_address(std::string address)
+void set_hello(char *hello)
+{
+    xSemaphoreTake(hello_lock, portMAX_DELAY);
+    free(mqtt_hello);
+    mqtt_hello = hello;
+    xSemaphoreGive(hello_lock);
+}
+
+/**
+ * Renders the hello message, and sets mqtt_hello to it.
+ */
+void create_hello()
+{
+    set_hello(render_hello());
+}
+
+/**
+ * Publishes mqtt_hello, if the broker is connected. Blocks until the MQTT client takes it; the bus tasks
+ * don't call this, see sync_sensors().
+ */
+void publish_hello()
+{
+    if (!link_online) {
+        return;
+    }
+
+    // The client may take a while, the hello may be re-rendered meanwhile
+    xSemaphoreTake(hello_lock, portMAX_DELAY);
+    char *hello = mqtt_hello != NULL ? strdup(mqtt_hello) : NULL;
+    xSemaphoreGive(hello_lock);
+
+    if (hello == NULL) {
+        ESP_LOGE(TAG, "[mqtt] no hello message to publish");
+        return;
+    }
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+    mqtt_unacked++;
+#endif
+
+    int msg_id = esp_mqtt_client_publish(mqtt_client, edge_pub_topic, hello, 0, 1, 0);
+    free(hello);
+
+    METRICS_SENT(msg_id);
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+    if (msg_id < 0) {
+        mqtt_acknowledged();
+    }
+#endif
+
+    ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+}
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+/**
+ * Pre-renders constant parts of the sensor's sample messages, in the encodings configured. Must be called after device_id is set.
+ */
+void setup_sample_payloads(sensor *s)
+{
+#ifdef ENCODE_JSON
+    if (!s->payload.setup(s->address, device_id)) {
+        ESP_LOGE(TAG, "[mqtt] can't fit sample message for %s, expect garbage", s->address);
+    }
+#endif
+
+#ifdef ENCODE_CBOR
+    if (!s->cborPayload.setup(s->romCode, device_id)) {
+        ESP_LOGE(TAG, "[mqtt] can't fit CBOR sample message for %s, expect garbage", s->address);
+    }
+#endif
+}
+#endif
+
+/**
+ * Pre-renders constant parts of sample messages for all sensors. Must be called after device_id is set.
+ */
+void create_sample_payloads()
+{
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+    for (auto &s : sensors) {
+        setup_sample_payloads(&s);
+    }
+#endif
+}
+
+/**
+ * Sets device_id to "ESP32-${esp_read_mac()}";
+ * Sets edge_pub_topic to "{@CONFIG_BROKER_PUB_ROOT}/edge/".
+ * Sets batch_pub_topic to "{@CONFIG_BROKER_PUB_ROOT}/batch", if batched publishing is enabled.
+ * Sets cbor_batch_pub_topic to "{@CONFIG_BROKER_PUB_ROOT}/batch/cbor", if batched publishing and CBOR encoding are enabled.
+ * Sets metrics_pub_topic to "{@CONFIG_BROKER_PUB_ROOT}/metrics", if metrics are enabled.
+ */
+void create_identity()
+{
+
+    uint8_t id[6] = {0};
+    ESP_ERROR_CHECK(esp_read_mac(id, ESP_MAC_WIFI_STA));
+
+    strcpy(device_id, "ESP32-");
+    sprintf(device_id + 6, "%02X%02X%02X%02X%02X%02X", id[0], id[1], id[2], id[3], id[4], id[5]);
+
+    edge_pub_topic = (char *)malloc(strlen(CONFIG_BROKER_PUB_ROOT) + 5 + 1);
+
+    strcpy(edge_pub_topic, CONFIG_BROKER_PUB_ROOT);
+    strcpy(edge_pub_topic + strlen(CONFIG_BROKER_PUB_ROOT), "/edge");
+
+#if defined(PUBLISH_BATCH) && defined(ENCODE_JSON)
+    batch_pub_topic = (char *)malloc(strlen(CONFIG_BROKER_PUB_ROOT) + 6 + 1);
+
+    strcpy(batch_pub_topic, CONFIG_BROKER_PUB_ROOT);
+    strcpy(batch_pub_topic + strlen(CONFIG_BROKER_PUB_ROOT), "/batch");
+#endif
+
+#if defined(PUBLISH_BATCH) && defined(ENCODE_CBOR)
+    cbor_batch_pub_topic = (char *)malloc(strlen(CONFIG_BROKER_PUB_ROOT) + 11 + 1);
+
+    strcpy(cbor_batch_pub_topic, CONFIG_BROKER_PUB_ROOT);
+    strcpy(cbor_batch_pub_topic + strlen(CONFIG_BROKER_PUB_ROOT), "/batch/cbor");
+#endif
+
+#ifdef CONFIG_HCC_ESP32_METRICS
+    metrics_pub_topic = (char *)malloc(strlen(CONFIG_BROKER_PUB_ROOT) + 8 + 1);
+
+    strcpy(metrics_pub_topic, CONFIG_BROKER_PUB_ROOT);
+    strcpy(metrics_pub_topic + strlen(CONFIG_BROKER_PUB_ROOT), "/metrics");
+#endif
+
+    ESP_LOGI(TAG, "[id] device id: %s", device_id);
+
+    hello_lock = xSemaphoreCreateMutex();
+}
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+/**
+ * Allocates memory and returns the sensor topic rendered as "${CONFIG_BROKER_PUB_ROOT}/sensor/${ADDRESS}"
+ */
+std::string create_topic_from_address(std::string address)
 {
     std::string root = CONFIG_BROKER_PUB_ROOT;
     std::string sensor = "/sensor/";
 
-    return root + sensor + address;
+    return root + sensor + address;
+}
+#endif
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+/**
+ * Binds the device on the bus to its sensor, creating the sensor if it's not in the registry yet. The device
+ * moved over from another bus keeps its sensor. Returns NULL if there's no room left in the registry.
+ *
+ * The caller holds sensors_lock, unless the sampling hasn't started yet.
+ */
+sensor *bind_sensor(int offset, int device)
+{
+    bus *b = &buses[offset];
+    uint64_t rom_code = hcc_onewire::rom_code_to_uint64(b->oneWire->getRomCodeAt(device));
+    sensor *s = sensors.find(rom_code);
+
+    if (s == NULL) {
+
+        s = sensors.add(rom_code, CONFIG_BROKER_PUB_ROOT "/sensor/");
+
+        if (s == NULL) {
+            ESP_LOGE(TAG, "[1-Wire] no room for %s, %d sensors at most", b->oneWire->getAddressAt(device).c_str(), (int) sensors.capacity());
+        } else {
+            s->filter.configure(CONFIG_HCC_ESP32_REPORT_DEADBAND_MILLIDEGREES / 1000.0f, CONFIG_HCC_ESP32_REPORT_HEARTBEAT_SECONDS * 1000LL);
+        }
+
+    } else {
+        ESP_LOGI(TAG, "[1-Wire] %s moved from bus %d to bus %d", s->address, s->bus, offset);
+    }
+
+    if (s != NULL) {
+        s->bus = offset;
+        s->device = device;
+    }
+
+    b->sensorOffsets.push_back(s != NULL ? sensors.offsetOf(s) : -1);
+
+    return s;
+}
+
+/**
+ * Returns the sensor at the offset, or NULL if there's no such sensor.
+ */
+inline sensor *get_sensor(int offset)
+{
+    return sensors.at(offset);
+}
+#endif
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+/**
+ * Looks for the devices on one bus, and exits. The buses are searched at the same time, every one of them
+ * waits out its own settle delay.
+ */
+void discovery_task(void *arg)
+{
+    const int offset = (intptr_t) arg;
+    bus *b = &buses[offset];
+    int64_t started = esp_timer_get_time();
+
+    int count = b->oneWire->browse(ONE_WIRE_ROM_CACHE);
+
+    if (ONE_WIRE_BUS_COUNT > 1) {
+        ESP_LOGI(TAG, "[1-Wire] bus %d (GPIO %d): %d devices", offset, one_wire_gpio[offset], count);
+    }
+
+    char name[16];
+    snprintf(name, sizeof(name), "bus %d search", offset);
+
+    boot_phase(BOOT_BUS_FOUND(offset), name, started);
+
+    vTaskDelete(NULL);
+}
+#endif
+
+/**
+ * Sets the buses up, and starts looking for the devices on them in the background. See onewire_join().
+ */
+void onewire_start(void)
+{
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+
+    sensors_lock = xSemaphoreCreateMutex();
+
+    for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+
+        bus *b = &buses[offset];
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_SIMULATOR
+        char name[12];
+        snprintf(name, sizeof(name), "sim%d", offset);
+
+        hcc_onewire::SimulatedBus::Config config = {};
+        config.devices = CONFIG_HCC_ESP32_ONE_WIRE_SIMULATOR_DEVICES;
+        config.crcFailureRate = CONFIG_HCC_ESP32_ONE_WIRE_SIMULATOR_CRC_FAILURE_PERMILLE / 1000.0f;
+        config.conversionScale = 1.0f;
+        config.hotPlugMicros = CONFIG_HCC_ESP32_ONE_WIRE_SIMULATOR_HOTPLUG_SECONDS * 1000000LL;
+        config.seed = offset + 1;
+
+        hcc_onewire::Bus *driver = new hcc_onewire::SimulatedBus(name, &system_clock, config);
+#else
+        hcc_onewire::Bus *driver = new hcc_onewire::Ds18b20Bus(one_wire_gpio[offset], (rmt_channel_t) (2 * offset + 1), (rmt_channel_t) (2 * offset));
+#endif
+
+        // Only the first bus gets to flash the LED, or they would be all stepping on each other
+        b->oneWire = new hcc_onewire::OneWire(TAG, driver, &system_clock,
+            offset == 0 ? ONE_WIRE_LED : NULL, CONFIG_HCC_ESP32_FLASH_LED_MILLIS,
+            ONE_WIRE_RESOLUTION_POLICY,
+            (hcc_onewire::Resolution) CONFIG_HCC_ESP32_ONE_WIRE_RESOLUTION,
+            (hcc_onewire::Resolution) CONFIG_HCC_ESP32_ONE_WIRE_STABLE_RESOLUTION,
+            CONFIG_HCC_ESP32_ONE_WIRE_STABLE_CYCLES);
+        b->lock = xSemaphoreCreateMutex();
+
+        char task_name[12];
+        snprintf(task_name, sizeof(task_name), "discovery%d", offset);
+
+        xTaskCreatePinnedToCore(discovery_task, task_name, DISCOVERY_STACK_SIZE, (void *) (intptr_t) offset, 5, NULL, SAMPLER_CORE);
+    }
+
+    bus_events = xEventGroupCreate();
+
+#endif
+}
+
+/**
+ * Waits for onewire_start() to find the devices on all the buses, and adds them to the sensor registry,
+ * in the bus order, so that the sensor offsets don't depend on which bus was done first.
+ */
+void onewire_join(void)
+{
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+
+    xEventGroupWaitBits(boot_events, BOOT_ALL_BUSES_FOUND, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+        for (int device = 0; device < buses[offset].oneWire->getDeviceCount(); device++) {
+            bind_sensor(offset, device);
+        }
+    }
+
+#endif
+}
+
+#ifdef CONFIG_HCC_ESP32_A4988_LIMIT_SWITCH_ENABLE
+/**
+ * Finds the limit switch and makes it position zero, then sets the failsafe position as the target, if there's one.
+ */
+void stepper_home(void)
+{
+    if (!limit_switch.initialize()) {
+        ESP_LOGE(TAG, "[A4988] limit switch on GPIO %d failed to initialize, not homing", CONFIG_HCC_ESP32_A4988_PIN_LIMIT);
+        stepper_known = false;
+        return;
+    }
+
+    stepper::HomingConfig config = {};
+
+    config.direction = (stepper::Direction) CONFIG_HCC_ESP32_A4988_LIMIT_DIRECTION;
+    config.fastMicros = A4988_STEP_MICROS;
+    config.slowMicros = 1000000 / CONFIG_HCC_ESP32_A4988_HOMING_SLOW_RATE;
+    config.backoff = CONFIG_HCC_ESP32_A4988_HOMING_BACKOFF;
+    config.travel = CONFIG_HCC_ESP32_A4988_HOMING_TRAVEL;
+
+    stepper::Homing homing(a4988, &stepper_pulses, &limit_switch);
+
+    int64_t started = esp_timer_get_time();
+
+    power_busy();
+    stepper::HomingResult result = homing.home(config);
+    power_idle();
+
+    int took = (int) ((esp_timer_get_time() - started) / 1000);
+
+    switch (result) {
+        case stepper::HomingResult::ok:
+            ESP_LOGI(TAG, "[A4988] homed in %dms, the fast approach was %d off", took, homing.getApproachError());
+            break;
+        case stepper::HomingResult::notFound:
+            ESP_LOGE(TAG, "[A4988] limit switch not found within %d steps, position unknown", CONFIG_HCC_ESP32_A4988_HOMING_TRAVEL);
+            stepper_known = false;
+            return;
+        case stepper::HomingResult::stuck:
+            ESP_LOGE(TAG, "[A4988] limit switch doesn't open, position unknown");
+            stepper_known = false;
+            return;
+        case stepper::HomingResult::failed:
+            ESP_LOGE(TAG, "[A4988] driver refused to move, position unknown");
+            stepper_known = false;
+            return;
+    }
+
+#ifdef CONFIG_HCC_ESP32_A4988_FAILSAFE_ENABLE
+    ESP_LOGI(TAG, "[A4988] moving to the failsafe position %d", CONFIG_HCC_ESP32_A4988_FAILSAFE_POSITION);
+    motion_planner->moveTo(CONFIG_HCC_ESP32_A4988_FAILSAFE_POSITION);
+#else
+    motion_planner->moveTo(0);
+#endif
+}
+#endif
+
+#ifdef CONFIG_HCC_ESP32_A4988_ENABLE
+/**
+ * Owns the driver. Takes the planner to the target, and sleeps until there's a new one.
+ *
+ * The targets that change mid-move are picked up by the planner as the steps go, this task only gets involved
+ * when the move ends short of the target, having had to reverse. It also keeps the position in NVS up to date,
+ * waking up when the position store says it's time to write.
+ */
+void motion_task(void *arg)
+{
+    bool moved = false;
+
+#ifdef CONFIG_HCC_ESP32_A4988_LIMIT_SWITCH_ENABLE
+    if (!stepper_resumed) {
+        stepper_home();
+    }
+#endif
+
+    while (1) {
+
+#ifdef CONFIG_HCC_ESP32_A4988_PERSIST
+        if (stepper_known && !motion_planner->isAtTarget() && !position_store.moving(esp_timer_get_time())) {
+            ESP_LOGE(TAG, "[A4988] can't invalidate the stored position, it will be wrong after a reboot");
+        }
+#endif
+
+        if (motion_planner->update()) {
+            power_busy();
+            a4988->wait(-1);
+            power_idle();
+            moved = true;
+            continue;
+        }
+
+        if (moved) {
+            ESP_LOGI(TAG, "[A4988] at %d", a4988->getPosition());
+            moved = false;
+        }
+
+        TickType_t timeout = portMAX_DELAY;
+
+#ifdef CONFIG_HCC_ESP32_A4988_PERSIST
+        if (stepper_known) {
+
+            uint32_t writes = position_store.getWrites();
+            int64_t now = esp_timer_get_time();
+            int64_t next = position_store.idle(a4988->getPosition(), a4988->getMicrostep(), now);
+
+            if (next >= 0) {
+                timeout = pdMS_TO_TICKS((next - now) / 1000) + 1;
+            } else if (position_store.getWrites() != writes) {
+                ESP_LOGI(TAG, "[A4988] position %d stored, %u writes since boot", a4988->getPosition(), position_store.getWrites());
+            }
+        }
+#endif
+
+        ulTaskNotifyTake(pdTRUE, timeout);
+    }
+}
+#endif
+
+void stepper_start(void)
+{
+#ifdef CONFIG_HCC_ESP32_A4988_ENABLE
+    stepper::A4988Pins pins = {
+        CONFIG_HCC_ESP32_A4988_PIN_DIR,
+        CONFIG_HCC_ESP32_A4988_PIN_MS1,
+        CONFIG_HCC_ESP32_A4988_PIN_MS2,
+        CONFIG_HCC_ESP32_A4988_PIN_MS3,
+        CONFIG_HCC_ESP32_A4988_PIN_SLP
+    };
+
+    stepper::A4988 *driver = new stepper::A4988(pins, &stepper_outputs, &stepper_pulses, A4988_STEP_MICROS);
+
+    if (!driver->initialize()) {
+        ESP_LOGE(TAG, "[A4988] failed to initialize, stepper disabled");
+        delete driver;
+        return;
+    }
+
+    // Finest there is, 0 means microstepping is not configured
+    int microstep = driver->getMaxMicrostep();
+
+    if (microstep > 0) {
+        driver->setMicrostep(microstep);
+    }
+
+#ifdef CONFIG_HCC_ESP32_A4988_PERSIST
+    int position;
+    int divider;
+
+    if (position_store.restore(position, divider)) {
+
+        if (microstep > 0 && divider > 0 && driver->setMicrostep(divider) != divider) {
+            ESP_LOGW(TAG, "[A4988] stored microstep 1/%d not supported, using 1/%d", divider, microstep);
+        }
+
+        driver->setPosition(position);
+        stepper_resumed = true;
+
+        ESP_LOGI(TAG, "[A4988] resuming at %d from NVS, not homing", position);
+    }
+#endif
+
+    stepper::MotionPlanner *planner = new stepper::MotionPlanner(driver);
+
+    if (!planner->setup(CONFIG_HCC_ESP32_A4988_MAX_SPEED, CONFIG_HCC_ESP32_A4988_ACCELERATION, A4988_PROFILE)) {
+        ESP_LOGE(TAG, "[A4988] can't compute the acceleration ramp, stepper disabled");
+        delete planner;
+        delete driver;
+        return;
+    }
+
+    ESP_LOGI(TAG, "[A4988] ready, microstep 1/%d, RMT channel %d", driver->getMicrostep(), A4988_RMT_CHANNEL);
+    ESP_LOGI(TAG, "[A4988] acceleration ramp: %d steps, top speed %d/s",
+        planner->getRampLength(), (int) (1000000 / planner->getCruiseMicros()));
+
+    a4988 = driver;
+    motion_planner = planner;
+
+    xTaskCreate(motion_task, "motion", MOTION_STACK_SIZE, NULL, 6, &motion_task_handle);
+#endif
+}
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+/**
+ * Hands the message over to the MQTT client, at QoS 1.
+ */
+void mqtt_publish(const char *topic, const char *data, size_t length)
+{
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+    mqtt_unacked++;
+#endif
+
+    METRICS_START(publish_started);
+    int msg_id = esp_mqtt_client_publish(mqtt_client, topic, data, length, 1, 0);
+    METRICS_RECORD(publishEnqueue, publish_started);
+    METRICS_SENT(msg_id);
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+    // Not going anywhere, nothing to wait for
+    if (msg_id < 0) {
+        mqtt_acknowledged();
+    }
+#endif
+
+    ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+}
+
+/**
+ * The broker connection, as the pipeline sees it.
+ */
+class MqttSink : public hcc_pipeline::MessageSink {
+public:
+
+    bool isOnline() override
+    {
+        return link_online;
+    }
+
+    void publish(const char *topic, const char *data, size_t length) override
+    {
+        mqtt_publish(topic, data, length);
+    }
+
+    void rendered(int64_t micros) override
+    {
+#ifdef CONFIG_HCC_ESP32_METRICS
+        metrics.serialization.record(micros);
+#endif
+    }
+};
+
+MqttSink mqtt_sink;
+
+/**
+ * Creates the pipeline, in the encodings and the publishing modes configured. The samples wait for the broker
+ * connection in the {@code store}, if there is one. Must be called after create_identity() and onewire_join().
+ */
+void pipeline_start(hcc_pipeline::SampleStore *store)
+{
+    hcc_pipeline::PipelineConfig config = {};
+    const char *batch_topic = NULL;
+    const char *cbor_batch_topic = NULL;
+
+#ifdef PUBLISH_PER_SENSOR
+    config.perSensor = true;
+#endif
+
+#ifdef PUBLISH_BATCH
+    config.batch = true;
+#endif
+
+#ifdef ENCODE_JSON
+    config.json = true;
+#endif
+
+#ifdef ENCODE_CBOR
+    config.cbor = true;
+#endif
+
+#if defined(PUBLISH_BATCH) && defined(ENCODE_JSON)
+    batch_topic = batch_pub_topic;
+#endif
+
+#if defined(PUBLISH_BATCH) && defined(ENCODE_CBOR)
+    cbor_batch_topic = cbor_batch_pub_topic;
+#endif
+
+#ifdef CONFIG_HCC_ESP32_STORE_ENABLE
+    config.drainBatch = STORE_DRAIN_BATCH;
+#endif
+
+    pipeline = new hcc_pipeline::SamplePipeline(TAG, &sensors, &sample_ring, store, &mqtt_sink, &system_clock, config);
+    pipeline->setup(device_id, batch_topic, cbor_batch_topic, sensors.size());
+}
+#endif
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+/**
+ * Returns the current time in milliseconds. This is the wall clock time if it was ever set, and time since boot otherwise.
+ */
+int64_t get_time_millis()
+{
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    return (int64_t) now.tv_sec * 1000 + now.tv_usec / 1000;
+}
+#endif
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+/**
+ * Start of the first poll cycle. All the bus tasks count their periods from here, so that they convert at the same time.
+ */
+TickType_t cycle_origin;
+
+/**
+ * Set when the sensor set changed, and the publisher task is to publish the new hello message.
+ */
+std::atomic<bool> hello_pending(false);
+
+/**
+ * Brings the sensor registry up to date with the devices on the bus after the rescan has found changes,
+ * and has the publisher task republish the hello message. Called on the bus task, which must not wait
+ * for the MQTT client.
+ */
+void sync_sensors(int offset)
+{
+    bus *b = &buses[offset];
+
+    xSemaphoreTake(sensors_lock, portMAX_DELAY);
+
+    for (int device = 0; device < b->oneWire->getDeviceCount(); device++) {
+
+        if (device == (int) b->sensorOffsets.size()) {
+
+            int known = sensors.size();
+            sensor *s = bind_sensor(offset, device);
+
+            // A sensor that moved over from another bus already has its payloads
+            if (sensors.size() > known) {
+                setup_sample_payloads(s);
+            }
+        }
+
+        sensor *s = sensors.at(b->sensorOffsets[device]);
+
+        if (s == NULL) {
+            continue;
+        }
+
+        if (b->oneWire->isPresentAt(device)) {
+
+            // It may have moved back from another bus
+            s->bus = offset;
+            s->device = device;
+            s->present = true;
+
+        } else if (s->bus == offset && s->device == device) {
+
+            // It may have moved to another bus, and be present there
+            s->present = false;
+        }
+    }
+
+    char *hello = render_hello();
+
+    xSemaphoreGive(sensors_lock);
+
+    set_hello(hello);
+
+    hello_pending = true;
+    xTaskNotifyGive(publisher_task_handle);
+}
+
+/**
+ * Reads one bus every SAMPLE_PERIOD_MILLIS, and hands the readings over to the sampler task.
+ * Looks for the devices added or removed every CONFIG_HCC_ESP32_ONE_WIRE_RESCAN_SECONDS, in between.
+ */
+void bus_task(void *arg)
+{
+    const int offset = (intptr_t) arg;
+    bus *b = &buses[offset];
+
+    const TickType_t period = SAMPLE_PERIOD_MILLIS / portTICK_PERIOD_MS;
+    TickType_t last_wake_time = cycle_origin;
+    int64_t rescan_due = esp_timer_get_time() + CONFIG_HCC_ESP32_ONE_WIRE_RESCAN_SECONDS * 1000000LL;
+
+    power_busy();
+    b->oneWire->startConversion();
+    power_idle();
+
+    while (1) {
+
+        // This only waits for whatever is left of the conversion, if anything
+        power_busy();
+        std::vector<hcc_onewire::Reading> readings = b->oneWire->collect();
+        power_idle();
+
+#ifdef CONFIG_HCC_ESP32_METRICS
+        metrics.conversionWait.record(b->oneWire->getLastTiming().waitMicros);
+        metrics.scratchpadRead.record(b->oneWire->getLastTiming().readMicros);
+#endif
+
+        xSemaphoreTake(b->lock, portMAX_DELAY);
+        b->readings.swap(readings);
+        xSemaphoreGive(b->lock);
+
+        xEventGroupSetBits(bus_events, BUS_READY(offset));
+
+#if CONFIG_HCC_ESP32_ONE_WIRE_RESCAN_SECONDS > 0
+        // There's nothing going on on the bus until the next conversion, a few search steps fit right in
+        if (esp_timer_get_time() >= rescan_due) {
+
+            power_busy();
+            bool changed = b->oneWire->rescan(RESCAN_BUDGET);
+            power_idle();
+
+            if (changed) {
+                sync_sensors(offset);
+            }
+
+            if (!b->oneWire->isRescanInProgress()) {
+                rescan_due = esp_timer_get_time() + CONFIG_HCC_ESP32_ONE_WIRE_RESCAN_SECONDS * 1000000LL;
+            }
+        }
+#endif
+
+        // The conversion is started this far ahead of the cycle, so that the readings are ready when the cycle begins.
+        // It may change from cycle to cycle if the resolution is adaptive.
+        TickType_t lead = (b->oneWire->getConversionMillis() + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+
+        if (lead > period) {
+            lead = period;
+        }
+
+        // The next conversion runs while this task is waiting for the next cycle. Neither the conversion
+        // nor the LED flash add to the cycle period.
+        vTaskDelayUntil(&last_wake_time, period - lead);
+
+        power_busy();
+        b->oneWire->startConversion();
+        power_idle();
+
+        vTaskDelayUntil(&last_wake_time, lead);
+    }
+}
+
+/**
+ * Runs the readings of the bus through the sensor report filters, and pushes the samples worth reporting into
+ * the ring. The {@code record} carries the timestamp and the cycle; {@code now} is the monotonic time, in milliseconds.
+ */
+void sample_readings(int offset, const std::vector<hcc_onewire::Reading> &readings, hcc_pipeline::SampleRecord &record, int64_t now)
+{
+    xSemaphoreTake(sensors_lock, portMAX_DELAY);
+    pipeline->sample(buses[offset].sensorOffsets, readings, record, now);
+    xSemaphoreGive(sensors_lock);
+}
+
+/**
+ * Waits for all the buses to deliver their readings, and hands them over to the publisher task as one poll cycle.
+ *
+ * Nothing here waits for the network, so the sampling period doesn't depend on how the broker is doing.
+ */
+void sampler_task(void *arg)
+{
+    const TickType_t period = SAMPLE_PERIOD_MILLIS / portTICK_PERIOD_MS;
+    const int64_t cycle_started = esp_timer_get_time();
+    uint32_t cycle = 0;
+    std::vector<hcc_onewire::Reading> readings;
+
+    while (1) {
+
+        // A bus that is late past the whole period is not holding the others back
+        EventBits_t ready = xEventGroupWaitBits(bus_events, ALL_BUSES_READY, pdTRUE, pdTRUE, period);
+
+        if (ready == 0) {
+            continue;
+        }
+
+        if ((ready & ALL_BUSES_READY) != ALL_BUSES_READY) {
+            // Timed out, the bits were left alone
+            xEventGroupClearBits(bus_events, ready);
+        }
+
+        hcc_pipeline::SampleRecord record = {};
+        record.timestamp = get_time_millis();
+        record.cycle = cycle++;
+
+        // The wall clock may jump, the heartbeat shouldn't
+        int64_t now = esp_timer_get_time() / 1000;
+
+        for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+
+            if (!(ready & BUS_READY(offset))) {
+                ESP_LOGW(TAG, "[1-Wire] bus %d is late, skipped this cycle", offset);
+                continue;
+            }
+
+            bus *b = &buses[offset];
+
+            xSemaphoreTake(b->lock, portMAX_DELAY);
+            readings.swap(b->readings);
+            xSemaphoreGive(b->lock);
+
+            sample_readings(offset, readings, record, now);
+        }
+
+        pipeline->endCycle(record);
+
+        xTaskNotifyGive(publisher_task_handle);
+
+        if (record.cycle == 0) {
+            boot_phase(BOOT_FIRST_READING, "first reading", cycle_started);
+        }
+    }
+}
+
+/**
+ * Takes the samples out of the ring, and publishes them. While there is no broker connection, and until
+ * the samples stored while it was down are drained, they go to the store instead. Publishes the hello message
+ * the bus tasks re-render, too.
+ */
+void publisher_task(void *arg)
+{
+    uint32_t overflows = 0;
+    TickType_t wait = portMAX_DELAY;
+
+    while (1) {
+
+        ulTaskNotifyTake(pdTRUE, wait);
+
+        wait = portMAX_DELAY;
+
+        // The sensor set changed, the samples that follow may come from the new ones
+        if (hello_pending.exchange(false)) {
+            publish_hello();
+        }
+
+#ifdef CONFIG_HCC_ESP32_STORE_ENABLE
+        if (pipeline->process()) {
+            wait = STORE_DRAIN_INTERVAL_MILLIS / portTICK_PERIOD_MS;
+        }
+#else
+        pipeline->process();
+#endif
+
+        uint32_t overflows_now = sample_ring.getOverflowCount();
+
+        if (overflows_now != overflows) {
+            ESP_LOGW(TAG, "[ring] %u samples lost to overflow so far, high watermark %u/%d",
+                overflows_now, sample_ring.getHighWatermark(), (int) sample_ring.capacity());
+            overflows = overflows_now;
+        }
+    }
+}
+#endif
+
+/**
+ * Starts the sampler and the publisher tasks, and returns.
+ */
+void onewire_poll(void)
+{
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+
+#ifdef CONFIG_HCC_ESP32_STORE_ENABLE
+    hcc_pipeline::SpillStorage *spill = NULL;
+
+#ifdef CONFIG_HCC_ESP32_STORE_SPILL_ENABLE
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, CONFIG_HCC_ESP32_STORE_SPILL_PARTITION);
+
+    if (partition == NULL) {
+        ESP_LOGW(TAG, "[store] no '%s' partition, samples will only be stored in RAM", CONFIG_HCC_ESP32_STORE_SPILL_PARTITION);
+    } else {
+        spill = new hcc_pipeline::PartitionStorage(partition);
+        ESP_LOGI(TAG, "[store] spilling to '%s' partition, %d bytes", partition->label, (int) spill->size());
+    }
+#endif
+
+    sample_store = new hcc_pipeline::SampleStore(CONFIG_HCC_ESP32_STORE_RAM_CAPACITY, spill);
+    ESP_LOGI(TAG, "[store] %d bytes of RAM", (int) sample_store->getRamBytes());
+
+    pipeline_start(sample_store);
+#else
+    pipeline_start(NULL);
+#endif
+
+    xTaskCreatePinnedToCore(publisher_task, "publisher", PUBLISHER_STACK_SIZE, NULL, 5, &publisher_task_handle, PUBLISHER_CORE);
+    xTaskCreatePinnedToCore(sampler_task, "sampler", SAMPLER_STACK_SIZE, NULL, 6, &sampler_task_handle, SAMPLER_CORE);
+
+    cycle_origin = xTaskGetTickCount();
+
+    for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+
+        char name[8];
+        snprintf(name, sizeof(name), "bus%d", offset);
+
+        xTaskCreatePinnedToCore(bus_task, name, BUS_STACK_SIZE, (void *) (intptr_t) offset, 6, &buses[offset].task, SAMPLER_CORE);
+    }
+
+#endif
+}
+
+#ifdef CONFIG_HCC_ESP32_METRICS
+/**
+ * Allocates memory and returns the metrics rendered as follows in the example below, but in one line
+ * (multiline for readability), and resets the histograms. Times are in microseconds, bucket N of every
+ * histogram counts the times from 2^N to 2^(N+1)-1; stages with nothing to report are left out.
+ *
+ * {
+ *  "entity_type": "metrics",
+ *  "device_id": "ESP32-246F28A7C53C",
+ *  "uptime": 3600,
+ *  "heap": {"free": 187412, "min_free": 176980},
+ *  "stack": {"publisher": 2412, "sampler": 2876, "bus0": 2640, "metrics": 2980},
+ *  "ring": {"overflows": 0, "high_watermark": 4},
+ *  "power": {"mode": "deep_sleep", "awake_ratio": 0.0123, "wakes": 1440},
+ *  "link": {"reconnects": 2, "disconnected": 47},
+ *  "stages": {
+ *      "conversion_wait": {"count": 30, "min": 741233, "max": 750102, "mean": 748011, "buckets": [0, ...]},
+ *      ...
+ *  }
+ * }
+ */
+char *create_metrics()
+{
+    cJSON *json_root = cJSON_CreateObject();
+    cJSON_AddItemToObject(json_root, "entity_type", cJSON_CreateString("metrics"));
+    cJSON_AddItemToObject(json_root, "device_id", cJSON_CreateString(device_id));
+    cJSON_AddNumberToObject(json_root, "uptime", esp_timer_get_time() / 1000000);
+
+    cJSON *json_heap = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json_heap, "free", esp_get_free_heap_size());
+    cJSON_AddNumberToObject(json_heap, "min_free", esp_get_minimum_free_heap_size());
+    cJSON_AddItemToObject(json_root, "heap", json_heap);
+
+    // Bytes, not words, on this platform
+    cJSON *json_stack = cJSON_CreateObject();
+
+    // The deep sleep mode polls without the tasks
+#if defined(CONFIG_HCC_ESP32_ONE_WIRE_ENABLE) && !defined(CONFIG_HCC_ESP32_POWER_DEEP_SLEEP)
+    cJSON_AddNumberToObject(json_stack, "publisher", uxTaskGetStackHighWaterMark(publisher_task_handle));
+    cJSON_AddNumberToObject(json_stack, "sampler", uxTaskGetStackHighWaterMark(sampler_task_handle));
+
+    for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+
+        char name[8];
+        snprintf(name, sizeof(name), "bus%d", offset);
+
+        cJSON_AddNumberToObject(json_stack, name, uxTaskGetStackHighWaterMark(buses[offset].task));
+    }
+#endif
+
+    cJSON_AddNumberToObject(json_stack, "metrics", uxTaskGetStackHighWaterMark(NULL));
+    cJSON_AddItemToObject(json_root, "stack", json_stack);
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+    cJSON *json_ring = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json_ring, "overflows", sample_ring.getOverflowCount());
+    cJSON_AddNumberToObject(json_ring, "high_watermark", sample_ring.getHighWatermark());
+    cJSON_AddItemToObject(json_root, "ring", json_ring);
+#endif
+
+#if defined(CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP) || defined(CONFIG_HCC_ESP32_POWER_DEEP_SLEEP)
+    cJSON *json_power = cJSON_CreateObject();
+#ifdef CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP
+    cJSON_AddItemToObject(json_power, "mode", cJSON_CreateString("light_sleep"));
+#else
+    cJSON_AddItemToObject(json_power, "mode", cJSON_CreateString("deep_sleep"));
+    cJSON_AddNumberToObject(json_power, "wakes", duty_cycle.getWakes());
+#endif
+    cJSON_AddNumberToObject(json_power, "awake_ratio", power_awake_ratio());
+    cJSON_AddItemToObject(json_root, "power", json_power);
+#endif
+
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    cJSON *json_link = cJSON_CreateObject();
+    cJSON_AddNumberToObject(json_link, "reconnects", link_supervisor->getReconnects());
+    cJSON_AddNumberToObject(json_link, "disconnected", link_supervisor->getDisconnectedMicros(esp_timer_get_time()) / 1000000);
+    cJSON_AddItemToObject(json_root, "link", json_link);
+    xSemaphoreGive(link_lock);
+
+    const struct {
+        const char *name;
+        hcc_metrics::Histogram *histogram;
+    } stages[] = {
+        { "conversion_wait", &metrics.conversionWait },
+        { "scratchpad_read", &metrics.scratchpadRead },
+        { "serialization", &metrics.serialization },
+        { "publish_enqueue", &metrics.publishEnqueue },
+        { "publish_ack", &metrics.publishAck },
+        { "command", &metrics.command },
+    };
+
+    cJSON *json_stages = cJSON_CreateObject();
+
+    for (auto &stage : stages) {
+
+        cJSON *json_stage = stage.histogram->toJson(true);
+
+        if (json_stage != NULL) {
+            cJSON_AddItemToObject(json_stages, stage.name, json_stage);
+        }
+    }
+
+    cJSON_AddItemToObject(json_root, "stages", json_stages);
+
+    char *message = cJSON_PrintUnformatted(json_root);
+
+    cJSON_Delete(json_root);
+
+    return message;
+}
+
+/**
+ * Publishes the metrics every CONFIG_HCC_ESP32_METRICS_SECONDS. While there is no broker connection,
+ * the histograms keep accumulating.
+ */
+void metrics_task(void *arg)
+{
+    const TickType_t period = CONFIG_HCC_ESP32_METRICS_SECONDS * 1000 / portTICK_PERIOD_MS;
+    TickType_t last_wake_time = xTaskGetTickCount();
+
+    while (1) {
+
+        vTaskDelayUntil(&last_wake_time, period);
+
+        if (!link_online) {
+            continue;
+        }
+
+        char *message = create_metrics();
+        ESP_LOGI(TAG, "[mqtt] %s %s", metrics_pub_topic, message);
+
+        // Nothing to gain from the broker acknowledging these
+        esp_mqtt_client_publish(mqtt_client, metrics_pub_topic, message, 0, 0, 0);
+
+        free(message);
+    }
+}
+
+/**
+ * Records how long it took the broker to acknowledge the message, if it was one of the tracked ones.
+ */
+void metrics_acknowledged(int msg_id)
+{
+    int64_t latency = metrics.acks.acknowledged(msg_id, esp_timer_get_time());
+
+    if (latency >= 0) {
+        metrics.publishAck.record(latency);
+    }
+}
+#endif
+
+/**
+ * Starts the metrics task, if metrics are enabled. Must be called after onewire_poll(), it reports on the tasks started there.
+ */
+void metrics_start(void)
+{
+#ifdef CONFIG_HCC_ESP32_METRICS
+    ESP_LOGI(TAG, "[metrics] publishing to %s every %ds", metrics_pub_topic, CONFIG_HCC_ESP32_METRICS_SECONDS);
+
+    xTaskCreate(metrics_task, "metrics", METRICS_STACK_SIZE, NULL, 2, NULL);
+#endif
+}
+
+/**
+ * Commands are received on "{@CONFIG_BROKER_SUB_ROOT}/${device_id}/${command}", set up by commands_start().
+ */
+char *command_root;
+char *command_sub_topic;
+hcc_mqtt::CommandRouter command_router;
+
+#define COMMAND_POOL_SIZE 4
+#define COMMAND_STACK_SIZE 4096
+
+/**
+ * The MQTT task assembles the commands right into the pool, and hands them over to the command task by pointer.
+ * There are as many queue slots as there are commands, so neither queue ever blocks.
+ */
+hcc_mqtt::Command command_pool[COMMAND_POOL_SIZE];
+QueueHandle_t free_commands;
+QueueHandle_t pending_commands;
+
+/**
+ * The command whose payload is still coming in fragments. Only touched by the MQTT task.
+ */
+hcc_mqtt::Command *command_in_progress;
+
+/**
+ * Returns true and sets the value if the whole payload is a number.
+ */
+bool parse_number(const hcc_mqtt::Command *c, float &value)
+{
+    char *end;
+    value = strtof(c->payload, &end);
+
+    return end != c->payload && *end == 0;
+}
+
+void command_hello(hcc_mqtt::Command *c)
+{
+    publish_hello();
+}
+
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+/**
+ * Returns the sensor with the address, or NULL if there's no such sensor. The caller holds sensors_lock.
+ */
+sensor *find_sensor(const char *address)
+{
+    char *end;
+    uint64_t rom_code = strtoull(address, &end, 16);
+
+    if (end - address != 16 || *end != 0) {
+        return NULL;
+    }
+
+    return sensors.find(rom_code);
+}
+
+/**
+ * Sets the sensor's report filter deadband, in degrees; 0 reports every sample.
+ */
+void command_sensor_deadband(hcc_mqtt::Command *c)
+{
+    float deadband;
+
+    if (!parse_number(c, deadband) || deadband < 0) {
+        ESP_LOGE(TAG, "[command] %s: bad deadband '%s'", c->arguments[0], c->payload);
+        return;
+    }
+
+    // The sampler holds the lock while it's filtering
+    xSemaphoreTake(sensors_lock, portMAX_DELAY);
+
+    sensor *s = find_sensor(c->arguments[0]);
+
+    if (s != NULL) {
+        s->filter.configure(deadband, s->filter.getHeartbeatMillis());
+    }
+
+    xSemaphoreGive(sensors_lock);
+
+    if (s == NULL) {
+        ESP_LOGE(TAG, "[command] %s: no such sensor", c->arguments[0]);
+        return;
+    }
+
+    ESP_LOGI(TAG, "[command] %s: deadband %.3fC", c->arguments[0], deadband);
+}
+
+/**
+ * Sets the sensor's report filter heartbeat, in seconds; 0 disables the heartbeat.
+ */
+void command_sensor_heartbeat(hcc_mqtt::Command *c)
+{
+    float seconds;
+
+    if (!parse_number(c, seconds) || seconds < 0) {
+        ESP_LOGE(TAG, "[command] %s: bad heartbeat '%s'", c->arguments[0], c->payload);
+        return;
+    }
+
+    xSemaphoreTake(sensors_lock, portMAX_DELAY);
+
+    sensor *s = find_sensor(c->arguments[0]);
+
+    if (s != NULL) {
+        s->filter.configure(s->filter.getDeadband(), (int64_t) (seconds * 1000));
+    }
+
+    xSemaphoreGive(sensors_lock);
+
+    if (s == NULL) {
+        ESP_LOGE(TAG, "[command] %s: no such sensor", c->arguments[0]);
+        return;
+    }
+
+    ESP_LOGI(TAG, "[command] %s: heartbeat %.1fs", c->arguments[0], seconds);
+}
+#endif
+
+#ifdef CONFIG_HCC_ESP32_A4988_ENABLE
+/**
+ * Returns true and sets the value if the whole payload is an integer.
+ */
+bool parse_int(const hcc_mqtt::Command *c, int &value)
+{
+    char *end;
+    value = strtol(c->payload, &end, 10);
+
+    return end != c->payload && *end == 0;
+}
+
+void command_stepper_position(hcc_mqtt::Command *c)
+{
+    int position;
+
+    if (!parse_int(c, position)) {
+        ESP_LOGE(TAG, "[command] stepper: bad position '%s'", c->payload);
+        return;
+    }
+
+    motion_planner->moveTo(position);
+    xTaskNotifyGive(motion_task_handle);
+
+    ESP_LOGI(TAG, "[command] stepper: target %d", position);
 }
-#endif
 
-void onewire_start(void)
+void command_stepper_move(hcc_mqtt::Command *c)
+{
+    int distance;
+
+    if (!parse_int(c, distance)) {
+        ESP_LOGE(TAG, "[command] stepper: bad distance '%s'", c->payload);
+        return;
+    }
+
+    motion_planner->moveBy(distance);
+    xTaskNotifyGive(motion_task_handle);
+
+    ESP_LOGI(TAG, "[command] stepper: target %d", motion_planner->getTarget());
+}
+
+/**
+ * The stepper commands are only routed if stepper_start() got the stepper going.
+ */
+bool stepper_available(void)
 {
+    return motion_planner != NULL;
+}
+#endif
+
+typedef struct {
+    const char *pattern;
+    void (*handler)(hcc_mqtt::Command *c);
+
+    /**
+     * Whether the command can be handled, {@code NULL} if it always can. Checked once, by commands_start().
+     */
+    bool (*available)(void);
+} command_route;
+
+/**
+ * Command topics, relative to command_root, and their handlers.
+ */
+const command_route commands[] = {
+    { "hello", command_hello, NULL },
 #ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+    { "sensor/+/deadband", command_sensor_deadband, NULL },
+    { "sensor/+/heartbeat", command_sensor_heartbeat, NULL },
+#endif
+#ifdef CONFIG_HCC_ESP32_A4988_ENABLE
+    { "stepper/position", command_stepper_position, stepper_available },
+    { "stepper/move", command_stepper_move, stepper_available },
+#endif
+};
+
+/**
+ * The commands by the route number the router assigned them, see commands_start(). A command that couldn't be
+ * routed is not here, and doesn't shift the others.
+ */
+const command_route *routes[hcc_mqtt::CommandRouter::MAX_ROUTES];
+
+/**
+ * Runs the command handlers, one command at a time, off the MQTT task.
+ */
+void command_task(void *arg)
+{
+    while (1) {
 
-    int count = oneWire.browse();
+        hcc_mqtt::Command *c;
+        xQueueReceive(pending_commands, &c, portMAX_DELAY);
 
-    for (int offset = 0; offset < count; offset++) {
+        int64_t started = esp_timer_get_time();
+        const command_route *route = routes[c->route];
 
-        sensor *s = new sensor();
+        route->handler(c);
 
-        s->address = std::string(oneWire.getAddressAt(offset));
-        s->topic = create_topic_from_address(s->address);
+        int64_t done = esp_timer_get_time();
 
-        sensors.push_back(s);
-    }
+        ESP_LOGI(TAG, "[command] %s: %dus from the last fragment, %dus in the handler",
+            route->pattern, (int) (done - c->received), (int) (done - started));
 
+#ifdef CONFIG_HCC_ESP32_METRICS
+        metrics.command.record(done - c->received);
 #endif
+
+        xQueueSend(free_commands, &c, 0);
+    }
 }
 
-void mqtt_send_sample(int offset, float signal)
+/**
+ * Assembles the command from the MQTT_EVENT_DATA fragments, and hands it over to the command task when it's complete.
+ * Runs on the MQTT task, never blocks.
+ */
+void command_receive(esp_mqtt_event_handle_t event)
 {
+    // Only the first fragment comes with the topic
+    if (event->current_data_offset == 0) {
 
-#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+        if (command_in_progress != NULL) {
+            ESP_LOGW(TAG, "[command] incomplete command dropped");
+            xQueueSend(free_commands, &command_in_progress, 0);
+            command_in_progress = NULL;
+        }
 
-    sensor s = *sensors[offset];
+        hcc_mqtt::Command *c;
 
-    // VT: NOTE: For now, we just have temperature sensors, this may change in the future
+        if (xQueueReceive(free_commands, &c, 0) != pdTRUE) {
+            ESP_LOGE(TAG, "[command] %.*s: too many commands in flight, dropped", event->topic_len, event->topic);
+            return;
+        }
 
-    std::string signature = "T";
-    signature += s.address;
+        if (command_router.match(event->topic, event->topic_len, *c) < 0) {
+            ESP_LOGE(TAG, "[command] %.*s: unknown command", event->topic_len, event->topic);
+            xQueueSend(free_commands, &c, 0);
+            return;
+        }
 
-    cJSON *json_root = cJSON_CreateObject();
-    cJSON_AddItemToObject(json_root, "entity_type", cJSON_CreateString("sensor"));
-    cJSON_AddItemToObject(json_root, "name", cJSON_CreateString(s.address.c_str()));
-    cJSON_AddItemToObject(json_root, "signature", cJSON_CreateString(signature.c_str()));
-    cJSON_AddNumberToObject(json_root, "signal", signal);
-    cJSON_AddItemToObject(json_root, "device_id", cJSON_CreateString(device_id));
+        if (event->total_data_len > (int) hcc_mqtt::Command::PAYLOAD_CAPACITY) {
+            ESP_LOGE(TAG, "[command] %.*s: %d byte payload, %d at most", event->topic_len, event->topic,
+                event->total_data_len, (int) hcc_mqtt::Command::PAYLOAD_CAPACITY);
+            xQueueSend(free_commands, &c, 0);
+            return;
+        }
 
-    char *message = cJSON_PrintUnformatted(json_root);
-    ESP_LOGI(TAG, "[mqtt] %s %s", s.topic.c_str(), message);
+        command_in_progress = c;
+    }
 
-    int msg_id = esp_mqtt_client_publish(mqtt_client, s.topic.c_str(), message, 0, 1, 0);
-    ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+    hcc_mqtt::Command *c = command_in_progress;
 
-    free(message);
+    // The rest of a command that was dropped
+    if (c == NULL) {
+        return;
+    }
 
-    cJSON_Delete(json_root);
+    memcpy(c->payload + event->current_data_offset, event->data, event->data_len);
 
-#else
-    ESP_LOGE(TAG, "1-Wire not enabled, not sending anything");
+    if (event->current_data_offset + event->data_len < event->total_data_len) {
+        return;
+    }
+
+    c->length = event->total_data_len;
+    c->payload[c->length] = 0;
+    c->received = esp_timer_get_time();
+
+    xQueueSend(pending_commands, &c, 0);
+    command_in_progress = NULL;
+}
+
+/**
+ * Sets up the command routes and starts the command task. Must be called after create_identity() and stepper_start(),
+ * and before mqtt_start().
+ */
+void commands_start(void)
+{
+    size_t length = strlen(CONFIG_BROKER_SUB_ROOT) + 1 + strlen(device_id) + 1;
+
+    command_root = (char *)malloc(length + 1);
+    sprintf(command_root, "%s/%s/", CONFIG_BROKER_SUB_ROOT, device_id);
+
+    command_sub_topic = (char *)malloc(length + 1 + 1);
+    sprintf(command_sub_topic, "%s#", command_root);
+
+    command_router.setRoot(command_root);
+
+    for (auto &command : commands) {
+
+        // Unknown commands are logged as such, rather than crashing the handler
+        if (command.available != NULL && !command.available()) {
+            ESP_LOGW(TAG, "[command] %s: not available, not routed", command.pattern);
+            continue;
+        }
+
+        int route = command_router.add(command.pattern);
+
+        if (route < 0) {
+            ESP_LOGE(TAG, "[command] can't route %s", command.pattern);
+            continue;
+        }
+
+        routes[route] = &command;
+    }
+
+    free_commands = xQueueCreate(COMMAND_POOL_SIZE, sizeof(hcc_mqtt::Command *));
+    pending_commands = xQueueCreate(COMMAND_POOL_SIZE, sizeof(hcc_mqtt::Command *));
+
+    for (int offset = 0; offset < COMMAND_POOL_SIZE; offset++) {
+        hcc_mqtt::Command *c = &command_pool[offset];
+        xQueueSend(free_commands, &c, 0);
+    }
+
+    ESP_LOGI(TAG, "[command] listening on %s", command_sub_topic);
+
+    xTaskCreate(command_task, "command", COMMAND_STACK_SIZE, NULL, 7, NULL);
+}
+
+/**
+ * Hands the event over to the connection supervisor, and wakes the link task up to act on it.
+ * Runs on the event loop and the MQTT tasks.
+ */
+void link_report(void (hcc_mqtt::ConnectionSupervisor::*event)(int64_t now))
+{
+    xSemaphoreTake(link_lock, portMAX_DELAY);
+    (link_supervisor->*event)(esp_timer_get_time());
+    link_online = link_supervisor->isOnline();
+    xSemaphoreGive(link_lock);
+
+    xTaskNotifyGive(link_task_handle);
+}
+
+static void link_event_handler(void *handler_args, esp_event_base_t base, int32_t event_id, void *event_data)
+{
+    if (base == IP_EVENT) {
+        link_report(&hcc_mqtt::ConnectionSupervisor::networkUp);
+    } else {
+        link_report(&hcc_mqtt::ConnectionSupervisor::networkDown);
+    }
+}
+
+/**
+ * Does what the supervisor asked for. The outcome comes back as events. Must not run on the MQTT task, the client
+ * can't be stopped from there.
+ */
+void link_act(hcc_mqtt::ConnectionAction action)
+{
+    esp_err_t err = ESP_OK;
+
+    switch (action) {
+    case hcc_mqtt::ConnectionAction::reconnectNetwork:
+#ifdef CONFIG_EXAMPLE_CONNECT_WIFI
+        ESP_LOGI(TAG, "[link] reconnecting Wi-Fi");
+        err = esp_wifi_connect();
 #endif
+        // Ethernet comes back by itself when the cable is plugged back in
+        break;
+    case hcc_mqtt::ConnectionAction::dropBroker:
+        ESP_LOGI(TAG, "[link] network lost, dropping the broker connection");
+        if (mqtt_started) {
+            esp_mqtt_client_stop(mqtt_client);
+        }
+        break;
+    case hcc_mqtt::ConnectionAction::reconnectBroker:
+        ESP_LOGI(TAG, "[link] reconnecting to %s", CONFIG_BROKER_URL);
+        if (mqtt_started) {
+            // With the auto reconnect disabled, the client task exits after the disconnect, and
+            // esp_mqtt_client_reconnect() has nothing to wake up; it takes a fresh start. The stop fails if the
+            // client is already stopped, and that's fine.
+            esp_mqtt_client_stop(mqtt_client);
+            err = esp_mqtt_client_start(mqtt_client);
+        }
+        break;
+    default:
+        break;
+    }
 
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "[link] action %d failed, error %d", (int) action, err);
+    }
 }
 
-void onewire_poll(void)
+/**
+ * Acts on the supervisor decisions when they are due, and logs the connection state changes.
+ */
+void link_task(void *arg)
 {
-#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+    const char *names[] = { "offline", "network up, broker down", "online" };
+    hcc_mqtt::ConnectionState last = hcc_mqtt::ConnectionState::offline;
 
-    TickType_t last_wake_time = xTaskGetTickCount();
+    while (!link_stopping) {
 
-    while (1) {
-        last_wake_time = xTaskGetTickCount();
+        xSemaphoreTake(link_lock, portMAX_DELAY);
 
-        std::vector<float> readings = oneWire.poll();
+        int64_t now = esp_timer_get_time();
+        hcc_mqtt::ConnectionAction action = link_supervisor->poll(now);
+        int64_t due = link_supervisor->getDue();
+        hcc_mqtt::ConnectionState state = link_supervisor->getState();
+        uint32_t reconnects = link_supervisor->getReconnects();
+        int64_t disconnected = link_supervisor->getDisconnectedMicros(now);
 
-        for (int offset = 0; offset < readings.size(); offset++) {
+        xSemaphoreGive(link_lock);
 
-            ESP_LOGI(TAG, "[1-Wire] %s: %.1fC", sensors[offset]->topic.c_str(), readings[offset]);
+        if (state != last) {
+            ESP_LOGI(TAG, "[link] %s, %u reconnects, %ds disconnected so far",
+                names[(int) state], reconnects, (int) (disconnected / 1000000));
+            last = state;
+        }
 
-            mqtt_send_sample(offset, readings[offset]);
+        // The broker client takes its API lock for as long as it's connecting, and reports events holding it;
+        // link_lock must not be held here
+        if (action != hcc_mqtt::ConnectionAction::none) {
+            link_act(action);
+            continue;
         }
 
-        // VT: NOTE: This call will block and make parallel processing impossible
-        vTaskDelayUntil(&last_wake_time, SAMPLE_PERIOD_MILLIS / portTICK_PERIOD_MS);
+        TickType_t wait = due < 0 ? portMAX_DELAY : (due - now + 999) / 1000 / portTICK_PERIOD_MS + 1;
+
+        ulTaskNotifyTake(pdTRUE, wait);
     }
+
+    xSemaphoreGive(link_stopped);
+
+    // Not holding anything; the stragglers can still notify it, they won't wake it up
+    vTaskSuspend(NULL);
+}
+
+/**
+ * Starts supervising the connection. Must be called before the network is brought up.
+ */
+void link_start(void)
+{
+    link_supervisor = new hcc_mqtt::ConnectionSupervisor(
+        CONFIG_HCC_ESP32_LINK_BACKOFF_MIN_MILLIS * 1000LL,
+        CONFIG_HCC_ESP32_LINK_BACKOFF_MAX_SECONDS * 1000000LL,
+        esp_random());
+    link_lock = xSemaphoreCreateMutex();
+    link_stopped = xSemaphoreCreateBinary();
+
+    xTaskCreate(link_task, "link", LINK_STACK_SIZE, NULL, 6, &link_task_handle);
+
+#ifdef CONFIG_EXAMPLE_CONNECT_WIFI
+    // The link task decides when to reconnect
+    example_set_auto_reconnect(false);
+
+    ESP_ERROR_CHECK(esp_event_handler_register(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &link_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &link_event_handler, NULL));
+#else
+    ESP_ERROR_CHECK(esp_event_handler_register(ETH_EVENT, ETHERNET_EVENT_DISCONNECTED, &link_event_handler, NULL));
+    ESP_ERROR_CHECK(esp_event_handler_register(IP_EVENT, IP_EVENT_ETH_GOT_IP, &link_event_handler, NULL));
+#endif
+
+    ESP_LOGI(TAG, "[link] backing off from %dms to %ds between the attempts",
+        CONFIG_HCC_ESP32_LINK_BACKOFF_MIN_MILLIS, CONFIG_HCC_ESP32_LINK_BACKOFF_MAX_SECONDS);
+}
+
+/**
+ * Stops supervising the connection, so that it is not brought back when it is taken down on purpose. Returns when
+ * the link task is done with whatever it was doing.
+ */
+void link_stop(void)
+{
+#ifdef CONFIG_EXAMPLE_CONNECT_WIFI
+    esp_event_handler_unregister(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &link_event_handler);
+    esp_event_handler_unregister(IP_EVENT, IP_EVENT_STA_GOT_IP, &link_event_handler);
+#else
+    esp_event_handler_unregister(ETH_EVENT, ETHERNET_EVENT_DISCONNECTED, &link_event_handler);
+    esp_event_handler_unregister(IP_EVENT, IP_EVENT_ETH_GOT_IP, &link_event_handler);
 #endif
+
+    link_stopping = true;
+    xTaskNotifyGive(link_task_handle);
+
+    xSemaphoreTake(link_stopped, portMAX_DELAY);
 }
 
 static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
@@ -323,37 +2291,47 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
     switch (event->event_id) {
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG, "[mqtt] connected to %s", CONFIG_BROKER_URL);
-        msg_id = esp_mqtt_client_publish(client, edge_pub_topic, mqtt_hello, 0, 1, 0);
-        ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
+        link_report(&hcc_mqtt::ConnectionSupervisor::brokerUp);
 
-        msg_id = esp_mqtt_client_subscribe(client, "/topic/qos0", 0);
-        ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
+        if (!(xEventGroupGetBits(boot_events) & BOOT_BROKER)) {
+            boot_phase(BOOT_BROKER, "broker", mqtt_start_time);
+        }
 
-        msg_id = esp_mqtt_client_subscribe(client, "/topic/qos1", 1);
+        // Every reconnect is a new session, the broker may have been restarted and know nothing about us
+        publish_hello();
+
+        msg_id = esp_mqtt_client_subscribe(client, command_sub_topic, 1);
         ESP_LOGI(TAG, "sent subscribe successful, msg_id=%d", msg_id);
 
-        msg_id = esp_mqtt_client_unsubscribe(client, "/topic/qos1");
-        ESP_LOGI(TAG, "sent unsubscribe successful, msg_id=%d", msg_id);
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+        // Let the publisher drain whatever was stored while the connection was down
+        if (publisher_task_handle != NULL) {
+            xTaskNotifyGive(publisher_task_handle);
+        }
+#endif
         break;
     case MQTT_EVENT_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        link_report(&hcc_mqtt::ConnectionSupervisor::brokerDown);
         break;
 
     case MQTT_EVENT_SUBSCRIBED:
         ESP_LOGI(TAG, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
-        msg_id = esp_mqtt_client_publish(client, "/topic/qos0", "data", 0, 0, 0);
-        ESP_LOGI(TAG, "sent publish successful, msg_id=%d", msg_id);
         break;
     case MQTT_EVENT_UNSUBSCRIBED:
         ESP_LOGI(TAG, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
         break;
     case MQTT_EVENT_PUBLISHED:
         ESP_LOGI(TAG, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+#ifdef CONFIG_HCC_ESP32_METRICS
+        metrics_acknowledged(event->msg_id);
+#endif
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+        mqtt_acknowledged();
+#endif
         break;
     case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG, "MQTT_EVENT_DATA");
-        printf("TOPIC=%.*s\r\n", event->topic_len, event->topic);
-        printf("DATA=%.*s\r\n", event->data_len, event->data);
+        command_receive(event);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
@@ -376,9 +2354,16 @@ void mqtt_start(void)
     esp_mqtt_client_config_t mqtt_cfg = {};
     mqtt_cfg.uri = CONFIG_BROKER_URL;
 
+    // The link task decides when to reconnect
+    mqtt_cfg.disable_auto_reconnect = true;
+
+    mqtt_start_time = esp_timer_get_time();
+
     mqtt_client = esp_mqtt_client_init(&mqtt_cfg);
     esp_mqtt_client_register_event(mqtt_client, (esp_mqtt_event_id_t) ESP_EVENT_ANY_ID, mqtt_event_handler, mqtt_client);
     esp_mqtt_client_start(mqtt_client);
+
+    mqtt_started = true;
 }
 
 void setLED(int state) {
@@ -392,6 +2377,186 @@ void setLED(int state) {
 #endif
 }
 
+/**
+ * Brings the network up, and starts the MQTT client as soon as the rest of the application is ready for it.
+ */
+void network_task(void *arg)
+{
+    int64_t started = esp_timer_get_time();
+
+    setLED(1);
+    /* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
+     * Read "Establishing Wi-Fi or Ethernet Connection" section in
+     * examples/protocols/README.md for more information about this function.
+     */
+    ESP_ERROR_CHECK(example_connect());
+
+    boot_phase(BOOT_NETWORK, "network", started);
+
+    xEventGroupWaitBits(boot_events, BOOT_READY, pdFALSE, pdTRUE, portMAX_DELAY);
+
+    mqtt_start();
+
+    setLED(0);
+
+    vTaskDelete(NULL);
+}
+
+/**
+ * Starts bringing the network up in the background, and returns.
+ */
+void network_start(void)
+{
+    xTaskCreate(network_task, "network", NETWORK_STACK_SIZE, NULL, 5, NULL);
+}
+
+/**
+ * Sets the power management up for the mode configured. In the deep sleep mode, picks up where the last wake left off.
+ */
+void power_start(void)
+{
+#ifdef CONFIG_HCC_ESP32_POWER_LIGHT_SLEEP
+    esp_pm_config_esp32_t config = {};
+
+    config.max_freq_mhz = CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ;
+
+    // The RMT timings are in APB clock ticks, and the APB clock follows the CPU clock below 80MHz
+    config.min_freq_mhz = 80;
+    config.light_sleep_enable = true;
+
+    esp_err_t err = esp_pm_configure(&config);
+
+    if (err == ESP_OK) {
+        err = esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "hcc", &power_lock);
+    }
+
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "[power] can't enable the light sleep, error %d, staying awake", err);
+        power_lock = NULL;
+        return;
+    }
+
+    power_meter_lock = xSemaphoreCreateMutex();
+    power_meter.sleep(esp_timer_get_time());
+
+    ESP_LOGI(TAG, "[power] automatic light sleep enabled");
+#endif
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+    if (duty_cycle.begin(esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_TIMER)) {
+        ESP_LOGI(TAG, "[power] wake %u, %d samples kept, awake %.2f%% of the time so far",
+            duty_cycle.getWakes(), sleep_retainer.getSampleCount(), power_awake_ratio() * 100);
+    } else {
+        rtc_state.cycle = 0;
+        sleep_retainer.reset();
+
+        ESP_LOGI(TAG, "[power] cold boot, deep sleeping between polls from now on");
+    }
+#endif
+}
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+/**
+ * Publishes everything in the store, once the broker connection is up. Then waits for the broker to acknowledge
+ * it all, and for the commands that may be coming.
+ */
+void deep_sleep_publish(uint32_t cycle)
+{
+    int64_t deadline = esp_timer_get_time() + CONFIG_HCC_ESP32_POWER_CONNECT_TIMEOUT_SECONDS * 1000000LL;
+
+    if (!sleep_retainer.publish(pipeline, sample_store, &mqtt_sink, cycle, deadline)) {
+        return;
+    }
+
+    duty_cycle.connected();
+
+#ifdef CONFIG_HCC_ESP32_METRICS
+    char *message = create_metrics();
+    ESP_LOGI(TAG, "[mqtt] %s %s", metrics_pub_topic, message);
+    esp_mqtt_client_publish(mqtt_client, metrics_pub_topic, message, 0, 0, 0);
+    free(message);
+#endif
+
+    vTaskDelay(CONFIG_HCC_ESP32_POWER_LINGER_MILLIS / portTICK_PERIOD_MS);
+
+    while (mqtt_unacked > 0 && link_online && esp_timer_get_time() < deadline) {
+        vTaskDelay(50 / portTICK_PERIOD_MS);
+    }
+}
+
+/**
+ * Takes one poll, publishes if it's time to bring the network up, and deep sleeps until the next poll is due.
+ * Takes the place of the poll tasks in the deep sleep mode, and never returns.
+ */
+void deep_sleep_run(void)
+{
+    sample_store = new hcc_pipeline::SampleStore(CONFIG_HCC_ESP32_STORE_RAM_CAPACITY, NULL);
+    pipeline_start(sample_store);
+
+    sleep_retainer.restore(&sensors, sample_store);
+
+    // Every sensor, and the end of the cycle
+    bool connect = duty_cycle.shouldConnect(sample_store->size(), sensors.size() + 1, CONFIG_HCC_ESP32_POWER_RTC_CAPACITY);
+
+    // The network takes longer to come up than the conversion, get it going first
+    if (connect) {
+        commands_start();
+        xEventGroupSetBits(boot_events, BOOT_READY);
+        network_start();
+    }
+
+    for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+        buses[offset].oneWire->startConversion();
+    }
+
+    hcc_pipeline::SampleRecord record = {};
+    std::vector<hcc_onewire::Reading> readings[ONE_WIRE_BUS_COUNT];
+
+    for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+        readings[offset] = buses[offset].oneWire->collect();
+    }
+
+    record.timestamp = get_time_millis();
+    record.cycle = rtc_state.cycle++;
+
+    for (int offset = 0; offset < ONE_WIRE_BUS_COUNT; offset++) {
+        sample_readings(offset, readings[offset], record, rtc_clock.micros() / 1000);
+    }
+
+    pipeline->endCycle(record);
+
+    while (sample_ring.pop(record)) {
+        sample_store->push(record);
+    }
+
+    if (connect) {
+        deep_sleep_publish(record.cycle);
+    }
+
+    sleep_retainer.retain(&sensors, sample_store);
+
+    if (connect) {
+
+        // Nothing to reconnect for anymore
+        link_stop();
+
+        if (mqtt_started) {
+            esp_mqtt_client_stop(mqtt_client);
+        }
+
+        esp_wifi_stop();
+    }
+
+    int64_t awake = esp_timer_get_time();
+    int64_t sleep = duty_cycle.end(DEEP_SLEEP_MIN_MICROS);
+
+    ESP_LOGI(TAG, "[power] awake for %dms, %d samples kept, sleeping for %dms, awake %.2f%% of the time",
+        (int) (awake / 1000), sleep_retainer.getSampleCount(), (int) (sleep / 1000), power_awake_ratio() * 100);
+
+    esp_deep_sleep(sleep);
+}
+#endif
+
 extern "C" void app_main(void)
 {
     ESP_LOGI(TAG, "[core] Oh, hai");
@@ -411,20 +2576,46 @@ extern "C" void app_main(void)
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
     log_configuration();
+    power_start();
+
+    int64_t boot_started = esp_timer_get_time();
+    boot_events = xEventGroupCreate();
 
+    link_start();
+
+    // The network and the bus search take the longest, and don't need each other, get them both going
+#ifndef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+    network_start();
+#endif
     onewire_start();
+    stepper_start();
+
+    int64_t started = esp_timer_get_time();
     create_identity();
+    boot_phase(BOOT_IDENTITY, "identity", started);
 
-    setLED(1);
-    /* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
-     * Read "Establishing Wi-Fi or Ethernet Connection" section in
-     * examples/protocols/README.md for more information about this function.
-     */
-    ESP_ERROR_CHECK(example_connect());
+    onewire_join();
+    create_sample_payloads();
+    create_hello();
 
-    mqtt_start();
+#ifdef CONFIG_HCC_ESP32_BENCHMARK
+    hcc_benchmark::Hooks hooks = {};
+    hooks.createHello = create_hello;
+#ifdef CONFIG_HCC_ESP32_ONE_WIRE_ENABLE
+    hooks.createTopic = create_topic_from_address;
+#endif
 
-    setLED(0);
+    hcc_benchmark::run(TAG, "D90301A2792B0528", device_id, hooks);
+#endif
+
+#ifdef CONFIG_HCC_ESP32_POWER_DEEP_SLEEP
+    deep_sleep_run();
+#endif
 
+    // Don't make the first sample wait for the network
     onewire_poll();
+    metrics_start();
+    commands_start();
+
+    boot_phase(BOOT_READY, "application", boot_started);
 }
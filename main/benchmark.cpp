@@ -0,0 +1,391 @@
+#include <algorithm>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_log.h"
+#include "xtensa/hal.h"
+
+// The reference renderer needs cJSON, the IDF's; the host build has it if it could find it
+#if defined(ESP_PLATFORM) || defined(HAVE_CJSON)
+#define BENCHMARK_CJSON 1
+#include "cJSON.h"
+#endif
+
+#include "onewire.h"
+#include "simulated_bus.h"
+#include "sample_payload.h"
+#include "cbor_payload.h"
+#include "sample_ring.h"
+#include "sample_pipeline.h"
+#include "sensor_registry.h"
+#include "benchmark.h"
+
+namespace hcc_benchmark {
+
+#define ITERATIONS 1000
+#define REPEATS 5
+
+// The end to end stage runs whole poll cycles against the simulated bus
+#define CYCLE_ITERATIONS 100
+#define CYCLE_SENSORS 8
+#define CYCLE_PERIOD_MICROS (10 * 1000000LL)
+
+/**
+ * Signal value for the given iteration, walks the whole DS18B20 range in 1/16C steps.
+ */
+static float signal_at(int iteration)
+{
+    return -55 + (iteration % 2880) * 0.0625f;
+}
+
+#ifdef BENCHMARK_CJSON
+
+/**
+ * The sample renderer that used to live in mqtt_send_sample(), kept here as a reference.
+ */
+static char *render_cjson(const std::string &address, const char *device_id, float signal)
+{
+    std::string signature = "T";
+    signature += address;
+
+    cJSON *json_root = cJSON_CreateObject();
+    cJSON_AddItemToObject(json_root, "entity_type", cJSON_CreateString("sensor"));
+    cJSON_AddItemToObject(json_root, "name", cJSON_CreateString(address.c_str()));
+    cJSON_AddItemToObject(json_root, "signature", cJSON_CreateString(signature.c_str()));
+    cJSON_AddNumberToObject(json_root, "signal", signal);
+    cJSON_AddItemToObject(json_root, "device_id", cJSON_CreateString(device_id));
+
+    char *message = cJSON_PrintUnformatted(json_root);
+
+    cJSON_Delete(json_root);
+
+    return message;
+}
+
+#endif
+
+/**
+ * Stands in for the broker connection. Copies the messages the way the MQTT client copies them into its outbox,
+ * and counts them. Nothing is allocated after the instance is created.
+ */
+class LoopbackBroker : public hcc_pipeline::MessageSink {
+private:
+
+    char outbox[512];
+
+public:
+
+    uint32_t messages = 0;
+    uint32_t bytes = 0;
+
+    bool isOnline() override
+    {
+        return true;
+    }
+
+    void rendered(int64_t micros) override
+    {
+    }
+
+    void publish(const char *topic, const char *data, size_t length) override
+    {
+        size_t topicLength = std::min(strlen(topic), sizeof(outbox));
+
+        memcpy(outbox, topic, topicLength);
+        memcpy(outbox + topicLength, data, std::min(length, sizeof(outbox) - topicLength));
+
+        messages++;
+        bytes += strlen(topic) + length;
+    }
+};
+
+struct Run {
+    int64_t micros;
+    uint32_t cycles;
+    int heapDelta;
+};
+
+/**
+ * Run {@code body(iteration)} {@code iterations} times, warming up first, {@link #REPEATS} times over,
+ * and print the median run.
+ */
+template <typename Body>
+static void measure(const char *name, int iterations, Body body)
+{
+    for (int offset = 0; offset < iterations / 10 + 1; offset++) {
+        body(offset);
+    }
+
+    Run runs[REPEATS];
+
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+
+        int heapBefore = esp_get_free_heap_size();
+        int64_t start = esp_timer_get_time();
+        uint32_t startCycles = xthal_get_ccount();
+
+        for (int offset = 0; offset < iterations; offset++) {
+            body(offset);
+        }
+
+        // The counter wraps around every 18 seconds at 240MHz, no run takes that long
+        runs[repeat].cycles = xthal_get_ccount() - startCycles;
+        runs[repeat].micros = esp_timer_get_time() - start;
+        runs[repeat].heapDelta = (int) esp_get_free_heap_size() - heapBefore;
+    }
+
+    std::sort(runs, runs + REPEATS, [](const Run &a, const Run &b) {
+        return a.micros < b.micros;
+    });
+
+    Run &median = runs[REPEATS / 2];
+
+    // Not ESP_LOGx, the timestamps would get in the way of comparing the output
+    printf("bench,%s,%d,%.3f,%u,%d\n",
+        name, iterations, (double) median.micros / iterations, median.cycles / iterations, median.heapDelta);
+}
+
+static bool check_sample_payload(const char *TAG, const char *address, const char *device_id)
+{
+    hcc_mqtt::SamplePayload payload;
+
+    if (!payload.setup(address, device_id)) {
+        ESP_LOGE(TAG, "[bench] can't set up sample payload for %s", address);
+        return false;
+    }
+
+#ifdef BENCHMARK_CJSON
+    std::string address_s = address;
+
+    // Make sure the output is identical before measuring anything
+    int mismatches = 0;
+
+    for (int offset = 0; offset < ITERATIONS; offset++) {
+
+        char *expected = render_cjson(address_s, device_id, signal_at(offset));
+        payload.render(signal_at(offset));
+
+        if (strcmp(expected, payload.c_str()) != 0) {
+            if (mismatches++ == 0) {
+                ESP_LOGE(TAG, "[bench] mismatch: expected %s, got %s", expected, payload.c_str());
+            }
+        }
+
+        free(expected);
+    }
+
+    ESP_LOGI(TAG, "[bench] sample payload mismatches: %d", mismatches);
+
+    return mismatches == 0;
+#else
+    return true;
+#endif
+}
+
+static void bench_sample_payload(const char *TAG, const char *address, const char *device_id)
+{
+    hcc_mqtt::SamplePayload payload;
+    hcc_mqtt::CborSamplePayload cbor;
+
+    payload.setup(address, device_id);
+    cbor.setup(strtoull(address, NULL, 16), device_id);
+
+#ifdef BENCHMARK_CJSON
+    std::string address_s = address;
+
+    measure("sample/cjson", ITERATIONS, [&](int offset) {
+        free(render_cjson(address_s, device_id, signal_at(offset)));
+    });
+#endif
+
+    measure("sample/payload", ITERATIONS, [&](int offset) {
+        payload.render(signal_at(offset));
+    });
+
+    measure("sample/payload_late", ITERATIONS, [&](int offset) {
+        payload.render(signal_at(offset), 1596240000123LL + offset);
+    });
+
+    measure("sample/cbor", ITERATIONS, [&](int offset) {
+        cbor.render(signal_at(offset));
+    });
+
+    measure("sample/cbor_late", ITERATIONS, [&](int offset) {
+        cbor.render(signal_at(offset), 1596240000123LL + offset);
+    });
+
+    ESP_LOGI(TAG, "[bench] sample size: JSON %d bytes, CBOR %d bytes; late: JSON %d bytes, CBOR %d bytes",
+        (int) payload.render(24.625f), (int) cbor.render(24.625f),
+        (int) payload.render(24.625f, 1596240000123LL), (int) cbor.render(24.625f, 1596240000123LL));
+}
+
+static void bench_batch(const char *TAG, const char *address, const char *device_id)
+{
+    hcc_mqtt::SamplePayload payload;
+    hcc_mqtt::BatchPayload batch;
+    hcc_mqtt::CborSamplePayload cborPayload;
+    hcc_mqtt::CborBatchPayload cborBatch;
+
+    payload.setup(address, device_id);
+    batch.setup(device_id, CYCLE_SENSORS);
+    cborPayload.setup(strtoull(address, NULL, 16), device_id);
+    cborBatch.setup(device_id, CYCLE_SENSORS);
+
+    measure("batch/8", ITERATIONS, [&](int offset) {
+
+        batch.begin(1596240000123LL + offset);
+
+        for (int sensor = 0; sensor < CYCLE_SENSORS; sensor++) {
+            batch.add(payload, signal_at(offset + sensor));
+        }
+
+        batch.finish();
+    });
+
+    measure("batch/8_cbor", ITERATIONS, [&](int offset) {
+
+        cborBatch.begin(1596240000123LL + offset);
+
+        for (int sensor = 0; sensor < CYCLE_SENSORS; sensor++) {
+            cborBatch.add(cborPayload, signal_at(offset + sensor));
+        }
+
+        cborBatch.finish();
+    });
+
+    ESP_LOGI(TAG, "[bench] batch/8 size: JSON %d bytes, CBOR %d bytes", (int) batch.size(), (int) cborBatch.size());
+}
+
+static void bench_ring()
+{
+    static hcc_pipeline::SpscRing<hcc_pipeline::SampleRecord, 64> ring(hcc_pipeline::OverflowPolicy::dropOldest);
+
+    measure("ring/push_pop", ITERATIONS, [&](int offset) {
+
+        hcc_pipeline::SampleRecord record = {};
+        record.signal = signal_at(offset);
+        record.cycle = offset;
+
+        ring.push(record);
+        ring.pop(record);
+    });
+}
+
+/**
+ * The sampler and publisher tasks' work for one poll cycle, minus the task switches: poll the simulated bus,
+ * and take the readings through the sample pipeline the application runs, to the stand-in broker.
+ */
+static void bench_cycle(const char *TAG, const char *device_id, const Hooks &hooks)
+{
+    hcc_onewire::SimulatedClock clock;
+
+    hcc_onewire::SimulatedBus::Config config = {};
+    config.devices = CYCLE_SENSORS;
+    config.crcFailureRate = 0.01f;
+    config.conversionScale = 1.0f;
+    config.seed = 1;
+
+    hcc_onewire::SimulatedBus bus("bench", &clock, config);
+    hcc_onewire::OneWire oneWire(TAG, &bus, &clock, NULL, 0);
+
+    int count = oneWire.browse();
+
+    // The topics the application would publish to, the hook gives away the prefix
+    std::string prefix = hooks.createTopic != NULL ? hooks.createTopic("") : "bench/sensor/";
+
+    static hcc_pipeline::SensorRegistry<CYCLE_SENSORS> sensors;
+    std::vector<int> sensorOffsets;
+
+    for (int device = 0; device < count; device++) {
+
+        hcc_pipeline::Sensor *s = sensors.add(hcc_onewire::rom_code_to_uint64(oneWire.getRomCodeAt(device)), prefix.c_str());
+
+        if (s == NULL || !s->payload.setup(s->address, device_id)) {
+            ESP_LOGE(TAG, "[bench] can't set up sensor #%d, cycle/8 skipped", device);
+            return;
+        }
+
+        s->filter.configure(0, 300 * 1000LL);
+        sensorOffsets.push_back(sensors.offsetOf(s));
+    }
+
+    hcc_pipeline::PipelineConfig pipelineConfig = {};
+    pipelineConfig.perSensor = true;
+    pipelineConfig.batch = true;
+    pipelineConfig.json = true;
+
+    static hcc_pipeline::SampleRing<64> ring(hcc_pipeline::OverflowPolicy::dropOldest);
+    LoopbackBroker broker;
+    hcc_pipeline::SamplePipeline pipeline(TAG, &sensors, &ring, NULL, &broker, &clock, pipelineConfig);
+
+    if (!pipeline.setup(device_id, "batch", NULL, count)) {
+        return;
+    }
+
+    // It logs every sample it publishes, that's not what is measured
+    esp_log_level_set(TAG, ESP_LOG_WARN);
+
+    measure("cycle/8", CYCLE_ITERATIONS, [&](int cycle) {
+
+        hcc_pipeline::SampleRecord record = {};
+        record.timestamp = clock.micros() / 1000;
+        record.cycle = cycle;
+
+        pipeline.sample(sensorOffsets, oneWire.poll(), record, record.timestamp);
+        pipeline.endCycle(record);
+        pipeline.process();
+
+        clock.advance(CYCLE_PERIOD_MICROS);
+    });
+
+    esp_log_level_set(TAG, ESP_LOG_VERBOSE);
+
+    ESP_LOGI(TAG, "[bench] cycle/8: %u messages, %u bytes to the stand-in broker", broker.messages, broker.bytes);
+}
+
+bool run(const char *TAG, const char *address, const char *device_id, const Hooks &hooks)
+{
+    ESP_LOGI(TAG, "[bench] starting");
+
+    if (!check_sample_payload(TAG, address, device_id)) {
+        return false;
+    }
+
+    printf("bench,stage,iterations,us_per_op,cycles_per_op,heap_delta\n");
+
+    if (hooks.createTopic != NULL) {
+
+        std::string address_s = address;
+
+        measure("topic", ITERATIONS, [&](int offset) {
+            hooks.createTopic(address_s);
+        });
+    }
+
+    bench_sample_payload(TAG, address, device_id);
+    bench_batch(TAG, address, device_id);
+
+    if (hooks.createHello != NULL) {
+
+        // It logs every hello it renders, that's not what is measured. app_main() runs with the tag at verbose.
+        esp_log_level_set(TAG, ESP_LOG_WARN);
+
+        measure("hello", ITERATIONS / 10, [&](int offset) {
+            hooks.createHello();
+        });
+
+        esp_log_level_set(TAG, ESP_LOG_VERBOSE);
+    }
+
+    bench_ring();
+    bench_cycle(TAG, device_id, hooks);
+
+    ESP_LOGI(TAG, "[bench] done");
+
+    return true;
+}
+}
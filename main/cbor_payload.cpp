@@ -0,0 +1,231 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cbor_payload.h"
+
+namespace hcc_mqtt {
+
+// RFC 8949 major types, already shifted into place
+#define CBOR_UNSIGNED   0x00
+#define CBOR_NEGATIVE   0x20
+#define CBOR_BYTES      0x40
+#define CBOR_TEXT       0x60
+#define CBOR_ARRAY      0x80
+#define CBOR_MAP        0xA0
+
+// Indefinite length array start, and the break that ends it
+#define CBOR_ARRAY_INDEFINITE   0x9F
+#define CBOR_BREAK              0xFF
+
+/**
+ * Write the item head with the shortest encoding of the argument, and return its length, at most 9 bytes.
+ */
+static size_t encode_head(uint8_t *buffer, uint8_t major, uint64_t value)
+{
+    if (value < 24) {
+        buffer[0] = major | value;
+        return 1;
+    }
+
+    int bytes = value <= 0xFF ? 1 : (value <= 0xFFFF ? 2 : (value <= 0xFFFFFFFF ? 4 : 8));
+
+    // 24, 25, 26, 27 for 1, 2, 4, 8 byte arguments
+    buffer[0] = major | (24 + __builtin_ctz(bytes));
+
+    for (int offset = 0; offset < bytes; offset++) {
+        buffer[bytes - offset] = (value >> (offset * 8)) & 0xFF;
+    }
+
+    return bytes + 1;
+}
+
+static size_t encode_int(uint8_t *buffer, int64_t value)
+{
+    // -1 - n for the negative ones
+    return value >= 0 ? encode_head(buffer, CBOR_UNSIGNED, value) : encode_head(buffer, CBOR_NEGATIVE, -1 - value);
+}
+
+/**
+ * Write the key and the signal in 1/16 C, and return the length.
+ */
+static size_t encode_signal(uint8_t *buffer, float signal)
+{
+    long scaled = lroundf(signal * CBOR_SIGNAL_SCALE);
+
+    // Way out of the DS18B20 range, only there to keep the argument at 16 bits
+    scaled = scaled < -32768 ? -32768 : (scaled > 32767 ? 32767 : scaled);
+
+    buffer[0] = CBOR_KEY_SIGNAL;
+
+    return 1 + encode_int(buffer + 1, scaled);
+}
+
+/**
+ * Write the key and the device ID as text, and return the length, or 0 if it doesn't fit.
+ */
+static size_t encode_device_id(uint8_t *buffer, size_t capacity, const char *device_id)
+{
+    size_t length = strlen(device_id);
+
+    if (length + 10 > capacity) {
+        return 0;
+    }
+
+    buffer[0] = CBOR_KEY_DEVICE_ID;
+
+    size_t offset = 1 + encode_head(buffer + 1, CBOR_TEXT, length);
+    memcpy(buffer + offset, device_id, length);
+
+    return offset + length;
+}
+
+bool CborSamplePayload::setup(uint64_t romCode, const char *device_id)
+{
+    // The map size is set by render(), it depends on whether there's a timestamp
+    size_t offset = 1;
+    size_t rendered = encode_device_id(buffer + offset, CAPACITY - offset, device_id);
+
+    // ROM code, signal and timestamp must fit, too
+    if (rendered == 0 || offset + rendered + 10 + 4 + 10 > CAPACITY) {
+        return false;
+    }
+
+    offset += rendered;
+
+    buffer[offset++] = CBOR_KEY_ROM_CODE;
+    buffer[offset++] = CBOR_BYTES | 8;
+
+    for (int byte = 0; byte < 8; byte++) {
+        buffer[offset++] = (romCode >> (byte * 8)) & 0xFF;
+    }
+
+    signalOffset = offset;
+
+    return true;
+}
+
+size_t CborSamplePayload::render(float signal)
+{
+    buffer[0] = CBOR_MAP | 3;
+    length = signalOffset + encode_signal(buffer + signalOffset, signal);
+
+    return length;
+}
+
+size_t CborSamplePayload::render(float signal, int64_t timestamp)
+{
+    buffer[0] = CBOR_MAP | 4;
+    length = signalOffset + encode_signal(buffer + signalOffset, signal);
+
+    buffer[length++] = CBOR_KEY_TIMESTAMP;
+    length += encode_int(buffer + length, timestamp);
+
+    return length;
+}
+
+CborBatchPayload::~CborBatchPayload()
+{
+    free(buffer);
+}
+
+bool CborBatchPayload::setup(const char *device_id, int sensorCount)
+{
+    header[0] = CBOR_MAP | 3;
+
+    size_t rendered = encode_device_id(header + 1, sizeof(header) - 1, device_id);
+
+    if (rendered == 0) {
+        return false;
+    }
+
+    headerLength = 1 + rendered;
+
+    free(buffer);
+    buffer = NULL;
+    capacity = 0;
+    length = 0;
+    entries = 0;
+
+    if (!reserve(sensorCount)) {
+        return false;
+    }
+
+    begin(0);
+
+    return true;
+}
+
+bool CborBatchPayload::reserve(int sensorCount)
+{
+    // Header, timestamp, samples key, array start and break
+    size_t required = headerLength + 10 + 2 + 1 + sensorCount * SAMPLE_CAPACITY;
+
+    if (required <= capacity) {
+        return true;
+    }
+
+    // Keeps whatever was rendered so far
+    uint8_t *grown = (uint8_t *) realloc(buffer, required);
+
+    if (grown == NULL) {
+        return false;
+    }
+
+    buffer = grown;
+    capacity = required;
+
+    return true;
+}
+
+bool CborBatchPayload::begin(int64_t timestamp)
+{
+    length = 0;
+    entries = 0;
+
+    // Not set up, or the buffer couldn't be allocated
+    if (buffer == NULL || headerLength == 0) {
+        return false;
+    }
+
+    memcpy(buffer, header, headerLength);
+    length = headerLength;
+
+    buffer[length++] = CBOR_KEY_TIMESTAMP;
+    length += encode_int(buffer + length, timestamp);
+
+    // The number of samples is not known yet
+    buffer[length++] = CBOR_KEY_SAMPLES;
+    buffer[length++] = CBOR_ARRAY_INDEFINITE;
+
+    return true;
+}
+
+bool CborBatchPayload::add(const CborSamplePayload &sample, float signal)
+{
+    // Not begun: there was no buffer for it. Leave room for the break
+    if (length == 0 || length + SAMPLE_CAPACITY + 1 > capacity) {
+        return false;
+    }
+
+    buffer[length++] = CBOR_MAP | 2;
+    memcpy(buffer + length, sample.romCode(), 10);
+    length += 10;
+    length += encode_signal(buffer + length, signal);
+
+    entries++;
+
+    return true;
+}
+
+size_t CborBatchPayload::finish()
+{
+    if (length == 0) {
+        return 0;
+    }
+
+    buffer[length++] = CBOR_BREAK;
+
+    return length;
+}
+}
@@ -0,0 +1,119 @@
+#include <string.h>
+
+#include "command_router.h"
+
+namespace hcc_mqtt {
+
+void CommandRouter::setRoot(const char *root)
+{
+    this->root = root;
+    rootLength = strlen(root);
+}
+
+int CommandRouter::add(const char *pattern)
+{
+    if (routeCount == MAX_ROUTES) {
+        return -1;
+    }
+
+    Route &r = routes[routeCount];
+    r.segmentCount = 0;
+
+    const char *start = pattern;
+
+    while (true) {
+
+        const char *end = strchr(start, '/');
+        size_t length = end != NULL ? (size_t) (end - start) : strlen(start);
+
+        if (length == 0 || r.segmentCount == MAX_SEGMENTS) {
+            return -1;
+        }
+
+        Segment &s = r.segments[r.segmentCount++];
+
+        if (length == 1 && *start == '+') {
+            s.text = NULL;
+        } else {
+            s.text = start;
+        }
+
+        s.length = length;
+
+        if (end == NULL) {
+            break;
+        }
+
+        start = end + 1;
+    }
+
+    return routeCount++;
+}
+
+int CommandRouter::match(const char *topic, size_t length, Command &command) const
+{
+    if (length < rootLength || memcmp(topic, root, rootLength) != 0) {
+        return -1;
+    }
+
+    // Split the rest of the topic into segments once, every route is compared against them
+    const char *segments[MAX_SEGMENTS];
+    size_t lengths[MAX_SEGMENTS];
+    int segmentCount = 0;
+
+    const char *start = topic + rootLength;
+    const char *end = topic + length;
+
+    while (start <= end) {
+
+        const char *slash = (const char *) memchr(start, '/', end - start);
+        const char *stop = slash != NULL ? slash : end;
+
+        if (segmentCount == MAX_SEGMENTS) {
+            return -1;
+        }
+
+        segments[segmentCount] = start;
+        lengths[segmentCount++] = stop - start;
+
+        start = stop + 1;
+    }
+
+    for (int offset = 0; offset < routeCount; offset++) {
+
+        const Route &r = routes[offset];
+
+        if (r.segmentCount != segmentCount) {
+            continue;
+        }
+
+        int arguments = 0;
+        bool matched = true;
+
+        for (int segment = 0; segment < segmentCount && matched; segment++) {
+
+            const Segment &s = r.segments[segment];
+
+            if (s.text != NULL) {
+                matched = s.length == lengths[segment] && memcmp(s.text, segments[segment], s.length) == 0;
+                continue;
+            }
+
+            if (lengths[segment] == 0 || arguments == Command::MAX_ARGUMENTS || lengths[segment] >= Command::ARGUMENT_CAPACITY) {
+                matched = false;
+                continue;
+            }
+
+            memcpy(command.arguments[arguments], segments[segment], lengths[segment]);
+            command.arguments[arguments++][lengths[segment]] = 0;
+        }
+
+        if (matched) {
+            command.route = offset;
+            return offset;
+        }
+    }
+
+    return -1;
+}
+}
@@ -0,0 +1,165 @@
+#include "connection_supervisor.h"
+
+namespace hcc_mqtt {
+
+Backoff::Backoff(int64_t minMicros, int64_t maxMicros, uint32_t seed) :
+    minMicros(minMicros), maxMicros(maxMicros)
+{
+    // xorshift doesn't survive a zero seed
+    random = seed != 0 ? seed : 1;
+}
+
+uint32_t Backoff::nextRandom()
+{
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+
+    return random;
+}
+
+int64_t Backoff::next()
+{
+    int64_t delay = minMicros;
+
+    for (uint32_t attempt = 0; attempt < attempts && delay < maxMicros; attempt++) {
+        delay *= 2;
+    }
+
+    if (delay > maxMicros) {
+        delay = maxMicros;
+    }
+
+    attempts++;
+
+    int64_t half = delay / 2;
+
+    return delay - half + (half > 0 ? nextRandom() % (half + 1) : 0);
+}
+
+void Backoff::reset()
+{
+    attempts = 0;
+}
+
+void ConnectionSupervisor::leaveOnline(int64_t now)
+{
+    if (state == ConnectionState::online) {
+        downSince = now;
+    }
+}
+
+void ConnectionSupervisor::networkUp(int64_t now)
+{
+    if (state != ConnectionState::offline) {
+        return;
+    }
+
+    state = ConnectionState::network;
+
+    networkBackoff.reset();
+    networkDue = -1;
+
+    // The broker has no idea the network is back, there's nothing to wait for
+    if (brokerLost) {
+        brokerDue = now;
+    }
+}
+
+void ConnectionSupervisor::networkDown(int64_t now)
+{
+    leaveOnline(now);
+
+    state = ConnectionState::offline;
+    networkDue = now + networkBackoff.next();
+    brokerDue = -1;
+
+    if (brokerConnected) {
+        dropPending = true;
+    }
+}
+
+void ConnectionSupervisor::brokerUp(int64_t now)
+{
+    brokerConnected = true;
+    brokerLost = false;
+    brokerBackoff.reset();
+    brokerDue = -1;
+
+    if (state == ConnectionState::offline) {
+        // Just made it before the network went down, it's not going to last
+        dropPending = true;
+        return;
+    }
+
+    if (state == ConnectionState::online) {
+        return;
+    }
+
+    state = ConnectionState::online;
+
+    if (wasOnline) {
+        reconnects++;
+        downMicros += now - downSince;
+    }
+
+    wasOnline = true;
+    downSince = -1;
+}
+
+void ConnectionSupervisor::brokerDown(int64_t now)
+{
+    leaveOnline(now);
+
+    brokerConnected = false;
+    brokerLost = true;
+
+    if (state == ConnectionState::offline) {
+        // To be retried when the network is back
+        return;
+    }
+
+    state = ConnectionState::network;
+    brokerDue = now + brokerBackoff.next();
+}
+
+ConnectionAction ConnectionSupervisor::poll(int64_t now)
+{
+    if (dropPending) {
+        dropPending = false;
+        brokerConnected = false;
+        brokerLost = true;
+
+        return ConnectionAction::dropBroker;
+    }
+
+    if (networkDue >= 0 && now >= networkDue) {
+        networkDue = -1;
+
+        return ConnectionAction::reconnectNetwork;
+    }
+
+    if (brokerDue >= 0 && now >= brokerDue) {
+        brokerDue = -1;
+
+        return ConnectionAction::reconnectBroker;
+    }
+
+    return ConnectionAction::none;
+}
+
+int64_t ConnectionSupervisor::getDue()
+{
+    if (networkDue < 0 || (brokerDue >= 0 && brokerDue < networkDue)) {
+        return brokerDue;
+    }
+
+    return networkDue;
+}
+
+int64_t ConnectionSupervisor::getDisconnectedMicros(int64_t now)
+{
+    return downMicros + (downSince >= 0 ? now - downSince : 0);
+}
+
+}
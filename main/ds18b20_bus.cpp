@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+
+#include "ds18b20_bus.h"
+
+namespace hcc_onewire {
+
+int64_t SystemClock::micros()
+{
+    return esp_timer_get_time();
+}
+
+void SystemClock::sleepUntil(int64_t deadline)
+{
+    int64_t remaining = deadline - esp_timer_get_time();
+
+    if (remaining > 0) {
+        // Round up, or we'll wake up a tick too early
+        vTaskDelay((remaining + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000));
+    }
+}
+
+Ds18b20Bus::Ds18b20Bus(gpio_num_t gpio, rmt_channel_t rmtTx, rmt_channel_t rmtRx) : gpio(gpio), rmtTx(rmtTx), rmtRx(rmtRx)
+{
+    snprintf(name, sizeof(name), "GPIO%d", gpio);
+}
+
+const char *Ds18b20Bus::getName()
+{
+    return name;
+}
+
+bool Ds18b20Bus::initialize()
+{
+    // To debug OWB, use 'make menuconfig' to set default Log level to DEBUG, then uncomment:
+    //esp_log_level_set("owb", ESP_LOG_DEBUG);
+
+    // Create a 1-Wire bus, using the RMT timeslot driver
+    owb = owb_rmt_initialize(&rmt_driver_info, gpio, rmtTx, rmtRx);
+
+    if (owb == NULL) {
+        return false;
+    }
+
+    // enable CRC check for ROM code
+    owb_use_crc(owb, true);
+
+    return true;
+}
+
+bool Ds18b20Bus::search(bool first, RomCode &romCode, bool &found)
+{
+    owb_status status;
+
+    if (first) {
+        searchState = {};
+        status = owb_search_first(owb, &searchState, &found);
+    } else {
+        status = owb_search_next(owb, &searchState, &found);
+    }
+
+    if (status != OWB_STATUS_OK) {
+        found = false;
+        return false;
+    }
+
+    if (found) {
+        memcpy(romCode.bytes, searchState.rom_code.bytes, sizeof(romCode.bytes));
+    }
+
+    return true;
+}
+
+bool Ds18b20Bus::verify(const RomCode &romCode, bool &present)
+{
+    OneWireBus_ROMCode code;
+    memcpy(code.bytes, romCode.bytes, sizeof(code.bytes));
+
+    return owb_verify_rom(owb, code, &present) == OWB_STATUS_OK;
+}
+
+int Ds18b20Bus::attach(const RomCode &romCode, bool solo)
+{
+    devices.push_back(ds18b20_malloc());
+    romCodes.push_back(romCode);
+
+    int offset = devices.size() - 1;
+
+    setSolo(offset, solo);
+
+    return offset;
+}
+
+void Ds18b20Bus::setSolo(int offset, bool solo)
+{
+    DS18B20_Info *ds18b20_info = devices[offset];
+
+    if (solo) {
+        ds18b20_init_solo(ds18b20_info, owb);
+    } else {
+        // associate with bus and device
+        OneWireBus_ROMCode code;
+        memcpy(code.bytes, romCodes[offset].bytes, sizeof(code.bytes));
+
+        ds18b20_init(ds18b20_info, owb, code);
+    }
+
+    // enable CRC check for temperature readings
+    ds18b20_use_crc(ds18b20_info, true);
+}
+
+bool Ds18b20Bus::isSolo(int offset)
+{
+    return devices[offset]->solo;
+}
+
+bool Ds18b20Bus::setResolution(int offset, Resolution resolution)
+{
+    return ds18b20_set_resolution(devices[offset], (DS18B20_RESOLUTION) resolution);
+}
+
+void Ds18b20Bus::convertAll()
+{
+    ds18b20_convert_all(owb);
+}
+
+BusError Ds18b20Bus::read(int offset, float &value)
+{
+    switch (ds18b20_read_temp(devices[offset], &value)) {
+
+    case DS18B20_OK:
+        return BusError::ok;
+
+    case DS18B20_ERROR_CRC:
+        return BusError::crc;
+
+    case DS18B20_ERROR_DEVICE:
+        return BusError::device;
+
+    default:
+        return BusError::bus;
+    }
+}
+}
@@ -0,0 +1,93 @@
+#include <string.h>
+
+#include "duty_cycle.h"
+
+namespace hcc_power {
+
+void AwakeMeter::wake(int64_t now)
+{
+    if (awake) {
+        return;
+    }
+
+    asleepMicros += now - since;
+    since = now;
+    awake = true;
+}
+
+void AwakeMeter::sleep(int64_t now)
+{
+    if (!awake) {
+        return;
+    }
+
+    awakeMicros += now - since;
+    since = now;
+    awake = false;
+}
+
+float AwakeMeter::getRatio(int64_t now)
+{
+    int64_t awakeNow = awakeMicros + (awake ? now - since : 0);
+    int64_t total = awakeMicros + asleepMicros + now - since;
+
+    return total > 0 ? (float) awakeNow / total : 1;
+}
+
+bool DutyCycle::begin(bool warm)
+{
+    if (warm && state->magic == MAGIC) {
+
+        state->wakes++;
+        state->sinceConnect++;
+
+        return true;
+    }
+
+    memset(state, 0, sizeof(DutyState));
+
+    state->magic = MAGIC;
+    state->wakeAt = clock->micros();
+
+    // Announce the node right away
+    state->sinceConnect = connectWakes;
+
+    return false;
+}
+
+bool DutyCycle::shouldConnect(int buffered, int perWake, int capacity)
+{
+    return state->sinceConnect >= connectWakes || buffered + perWake > capacity;
+}
+
+void DutyCycle::connected()
+{
+    state->sinceConnect = 0;
+}
+
+int64_t DutyCycle::end(int64_t minSleepMicros)
+{
+    int64_t now = clock->micros();
+    int64_t due = state->wakeAt + periodMicros;
+
+    if (due < now + minSleepMicros) {
+        // Missed it, skip to the first one that can still be made
+        int64_t missed = (now + minSleepMicros - due + periodMicros - 1) / periodMicros;
+        due += missed * periodMicros;
+    }
+
+    state->awakeMicros += now - state->wakeAt;
+    state->asleepMicros += due - now;
+    state->wakeAt = due;
+
+    return due - now;
+}
+
+float DutyCycle::getAwakeRatio()
+{
+    int64_t total = state->awakeMicros + state->asleepMicros;
+
+    return total > 0 ? (float) state->awakeMicros / total : 1;
+}
+
+}
@@ -0,0 +1,34 @@
+#include "gpio_led.h"
+
+namespace hcc_onewire {
+
+void GpioLed::flash(long millis)
+{
+    if (timer == NULL) {
+
+        esp_timer_create_args_t timerArgs = {};
+        timerArgs.callback = &GpioLed::off;
+        timerArgs.arg = this;
+        timerArgs.name = "1-Wire LED";
+
+        ESP_ERROR_CHECK(esp_timer_create(&timerArgs, &timer));
+    }
+
+    gpio_pad_select_gpio(gpio);
+    gpio_set_direction(gpio, GPIO_MODE_OUTPUT);
+
+    gpio_set_level(gpio, 1);
+
+    // Restart the flash if the previous one is still in progress
+    esp_timer_stop(timer);
+    esp_timer_start_once(timer, millis * 1000);
+}
+
+void GpioLed::off(void *arg)
+{
+    GpioLed *instance = (GpioLed *) arg;
+
+    gpio_set_level(instance->gpio, 0);
+}
+
+}
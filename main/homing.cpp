@@ -0,0 +1,88 @@
+#include "homing.h"
+
+namespace stepper {
+
+bool Homing::run(Direction d, uint32_t steps, uint32_t periodMicros, bool armed, bool &moved)
+{
+    ConstantTiming timing(periodMicros);
+
+    if (armed) {
+        limit->arm(pulses);
+    }
+
+    moved = driver->move(d, steps, &timing);
+
+    if (moved) {
+        driver->wait(-1);
+    }
+
+    if (!armed) {
+        return false;
+    }
+
+    limit->disarm();
+
+    return limit->isTriggered();
+}
+
+HomingResult Homing::home(const HomingConfig &config)
+{
+    Direction towards = config.direction;
+    Direction away = towards == Direction::up ? Direction::down : Direction::up;
+    bool moved;
+
+    // Get off the switch if it's already pressed, the approach needs it to close
+    if (limit->isPressed()) {
+
+        run(away, config.backoff, config.fastMicros, false, moved);
+
+        if (!moved) {
+            return HomingResult::failed;
+        }
+
+        if (limit->isPressed()) {
+            return HomingResult::stuck;
+        }
+    }
+
+    bool found = run(towards, config.travel, config.fastMicros, true, moved);
+
+    if (!moved) {
+        return HomingResult::failed;
+    }
+
+    if (!found) {
+        return HomingResult::notFound;
+    }
+
+    int fast = driver->getPosition();
+
+    run(away, config.backoff, config.fastMicros, false, moved);
+
+    if (!moved) {
+        return HomingResult::failed;
+    }
+
+    if (limit->isPressed()) {
+        return HomingResult::stuck;
+    }
+
+    // Twice the backoff, in case the fast approach overshot that much
+    found = run(towards, 2 * config.backoff, config.slowMicros, true, moved);
+
+    if (!moved) {
+        return HomingResult::failed;
+    }
+
+    if (!found) {
+        return HomingResult::notFound;
+    }
+
+    approachError = (fast - driver->getPosition()) * (int) towards;
+
+    driver->setPosition(0);
+
+    return HomingResult::ok;
+}
+
+}
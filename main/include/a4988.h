@@ -0,0 +1,152 @@
+#ifndef _HCC_ESP32_A4988_H_
+#define _HCC_ESP32_A4988_H_
+
+#include <stdint.h>
+
+#include "stepper_api.h"
+#include "stepper_hal.h"
+
+namespace stepper {
+
+/**
+ * A4988 control pins, besides STEP which belongs to the {@link PulseGenerator}. -1 for the ones not connected.
+ */
+struct A4988Pins {
+    int dir;
+    int ms1;
+    int ms2;
+    int ms3;
+    int slp;
+};
+
+/**
+ * A4988 stepper driver. The STEP pulses come from the {@link PulseGenerator}, the CPU is not involved while moving.
+ *
+ * The position is counted in the finest microsteps the configuration allows, so that it keeps its meaning
+ * when the microstepping changes. Not thread safe.
+ */
+class A4988 : public Stepper {
+public:
+
+    static const int MAX_MICROSTEP = 16;
+
+    /**
+     * Time the charge pump needs after the driver wakes up, before it takes the first STEP.
+     */
+    static const uint32_t WAKE_MICROS = 1000;
+
+    /**
+     * DIR setup time before the first STEP. The A4988 needs 200ns.
+     */
+    static const uint32_t DIR_SETUP_MICROS = 2;
+
+private:
+
+    A4988Pins pins;
+    OutputPins *outputs;
+    PulseGenerator *pulses;
+
+    int position = 0;
+    int microstep = 1;
+
+    bool sleeping = false;
+
+    /**
+     * {@code true} until the first move after waking up, which has to wait for {@link #WAKE_MICROS}.
+     */
+    bool waking = true;
+
+    /**
+     * The move in progress. The position is updated when it completes.
+     */
+    bool moving = false;
+    Direction moveDirection = Direction::up;
+
+    /**
+     * Timing of the single steps.
+     */
+    ConstantTiming stepTiming;
+
+    /**
+     * Fold the move into the position if it completed, and return whether it's still in progress.
+     */
+    bool update();
+
+public:
+
+    /**
+     * Create an instance. {@code stepMicros} is the period of the single steps taken by {@link #step()}.
+     */
+    A4988(const A4988Pins &pins, OutputPins *outputs, PulseGenerator *pulses, uint32_t stepMicros);
+
+    /**
+     * Set up the pins and the pulse generator, leaving the driver awake in full step mode.
+     * Returns {@code false} if it failed.
+     */
+    bool initialize();
+
+    /**
+     * Take one step, and wait for it to complete. Returns the current position.
+     */
+    int step(Direction d) override;
+
+    /**
+     * Start moving up to {@code steps} steps at the given timing, and return right away. The timing can end
+     * the move earlier. Returns {@code false} if there's nothing to do, or a move is already in progress.
+     */
+    bool move(Direction d, uint32_t steps, StepTiming *timing);
+
+    /**
+     * Wait for the move in progress to complete, forever if {@code timeoutMicros} is negative.
+     * Returns {@code false} if it is still in progress.
+     */
+    bool wait(int64_t timeoutMicros);
+
+    /**
+     * Abort the move in progress, the position reflects the steps actually taken.
+     */
+    void stop();
+
+    bool isMoving();
+
+    /**
+     * Return the position as of the last move that completed or was stopped.
+     */
+    inline int getPosition()
+    {
+        return position;
+    }
+
+    /**
+     * Position units per step at the current microstepping.
+     */
+    inline int getStepSize()
+    {
+        return (pins.ms1 < 0 ? 1 : MAX_MICROSTEP) / microstep;
+    }
+
+    /**
+     * Declare the current position to be {@code position}, e.g. after homing.
+     */
+    inline void setPosition(int position)
+    {
+        this->position = position;
+    }
+
+    int getMaxMicrostep() override;
+    int getMicrostep() override;
+
+    /**
+     * Returns -2 as well if a move is in progress, the MSx pins must not change while the driver steps.
+     */
+    int setMicrostep(int divider) override;
+
+    /**
+     * Stops the move in progress when going to sleep.
+     */
+    bool powerSave(bool enable) override;
+};
+
+}
+
+#endif /* _HCC_ESP32_A4988_H_ */
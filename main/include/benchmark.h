@@ -0,0 +1,51 @@
+#ifndef _HCC_ESP32_BENCHMARK_H_
+#define _HCC_ESP32_BENCHMARK_H_
+
+#include <string>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+namespace hcc_benchmark {
+
+/**
+ * Application functions to measure. They are passed in by the caller so that they are measured exactly as they are.
+ * Either can be {@code NULL}, the stage is skipped then.
+ */
+struct Hooks {
+
+    /**
+     * {@code create_topic_from_address()}
+     */
+    std::string (*createTopic)(std::string address);
+
+    /**
+     * {@code create_hello()}. It is expected to free what it allocated the previous time.
+     */
+    void (*createHello)();
+};
+
+/**
+ * Run the sample pipeline benchmarks and print the results on the console.
+ *
+ * {@code address} is the sensor address to render samples for, any 16 character hex string will do
+ * if there are no sensors.
+ *
+ * Every stage is run once to warm up, then several times over; the median is reported. The results are printed
+ * one stage per line, in a format meant to be extracted from the console log and compared between builds:
+ *
+ * bench,<stage>,<iterations>,<microseconds per op>,<CPU cycles per op>,<heap delta bytes>
+ *
+ * Returns {@code false}, having measured nothing, if the sample payload doesn't render byte for byte what cJSON
+ * renders, or couldn't be set up at all.
+ */
+bool run(const char *TAG, const char *address, const char *device_id, const Hooks &hooks);
+
+}
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* _HCC_ESP32_BENCHMARK_H_ */
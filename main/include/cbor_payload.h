@@ -0,0 +1,190 @@
+#ifndef _HCC_ESP32_CBOR_PAYLOAD_H_
+#define _HCC_ESP32_CBOR_PAYLOAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+namespace hcc_mqtt {
+
+/**
+ * CBOR map keys. Integers rather than strings, the field names are what made the JSON messages long.
+ */
+enum CborKey {
+    CBOR_KEY_DEVICE_ID = 1,
+    CBOR_KEY_ROM_CODE = 2,
+    CBOR_KEY_SIGNAL = 3,
+    CBOR_KEY_TIMESTAMP = 4,
+    CBOR_KEY_SAMPLES = 5
+};
+
+/**
+ * The signal goes out as an integer number of these, the DS18B20 native resolution.
+ */
+const int CBOR_SIGNAL_SCALE = 16;
+
+/**
+ * Binary (RFC 8949 CBOR) counterpart of {@link SamplePayload}, a map of
+ *
+ * 1: device ID (text), 2: ROM code (8 bytes, family code first, the way it comes off the bus),
+ * 3: signal (integer, 1/16 C), and for the late samples, 4: timestamp (integer, milliseconds).
+ *
+ * About a quarter of the JSON message size. Constant parts are pre-rendered, nothing is allocated.
+ */
+class CborSamplePayload {
+public:
+
+    /**
+     * Map header, 18 character device ID, ROM code, signal and timestamp with their keys.
+     */
+    static const size_t CAPACITY = 64;
+
+private:
+
+    uint8_t buffer[CAPACITY];
+
+    /**
+     * Where the signal goes.
+     */
+    size_t signalOffset = 0;
+
+    /**
+     * Length of the last rendered message.
+     */
+    size_t length = 0;
+
+public:
+
+    /**
+     * Pre-render the constant parts of the message.
+     *
+     * Returns {@code false} if the device ID is too long to fit.
+     */
+    bool setup(uint64_t romCode, const char *device_id);
+
+    /**
+     * Render the message with the given signal value, and return its length.
+     *
+     * Must not be called before {@link #setup()}.
+     */
+    size_t render(float signal);
+
+    /**
+     * Render the message with the given signal value and the time it was taken at (milliseconds),
+     * and return its length. Used for samples published late.
+     *
+     * Must not be called before {@link #setup()}.
+     */
+    size_t render(float signal, int64_t timestamp);
+
+    inline const uint8_t *data() const
+    {
+        return buffer;
+    }
+
+    inline size_t size() const
+    {
+        return length;
+    }
+
+    /**
+     * Return the ROM code, with its key, for {@link CborBatchPayload} to reuse.
+     */
+    inline const uint8_t *romCode() const
+    {
+        return buffer + signalOffset - 10;
+    }
+};
+
+/**
+ * Binary counterpart of {@link BatchPayload}, a map of
+ *
+ * 1: device ID, 4: timestamp, 5: samples, an array of maps of 2: ROM code and 3: signal.
+ *
+ * The buffer is allocated once by {@link #setup()}, nothing is allocated after that.
+ */
+class CborBatchPayload {
+private:
+
+    /**
+     * A sample map: header, ROM code and signal with their keys.
+     */
+    static const size_t SAMPLE_CAPACITY = 16;
+
+    uint8_t *buffer = NULL;
+    size_t capacity = 0;
+
+    /**
+     * Map header and device ID, up to the timestamp.
+     */
+    uint8_t header[32];
+    size_t headerLength = 0;
+
+    size_t length = 0;
+    int entries = 0;
+
+public:
+
+    ~CborBatchPayload();
+
+    /**
+     * Render the header and allocate the buffer big enough for {@code sensorCount} samples.
+     *
+     * Returns {@code false} if the device ID is too long, or the memory can't be allocated.
+     */
+    bool setup(const char *device_id, int sensorCount);
+
+    /**
+     * Grow the buffer, if necessary, to fit {@code sensorCount} samples. The message rendered so far is kept.
+     *
+     * Returns {@code false} if the memory can't be allocated.
+     */
+    bool reserve(int sensorCount);
+
+    /**
+     * Start rendering a new message for the poll cycle started at {@code timestamp} (milliseconds).
+     *
+     * Returns {@code false} if {@link #setup()} failed, or couldn't allocate the buffer. Nothing can be added
+     * to the message then; if it was the allocation, a {@link #reserve()} that succeeds fixes the next one.
+     */
+    bool begin(int64_t timestamp);
+
+    /**
+     * Add the sample to the message.
+     *
+     * Returns {@code false} if the message wasn't begun, or the sample doesn't fit; that shouldn't happen unless there
+     * are more samples than the buffer was set up for.
+     */
+    bool add(const CborSamplePayload &sample, float signal);
+
+    /**
+     * Close the message, and return its length, 0 if it wasn't begun.
+     */
+    size_t finish();
+
+    inline const uint8_t *data() const
+    {
+        return buffer;
+    }
+
+    inline size_t size() const
+    {
+        return length;
+    }
+
+    inline int getSampleCount() const
+    {
+        return entries;
+    }
+};
+
+}
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* _HCC_ESP32_CBOR_PAYLOAD_H_ */
@@ -0,0 +1,107 @@
+#ifndef _HCC_ESP32_COMMAND_ROUTER_H_
+#define _HCC_ESP32_COMMAND_ROUTER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hcc_mqtt {
+
+/**
+ * A command received on the subscribe topic, on its way from the MQTT task to the command handler.
+ */
+struct Command {
+
+    /**
+     * Longest payload accepted. Commands are short, anything longer is dropped.
+     */
+    static const size_t PAYLOAD_CAPACITY = 256;
+
+    static const int MAX_ARGUMENTS = 2;
+
+    /**
+     * Longest topic segment matched by a wildcard, including the terminating zero. Fits a 1-Wire address.
+     */
+    static const size_t ARGUMENT_CAPACITY = 24;
+
+    /**
+     * Route the topic matched, see {@link CommandRouter#add()}.
+     */
+    int route;
+
+    /**
+     * Topic segments matched by the route wildcards, in order, zero terminated.
+     */
+    char arguments[MAX_ARGUMENTS][ARGUMENT_CAPACITY];
+
+    /**
+     * The payload, zero terminated.
+     */
+    char payload[PAYLOAD_CAPACITY + 1];
+    size_t length;
+
+    /**
+     * {@code esp_timer_get_time()} when the last fragment of the payload was received.
+     */
+    int64_t received;
+};
+
+/**
+ * Maps the command topics to routes.
+ *
+ * Routes are topic patterns relative to the root, with {@code +} matching one whole topic segment, the same way
+ * MQTT subscriptions do: {@code sensor/+/deadband}. The patterns are split into segments when they are added,
+ * so matching a topic is a single pass over it, without copying or allocating anything.
+ */
+class CommandRouter {
+public:
+
+    static const int MAX_ROUTES = 16;
+    static const int MAX_SEGMENTS = 4;
+
+private:
+
+    struct Segment {
+
+        /**
+         * {@code NULL} for the wildcard.
+         */
+        const char *text;
+        size_t length;
+    };
+
+    struct Route {
+        Segment segments[MAX_SEGMENTS];
+        int segmentCount;
+    };
+
+    const char *root = NULL;
+    size_t rootLength = 0;
+
+    Route routes[MAX_ROUTES];
+    int routeCount = 0;
+
+public:
+
+    /**
+     * Set the topic all the routes are relative to, it must end with a slash. The string must stay around.
+     */
+    void setRoot(const char *root);
+
+    /**
+     * Add the route, and return its number, or -1 if the pattern is malformed or there are too many routes.
+     * Routes are numbered in the order they were added, starting from zero; a route that failed doesn't take
+     * a number. Keep the number, it's what {@link #match()} sets. The pattern must stay around.
+     */
+    int add(const char *pattern);
+
+    /**
+     * Match the topic, which doesn't need to be zero terminated, against the routes. Returns the number of
+     * the first route matched, and sets the command route and arguments, or returns -1 if nothing matched.
+     * A wildcard doesn't match a segment that doesn't fit the arguments.
+     */
+    int match(const char *topic, size_t length, Command &command) const;
+};
+
+}
+
+#endif /* _HCC_ESP32_COMMAND_ROUTER_H_ */
@@ -0,0 +1,197 @@
+#ifndef _HCC_ESP32_CONNECTION_SUPERVISOR_H_
+#define _HCC_ESP32_CONNECTION_SUPERVISOR_H_
+
+#include <stdint.h>
+
+namespace hcc_mqtt {
+
+/**
+ * Exponential backoff with jitter. Every attempt doubles the delay, up to the maximum; the delay actually used is
+ * picked at random from its upper half, so that the nodes that lost the connection at the same time don't all
+ * come back at the same time. Deterministic for the given seed. Times are in microseconds.
+ */
+class Backoff {
+private:
+
+    const int64_t minMicros;
+    const int64_t maxMicros;
+
+    uint32_t random;
+    uint32_t attempts = 0;
+
+    uint32_t nextRandom();
+
+public:
+
+    Backoff(int64_t minMicros, int64_t maxMicros, uint32_t seed);
+
+    /**
+     * Return the delay before the next attempt, and count the attempt.
+     */
+    int64_t next();
+
+    /**
+     * Start over from the minimum delay, after a success.
+     */
+    void reset();
+
+    inline uint32_t getAttempts()
+    {
+        return attempts;
+    }
+};
+
+enum class ConnectionState : uint8_t {
+
+    /**
+     * No network.
+     */
+    offline,
+
+    /**
+     * The network is up, the broker connection is not.
+     */
+    network,
+
+    /**
+     * Both are up, the messages have a way out.
+     */
+    online,
+};
+
+/**
+ * What the {@link ConnectionSupervisor} wants done.
+ */
+enum class ConnectionAction : uint8_t {
+
+    none,
+
+    /**
+     * Try to bring the network up again.
+     */
+    reconnectNetwork,
+
+    /**
+     * Close the broker connection. It is going nowhere without the network, even if the client
+     * hasn't noticed yet.
+     */
+    dropBroker,
+
+    /**
+     * Try to connect to the broker again.
+     */
+    reconnectBroker,
+};
+
+/**
+ * Tells whether the messages have a way out, and when to try to bring the network and the broker connection back.
+ *
+ * The network and the broker client report their ups and downs, and the supervisor comes up with the actions.
+ * A failed attempt is reported as another down, and the next attempt backs off further; an up resets the backoff.
+ * The broker is only retried while the network is up. A network loss drops the broker connection right away,
+ * rather than waiting for the keepalive to time it out, so that every network outage is followed by a fresh
+ * broker session, and the application can greet the broker again.
+ *
+ * The broker connection is only retried if it has been up or attempted before; the application makes the first
+ * connection itself. The time spent disconnected is counted from the first time the supervisor was online.
+ *
+ * Not thread safe. Times are in microseconds, from any clock that only goes forward.
+ */
+class ConnectionSupervisor {
+private:
+
+    ConnectionState state = ConnectionState::offline;
+
+    Backoff networkBackoff;
+    Backoff brokerBackoff;
+
+    /**
+     * When to do the next network and broker attempt, -1 if there's none scheduled.
+     */
+    int64_t networkDue = -1;
+    int64_t brokerDue = -1;
+
+    /**
+     * What the broker client reported last.
+     */
+    bool brokerConnected = false;
+
+    /**
+     * The broker connection went down, and hasn't been brought back yet.
+     */
+    bool brokerLost = false;
+
+    bool dropPending = false;
+
+    bool wasOnline = false;
+    int64_t downSince = -1;
+    int64_t downMicros = 0;
+    uint32_t reconnects = 0;
+
+    void leaveOnline(int64_t now);
+
+public:
+
+    ConnectionSupervisor(int64_t backoffMinMicros, int64_t backoffMaxMicros, uint32_t seed) :
+        networkBackoff(backoffMinMicros, backoffMaxMicros, seed),
+        brokerBackoff(backoffMinMicros, backoffMaxMicros, seed ^ 0x5bd1e995)
+    {
+    }
+
+    /**
+     * The network is up, with an address.
+     */
+    void networkUp(int64_t now);
+
+    /**
+     * The network went down, or an attempt to bring it up failed.
+     */
+    void networkDown(int64_t now);
+
+    /**
+     * The broker connection is up.
+     */
+    void brokerUp(int64_t now);
+
+    /**
+     * The broker connection went down, or an attempt to make it failed.
+     */
+    void brokerDown(int64_t now);
+
+    /**
+     * Return what to do now, one action at a time; call again until it's {@link ConnectionAction#none}.
+     */
+    ConnectionAction poll(int64_t now);
+
+    /**
+     * Return when the next action is due, -1 if there's nothing to do until something is reported.
+     */
+    int64_t getDue();
+
+    inline ConnectionState getState()
+    {
+        return state;
+    }
+
+    inline bool isOnline()
+    {
+        return state == ConnectionState::online;
+    }
+
+    /**
+     * Return how many times the supervisor came back online after it was first online.
+     */
+    inline uint32_t getReconnects()
+    {
+        return reconnects;
+    }
+
+    /**
+     * Return the time spent not online since the first time it was, including the outage going on now, if any.
+     */
+    int64_t getDisconnectedMicros(int64_t now);
+};
+
+}
+
+#endif /* _HCC_ESP32_CONNECTION_SUPERVISOR_H_ */
@@ -0,0 +1,77 @@
+#ifndef _HCC_ESP32_DS18B20_BUS_H_
+#define _HCC_ESP32_DS18B20_BUS_H_
+
+#include <vector>
+#include "owb.h"
+#include "owb_rmt.h"
+#include "ds18b20.h"
+
+#include "onewire_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+namespace hcc_onewire {
+
+/**
+ * {@link Clock} backed by {@code esp_timer_get_time()} and {@code vTaskDelay()}.
+ */
+class SystemClock : public Clock {
+public:
+
+    int64_t micros() override;
+    void sleepUntil(int64_t deadline) override;
+};
+
+/**
+ * {@link Bus} driven by the RMT peripheral, with the devices handled by the ds18b20 component.
+ */
+class Ds18b20Bus : public Bus {
+private:
+
+    gpio_num_t gpio;
+    rmt_channel_t rmtTx;
+    rmt_channel_t rmtRx;
+
+    char name[12];
+
+    owb_rmt_driver_info rmt_driver_info;
+    OneWireBus *owb = NULL;
+
+    OneWireBus_SearchState searchState;
+
+    /**
+     * Device pointers.
+     *
+     * VT: NOTE: If we ever write the destructor, these need to be freed.
+     */
+    std::vector<DS18B20_Info *> devices;
+    std::vector<RomCode> romCodes;
+
+public:
+
+    /**
+     * Create an instance. Every instance needs its own GPIO and RMT channels.
+     */
+    Ds18b20Bus(gpio_num_t gpio, rmt_channel_t rmtTx, rmt_channel_t rmtRx);
+
+    const char *getName() override;
+    bool initialize() override;
+    bool search(bool first, RomCode &romCode, bool &found) override;
+    bool verify(const RomCode &romCode, bool &present) override;
+    int attach(const RomCode &romCode, bool solo) override;
+    void setSolo(int offset, bool solo) override;
+    bool isSolo(int offset) override;
+    bool setResolution(int offset, Resolution resolution) override;
+    void convertAll() override;
+    BusError read(int offset, float &value) override;
+};
+
+}
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* _HCC_ESP32_DS18B20_BUS_H_ */
@@ -0,0 +1,134 @@
+#ifndef _HCC_ESP32_DUTY_CYCLE_H_
+#define _HCC_ESP32_DUTY_CYCLE_H_
+
+#include <stdint.h>
+
+#include "onewire_hal.h"
+
+namespace hcc_power {
+
+/**
+ * Adds up the time spent awake and asleep, to tell the awake ratio. Times are in microseconds.
+ * Not thread safe.
+ */
+class AwakeMeter {
+private:
+
+    int64_t awakeMicros = 0;
+    int64_t asleepMicros = 0;
+    int64_t since;
+    bool awake = true;
+
+public:
+
+    /**
+     * Start metering, awake.
+     */
+    AwakeMeter(int64_t now) : since(now) {}
+
+    void wake(int64_t now);
+    void sleep(int64_t now);
+
+    /**
+     * Return the share of the time spent awake so far, 1 if no time has passed yet.
+     */
+    float getRatio(int64_t now);
+};
+
+/**
+ * What the {@link DutyCycle} remembers across deep sleep. Plain data, to be kept in RTC memory.
+ */
+struct DutyState {
+
+    uint32_t magic;
+
+    /**
+     * Wakes from deep sleep since the cold boot.
+     */
+    uint32_t wakes;
+
+    /**
+     * Wakes since the network was last brought up.
+     */
+    uint32_t sinceConnect;
+
+    /**
+     * When this wake was due.
+     */
+    int64_t wakeAt;
+
+    int64_t awakeMicros;
+    int64_t asleepMicros;
+};
+
+/**
+ * Schedules the wakes of a node that deep sleeps between the polls.
+ *
+ * The node wakes up once a period, takes one poll, and goes back to sleep. The wakes stay on the period grid
+ * however long every one of them took; a wake that overran the period skips the cycles it missed instead of
+ * bunching them up. The network is the expensive part, so it is only brought up every few wakes, and on the cold
+ * boot, or sooner if the samples buffered in the meantime wouldn't survive another wake.
+ *
+ * The clock must keep counting across deep sleep, like the RTC timer does. Times are in microseconds.
+ */
+class DutyCycle {
+public:
+
+    static const uint32_t MAGIC = 0x44555459;
+
+private:
+
+    hcc_onewire::Clock *clock;
+    DutyState *state;
+
+    const int64_t periodMicros;
+    const uint32_t connectWakes;
+
+public:
+
+    /**
+     * Create an instance. The network is brought up every {@code connectWakes} wakes.
+     */
+    DutyCycle(hcc_onewire::Clock *clock, DutyState *state, int64_t periodMicros, uint32_t connectWakes) :
+        clock(clock), state(state), periodMicros(periodMicros), connectWakes(connectWakes)
+    {
+    }
+
+    /**
+     * Call first thing after the boot. The state is only picked up if the boot is a {@code warm} one,
+     * a wake from deep sleep, and it's intact; otherwise it starts over. Returns whether it was picked up.
+     */
+    bool begin(bool warm);
+
+    /**
+     * Return whether to bring the network up this wake, with {@code buffered} samples waiting for it,
+     * and {@code capacity} samples fitting in the buffer. A wake adds up to {@code perWake} samples.
+     */
+    bool shouldConnect(int buffered, int perWake, int capacity);
+
+    /**
+     * Call when the network was up this wake.
+     */
+    void connected();
+
+    /**
+     * Close this wake, and return how long to sleep until the next one is due, at least {@code minSleepMicros}.
+     * The state is ready for the next {@link #begin()}.
+     */
+    int64_t end(int64_t minSleepMicros);
+
+    /**
+     * Return the share of the time spent awake since the cold boot, counting the wakes closed so far,
+     * 1 if there were none yet.
+     */
+    float getAwakeRatio();
+
+    inline uint32_t getWakes()
+    {
+        return state->wakes;
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_DUTY_CYCLE_H_ */
@@ -0,0 +1,35 @@
+#ifndef _HCC_ESP32_GPIO_LED_H_
+#define _HCC_ESP32_GPIO_LED_H_
+
+#include "driver/gpio.h"
+#include "esp_timer.h"
+
+#include "onewire_hal.h"
+
+namespace hcc_onewire {
+
+/**
+ * {@link Led} on a GPIO pin, turned off by an {@code esp_timer} when the flash is over.
+ */
+class GpioLed : public Led {
+private:
+
+    gpio_num_t gpio;
+
+    /**
+     * Turns the LED off when the flash is over. Created by the first {@link #flash()}.
+     */
+    esp_timer_handle_t timer = NULL;
+
+    static void off(void *arg);
+
+public:
+
+    GpioLed(gpio_num_t gpio) : gpio(gpio) {}
+
+    void flash(long millis) override;
+};
+
+}
+
+#endif /* _HCC_ESP32_GPIO_LED_H_ */
@@ -0,0 +1,102 @@
+#ifndef _HCC_ESP32_HOMING_H_
+#define _HCC_ESP32_HOMING_H_
+
+#include <stdint.h>
+
+#include "a4988.h"
+#include "stepper_hal.h"
+
+namespace stepper {
+
+/**
+ * Homing parameters. Distances are in steps at the current microstepping.
+ */
+struct HomingConfig {
+
+    /**
+     * Direction to the limit switch.
+     */
+    Direction direction;
+
+    /**
+     * Step periods of the approach and the re-approach, in microseconds.
+     */
+    uint32_t fastMicros;
+    uint32_t slowMicros;
+
+    /**
+     * How far to back off the switch before the re-approach.
+     */
+    uint32_t backoff;
+
+    /**
+     * How far to look for the switch before giving up.
+     */
+    uint32_t travel;
+};
+
+enum class HomingResult {
+    ok,
+
+    /**
+     * The switch didn't close within the travel.
+     */
+    notFound,
+
+    /**
+     * The switch didn't open when backing off.
+     */
+    stuck,
+
+    /**
+     * The driver refused to move.
+     */
+    failed
+};
+
+/**
+ * Finds the limit switch, and makes where it closes position zero.
+ *
+ * The switch halts the pulses itself, from the interrupt, so the driver's position at the switch is exact
+ * to the step. The switch is approached fast, then backed off, then approached again slowly to take the position,
+ * so that it doesn't depend on how fast the mechanism was going when the switch closed.
+ */
+class Homing {
+private:
+
+    A4988 *driver;
+    PulseGenerator *pulses;
+    LimitSwitch *limit;
+
+    /**
+     * Where the fast approach found the switch, relative to the slow one.
+     */
+    int approachError = 0;
+
+    /**
+     * Move up to {@code steps} steps, and return whether the switch stopped the move.
+     */
+    bool run(Direction d, uint32_t steps, uint32_t periodMicros, bool armed, bool &moved);
+
+public:
+
+    Homing(A4988 *driver, PulseGenerator *pulses, LimitSwitch *limit) : driver(driver), pulses(pulses), limit(limit) {}
+
+    /**
+     * Home the driver. Blocks until done. The driver must be awake, and idle.
+     */
+    HomingResult home(const HomingConfig &config);
+
+    /**
+     * Return how far past the final position the fast approach stopped, in position units.
+     * Tells how much the position would be off without the re-approach.
+     */
+    inline int getApproachError()
+    {
+        return approachError;
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_HOMING_H_ */
@@ -0,0 +1,87 @@
+#ifndef _HCC_ESP32_METRICS_H_
+#define _HCC_ESP32_METRICS_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cJSON.h"
+
+namespace hcc_metrics {
+
+/**
+ * Lock-free duration histogram with power of two buckets: bucket N counts the durations from 2^N to 2^(N+1)-1
+ * microseconds, bucket 0 also counts everything shorter than that, the last bucket everything longer.
+ *
+ * Can be recorded into from any task. Taking a snapshot while recording is in progress may miss
+ * or split the samples being recorded, which is fine for what it is used for.
+ */
+class Histogram {
+public:
+
+    /**
+     * Enough for 2^24 microseconds, almost 17 seconds.
+     */
+    static const int BUCKETS = 24;
+
+private:
+
+    std::atomic<uint32_t> buckets[BUCKETS];
+    std::atomic<uint32_t> count;
+
+    /**
+     * Microseconds, wraps around after 71 minutes' worth of samples. Reset often enough for that not to matter.
+     */
+    std::atomic<uint32_t> sum;
+    std::atomic<uint32_t> min;
+    std::atomic<uint32_t> max;
+
+public:
+
+    Histogram();
+
+    void record(int64_t micros);
+
+    /**
+     * Render the count, minimum, maximum, mean (microseconds) and the buckets up to the last non-empty one, and
+     * start over if {@code reset}. Returns {@code NULL} if there were no samples.
+     */
+    cJSON *toJson(bool reset);
+
+    void reset();
+};
+
+/**
+ * Matches published messages with their acknowledgements, and measures the time in between.
+ *
+ * Remembers the last {@link #SLOTS} messages by their ID, the older ones are forgotten. Lock-free,
+ * {@link #sent()} and {@link #acknowledged()} can be called from different tasks.
+ */
+class AckTracker {
+public:
+
+    static const int SLOTS = 32;
+
+private:
+
+    std::atomic<int> ids[SLOTS];
+    std::atomic<uint32_t> times[SLOTS];
+
+public:
+
+    AckTracker();
+
+    /**
+     * Remember that the message with the ID was sent at {@code micros}.
+     */
+    void sent(int id, int64_t micros);
+
+    /**
+     * Return the time passed since the message with the ID was sent, or -1 if it's not known.
+     */
+    int64_t acknowledged(int id, int64_t micros);
+};
+
+}
+
+#endif /* _HCC_ESP32_METRICS_H_ */
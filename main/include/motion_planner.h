@@ -0,0 +1,128 @@
+#ifndef _HCC_ESP32_MOTION_PLANNER_H_
+#define _HCC_ESP32_MOTION_PLANNER_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "a4988.h"
+#include "stepper_hal.h"
+
+namespace stepper {
+
+/**
+ * Shape of the speed change.
+ */
+enum class Profile {
+
+    /**
+     * Constant acceleration.
+     */
+    trapezoidal,
+
+    /**
+     * Acceleration ramping up and down smoothly, peaking at the configured one. Takes longer, jerks less.
+     */
+    sCurve
+};
+
+/**
+ * Moves the driver to the target position, accelerating and decelerating along a precomputed ramp.
+ *
+ * The planner is the {@link StepTiming} of its moves: the interval of every step is picked from the ramp
+ * as the pulses are rendered, looking at the target as it is at that moment. A target that changes mid-move
+ * is followed without stopping if it is ahead; if it is behind, or too close to stop at, the move slows down
+ * to a stop past it, and {@link #update()} starts the move back.
+ *
+ * The speeds are in steps at the current microstepping, the positions are the driver's.
+ */
+class MotionPlanner : public StepTiming {
+public:
+
+    /**
+     * Longest ramp, in steps. If the acceleration doesn't get to the maximum speed within it,
+     * the speed at the end of the ramp is the maximum.
+     */
+    static const int RAMP_CAPACITY = 1024;
+
+private:
+
+    A4988 *driver;
+
+    /**
+     * Intervals between the steps when accelerating from rest, in microseconds. The last one is the cruise interval.
+     */
+    uint32_t *ramp = NULL;
+    int rampLength = 0;
+
+    std::atomic<int> target;
+
+    /**
+     * The move in progress. Set by {@link #update()}, then owned by {@link #periodAt()} until the move is over.
+     */
+    Direction direction = Direction::up;
+    int origin = 0;
+    int stepSize = 1;
+
+    /**
+     * Ramp offset of the last interval, -1 at rest.
+     */
+    int level = -1;
+
+public:
+
+    MotionPlanner(A4988 *driver);
+    ~MotionPlanner();
+
+    /**
+     * Compute the ramp for the maximum speed, steps per second, and the acceleration, steps per second squared.
+     * Returns {@code false} if the parameters make no sense, or the memory ran out.
+     */
+    bool setup(float maxSpeed, float acceleration, Profile profile);
+
+    /**
+     * Set the target position. Safe to call from any task, see {@link #update()}.
+     */
+    void moveTo(int position);
+
+    /**
+     * Move the target by {@code distance} position units.
+     */
+    void moveBy(int distance);
+
+    inline int getTarget()
+    {
+        return target;
+    }
+
+    /**
+     * Start moving to the target if the driver is idle and not there yet. Returns whether the driver is moving.
+     * Must only be called by the task that owns the driver.
+     */
+    bool update();
+
+    /**
+     * Return whether the driver is at the target, as close as the step size allows, that is whether
+     * {@link #update()} has nothing to do. Must only be called by the task that owns the driver, when it's idle.
+     */
+    bool isAtTarget();
+
+    uint32_t periodAt(uint32_t step) override;
+
+    inline int getRampLength()
+    {
+        return rampLength;
+    }
+
+    /**
+     * Return the interval between the steps at the top speed, in microseconds.
+     */
+    inline uint32_t getCruiseMicros()
+    {
+        return ramp[rampLength - 1];
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_MOTION_PLANNER_H_ */
@@ -0,0 +1,28 @@
+#ifndef _HCC_ESP32_NVS_RECORD_STORAGE_H_
+#define _HCC_ESP32_NVS_RECORD_STORAGE_H_
+
+#include "position_store.h"
+
+namespace stepper {
+
+/**
+ * {@link RecordStorage} backed by NVS. The record is stored as a single {@code u64} entry rather than a blob,
+ * a blob takes three entries of the page for every write.
+ */
+class NvsRecordStorage : public RecordStorage {
+private:
+
+    const char *nvsNamespace;
+    const char *key;
+
+public:
+
+    NvsRecordStorage(const char *nvsNamespace, const char *key) : nvsNamespace(nvsNamespace), key(key) {}
+
+    bool load(PositionRecord &record) override;
+    bool save(const PositionRecord &record) override;
+};
+
+}
+
+#endif /* _HCC_ESP32_NVS_RECORD_STORAGE_H_ */
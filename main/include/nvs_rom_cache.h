@@ -0,0 +1,26 @@
+#ifndef _HCC_ESP32_NVS_ROM_CACHE_H_
+#define _HCC_ESP32_NVS_ROM_CACHE_H_
+
+#include "onewire_hal.h"
+
+namespace hcc_onewire {
+
+/**
+ * {@link RomCache} backed by NVS. Every bus gets a blob of its own, keyed by the bus name.
+ */
+class NvsRomCache : public RomCache {
+private:
+
+    const char *nvsNamespace;
+
+public:
+
+    NvsRomCache(const char *nvsNamespace) : nvsNamespace(nvsNamespace) {}
+
+    bool load(const char *busName, std::vector<CachedDevice> &devices) override;
+    bool store(const char *busName, const std::vector<CachedDevice> &devices) override;
+};
+
+}
+
+#endif /* _HCC_ESP32_NVS_ROM_CACHE_H_ */
@@ -3,9 +3,8 @@
 
 #include <string>
 #include <vector>
-#include "owb.h"
-#include "owb_rmt.h"
-#include "ds18b20.h"
+
+#include "onewire_hal.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -13,6 +12,149 @@ extern "C" {
 
 namespace hcc_onewire {
 
+/**
+ * How the device resolution is chosen.
+ */
+enum class ResolutionPolicy {
+
+    /**
+     * Always use the same resolution.
+     */
+    fixed,
+
+    /**
+     * Drop to the low resolution while the readings are stable, and go back up as soon as they change.
+     */
+    adaptive
+};
+
+/**
+ * Per device resolution settings and state.
+ */
+struct ResolutionState {
+
+    ResolutionPolicy policy;
+
+    /**
+     * The resolution for the fixed policy, or for changing readings with the adaptive policy.
+     */
+    Resolution high;
+
+    /**
+     * The resolution for stable readings with the adaptive policy.
+     */
+    Resolution low;
+
+    /**
+     * The resolution the device is set to right now.
+     */
+    Resolution current;
+
+    /**
+     * Last good reading, and how many cycles in a row it didn't change by more than the low resolution step.
+     */
+    float lastValue;
+    bool hasValue;
+    int stableCycles;
+};
+
+/**
+ * What became of the device in the last poll.
+ */
+enum class ReadingStatus {
+
+    /**
+     * The value is good.
+     */
+    ok,
+
+    /**
+     * The device was read, and failed, retries included. The value is garbage.
+     */
+    failed,
+
+    /**
+     * The device is gone from the bus, and wasn't read.
+     */
+    retired,
+
+    /**
+     * The device has been failing for too long, and wasn't read.
+     */
+    quarantined
+};
+
+struct Reading {
+
+    /**
+     * The temperature, {@code NAN} unless the status is {@code ok}.
+     */
+    float value;
+
+    ReadingStatus status;
+
+    /**
+     * The last error the device reported, {@code BusError::ok} unless the status is {@code failed}.
+     */
+    BusError error;
+
+    /**
+     * The resolution the conversion was done at.
+     */
+    Resolution resolution;
+};
+
+/**
+ * Per device error accounting.
+ */
+struct DeviceStats {
+
+    /**
+     * Number of times the device was read, not counting retries.
+     */
+    uint32_t reads;
+
+    /**
+     * Number of reads that failed, retries included.
+     */
+    uint32_t failures;
+
+    uint32_t crcErrors;
+
+    /**
+     * Number of retries, and how many of them produced a good reading.
+     */
+    uint32_t retries;
+    uint32_t recovered;
+
+    /**
+     * Number of polls in a row the device failed in.
+     */
+    int consecutiveFailures;
+
+    /**
+     * Number of times the device was quarantined, and how many polls are left until the next attempt to read it.
+     */
+    uint32_t quarantines;
+    int quarantineLeft;
+};
+
+/**
+ * Where the time went in the last {@link OneWire#collect()}, in microseconds.
+ */
+struct CollectTiming {
+
+    /**
+     * Waiting for the conversions to complete.
+     */
+    int64_t waitMicros;
+
+    /**
+     * Reading the scratchpads, retries included.
+     */
+    int64_t readMicros;
+};
+
 class OneWire {
 private:
 
@@ -22,84 +164,258 @@ private:
     const char *TAG;
 
     /**
-     * GPIO number to use to drive the 1-Wire bus.
+     * The bus the devices are on, and the clock to time the conversions with.
      */
-    gpio_num_t gpioOnewire;
+    Bus *bus;
+    Clock *clock;
 
     /**
-     * GPIO number to use to flash the LED. Use {@code GPIO_NUM_NC} to disable.
+     * The LED to flash, {@code NULL} to disable.
      */
-    gpio_num_t gpioLED;
+    Led *led;
 
     /**
      * Flash the LED for this many milliseconds.
      */
     long flashMillis;
 
-    // Initialized in browse()
-    owb_rmt_driver_info rmt_driver_info;
+    /**
+     * Device state, in the order the devices were attached to the bus.
+     */
+    std::vector<std::string> addresses;
+    std::vector<ResolutionState> resolutions;
+    std::vector<RomCode> romCodes;
+    std::vector<DeviceStats> stats;
 
-    // Initialized in browse()
-    OneWireBus *owb = NULL;
+    /**
+     * {@code false} for the devices that were not found by the last {@link #rescan()}. Devices are never removed,
+     * so that their offsets stay the same; they are retired, and brought back if they are found again.
+     */
+    std::vector<bool> present;
 
     /**
-     * Device pointers.
-     *
-     * VT: NOTE: If we ever write the destructor, these need to be freed.
+     * Where the devices found are remembered, {@code NULL} if they are not, see {@link #browse()}.
      */
-    std::vector<DS18B20_Info *> devices;
-    std::vector<std::string> addresses;
+    RomCache *romCache = NULL;
+
+    /**
+     * What the {@link #romCache} holds for this bus, as far as we know: what was restored, or stored last.
+     */
+    std::vector<CachedDevice> cachedDevices;
+
+    /**
+     * State of the search in progress, see {@link #rescan()}.
+     */
+    bool rescanInProgress = false;
+    std::vector<RomCode> rescanFound;
 
     /**
      * Number of devices found on 1-Wire bus. Expected to be atomically set by {@link browse()}.
      */
     int devicesFound = -1;
 
+    /**
+     * {@link Clock#micros()} timestamp when the conversion was started by {@link #startConversion()},
+     * or 0 if there's no conversion in progress.
+     */
+    int64_t conversionStarted = 0;
+
+    CollectTiming lastTiming = {};
+
+    /**
+     * Number of consecutive stable readings after which the adaptive policy drops to the low resolution.
+     */
+    int stableCycles;
+
+    /**
+     * Resolution settings every device starts with.
+     */
+    ResolutionState defaultResolution;
+
+    /**
+     * Apply the adaptive policy to the device given its latest good reading.
+     */
+    void adapt(int offset, float value);
+
+    void setResolution(int offset, Resolution resolution);
+
+    /**
+     * Create the device with the given resolution settings, and append it to the device list.
+     */
+    void addDevice(const RomCode &romCode, bool solo, const ResolutionState &resolution);
+
+    /**
+     * Create the devices remembered by {@link #persist()}, if all of them respond. Returns {@code false},
+     * having created nothing, if there are none or any of them doesn't respond.
+     */
+    bool restore();
 
-    void flashLED();
+    /**
+     * Remember the ROM codes and resolution settings of the devices present on the bus in the {@link #romCache}.
+     * Nothing is written if the cache already holds the same.
+     */
+    void persist();
+
+    /**
+     * Account for the outcome of reading the device, and quarantine it if it has been failing for too long.
+     */
+    void account(int offset, bool ok);
+
+    /**
+     * Compare the devices found by the rescan against the known ones. Returns {@code true} if anything changed.
+     */
+    bool reconcile();
 
 public:
 
     /**
      * Create an instance.
      *
-     * Specify {@code gpioLED} as {@code GPIO_NUM_NC} if you don't want to flash the LED.
+     * Specify {@code led} as {@code NULL} if you don't want to flash the LED.
+     * Every instance needs its own {@code bus}, and can be polled concurrently with other instances.
+     *
+     * {@code policy}, {@code high} and {@code low} are the resolution settings every device starts with,
+     * see {@link #setResolutionPolicy()}. The adaptive policy drops to the low resolution after {@code stableCycles}
+     * stable readings.
      */
-    OneWire(const char *TAG, gpio_num_t gpioOnewire, gpio_num_t gpioLED, long flashMillis)
+    OneWire(const char *TAG, Bus *bus, Clock *clock, Led *led, long flashMillis,
+            ResolutionPolicy policy = ResolutionPolicy::fixed,
+            Resolution high = RESOLUTION_12_BIT,
+            Resolution low = RESOLUTION_10_BIT,
+            int stableCycles = 3)
     {
         this->TAG = TAG;
-        this->gpioOnewire = gpioOnewire;
-        this->gpioLED = gpioLED;
+        this->bus = bus;
+        this->clock = clock;
+        this->led = led;
         this->flashMillis = flashMillis;
+        this->defaultResolution = { policy, high, low, high, 0, false, 0 };
+        this->stableCycles = stableCycles;
     }
 
     /**
      * Discover connected devices.
      *
+     * With the {@code romCache}, the devices found the last time are checked first, and if all of them respond,
+     * they are used right away, without the settle delay and the full search. Devices added since then are
+     * picked up by {@link #rescan()}. The full search results are remembered for the next time.
+     *
      * Returns the number of devices found.
      *
      * @see #devicesFound
      * @see #getDeviceCount
      */
-    int browse();
+    int browse(RomCache *romCache = NULL);
+
+    /**
+     * Take up to {@code budget} steps of the incremental bus search, finding one device each, and return.
+     *
+     * When the search is complete, the devices found are compared against the known ones. The devices that
+     * were not found are retired, the ones found again are brought back, and the new ones are appended.
+     * Returns {@code true} if this call completed the search and the device set has changed.
+     *
+     * Must be called between the conversions, and not concurrently with anything else on this instance.
+     */
+    bool rescan(int budget);
+
+    /**
+     * Start the temperature conversion on all devices, and return immediately.
+     *
+     * The readings can be collected with {@link #collect()} after {@link #getConversionMillis()}.
+     */
+    void startConversion();
 
     /**
-     * Poll the sensors, and return their readings.
+     * Return {@code true} if the conversion started by {@link #startConversion()} is complete on all devices.
      */
-    std::vector<float> poll();
+    bool isReady();
 
     /**
-     * Return number of devices discovered on the bus. -1 if {@link #browse()} hasn't been called yet.
+     * Return the readings of the conversion started by {@link #startConversion()}, one per device, with the status.
+     *
+     * Devices are read in groups by resolution, each group as soon as its conversion is complete, lowest
+     * resolution first. Blocks for whatever is left of the conversion time if it is not complete yet, and starts
+     * a new conversion (blocking for its full duration) if there is none in progress.
+     *
+     * Devices that failed CRC are read again, within a bounded time budget. Devices failing for several polls
+     * in a row are quarantined, and not read for a while, so that they don't make every poll longer.
+     * Retired and quarantined devices are not read.
+     */
+    std::vector<Reading> collect();
+
+    /**
+     * Poll the sensors, and return their readings. Blocks for the whole conversion time.
+     */
+    std::vector<Reading> poll();
+
+    /**
+     * Return the time it takes for the conversion to complete on all devices, in milliseconds.
+     *
+     * This may change from one cycle to another if the adaptive resolution policy is used.
+     */
+    long getConversionMillis();
+
+    /**
+     * Return the time it takes for the conversion to complete at the given resolution, in milliseconds.
+     */
+    static long getConversionMillis(Resolution resolution);
+
+    /**
+     * Set the resolution policy for the device at {@code offset}. {@code low} is ignored for the fixed policy.
+     *
+     * Takes effect with the next conversion. Must not be called while the conversion is in progress.
+     */
+    void setResolutionPolicy(int offset, ResolutionPolicy policy, Resolution high, Resolution low);
+
+    inline const ResolutionState &getResolutionAt(int offset)
+    {
+        return resolutions[offset];
+    }
+
+    inline const CollectTiming &getLastTiming()
+    {
+        return lastTiming;
+    }
+
+    inline const DeviceStats &getStatsAt(int offset)
+    {
+        return stats[offset];
+    }
+
+    /**
+     * Return number of devices discovered on the bus, including the retired ones. -1 if {@link #browse()}
+     * hasn't been called yet.
      */
     inline int getDeviceCount()
     {
         return devicesFound;
     }
 
-    inline std::string getAddressAt(int offset)
+    inline const std::string &getAddressAt(int offset)
     {
         return addresses[offset];
-    };
+    }
+
+    inline const RomCode &getRomCodeAt(int offset)
+    {
+        return romCodes[offset];
+    }
+
+    /**
+     * Return {@code false} if the device was retired by {@link #rescan()}.
+     */
+    inline bool isPresentAt(int offset)
+    {
+        return present[offset];
+    }
+
+    /**
+     * Return {@code true} if {@link #rescan()} has more steps to take.
+     */
+    inline bool isRescanInProgress()
+    {
+        return rescanInProgress;
+    }
 };
 
 }
@@ -0,0 +1,201 @@
+#ifndef _HCC_ESP32_ONEWIRE_HAL_H_
+#define _HCC_ESP32_ONEWIRE_HAL_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+namespace hcc_onewire {
+
+/**
+ * DS18B20 resolution, in bits.
+ */
+enum Resolution {
+    RESOLUTION_9_BIT = 9,
+    RESOLUTION_10_BIT = 10,
+    RESOLUTION_11_BIT = 11,
+    RESOLUTION_12_BIT = 12
+};
+
+/**
+ * Outcome of a device read.
+ */
+enum class BusError {
+    ok,
+
+    /**
+     * The device responded, but the data didn't pass the CRC check.
+     */
+    crc,
+
+    /**
+     * The device didn't respond.
+     */
+    device,
+
+    /**
+     * The bus itself failed.
+     */
+    bus
+};
+
+/**
+ * 64 bit device ROM code, in the order the bytes come off the bus: family code first, CRC last.
+ */
+struct RomCode {
+    uint8_t bytes[8];
+};
+
+/**
+ * Render the ROM code the way it is printed on the device and used in the topics, most significant byte first,
+ * upper case. The buffer must be at least 17 bytes long.
+ */
+inline void format_rom_code(const RomCode &romCode, char *buffer)
+{
+    for (int offset = 0; offset < 8; offset++) {
+        snprintf(buffer + offset * 2, 3, "%02X", romCode.bytes[7 - offset]);
+    }
+}
+
+/**
+ * Return the ROM code as a number, the family code being the least significant byte. Printed in hex,
+ * it reads the same as {@link #format_rom_code()}.
+ */
+inline uint64_t rom_code_to_uint64(const RomCode &romCode)
+{
+    uint64_t value = 0;
+
+    for (int offset = 7; offset >= 0; offset--) {
+        value = (value << 8) | romCode.bytes[offset];
+    }
+
+    return value;
+}
+
+/**
+ * Time source for everything that waits on the bus, so that it can be simulated.
+ */
+class Clock {
+public:
+
+    virtual ~Clock() {}
+
+    /**
+     * Return the monotonic time, in microseconds.
+     */
+    virtual int64_t micros() = 0;
+
+    /**
+     * Return when {@link #micros()} reaches {@code deadline}, or right away if it already has.
+     */
+    virtual void sleepUntil(int64_t deadline) = 0;
+};
+
+/**
+ * What the {@link RomCache} remembers about every device.
+ */
+struct CachedDevice {
+    RomCode romCode;
+    uint8_t policy;
+    uint8_t high;
+    uint8_t low;
+    uint8_t reserved;
+};
+
+/**
+ * Where the devices found on the bus are remembered between the boots, see {@link OneWire#browse()}.
+ * The entries are kept per bus, by its name.
+ */
+class RomCache {
+public:
+
+    virtual ~RomCache() {}
+
+    /**
+     * Read the devices remembered for the bus into {@code devices}. Returns {@code false} if there are none,
+     * or they can't be read.
+     */
+    virtual bool load(const char *busName, std::vector<CachedDevice> &devices) = 0;
+
+    /**
+     * Remember the devices for the bus, replacing whatever was there. An empty list forgets them.
+     * Returns {@code false} if they couldn't be written.
+     */
+    virtual bool store(const char *busName, const std::vector<CachedDevice> &devices) = 0;
+};
+
+/**
+ * Status LED that {@link OneWire} flashes around the conversions.
+ */
+class Led {
+public:
+
+    virtual ~Led() {}
+
+    /**
+     * Turn the LED on, and turn it off after {@code millis}, without blocking. Restarts the flash if the previous
+     * one is still in progress.
+     */
+    virtual void flash(long millis) = 0;
+};
+
+/**
+ * 1-Wire bus with DS18B20 devices on it. This is everything {@link OneWire} needs from the hardware.
+ *
+ * Devices are attached by the ROM code, and addressed by the offset {@link #attach()} returned from then on.
+ * Implementations are not thread safe.
+ */
+class Bus {
+public:
+
+    virtual ~Bus() {}
+
+    /**
+     * Return the name to tell the bus apart in the logs and the device cache, no longer than 11 characters.
+     */
+    virtual const char *getName() = 0;
+
+    /**
+     * Bring the bus up. Returns {@code false} if it failed.
+     */
+    virtual bool initialize() = 0;
+
+    /**
+     * Start the ROM search if {@code first}, or continue it otherwise. Sets {@code found} and {@code romCode}
+     * if a device was found. Returns {@code false} if the bus failed, in which case the search is over.
+     */
+    virtual bool search(bool first, RomCode &romCode, bool &found) = 0;
+
+    /**
+     * Check if the device with this ROM code is present. Returns {@code false} if the bus failed.
+     */
+    virtual bool verify(const RomCode &romCode, bool &present) = 0;
+
+    /**
+     * Attach the device, and return its offset. A {@code solo} device is addressed without the ROM code.
+     */
+    virtual int attach(const RomCode &romCode, bool solo) = 0;
+
+    /**
+     * Change the way the attached device is addressed.
+     */
+    virtual void setSolo(int offset, bool solo) = 0;
+
+    virtual bool isSolo(int offset) = 0;
+
+    virtual bool setResolution(int offset, Resolution resolution) = 0;
+
+    /**
+     * Start the temperature conversion on all devices at once, and return immediately.
+     */
+    virtual void convertAll() = 0;
+
+    /**
+     * Read the temperature the last conversion produced.
+     */
+    virtual BusError read(int offset, float &value) = 0;
+};
+
+}
+
+#endif /* _HCC_ESP32_ONEWIRE_HAL_H_ */
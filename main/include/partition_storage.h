@@ -0,0 +1,37 @@
+#ifndef _HCC_ESP32_PARTITION_STORAGE_H_
+#define _HCC_ESP32_PARTITION_STORAGE_H_
+
+#include "esp_partition.h"
+
+#include "sample_store.h"
+
+namespace hcc_pipeline {
+
+/**
+ * {@link SpillStorage} backed by a flash data partition.
+ */
+class PartitionStorage : public SpillStorage {
+private:
+
+    const esp_partition_t *partition;
+
+public:
+
+    /**
+     * Create an instance. Use {@code esp_partition_find_first()} to locate the partition.
+     */
+    PartitionStorage(const esp_partition_t *partition)
+    {
+        this->partition = partition;
+    }
+
+    size_t size() override;
+    size_t sectorSize() override;
+    bool erase(size_t offset, size_t length) override;
+    bool write(size_t offset, const void *data, size_t length) override;
+    bool read(size_t offset, void *data, size_t length) override;
+};
+
+}
+
+#endif /* _HCC_ESP32_PARTITION_STORAGE_H_ */
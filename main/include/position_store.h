@@ -0,0 +1,127 @@
+#ifndef _HCC_ESP32_POSITION_STORE_H_
+#define _HCC_ESP32_POSITION_STORE_H_
+
+#include <stdint.h>
+
+namespace stepper {
+
+/**
+ * What survives a reboot. Eight bytes, to fit a single NVS entry.
+ */
+struct PositionRecord {
+
+    /**
+     * {@link PositionStore#VERSION} of the layout, records of other versions are ignored.
+     */
+    uint8_t version;
+
+    /**
+     * Non-zero if the motor was at rest at {@link #position} when the record was written, and hasn't moved since.
+     */
+    uint8_t clean;
+
+    /**
+     * Microstep divider the driver was set to, 1 at full steps, including when microstepping was not configured.
+     */
+    uint8_t microstep;
+
+    uint8_t reserved;
+
+    /**
+     * Driver position, in the finest microsteps.
+     */
+    int32_t position;
+};
+
+/**
+ * Where the {@link PositionStore} keeps its record.
+ */
+class RecordStorage {
+public:
+
+    virtual ~RecordStorage() {}
+
+    /**
+     * Read the record. Returns {@code false} if there's none, or it can't be read.
+     */
+    virtual bool load(PositionRecord &record) = 0;
+
+    virtual bool save(const PositionRecord &record) = 0;
+};
+
+/**
+ * Remembers the stepper position across reboots, so that it doesn't have to be homed again.
+ *
+ * The record is only trusted if it's clean: written when the motor had settled, and not invalidated since.
+ * The first move after a clean record is written invalidates it before it starts, so a reset or a power loss
+ * mid-move leaves a record that is ignored. The position is written back once the motor has been idle for the
+ * settle time, so a burst of moves costs two writes, and never more often than the interval allows, so a motor
+ * that keeps moving doesn't wear the flash out - the record just stays dirty until it stops.
+ *
+ * Times are in microseconds, from any clock that only goes forward.
+ */
+class PositionStore {
+public:
+
+    static const uint8_t VERSION = 1;
+
+private:
+
+    RecordStorage *storage;
+
+    const int64_t settleMicros;
+    const int64_t intervalMicros;
+
+    /**
+     * What the storage holds, as far as we know.
+     */
+    PositionRecord stored = {};
+
+    /**
+     * When the motor stopped, -1 while it's moving.
+     */
+    int64_t idleSince = 0;
+
+    int64_t lastWrite = INT64_MIN;
+    uint32_t writes = 0;
+
+    bool write(const PositionRecord &record, int64_t now);
+
+public:
+
+    PositionStore(RecordStorage *storage, int64_t settleMicros, int64_t intervalMicros) :
+        storage(storage), settleMicros(settleMicros), intervalMicros(intervalMicros)
+    {
+    }
+
+    /**
+     * Read the record. Returns {@code true}, with the position and the microstep divider it holds,
+     * if it's clean and of this version.
+     */
+    bool restore(int &position, int &microstep);
+
+    /**
+     * Call before every move. Invalidates the record if it's clean, right away, whatever the interval.
+     * Returns {@code false} if that write failed, the stale record is then going to be trusted on the next boot.
+     */
+    bool moving(int64_t now);
+
+    /**
+     * Call when the motor is at rest. Writes the position if it isn't stored yet, and it's time.
+     *
+     * Returns when to call again, or -1 if the record is up to date.
+     */
+    int64_t idle(int position, int microstep, int64_t now);
+
+    /**
+     * Return the number of writes done, to estimate the flash wear.
+     */
+    inline uint32_t getWrites()
+    {
+        return writes;
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_POSITION_STORE_H_ */
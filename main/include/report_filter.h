@@ -0,0 +1,93 @@
+#ifndef _HCC_ESP32_REPORT_FILTER_H_
+#define _HCC_ESP32_REPORT_FILTER_H_
+
+#include <stdint.h>
+
+namespace hcc_pipeline {
+
+/**
+ * Change based report suppression for one sensor.
+ *
+ * A sample is reported if it is the first one, if it differs from the last reported one by at least the deadband,
+ * or if the heartbeat interval has expired since the last report.
+ */
+class ReportFilter {
+public:
+
+    /**
+     * Everything the filter remembers, as plain data. Use it to carry the filter over something
+     * that doesn't keep the objects, like deep sleep.
+     */
+    struct State {
+        float deadband;
+        int64_t heartbeatMillis;
+        bool reported;
+        float lastValue;
+        int64_t lastTimestamp;
+    };
+
+private:
+
+    /**
+     * Smallest change worth reporting. 0 disables suppression altogether.
+     */
+    float deadband = 0;
+
+    /**
+     * Longest time to go without a report, in milliseconds. 0 means no heartbeat.
+     */
+    int64_t heartbeatMillis = 0;
+
+    bool reported = false;
+    float lastValue = 0;
+    int64_t lastTimestamp = 0;
+
+    uint32_t suppressed = 0;
+
+public:
+
+    void configure(float deadband, int64_t heartbeatMillis);
+
+    /**
+     * Return {@code true} if the value taken at {@code timestamp} (monotonic, milliseconds) needs to be reported,
+     * and remember it as the last reported value if so.
+     */
+    bool accept(float value, int64_t timestamp);
+
+    State save() const;
+
+    /**
+     * Pick up where the filter the state was saved from left off. The timestamps must come from the same clock.
+     */
+    void restore(const State &state);
+
+    /**
+     * Forget the last reported value, so that the next one is reported unconditionally.
+     */
+    inline void reset()
+    {
+        reported = false;
+    }
+
+    inline float getDeadband() const
+    {
+        return deadband;
+    }
+
+    inline int64_t getHeartbeatMillis() const
+    {
+        return heartbeatMillis;
+    }
+
+    /**
+     * Return the number of samples suppressed so far.
+     */
+    inline uint32_t getSuppressedCount() const
+    {
+        return suppressed;
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_REPORT_FILTER_H_ */
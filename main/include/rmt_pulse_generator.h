@@ -0,0 +1,154 @@
+#ifndef _HCC_ESP32_RMT_PULSE_GENERATOR_H_
+#define _HCC_ESP32_RMT_PULSE_GENERATOR_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "driver/gpio.h"
+#include "driver/rmt.h"
+
+#include "stepper_hal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+namespace stepper {
+
+/**
+ * {@link OutputPins} backed by the GPIO driver.
+ */
+class GpioOutputPins : public OutputPins {
+public:
+
+    void setup(int pin, bool level) override;
+    void set(int pin, bool level) override;
+};
+
+/**
+ * {@link LimitSwitch} closing the GPIO to ground, with the internal pull-up enabled. GPIOs 34-39 don't have one,
+ * they need an external pull-up. The switch is watched by the GPIO interrupt, so the pulses stop within microseconds
+ * of it closing, whatever the CPU is busy with.
+ */
+class GpioLimitSwitch : public LimitSwitch {
+private:
+
+    gpio_num_t gpio;
+
+    /**
+     * Set by {@link #arm()}, cleared by {@link #disarm()}. Read by the interrupt handler.
+     */
+    PulseGenerator * volatile pulses = NULL;
+    volatile bool triggered = false;
+
+    static void handler(void *arg);
+
+public:
+
+    GpioLimitSwitch(gpio_num_t gpio) : gpio(gpio) {}
+
+    bool initialize() override;
+    bool isPressed() override;
+    void arm(PulseGenerator *pulses) override;
+    void disarm() override;
+    bool isTriggered() override;
+};
+
+/**
+ * {@link PulseGenerator} driven by the RMT peripheral, with 1us resolution.
+ *
+ * The pulses are rendered into the RMT memory from the RMT interrupt as it drains, a few dozen at a time,
+ * so runs of any length take no memory and no CPU time besides the refills. Periods longer than the RMT item
+ * can hold are split across several items. Only one instance can exist, the RMT translator doesn't say
+ * which channel it is working for.
+ */
+class RmtPulseGenerator : public PulseGenerator {
+private:
+
+    /**
+     * Pulses in flight, rendered into the RMT memory but not emitted yet, never exceed the RMT memory block.
+     * This holds their times, for {@link #stop()} to tell how many made it to the pin.
+     */
+    static const uint32_t SCHEDULE_SIZE = 128;
+
+    static RmtPulseGenerator *instance;
+
+    gpio_num_t gpio;
+    rmt_channel_t channel;
+
+    /**
+     * The run in progress. The translator owns everything below from {@link #start()} until the run is over.
+     */
+    uint32_t count = 0;
+    StepTiming *timing = NULL;
+
+    /**
+     * Low time still to be rendered before the next pulse, in microseconds.
+     */
+    uint32_t gap = 0;
+
+    /**
+     * Time of the next pulse to render, relative to the start of the run, in microseconds. Wraps in 71 minutes,
+     * which only matters to {@link #stop()} for runs longer than that.
+     */
+    uint32_t elapsed = 0;
+
+    uint32_t scheduled[SCHEDULE_SIZE];
+    std::atomic<uint32_t> rendered;
+
+    /**
+     * Set when the last pulse of the run has been rendered.
+     */
+    bool finished = false;
+
+    /**
+     * Set by {@link #halt()} to make the translator wind the run down.
+     */
+    std::atomic<bool> stopping;
+
+    /**
+     * When {@link #halt()} took the pin away, relative to the start of the run, in microseconds.
+     */
+    uint32_t halted = 0;
+
+    /**
+     * {@code esp_timer_get_time()} when the run started.
+     */
+    int64_t started = 0;
+
+    /**
+     * RMT translator, {@code sample_to_rmt_t}. Every source byte stands for one pulse, the contents are never read.
+     * Runs in the RMT interrupt.
+     */
+    static void translate(const void *src, rmt_item32_t *dest, size_t src_size, size_t wanted_num, size_t *translated_size, size_t *item_num);
+
+public:
+
+    /**
+     * Create an instance. The RMT channel must not be used by anything else.
+     */
+    RmtPulseGenerator(gpio_num_t gpio, rmt_channel_t channel);
+
+    bool initialize() override;
+    bool start(uint32_t count, StepTiming *timing, uint32_t delayMicros) override;
+    bool wait(int64_t timeoutMicros) override;
+
+    uint32_t stop() override;
+
+    /**
+     * Disconnects the pin from the RMT right away. Safe to call from an interrupt. The pulses already rendered
+     * still drain, out of sight, until the next {@link #start()} stops the RMT.
+     */
+    void halt() override;
+
+    uint32_t getPulses() override;
+    bool isBusy() override;
+};
+
+}
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* _HCC_ESP32_RMT_PULSE_GENERATOR_H_ */
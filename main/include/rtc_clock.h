@@ -0,0 +1,21 @@
+#ifndef _HCC_ESP32_RTC_CLOCK_H_
+#define _HCC_ESP32_RTC_CLOCK_H_
+
+#include "onewire_hal.h"
+
+namespace hcc_power {
+
+/**
+ * {@link hcc_onewire::Clock} backed by the RTC timer. Unlike {@code esp_timer_get_time()}, it keeps counting
+ * across deep sleep. It is coarser and drifts more than the system clock, which is fine for scheduling the wakes.
+ */
+class RtcClock : public hcc_onewire::Clock {
+public:
+
+    int64_t micros() override;
+    void sleepUntil(int64_t deadline) override;
+};
+
+}
+
+#endif /* _HCC_ESP32_RTC_CLOCK_H_ */
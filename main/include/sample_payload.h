@@ -0,0 +1,227 @@
+#ifndef _HCC_ESP32_SAMPLE_PAYLOAD_H_
+#define _HCC_ESP32_SAMPLE_PAYLOAD_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+namespace hcc_mqtt {
+
+/**
+ * Longest possible rendition of a number, including the terminating zero. Same as cJSON uses.
+ */
+const size_t NUMBER_CAPACITY = 26;
+
+/**
+ * Render the value into the buffer the same way {@code cJSON_PrintUnformatted()} does.
+ *
+ * The buffer must be at least {@link #NUMBER_CAPACITY} bytes long. Returns the number of characters written,
+ * not including the terminating zero.
+ */
+size_t render_number(char *buffer, double value);
+
+/**
+ * Sensor sample MQTT message renderer.
+ *
+ * Produces output byte for byte identical to what the cJSON based renderer used to produce:
+ *
+ * {"entity_type":"sensor","name":"D90301A2792B0528","signature":"TD90301A2792B0528","signal":24.625,"device_id":"ESP32-246F28A7C53C"}
+ *
+ * Everything except the signal is rendered once by {@link #setup()}, {@link #render()} only writes the
+ * signal and copies the constant tail. No memory is allocated after the instance is created.
+ *
+ * The address and device ID are not escaped, they are expected to contain nothing but hex digits, letters and dashes.
+ */
+class SamplePayload {
+public:
+
+    /**
+     * Buffer size, enough for 16 character address, 18 character device ID, the longest number and the timestamp.
+     */
+    static const size_t CAPACITY = 192;
+
+    /**
+     * Longest possible rendition of the timestamp field, ,"timestamp":-9223372036854775808
+     */
+    static const size_t TIMESTAMP_CAPACITY = 34;
+
+    /**
+     * Length of the {"entity_type":"sensor", header that precedes the name.
+     */
+    static const size_t FIELDS_OFFSET = 24;
+
+private:
+
+    char buffer[CAPACITY];
+
+    /**
+     * Where the signal goes.
+     */
+    size_t signalOffset = 0;
+
+    /**
+     * Everything that follows the signal, rendered by {@link #setup()}.
+     */
+    char suffix[64];
+    size_t suffixLength = 0;
+
+    /**
+     * Length of the last rendered message.
+     */
+    size_t length = 0;
+
+public:
+
+    /**
+     * Pre-render the constant parts of the message.
+     *
+     * Returns {@code false} if the address or device ID are too long to fit.
+     */
+    bool setup(const char *address, const char *device_id);
+
+    /**
+     * Render the message with the given signal value, and return its length.
+     *
+     * Must not be called before {@link #setup()}.
+     */
+    size_t render(float signal);
+
+    /**
+     * Render the message with the given signal value and the time it was taken at (milliseconds) as the
+     * last {@code "timestamp"} field, and return its length. Used for samples published late.
+     *
+     * Must not be called before {@link #setup()}.
+     */
+    size_t render(float signal, int64_t timestamp);
+
+    /**
+     * Return the last rendered message.
+     */
+    inline const char *c_str() const
+    {
+        return buffer;
+    }
+
+    /**
+     * Return the length of the last rendered message.
+     */
+    inline size_t size() const
+    {
+        return length;
+    }
+
+    /**
+     * Return the constant part between the entity type and the signal value,
+     * {@code "name":"...","signature":"...","signal":}, for {@link BatchPayload} to reuse.
+     */
+    inline const char *fields() const
+    {
+        return buffer + FIELDS_OFFSET;
+    }
+
+    inline size_t fieldsLength() const
+    {
+        return signalOffset - FIELDS_OFFSET;
+    }
+};
+
+/**
+ * Poll cycle MQTT message renderer, all the samples taken in one cycle go into one message
+ * (multiline for readability):
+ *
+ * {
+ *  "entity_type":"sensor",
+ *  "device_id":"ESP32-246F28A7C53C",
+ *  "timestamp":1596240000123,
+ *  "samples":[
+ *      {"name":"D90301A2792B0528","signature":"TD90301A2792B0528","signal":24.625},
+ *      {"name":"E40300A27970F728","signature":"TE40300A27970F728","signal":26.1875}
+ *  ]
+ * }
+ *
+ * Sample entries are made of the parts already pre-rendered by {@link SamplePayload}. The buffer is allocated
+ * once by {@link #setup()}, nothing is allocated after that.
+ */
+class BatchPayload {
+private:
+
+    char *buffer = NULL;
+    size_t capacity = 0;
+
+    /**
+     * {"entity_type":"sensor","device_id":"...","timestamp":
+     */
+    char header[80];
+    size_t headerLength = 0;
+
+    size_t length = 0;
+    int entries = 0;
+
+public:
+
+    ~BatchPayload();
+
+    /**
+     * Render the header and allocate the buffer big enough for {@code sensorCount} samples.
+     *
+     * Returns {@code false} if the device ID is too long, or the memory can't be allocated.
+     */
+    bool setup(const char *device_id, int sensorCount);
+
+    /**
+     * Grow the buffer, if necessary, to fit {@code sensorCount} samples. The message rendered so far is kept.
+     *
+     * Returns {@code false} if the memory can't be allocated.
+     */
+    bool reserve(int sensorCount);
+
+    /**
+     * Start rendering a new message for the poll cycle started at {@code timestamp} (milliseconds).
+     *
+     * Returns {@code false} if {@link #setup()} failed, or couldn't allocate the buffer. Nothing can be added
+     * to the message then; if it was the allocation, a {@link #reserve()} that succeeds fixes the next one.
+     */
+    bool begin(int64_t timestamp);
+
+    /**
+     * Add the sample to the message.
+     *
+     * Returns {@code false} if the message wasn't begun, or the sample doesn't fit; that shouldn't happen unless there
+     * are more samples than the buffer was set up for.
+     */
+    bool add(const SamplePayload &sample, float signal);
+
+    /**
+     * Close the message, and return its length, 0 if it wasn't begun.
+     */
+    size_t finish();
+
+    inline const char *c_str() const
+    {
+        return buffer;
+    }
+
+    inline size_t size() const
+    {
+        return length;
+    }
+
+    /**
+     * Return the number of samples added since {@link #begin()}.
+     */
+    inline int getSampleCount() const
+    {
+        return entries;
+    }
+};
+
+}
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* _HCC_ESP32_SAMPLE_PAYLOAD_H_ */
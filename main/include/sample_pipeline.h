@@ -0,0 +1,193 @@
+#ifndef _HCC_ESP32_SAMPLE_PIPELINE_H_
+#define _HCC_ESP32_SAMPLE_PIPELINE_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "onewire.h"
+#include "sample_payload.h"
+#include "cbor_payload.h"
+#include "sample_ring.h"
+#include "sample_store.h"
+#include "sensor_registry.h"
+
+namespace hcc_pipeline {
+
+/**
+ * Where the messages go, the MQTT client in the application.
+ */
+class MessageSink {
+public:
+
+    virtual ~MessageSink() {}
+
+    /**
+     * Return whether the messages have a way out.
+     */
+    virtual bool isOnline() = 0;
+
+    /**
+     * Hand the message over, at QoS 1.
+     */
+    virtual void publish(const char *topic, const char *data, size_t length) = 0;
+
+    /**
+     * Called with the time it took to render a message, in microseconds.
+     */
+    virtual void rendered(int64_t micros) = 0;
+};
+
+/**
+ * What gets published, and how.
+ */
+struct PipelineConfig {
+
+    /**
+     * Publish every sample to its sensor's topic.
+     */
+    bool perSensor;
+
+    /**
+     * Publish the samples of every poll cycle as one message.
+     */
+    bool batch;
+
+    bool json;
+    bool cbor;
+
+    /**
+     * Number of stored samples {@link SamplePipeline#drain()} publishes at a time.
+     */
+    int drainBatch;
+};
+
+/**
+ * The way from the bus readings to the sink, minus the tasks.
+ *
+ * The sampler side runs the readings through the sensor report filters, and pushes the samples worth reporting
+ * into the ring, followed by the end of the poll cycle. The publisher side takes them out, and publishes them
+ * one by one, as one batch per poll cycle, or both. While the sink is offline, and until the samples stored
+ * in the meantime are drained, the samples go to the store instead; there being no store, they are dropped.
+ *
+ * A sample only counts as reported to its sensor's report filter once it is in the ring, and bound for the sink
+ * or the store. If it is lost on the way, the filter is wound back, or, if there's no telling whose sample it was,
+ * every sensor reports its next sample unconditionally.
+ *
+ * Each side must be called from one task only; the sampler side holding whatever guards the sensor report filters.
+ */
+class SamplePipeline {
+private:
+
+    const char *TAG;
+
+    SensorDirectory *sensors;
+    SampleQueue *ring;
+
+    /**
+     * {@code NULL} if the samples are not stored.
+     */
+    SampleStore *store;
+
+    MessageSink *sink;
+    hcc_onewire::Clock *clock;
+    const PipelineConfig config;
+
+    const char *batchTopic = NULL;
+    const char *cborBatchTopic = NULL;
+
+    hcc_mqtt::BatchPayload batch;
+    hcc_mqtt::CborBatchPayload cborBatch;
+
+    /**
+     * Whether the batches are begun, and for which poll cycle.
+     */
+    bool batchOpen = false;
+    uint32_t batchCycle = 0;
+
+    /**
+     * When the store started draining, -1 if it isn't, and how many samples were drained before.
+     */
+    int64_t drainStarted = -1;
+    uint32_t drainedBefore = 0;
+
+    /**
+     * Set by the publisher side when it drops a sample for the lack of the sink and the store, for the sampler side
+     * to act on, it's the one that owns the filters.
+     */
+    std::atomic<bool> dropped;
+
+    /**
+     * Push the record into the ring. If it was lost to overflow, wind the report filter of its sensor back to the
+     * {@code last} state, or forget what every sensor reported if it was someone else's record that was lost.
+     */
+    void push(const SampleRecord &record, Sensor *s, const ReportFilter::State &last);
+
+    /**
+     * Make every sensor but {@code except} report its next sample, whatever the filter says.
+     */
+    void forget(Sensor *except);
+
+    void beginBatch(int64_t timestamp);
+    void addToBatch(Sensor *s, float signal);
+    int getBatchSampleCount();
+    void sendBatch();
+
+    /**
+     * Publish the sample, in the encodings configured. Late samples are published with their timestamp.
+     */
+    void sendSample(Sensor *s, const SampleRecord &record, bool late);
+
+public:
+
+    /**
+     * Create an instance. The {@code store} can be {@code NULL}.
+     */
+    SamplePipeline(const char *TAG, SensorDirectory *sensors, SampleQueue *ring, SampleStore *store,
+        MessageSink *sink, hcc_onewire::Clock *clock, const PipelineConfig &config) :
+        TAG(TAG), sensors(sensors), ring(ring), store(store), sink(sink), clock(clock), config(config), dropped(false)
+    {
+    }
+
+    /**
+     * Allocate the batch messages for {@code sensorCount} sensors, if batching is configured, and remember
+     * the topics they go to. Returns {@code false} if they couldn't be allocated, the batches are skipped
+     * until {@link #addToBatch()} manages to.
+     */
+    bool setup(const char *deviceId, const char *batchTopic, const char *cborBatchTopic, int sensorCount);
+
+    /**
+     * Sampler side. Run the bus readings through the sensor report filters, and push the samples worth reporting
+     * into the ring. {@code sensorOffsets} maps the bus devices to the sensors; the {@code record} carries the
+     * timestamp and the poll cycle; {@code now} is the monotonic time, in milliseconds.
+     */
+    void sample(const std::vector<int> &sensorOffsets, const std::vector<hcc_onewire::Reading> &readings, SampleRecord &record, int64_t now);
+
+    /**
+     * Sampler side. Push the end of the poll cycle the {@code record} is for into the ring.
+     */
+    void endCycle(SampleRecord &record);
+
+    /**
+     * Publisher side. Take the samples out of the ring, and publish or store them; then publish some of the stored
+     * ones, if the sink is online. Returns {@code true} if there are stored samples left, call again after a while.
+     */
+    bool process();
+
+    /**
+     * Publisher side. Publish up to {@link PipelineConfig#drainBatch} stored samples. Returns {@code true}
+     * if there are more left.
+     */
+    bool drain();
+
+    /**
+     * Publisher side. Log and publish the sample, or add it to the batch; or publish the batch,
+     * if the record is the end of the poll cycle.
+     */
+    void publish(const SampleRecord &record, bool late);
+};
+
+}
+
+#endif /* _HCC_ESP32_SAMPLE_PIPELINE_H_ */
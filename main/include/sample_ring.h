@@ -0,0 +1,245 @@
+#ifndef _HCC_ESP32_SAMPLE_RING_H_
+#define _HCC_ESP32_SAMPLE_RING_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+namespace hcc_pipeline {
+
+/**
+ * A sample, as passed from the bus sampler to the publisher.
+ */
+struct SampleRecord {
+
+    /**
+     * Sensor offset value marking the end of the poll cycle.
+     */
+    static const uint16_t CYCLE_END = 0xFFFF;
+
+    /**
+     * When the sample was collected, in milliseconds.
+     */
+    int64_t timestamp;
+
+    float signal;
+
+    /**
+     * Poll cycle number, to tell the cycles apart if the end of the cycle record was lost.
+     */
+    uint32_t cycle;
+
+    /**
+     * Sensor offset, or {@link #CYCLE_END}.
+     */
+    uint16_t sensor;
+};
+
+/**
+ * What to do when a record is pushed into a full ring.
+ */
+enum class OverflowPolicy {
+
+    /**
+     * Discard the oldest record to make room for the new one.
+     */
+    dropOldest,
+
+    /**
+     * Discard the new record.
+     */
+    dropNewest
+};
+
+/**
+ * Return the smallest power of two not less than {@code n}, a capacity {@link SpscRing} accepts.
+ */
+constexpr size_t ring_capacity(size_t n, size_t power = 1)
+{
+    return power >= n ? power : ring_capacity(n, power * 2);
+}
+
+/**
+ * Fixed capacity lock-free single producer, single consumer ring.
+ *
+ * {@code N} must be a power of two. Indexes are free running, and only wrap when converted to the slot number.
+ */
+template <typename T, size_t N>
+class SpscRing {
+
+    static_assert(N > 0 && (N & (N - 1)) == 0, "ring capacity must be a power of two");
+
+private:
+
+    static const uint32_t MASK = N - 1;
+
+    T slots[N];
+
+    /**
+     * Next slot to write. Only the producer modifies it.
+     */
+    std::atomic<uint32_t> head;
+
+    /**
+     * Next slot to read. The consumer advances it, and so does the producer when it drops the oldest record.
+     */
+    std::atomic<uint32_t> tail;
+
+    const OverflowPolicy policy;
+
+    /**
+     * Number of records lost to overflow.
+     */
+    std::atomic<uint32_t> overflows;
+
+    /**
+     * Largest number of records ever waiting in the ring.
+     */
+    std::atomic<uint32_t> highWatermark;
+
+public:
+
+    SpscRing(OverflowPolicy policy) : head(0), tail(0), policy(policy), overflows(0), highWatermark(0)
+    {
+    }
+
+    /**
+     * Add the record to the ring. Producer side only.
+     *
+     * Returns {@code false} if a record was lost to overflow, the new one or the oldest one, depending on the policy.
+     */
+    bool push(const T &item)
+    {
+        uint32_t h = head.load(std::memory_order_relaxed);
+        uint32_t t = tail.load(std::memory_order_acquire);
+        bool lost = false;
+
+        if (h - t == N) {
+
+            lost = true;
+            overflows.fetch_add(1, std::memory_order_relaxed);
+
+            if (policy == OverflowPolicy::dropNewest) {
+                return false;
+            }
+
+            // If this fails, the consumer has just freed the slot, and the record is not lost after all.
+            // If it succeeds, and the consumer is in the middle of copying the oldest record out, its own
+            // compare and swap will fail, and the torn copy will be discarded.
+            if (!tail.compare_exchange_strong(t, t + 1, std::memory_order_acq_rel)) {
+                overflows.fetch_sub(1, std::memory_order_relaxed);
+                lost = false;
+            }
+        }
+
+        slots[h & MASK] = item;
+        head.store(h + 1, std::memory_order_release);
+
+        uint32_t size = h + 1 - tail.load(std::memory_order_relaxed);
+
+        if (size > highWatermark.load(std::memory_order_relaxed)) {
+            highWatermark.store(size, std::memory_order_relaxed);
+        }
+
+        return !lost;
+    }
+
+    /**
+     * Take the oldest record out of the ring. Consumer side only.
+     *
+     * Returns {@code false} if the ring is empty.
+     */
+    bool pop(T &item)
+    {
+        uint32_t t = tail.load(std::memory_order_acquire);
+
+        do {
+
+            if (t == head.load(std::memory_order_acquire)) {
+                return false;
+            }
+
+            item = slots[t & MASK];
+
+        } while (!tail.compare_exchange_weak(t, t + 1, std::memory_order_acq_rel, std::memory_order_acquire));
+
+        return true;
+    }
+
+    inline size_t size() const
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    inline size_t capacity() const
+    {
+        return N;
+    }
+
+    inline OverflowPolicy getPolicy() const
+    {
+        return policy;
+    }
+
+    inline uint32_t getOverflowCount() const
+    {
+        return overflows.load(std::memory_order_relaxed);
+    }
+
+    inline uint32_t getHighWatermark() const
+    {
+        return highWatermark.load(std::memory_order_relaxed);
+    }
+};
+
+/**
+ * Both ends of a sample ring, to the code that doesn't need to know its capacity.
+ */
+class SampleQueue {
+public:
+
+    virtual ~SampleQueue() {}
+
+    /**
+     * See {@link SpscRing#push()}.
+     */
+    virtual bool push(const SampleRecord &record) = 0;
+
+    /**
+     * See {@link SpscRing#pop()}.
+     */
+    virtual bool pop(SampleRecord &record) = 0;
+
+    virtual OverflowPolicy getPolicy() const = 0;
+};
+
+/**
+ * {@link SpscRing} of samples, that can be passed around as a {@link SampleQueue}.
+ */
+template <size_t N>
+class SampleRing : public SpscRing<SampleRecord, N>, public SampleQueue {
+public:
+
+    SampleRing(OverflowPolicy policy) : SpscRing<SampleRecord, N>(policy)
+    {
+    }
+
+    bool push(const SampleRecord &record) override
+    {
+        return SpscRing<SampleRecord, N>::push(record);
+    }
+
+    bool pop(SampleRecord &record) override
+    {
+        return SpscRing<SampleRecord, N>::pop(record);
+    }
+
+    OverflowPolicy getPolicy() const override
+    {
+        return SpscRing<SampleRecord, N>::getPolicy();
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_SAMPLE_RING_H_ */
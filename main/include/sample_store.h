@@ -0,0 +1,200 @@
+#ifndef _HCC_ESP32_SAMPLE_STORE_H_
+#define _HCC_ESP32_SAMPLE_STORE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "sample_ring.h"
+
+namespace hcc_pipeline {
+
+/**
+ * Flash-like storage the {@link SampleStore} spills to when it runs out of RAM.
+ *
+ * Semantics are those of NOR flash: erasing sets all bits, writing can only clear them, and erasing
+ * is only possible in whole sectors.
+ */
+class SpillStorage {
+public:
+
+    virtual ~SpillStorage() {}
+
+    /**
+     * Return the storage size, in bytes. Must be a multiple of the sector size.
+     */
+    virtual size_t size() = 0;
+
+    /**
+     * Return the erase sector size, in bytes.
+     */
+    virtual size_t sectorSize() = 0;
+
+    /**
+     * Erase {@code length} bytes starting at {@code offset}. Both must be aligned to the sector size.
+     */
+    virtual bool erase(size_t offset, size_t length) = 0;
+
+    virtual bool write(size_t offset, const void *data, size_t length) = 0;
+
+    virtual bool read(size_t offset, void *data, size_t length) = 0;
+};
+
+/**
+ * RAM backed {@link SpillStorage} following the flash semantics. Use it to exercise the spill logic
+ * without wearing the flash out, or on a host.
+ */
+class MemoryStorage : public SpillStorage {
+private:
+
+    std::vector<uint8_t> data;
+    const size_t sector;
+
+public:
+
+    /**
+     * Number of erase and write operations performed, to estimate the flash wear.
+     */
+    uint32_t erases = 0;
+    uint32_t writes = 0;
+
+    MemoryStorage(size_t size, size_t sectorSize = 4096) : data(size, 0xFF), sector(sectorSize)
+    {
+    }
+
+    size_t size() override;
+    size_t sectorSize() override;
+    bool erase(size_t offset, size_t length) override;
+    bool write(size_t offset, const void *data, size_t length) override;
+    bool read(size_t offset, void *data, size_t length) override;
+};
+
+/**
+ * Store-and-forward buffer for samples that can't be published right now.
+ *
+ * Samples are kept in a RAM ring allocated once by the constructor. When the ring fills up, up to a sector's worth
+ * of the oldest samples is spilled into a circular log in {@link SpillStorage}, if there is one; otherwise the oldest
+ * sample is dropped. When the log fills up, its oldest sector is erased and the samples in it are dropped.
+ *
+ * The log position lives in RAM, so the samples spilled before a reboot are not recovered after it.
+ *
+ * Not thread safe, it is expected to be used by the publisher task only.
+ */
+class SampleStore {
+public:
+
+    struct Stats {
+
+        /**
+         * Samples accepted by {@link #push()}.
+         */
+        uint32_t stored;
+
+        /**
+         * Samples moved from RAM to the spill storage.
+         */
+        uint32_t spilled;
+
+        /**
+         * Samples taken out by {@link #pop()}.
+         */
+        uint32_t drained;
+
+        /**
+         * Samples lost because there was no room for them.
+         */
+        uint32_t dropped;
+    };
+
+private:
+
+    SampleRecord *ram;
+    const size_t ramCapacity;
+
+    /**
+     * Free running RAM ring indexes, kept from wrapping by {@link #rebase()}.
+     */
+    size_t ramHead = 0;
+    size_t ramTail = 0;
+
+    SpillStorage *spill;
+
+    /**
+     * Number of record slots in one sector, and in the whole spill storage. 0 if there is no spill storage.
+     */
+    size_t slotsPerSector = 0;
+    size_t slotCount = 0;
+
+    /**
+     * Free running spill log indexes, kept from wrapping by {@link #rebase()}.
+     */
+    uint32_t spillHead = 0;
+    uint32_t spillTail = 0;
+
+    Stats stats = {};
+
+    size_t offsetOf(uint32_t slot);
+
+    /**
+     * Move up to a sector's worth of the oldest RAM records to the spill log.
+     */
+    void spillOldest();
+
+    /**
+     * Move the indexes back by a whole capacity once the tail has gone round. They are only ever used modulo
+     * the capacity, which a wrap of the counter would break unless the capacity is a power of two. This keeps them
+     * under twice the capacity instead.
+     */
+    void rebase();
+
+public:
+
+    /**
+     * Create an instance holding {@code ramCapacity} records in RAM, and spilling into {@code spill} if it's not {@code NULL}.
+     */
+    SampleStore(size_t ramCapacity, SpillStorage *spill = NULL);
+
+    ~SampleStore();
+
+    void push(const SampleRecord &record);
+
+    /**
+     * Take the oldest record out. Returns {@code false} if there are none.
+     */
+    bool pop(SampleRecord &record);
+
+    inline size_t size() const
+    {
+        return (spillHead - spillTail) + (ramHead - ramTail);
+    }
+
+    inline bool empty() const
+    {
+        return size() == 0;
+    }
+
+    /**
+     * Return the RAM taken by the buffer, in bytes.
+     */
+    inline size_t getRamBytes() const
+    {
+        return ramCapacity * sizeof(SampleRecord);
+    }
+
+    /**
+     * Return the spill storage taken by the samples right now, in bytes.
+     */
+    inline size_t getSpillBytes() const
+    {
+        return (spillHead - spillTail) * sizeof(SampleRecord);
+    }
+
+    inline Stats getStats() const
+    {
+        return stats;
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_SAMPLE_STORE_H_ */
@@ -0,0 +1,243 @@
+#ifndef _HCC_ESP32_SENSOR_REGISTRY_H_
+#define _HCC_ESP32_SENSOR_REGISTRY_H_
+
+#include <atomic>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sample_payload.h"
+#include "cbor_payload.h"
+#include "report_filter.h"
+
+namespace hcc_pipeline {
+
+/**
+ * Everything the pipeline knows about one sensor. Lives in the {@link SensorRegistry}, and never moves.
+ */
+struct Sensor {
+
+    /**
+     * 16 hex digits and the terminating zero.
+     */
+    static const size_t ADDRESS_CAPACITY = 17;
+
+    static const size_t TOPIC_CAPACITY = 96;
+
+    /**
+     * ROM code, see {@code hcc_onewire::rom_code_to_uint64()}.
+     */
+    uint64_t romCode;
+
+    /**
+     * ROM code rendered the way it is printed on the device.
+     */
+    char address[ADDRESS_CAPACITY];
+
+    char topic[TOPIC_CAPACITY];
+
+    /**
+     * Where the CBOR encoded samples go, the topic followed by "/cbor".
+     */
+    char cborTopic[TOPIC_CAPACITY + 5];
+
+    /**
+     * Offset of the bus, and of the device on that bus. Change if the device is moved to another bus.
+     */
+    int bus;
+    int device;
+
+    /**
+     * {@code false} if the device is gone from the bus.
+     */
+    bool present;
+
+    /**
+     * Last good reading, {@code NAN} if there was none yet, and the resolution it was taken at.
+     * Written by the sampler only.
+     */
+    float lastValue;
+    int resolution;
+
+    /**
+     * Number of failed readings. Written by the sampler only.
+     */
+    uint32_t failures;
+
+    /**
+     * Preallocated sample messages.
+     */
+    hcc_mqtt::SamplePayload payload;
+    hcc_mqtt::CborSamplePayload cborPayload;
+
+    /**
+     * Last reported state, used by the sampler to suppress the samples not worth reporting.
+     */
+    ReportFilter filter;
+};
+
+/**
+ * The registry, to the code that doesn't need to know its capacity.
+ */
+class SensorDirectory {
+public:
+
+    virtual ~SensorDirectory() {}
+
+    /**
+     * Return the sensor with the ROM code, or {@code NULL} if there's none.
+     */
+    virtual Sensor *find(uint64_t romCode) = 0;
+
+    /**
+     * Return the sensor at the offset, or {@code NULL} if there's no such sensor.
+     */
+    virtual Sensor *at(int offset) = 0;
+
+    virtual int offsetOf(const Sensor *s) const = 0;
+
+    virtual int size() const = 0;
+};
+
+/**
+ * Fixed capacity sensor registry. The sensors are stored contiguously, and are looked up by their offset,
+ * or by their ROM code in constant time.
+ *
+ * Sensors are never removed, and never move, so that their offsets and pointers stay valid.
+ * {@link #add()} and {@link #find()} must not be called concurrently, everything else can be called from any task.
+ */
+template <size_t N>
+class SensorRegistry : public SensorDirectory {
+
+    static_assert(N > 0 && N < 0x7FFF, "sensor registry capacity out of range");
+
+private:
+
+    /**
+     * Smallest power of two at least twice the capacity, so that the probe sequences stay short.
+     */
+    static constexpr size_t indexSize(size_t size = 1)
+    {
+        return size >= 2 * N ? size : indexSize(size * 2);
+    }
+
+    static const size_t INDEX_SIZE = indexSize();
+    static const size_t INDEX_MASK = INDEX_SIZE - 1;
+
+    Sensor sensors[N];
+
+    /**
+     * Open addressing hash table of sensor offsets plus one, zero marks an empty slot.
+     */
+    int16_t index[INDEX_SIZE] = {};
+
+    std::atomic<int> count;
+
+    /**
+     * The family code is the same for all the devices, and the serial numbers are sequential more often than not,
+     * so the bits are mixed first.
+     */
+    static inline size_t hash(uint64_t romCode)
+    {
+        return (size_t) ((romCode * 0x9E3779B97F4A7C15ULL) >> 32) & INDEX_MASK;
+    }
+
+public:
+
+    SensorRegistry() : count(0)
+    {
+    }
+
+    /**
+     * Create the sensor with the ROM code, and return it. The topic is {@code topicPrefix} followed by the address.
+     *
+     * Returns {@code NULL} if the registry is full, or the topic doesn't fit.
+     */
+    Sensor *add(uint64_t romCode, const char *topicPrefix)
+    {
+        int offset = count.load(std::memory_order_relaxed);
+
+        if (offset == (int) N) {
+            return NULL;
+        }
+
+        Sensor &s = sensors[offset];
+
+        s.romCode = romCode;
+        snprintf(s.address, sizeof(s.address), "%016llX", (unsigned long long) romCode);
+
+        if (snprintf(s.topic, sizeof(s.topic), "%s%016llX", topicPrefix, (unsigned long long) romCode) >= (int) sizeof(s.topic)) {
+            return NULL;
+        }
+
+        snprintf(s.cborTopic, sizeof(s.cborTopic), "%s%016llX/cbor", topicPrefix, (unsigned long long) romCode);
+
+        s.bus = -1;
+        s.device = -1;
+        s.present = true;
+        s.lastValue = NAN;
+        s.resolution = 0;
+        s.failures = 0;
+
+        size_t slot = hash(romCode);
+
+        while (index[slot] != 0) {
+            slot = (slot + 1) & INDEX_MASK;
+        }
+
+        index[slot] = offset + 1;
+
+        count.store(offset + 1, std::memory_order_release);
+
+        return &s;
+    }
+
+    Sensor *find(uint64_t romCode) override
+    {
+        for (size_t slot = hash(romCode); index[slot] != 0; slot = (slot + 1) & INDEX_MASK) {
+
+            Sensor &s = sensors[index[slot] - 1];
+
+            if (s.romCode == romCode) {
+                return &s;
+            }
+        }
+
+        return NULL;
+    }
+
+    inline Sensor *at(int offset) override
+    {
+        return offset >= 0 && offset < count.load(std::memory_order_acquire) ? &sensors[offset] : NULL;
+    }
+
+    inline int offsetOf(const Sensor *s) const override
+    {
+        return s - sensors;
+    }
+
+    inline int size() const override
+    {
+        return count.load(std::memory_order_acquire);
+    }
+
+    inline size_t capacity() const
+    {
+        return N;
+    }
+
+    inline Sensor *begin()
+    {
+        return sensors;
+    }
+
+    inline Sensor *end()
+    {
+        return sensors + size();
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_SENSOR_REGISTRY_H_ */
@@ -0,0 +1,218 @@
+#ifndef _HCC_ESP32_SIMULATED_BUS_H_
+#define _HCC_ESP32_SIMULATED_BUS_H_
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "onewire_hal.h"
+
+namespace hcc_onewire {
+
+/**
+ * {@link Clock} that only moves when it's told to, or when someone sleeps on it. Use it to run the bus logic
+ * on a host faster than real time.
+ */
+class SimulatedClock : public Clock {
+private:
+
+    int64_t now = 0;
+
+public:
+
+    int64_t micros() override;
+    void sleepUntil(int64_t deadline) override;
+
+    void advance(int64_t micros);
+};
+
+/**
+ * {@link RomCache} kept in memory, for the simulation to survive a simulated reboot.
+ */
+class MemoryRomCache : public RomCache {
+private:
+
+    std::map<std::string, std::vector<CachedDevice>> buses;
+
+public:
+
+    /**
+     * Number of times the devices were stored, to check how often the real cache would be written.
+     */
+    uint32_t stores = 0;
+
+    bool load(const char *busName, std::vector<CachedDevice> &devices) override;
+    bool store(const char *busName, const std::vector<CachedDevice> &devices) override;
+};
+
+/**
+ * Simulated DS18B20 device.
+ */
+struct SimulatedDevice {
+
+    RomCode romCode;
+    bool present;
+
+    /**
+     * Doesn't respond to reads while set, like a device with a bad connection. Set it to script the failures.
+     */
+    bool failing;
+
+    /**
+     * The temperature the device is exposed to. It drifts a little with every conversion.
+     */
+    float temperature;
+
+    Resolution resolution;
+
+    /**
+     * The value the last complete conversion left in the scratchpad, and the one the conversion in progress will.
+     */
+    float scratchpad;
+    float converting;
+
+    /**
+     * When the conversion in progress completes, according to the clock.
+     */
+    int64_t conversionComplete;
+};
+
+/**
+ * {@link Bus} with simulated DS18B20 devices on it. Has nothing to do with the hardware, and builds on any host.
+ *
+ * Models the conversion time at every resolution, reads during the conversion returning the previous value,
+ * random CRC and device failures, devices coming and going, and the collisions a solo device suffers when it
+ * is not alone on the bus anymore. Deterministic for the given seed.
+ */
+class SimulatedBus : public Bus {
+public:
+
+    struct Config {
+
+        /**
+         * Number of devices on the bus to begin with.
+         */
+        int devices;
+
+        /**
+         * Probability of a read failing CRC, and of a device not responding to a read, 0 to 1.
+         */
+        float crcFailureRate;
+        float deviceFailureRate;
+
+        /**
+         * Conversion time multiplier, 1 for the datasheet maximum.
+         */
+        float conversionScale;
+
+        /**
+         * Time every read takes, the clock is slept on for it. 0 makes the reads take no time.
+         */
+        int64_t readMicros;
+
+        /**
+         * Unplug a random device, or plug it back in, this often. 0 disables hot plugging.
+         */
+        int64_t hotPlugMicros;
+
+        uint32_t seed;
+    };
+
+    /**
+     * Counters, to check what the code under test did to the bus.
+     */
+    struct Stats {
+        uint32_t searches;
+        uint32_t conversions;
+        uint32_t reads;
+        uint32_t crcFailures;
+        uint32_t deviceFailures;
+        uint32_t hotPlugs;
+    };
+
+private:
+
+    char name[12];
+    Clock *clock;
+    Config config;
+
+    std::vector<SimulatedDevice> devices;
+
+    /**
+     * Offsets in {@code devices} of the devices attached by {@link #attach()}, and whether they are addressed solo.
+     */
+    std::vector<int> attached;
+    std::vector<bool> solo;
+
+    /**
+     * Offset in {@code devices} the search in progress is at.
+     */
+    int searchNext = 0;
+
+    int64_t nextHotPlug = 0;
+    uint32_t random;
+
+    Stats stats = {};
+
+    /**
+     * Return a pseudo random number, xorshift32.
+     */
+    uint32_t next();
+
+    /**
+     * Return {@code true} with the given probability.
+     */
+    bool chance(float probability);
+
+    /**
+     * Toggle a random device's presence if it's time.
+     */
+    void hotPlug();
+
+    int find(const RomCode &romCode);
+
+public:
+
+    SimulatedBus(const char *name, Clock *clock, const Config &config);
+
+    /**
+     * Add a new device to the bus, and return its offset in the simulation. Use it for scripted hot plug events.
+     */
+    int plug(float temperature);
+
+    /**
+     * Make the device at the simulation offset disappear from the bus, or come back.
+     */
+    void setPresent(int offset, bool present);
+
+    inline SimulatedDevice &getDevice(int offset)
+    {
+        return devices[offset];
+    }
+
+    inline int getDeviceCount()
+    {
+        return devices.size();
+    }
+
+    inline Stats getStats()
+    {
+        return stats;
+    }
+
+    const char *getName() override;
+    bool initialize() override;
+    bool search(bool first, RomCode &romCode, bool &found) override;
+    bool verify(const RomCode &romCode, bool &present) override;
+    int attach(const RomCode &romCode, bool solo) override;
+    void setSolo(int offset, bool solo) override;
+    bool isSolo(int offset) override;
+    bool setResolution(int offset, Resolution resolution) override;
+    void convertAll() override;
+    BusError read(int offset, float &value) override;
+};
+
+}
+
+#endif /* _HCC_ESP32_SIMULATED_BUS_H_ */
@@ -0,0 +1,202 @@
+#ifndef _HCC_ESP32_SIMULATED_STEPPER_H_
+#define _HCC_ESP32_SIMULATED_STEPPER_H_
+
+#include <stdint.h>
+#include <vector>
+
+#include "onewire_hal.h"
+#include "stepper_hal.h"
+
+namespace stepper {
+
+/**
+ * {@link OutputPins} that remember the levels, and when they last changed according to the clock.
+ */
+class SimulatedOutputPins : public OutputPins {
+public:
+
+    static const int PIN_COUNT = 40;
+
+private:
+
+    hcc_onewire::Clock *clock;
+
+    bool levels[PIN_COUNT] = {};
+    int64_t changed[PIN_COUNT] = {};
+
+public:
+
+    SimulatedOutputPins(hcc_onewire::Clock *clock) : clock(clock) {}
+
+    void setup(int pin, bool level) override;
+    void set(int pin, bool level) override;
+
+    inline bool get(int pin)
+    {
+        return levels[pin];
+    }
+
+    inline int64_t getChanged(int pin)
+    {
+        return changed[pin];
+    }
+};
+
+/**
+ * Watches the pulses of a {@link SimulatedPulseGenerator}.
+ */
+class PulseObserver {
+public:
+
+    virtual ~PulseObserver() {}
+
+    /**
+     * Called for every pulse, as it is rendered. The observer may halt the generator.
+     */
+    virtual void pulse(int64_t time) = 0;
+};
+
+/**
+ * {@link PulseGenerator} that lays the pulses out on the clock instead of a pin. Has nothing to do with the hardware,
+ * and builds on any host; use it with {@link hcc_onewire::SimulatedClock} to run the stepper logic faster than real time.
+ *
+ * A run takes as long as it would on the hardware: the pulses are only emitted when the clock gets to them.
+ * Like the RMT, the generator renders a few pulses ahead of the clock, so the timing learns about changes late.
+ */
+class SimulatedPulseGenerator : public PulseGenerator {
+public:
+
+    /**
+     * How many pulses are rendered ahead of the clock, half the RMT memory block.
+     */
+    static const uint32_t LOOKAHEAD = 32;
+
+    /**
+     * Counters, to check what the code under test did to the driver.
+     */
+    struct Stats {
+        uint32_t runs;
+        uint32_t stops;
+        uint32_t pulses;
+        uint32_t minPeriod;
+        uint32_t maxPeriod;
+    };
+
+private:
+
+    hcc_onewire::Clock *clock;
+    PulseObserver *observer = NULL;
+
+    /**
+     * Times of the pulses of all the runs so far, including the ones rendered ahead of the clock.
+     */
+    std::vector<int64_t> pulses;
+
+    /**
+     * The run in progress, or the last one.
+     */
+    uint32_t count = 0;
+    StepTiming *timing = NULL;
+    size_t runStart = 0;
+    int64_t next = 0;
+    bool finished = true;
+
+    Stats stats = {};
+
+    /**
+     * Render the pulses up to {@link #LOOKAHEAD} ahead of the clock.
+     */
+    void render();
+
+    /**
+     * Return the pulses of the run rendered ahead of the clock.
+     */
+    uint32_t ahead();
+
+public:
+
+    SimulatedPulseGenerator(hcc_onewire::Clock *clock) : clock(clock) {}
+
+    inline const std::vector<int64_t> &getPulseTimes()
+    {
+        return pulses;
+    }
+
+    inline Stats getStats()
+    {
+        return stats;
+    }
+
+    inline void setObserver(PulseObserver *observer)
+    {
+        this->observer = observer;
+    }
+
+    /**
+     * Drop the pulses of the run in progress later than {@code time}, and end the run.
+     * Returns the number of pulses dropped.
+     */
+    uint32_t haltAt(int64_t time);
+
+    bool initialize() override;
+    bool start(uint32_t count, StepTiming *timing, uint32_t delayMicros) override;
+    bool wait(int64_t timeoutMicros) override;
+    uint32_t stop() override;
+    void halt() override;
+    uint32_t getPulses() override;
+    bool isBusy() override;
+};
+
+/**
+ * {@link LimitSwitch} at a fixed distance from where the simulation started. Follows the pulses the generator
+ * renders, in the direction the DIR pin says, so it knows where the mechanism is regardless of what the driver thinks.
+ */
+class SimulatedLimitSwitch : public LimitSwitch, public PulseObserver {
+public:
+
+    /**
+     * Time from the switch closing to the pulses stopping, the interrupt latency.
+     */
+    static const int64_t LATENCY_MICROS = 5;
+
+private:
+
+    SimulatedPulseGenerator *generator;
+    SimulatedOutputPins *pins;
+    int dirPin;
+
+    /**
+     * DIR level that moves the mechanism towards the switch.
+     */
+    bool towards;
+
+    /**
+     * Pulses from the start of the simulation to the switch, and where the mechanism is now.
+     */
+    int distance;
+    int position = 0;
+
+    bool armed = false;
+    bool triggered = false;
+
+public:
+
+    SimulatedLimitSwitch(SimulatedPulseGenerator *generator, SimulatedOutputPins *pins, int dirPin, bool towards, int distance);
+
+    inline int getPosition()
+    {
+        return position;
+    }
+
+    void pulse(int64_t time) override;
+
+    bool initialize() override;
+    bool isPressed() override;
+    void arm(PulseGenerator *pulses) override;
+    void disarm() override;
+    bool isTriggered() override;
+};
+
+}
+
+#endif /* _HCC_ESP32_SIMULATED_STEPPER_H_ */
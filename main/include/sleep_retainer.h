@@ -0,0 +1,96 @@
+#ifndef _HCC_ESP32_SLEEP_RETAINER_H_
+#define _HCC_ESP32_SLEEP_RETAINER_H_
+
+#include <stdint.h>
+
+#include "onewire_hal.h"
+#include "report_filter.h"
+#include "sample_ring.h"
+#include "sample_store.h"
+#include "sample_pipeline.h"
+#include "sensor_registry.h"
+
+namespace hcc_power {
+
+/**
+ * What a sensor leaves behind across deep sleep: its report filter, and its ROM code to find it again.
+ */
+struct RetainedSensor {
+    uint64_t romCode;
+    hcc_pipeline::ReportFilter::State filter;
+};
+
+/**
+ * How many of the sensors and the samples kept next to it were retained. Plain data, to be kept in RTC memory
+ * with them.
+ */
+struct RetainedCounts {
+    int sensorCount;
+    int sampleCount;
+};
+
+/**
+ * Carries the report filters of the sensors, in the registry order at the time, and the samples the network wasn't
+ * up for, across deep sleep. The arrays and the counts are the caller's, kept in memory the deep sleep doesn't
+ * wipe out; the instance itself is created anew on every wake.
+ */
+class SleepRetainer {
+private:
+
+    const char *TAG;
+    hcc_onewire::Clock *clock;
+
+    RetainedCounts *counts;
+
+    RetainedSensor *sensors;
+    const int sensorCapacity;
+
+    hcc_pipeline::SampleRecord *samples;
+    const int sampleCapacity;
+
+public:
+
+    /**
+     * Create an instance over the retained {@code counts}, {@code sensors} and {@code samples}.
+     */
+    SleepRetainer(const char *TAG, hcc_onewire::Clock *clock, RetainedCounts *counts,
+        RetainedSensor *sensors, int sensorCapacity, hcc_pipeline::SampleRecord *samples, int sampleCapacity) :
+        TAG(TAG), clock(clock), counts(counts),
+        sensors(sensors), sensorCapacity(sensorCapacity), samples(samples), sampleCapacity(sampleCapacity)
+    {
+    }
+
+    /**
+     * Forget everything retained, on the cold boot.
+     */
+    void reset();
+
+    /**
+     * Put the report filters back the way they were before the deep sleep, and the samples retained into the
+     * {@code store}. The sensors are matched by their ROM codes, the samples of the ones gone missing are dropped.
+     */
+    void restore(hcc_pipeline::SensorDirectory *directory, hcc_pipeline::SampleStore *store);
+
+    /**
+     * Retain the report filters, and the samples still in the {@code store}. If there are more samples
+     * than fit, the oldest ones are dropped; so are the sensors past the capacity.
+     */
+    void retain(hcc_pipeline::SensorDirectory *directory, hcc_pipeline::SampleStore *store);
+
+    /**
+     * Wait until the {@code sink} is online, or the {@code deadline} passes, and publish everything in the
+     * {@code store}; the samples of the cycles other than the current {@code cycle} as late. Returns {@code false}
+     * if the sink didn't come online in time, the samples stay in the store then.
+     */
+    bool publish(hcc_pipeline::SamplePipeline *pipeline, hcc_pipeline::SampleStore *store,
+        hcc_pipeline::MessageSink *sink, uint32_t cycle, int64_t deadline);
+
+    inline int getSampleCount() const
+    {
+        return counts->sampleCount;
+    }
+};
+
+}
+
+#endif /* _HCC_ESP32_SLEEP_RETAINER_H_ */
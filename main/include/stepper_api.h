@@ -49,6 +49,8 @@ public:
      */
     virtual bool powerSave(bool enable) = 0;
 };
+
+inline Stepper::~Stepper() {}
 }
 #ifdef __cplusplus
 }
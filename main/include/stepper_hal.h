@@ -0,0 +1,145 @@
+#ifndef _HCC_ESP32_STEPPER_HAL_H_
+#define _HCC_ESP32_STEPPER_HAL_H_
+
+#include <stdint.h>
+
+namespace stepper {
+
+/**
+ * Time between the steps of a run, in microseconds.
+ *
+ * On the target, this is called from the RMT interrupt as the pulses are being emitted, so it must be fast
+ * and must not block or allocate.
+ */
+class StepTiming {
+public:
+
+    virtual ~StepTiming() {}
+
+    /**
+     * Return the time from the pulse {@code step} to the next one, counting from zero,
+     * or 0 to make it the last pulse of the run.
+     */
+    virtual uint32_t periodAt(uint32_t step) = 0;
+};
+
+/**
+ * {@link StepTiming} at a constant rate.
+ */
+class ConstantTiming : public StepTiming {
+private:
+
+    uint32_t period;
+
+public:
+
+    ConstantTiming(uint32_t periodMicros) : period(periodMicros) {}
+
+    uint32_t periodAt(uint32_t step) override
+    {
+        return period;
+    }
+};
+
+/**
+ * Emits STEP pulses in the background, timed by the hardware. This is everything the driver needs from a timer.
+ *
+ * Implementations are not thread safe.
+ */
+class PulseGenerator {
+public:
+
+    /**
+     * Duration of the STEP pulse, and the shortest time it stays low, in microseconds.
+     * The A4988 needs 1us, this leaves a margin.
+     */
+    static const uint32_t PULSE_MICROS = 2;
+
+    virtual ~PulseGenerator() {}
+
+    /**
+     * Set up the hardware. Returns {@code false} if it failed.
+     */
+    virtual bool initialize() = 0;
+
+    /**
+     * Start emitting up to {@code count} pulses, the first one {@code delayMicros} from now, and return right away.
+     * The timing can end the run earlier. Periods shorter than two {@link #PULSE_MICROS} are stretched.
+     * The timing must stay around until the run is over.
+     *
+     * Returns {@code false} if there's nothing to emit, or another run is in progress.
+     */
+    virtual bool start(uint32_t count, StepTiming *timing, uint32_t delayMicros) = 0;
+
+    /**
+     * Wait for the run in progress to complete, forever if {@code timeoutMicros} is negative.
+     * Returns {@code false} if it is still in progress.
+     */
+    virtual bool wait(int64_t timeoutMicros) = 0;
+
+    /**
+     * Abort the run in progress, and return the number of pulses emitted. No more pulses reach the pin after this returns.
+     */
+    virtual uint32_t stop() = 0;
+
+    /**
+     * Cut the pulses of the run in progress off the pin right away. Safe to call from an interrupt handler.
+     * The run may take a while to wind down after that, {@link #getPulses()} counts what made it to the pin.
+     */
+    virtual void halt() = 0;
+
+    /**
+     * Return the number of pulses the last run emitted. While the run is in progress, this may run ahead of the pin.
+     */
+    virtual uint32_t getPulses() = 0;
+
+    virtual bool isBusy() = 0;
+};
+
+/**
+ * Limit switch, stopping the pulses the moment it closes.
+ */
+class LimitSwitch {
+public:
+
+    virtual ~LimitSwitch() {}
+
+    /**
+     * Set up the hardware. Returns {@code false} if it failed.
+     */
+    virtual bool initialize() = 0;
+
+    virtual bool isPressed() = 0;
+
+    /**
+     * Halt the pulse generator as soon as the switch closes, until {@link #disarm()}.
+     */
+    virtual void arm(PulseGenerator *pulses) = 0;
+
+    virtual void disarm() = 0;
+
+    /**
+     * Return whether the switch closed since it was armed.
+     */
+    virtual bool isTriggered() = 0;
+};
+
+/**
+ * Digital outputs controlling the driver besides the STEP pin: DIR, MSx, SLP.
+ */
+class OutputPins {
+public:
+
+    virtual ~OutputPins() {}
+
+    /**
+     * Make the pin an output, and set it to the level.
+     */
+    virtual void setup(int pin, bool level) = 0;
+
+    virtual void set(int pin, bool level) = 0;
+};
+
+}
+
+#endif /* _HCC_ESP32_STEPPER_HAL_H_ */
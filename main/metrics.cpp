@@ -0,0 +1,120 @@
+#include "metrics.h"
+
+namespace hcc_metrics {
+
+Histogram::Histogram()
+{
+    reset();
+}
+
+void Histogram::reset()
+{
+    for (int offset = 0; offset < BUCKETS; offset++) {
+        buckets[offset].store(0, std::memory_order_relaxed);
+    }
+
+    count.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    min.store(UINT32_MAX, std::memory_order_relaxed);
+    max.store(0, std::memory_order_relaxed);
+}
+
+void Histogram::record(int64_t micros)
+{
+    uint32_t value = micros < 0 ? 0 : (micros > UINT32_MAX ? UINT32_MAX : (uint32_t) micros);
+
+    int bucket = value == 0 ? 0 : 31 - __builtin_clz(value);
+
+    if (bucket >= BUCKETS) {
+        bucket = BUCKETS - 1;
+    }
+
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    uint32_t current = min.load(std::memory_order_relaxed);
+
+    while (value < current && !min.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+
+    current = max.load(std::memory_order_relaxed);
+
+    while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+cJSON *Histogram::toJson(bool reset)
+{
+    uint32_t samples = count.load(std::memory_order_relaxed);
+
+    if (samples == 0) {
+        return NULL;
+    }
+
+    cJSON *json = cJSON_CreateObject();
+
+    cJSON_AddNumberToObject(json, "count", samples);
+    cJSON_AddNumberToObject(json, "min", min.load(std::memory_order_relaxed));
+    cJSON_AddNumberToObject(json, "max", max.load(std::memory_order_relaxed));
+    cJSON_AddNumberToObject(json, "mean", sum.load(std::memory_order_relaxed) / samples);
+
+    int last = 0;
+    int values[BUCKETS];
+
+    for (int offset = 0; offset < BUCKETS; offset++) {
+
+        values[offset] = buckets[offset].load(std::memory_order_relaxed);
+
+        if (values[offset] != 0) {
+            last = offset;
+        }
+    }
+
+    cJSON_AddItemToObject(json, "buckets", cJSON_CreateIntArray(values, last + 1));
+
+    if (reset) {
+        this->reset();
+    }
+
+    return json;
+}
+
+AckTracker::AckTracker()
+{
+    for (int offset = 0; offset < SLOTS; offset++) {
+        ids[offset].store(-1, std::memory_order_relaxed);
+        times[offset].store(0, std::memory_order_relaxed);
+    }
+}
+
+void AckTracker::sent(int id, int64_t micros)
+{
+    if (id < 0) {
+        return;
+    }
+
+    // Message IDs are sequential, the slots are reused in order
+    int slot = id % SLOTS;
+
+    times[slot].store((uint32_t) micros, std::memory_order_relaxed);
+    ids[slot].store(id, std::memory_order_release);
+}
+
+int64_t AckTracker::acknowledged(int id, int64_t micros)
+{
+    if (id < 0) {
+        return -1;
+    }
+
+    int slot = id % SLOTS;
+    int expected = id;
+
+    if (!ids[slot].compare_exchange_strong(expected, -1, std::memory_order_acquire)) {
+        return -1;
+    }
+
+    // Differences survive the wraparound
+    return (uint32_t) micros - times[slot].load(std::memory_order_relaxed);
+}
+}
@@ -0,0 +1,166 @@
+#include <math.h>
+#include <stdlib.h>
+
+#include "motion_planner.h"
+
+namespace stepper {
+
+MotionPlanner::MotionPlanner(A4988 *driver) : driver(driver), target(driver->getPosition())
+{
+}
+
+MotionPlanner::~MotionPlanner()
+{
+    free(ramp);
+}
+
+/**
+ * Return the time it takes to travel {@code distance} steps from rest, in seconds.
+ *
+ * {@code rampTime} and {@code rampDistance} are how long it takes, and how far it goes, to get to {@code speed}.
+ * The trapezoidal profile has the distance growing with the square of the time, the S-curve has the speed following
+ * smoothstep, 3t^2 - 2t^3, so the distance follows its integral.
+ */
+static double time_of(double distance, double speed, double rampTime, double rampDistance, Profile profile)
+{
+    if (distance >= rampDistance) {
+        return rampTime + (distance - rampDistance) / speed;
+    }
+
+    if (profile == Profile::trapezoidal) {
+        return rampTime * sqrt(distance / rampDistance);
+    }
+
+    // rampDistance * (2t^3 - t^4) is monotonic on [0, 1], bisect it
+    double low = 0;
+    double high = 1;
+
+    for (int round = 0; round < 40; round++) {
+
+        double t = (low + high) / 2;
+
+        if (rampDistance * (2 * t * t * t - t * t * t * t) < distance) {
+            low = t;
+        } else {
+            high = t;
+        }
+    }
+
+    return rampTime * (low + high) / 2;
+}
+
+bool MotionPlanner::setup(float maxSpeed, float acceleration, Profile profile)
+{
+    if (maxSpeed <= 0 || acceleration <= 0) {
+        return false;
+    }
+
+    // The S-curve takes half as long again, to peak at the same acceleration
+    double rampTime = (profile == Profile::trapezoidal ? 1.0 : 1.5) * maxSpeed / acceleration;
+    double rampDistance = maxSpeed * rampTime / 2;
+
+    uint32_t *intervals = (uint32_t *) malloc(RAMP_CAPACITY * sizeof(uint32_t));
+
+    if (intervals == NULL) {
+        return false;
+    }
+
+    int length = 0;
+    double previous = 0;
+
+    while (length < RAMP_CAPACITY) {
+
+        double next = time_of(length + 1, maxSpeed, rampTime, rampDistance, profile);
+
+        intervals[length++] = lround((next - previous) * 1000000);
+        previous = next;
+
+        if (length >= rampDistance) {
+            break;
+        }
+    }
+
+    // The last one sets the cruise speed, make it the exact one if the ramp got there
+    if (length < RAMP_CAPACITY) {
+        intervals[length++] = lround(1000000 / maxSpeed);
+    }
+
+    free(ramp);
+
+    ramp = (uint32_t *) realloc(intervals, length * sizeof(uint32_t));
+    ramp = ramp != NULL ? ramp : intervals;
+    rampLength = length;
+
+    return true;
+}
+
+void MotionPlanner::moveTo(int position)
+{
+    target = position;
+}
+
+void MotionPlanner::moveBy(int distance)
+{
+    target += distance;
+}
+
+bool MotionPlanner::update()
+{
+    if (driver->isMoving()) {
+        return true;
+    }
+
+    int position = driver->getPosition();
+    int distance = target - position;
+
+    stepSize = driver->getStepSize();
+
+    if (abs(distance) < stepSize) {
+        return false;
+    }
+
+    direction = distance > 0 ? Direction::up : Direction::down;
+    origin = position;
+    level = -1;
+
+    return driver->move(direction, UINT32_MAX, this);
+}
+
+bool MotionPlanner::isAtTarget()
+{
+    return abs(target - driver->getPosition()) < driver->getStepSize();
+}
+
+uint32_t MotionPlanner::periodAt(uint32_t step)
+{
+    int position = origin + (int) direction * (int) (step + 1) * stepSize;
+
+    // Steps left to go after this one, negative if the target is behind
+    int remaining = (target.load(std::memory_order_relaxed) - position) * (int) direction / stepSize;
+    int next;
+
+    if (remaining <= 0) {
+
+        if (level <= 0) {
+            // Slow enough to stop right here
+            return 0;
+        }
+
+        // Too fast to stop here, it's going to overshoot
+        next = level - 1;
+
+    } else {
+
+        // Speed up as long as there's room to slow down, but never slow down faster than the ramp allows
+        next = level + 1;
+        next = next < remaining - 1 ? next : remaining - 1;
+        next = next < rampLength - 1 ? next : rampLength - 1;
+        next = next > level - 1 ? next : level - 1;
+    }
+
+    level = next;
+
+    return ramp[next];
+}
+
+}
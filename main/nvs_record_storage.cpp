@@ -0,0 +1,55 @@
+#include <string.h>
+
+#include "nvs.h"
+
+#include "nvs_record_storage.h"
+
+namespace stepper {
+
+static_assert(sizeof(PositionRecord) == sizeof(uint64_t), "PositionRecord must fit a u64 NVS entry");
+
+bool NvsRecordStorage::load(PositionRecord &record)
+{
+    nvs_handle_t handle;
+
+    if (nvs_open(nvsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+
+    uint64_t value;
+    esp_err_t err = nvs_get_u64(handle, key, &value);
+
+    nvs_close(handle);
+
+    if (err != ESP_OK) {
+        return false;
+    }
+
+    memcpy(&record, &value, sizeof(record));
+
+    return true;
+}
+
+bool NvsRecordStorage::save(const PositionRecord &record)
+{
+    nvs_handle_t handle;
+
+    if (nvs_open(nvsNamespace, NVS_READWRITE, &handle) != ESP_OK) {
+        return false;
+    }
+
+    uint64_t value;
+    memcpy(&value, &record, sizeof(value));
+
+    esp_err_t err = nvs_set_u64(handle, key, value);
+
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+
+    nvs_close(handle);
+
+    return err == ESP_OK;
+}
+
+}
@@ -0,0 +1,61 @@
+#include <stdio.h>
+
+#include "nvs.h"
+
+#include "nvs_rom_cache.h"
+
+namespace hcc_onewire {
+
+bool NvsRomCache::load(const char *busName, std::vector<CachedDevice> &devices)
+{
+    nvs_handle_t handle;
+
+    if (nvs_open(nvsNamespace, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+
+    char key[16];
+    snprintf(key, sizeof(key), "rom%s", busName);
+
+    size_t size = 0;
+
+    devices.clear();
+
+    if (nvs_get_blob(handle, key, NULL, &size) == ESP_OK && size > 0 && size % sizeof(CachedDevice) == 0) {
+
+        devices.resize(size / sizeof(CachedDevice));
+
+        if (nvs_get_blob(handle, key, devices.data(), &size) != ESP_OK) {
+            devices.clear();
+        }
+    }
+
+    nvs_close(handle);
+
+    return !devices.empty();
+}
+
+bool NvsRomCache::store(const char *busName, const std::vector<CachedDevice> &devices)
+{
+    nvs_handle_t handle;
+
+    if (nvs_open(nvsNamespace, NVS_READWRITE, &handle) != ESP_OK) {
+        return false;
+    }
+
+    char key[16];
+    snprintf(key, sizeof(key), "rom%s", busName);
+
+    esp_err_t err = devices.empty() ? nvs_erase_key(handle, key) : nvs_set_blob(handle, key, devices.data(), devices.size() * sizeof(CachedDevice));
+
+    if (err == ESP_OK) {
+        err = nvs_commit(handle);
+    }
+
+    nvs_close(handle);
+
+    // Nothing to forget is not a failure
+    return err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND;
+}
+
+}
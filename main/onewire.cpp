@@ -1,139 +1,523 @@
+#include <math.h>
+#include <stdio.h>
 #include <string.h>
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-#include "driver/gpio.h"
 
 #include "esp_log.h"
 
-#include "owb.h"
-#include "owb_rmt.h"
-#include "ds18b20.h"
-
 #include "onewire.h"
 
 namespace hcc_onewire {
 
-#define DS18B20_RESOLUTION   (DS18B20_RESOLUTION_12_BIT)
 #define SAMPLE_PERIOD_MILLIS        (1000 * CONFIG_ONE_WIRE_POLL_SECONDS)
 
-int OneWire::browse()
+// Maximum 12 bit conversion time from the datasheet, plus the same 10% margin the ds18b20 component adds
+#define CONVERSION_MILLIS_12_BIT    (750 * 1.1)
+
+// How long, and how many times, to keep reading the devices that failed CRC
+#define RETRY_BUDGET_MILLIS         30
+#define MAX_RETRIES                 2
+
+// Failed polls in a row before the device is quarantined, for how many polls, and how many times it can double
+#define QUARANTINE_THRESHOLD        5
+#define QUARANTINE_POLLS            10
+#define QUARANTINE_MAX_BACKOFF      5
+
+int OneWire::browse(RomCache *romCache)
 {
+    this->romCache = romCache;
 
     // VT: FIXME: Wrap this into a mutex at some point.
 
-    // To debug OWB, use 'make menuconfig' to set default Log level to DEBUG, then uncomment:
-    //esp_log_level_set("owb", ESP_LOG_DEBUG);
+    if (!bus->initialize()) {
+        ESP_LOGE(TAG, "[1-Wire] can't initialize %s", bus->getName());
+        devicesFound = 0;
+        return devicesFound;
+    }
 
-    // Stable readings require a brief period before communication
-    vTaskDelay(2000.0 / portTICK_PERIOD_MS);
+    if (romCache != NULL && restore()) {
 
-    // Create a 1-Wire bus, using the RMT timeslot driver
-    owb = owb_rmt_initialize(&rmt_driver_info, gpioOnewire, RMT_CHANNEL_1, RMT_CHANNEL_0);
+        devicesFound = romCodes.size();
+        ESP_LOGI(TAG, "[1-Wire] %d cached device%s on %s verified", devicesFound, devicesFound == 1 ? "" : "s", bus->getName());
 
-    // enable CRC check for ROM code
-    owb_use_crc(owb, true);
+        return devicesFound;
+    }
 
-    ESP_LOGI(TAG, "[1-Wire] looking for connected devices on pin %d...", gpioOnewire);
+    // Stable readings require a brief period before communication
+    clock->sleepUntil(clock->micros() + 2000 * 1000);
+
+    ESP_LOGI(TAG, "[1-Wire] looking for connected devices on %s...", bus->getName());
 
-    std::vector<OneWireBus_ROMCode> device_rom_codes;
-    OneWireBus_SearchState search_state = {};
+    std::vector<RomCode> device_rom_codes;
+    RomCode rom_code;
     bool found = false;
-    owb_search_first(owb, &search_state, &found);
+    bus->search(true, rom_code, found);
     int devices_found = 0;
     while (found) {
         char rom_code_s[17];
-        owb_string_from_rom_code(search_state.rom_code, rom_code_s, sizeof(rom_code_s));
-        strupr(rom_code_s);
+        format_rom_code(rom_code, rom_code_s);
         ESP_LOGI(TAG, "[1-Wire] %d: %s", devices_found, rom_code_s);
-        device_rom_codes.push_back(search_state.rom_code);
-        addresses.push_back(rom_code_s);
+        device_rom_codes.push_back(rom_code);
 
         ++devices_found;
-        owb_search_next(owb, &search_state, &found);
+        bus->search(false, rom_code, found);
     }
-    ESP_LOGI(TAG, "[1-Wire] found %d device%s on pin %d", devices_found, devices_found == 1 ? "" : "s", gpioOnewire);
+    ESP_LOGI(TAG, "[1-Wire] found %d device%s on %s", devices_found, devices_found == 1 ? "" : "s", bus->getName());
 
     // Create DS18B20 devices on the 1-Wire bus
     for (int i = 0; i < devices_found; ++i) {
-        DS18B20_Info *ds18b20_info = ds18b20_malloc();
-        devices.push_back(ds18b20_info);
+        addDevice(device_rom_codes[i], devices_found == 1, defaultResolution);
+    }
 
-        if (devices_found == 1) {
-            ESP_LOGD(TAG, "[1-Wire] single device optimizations enabled");
-            ds18b20_init_solo(ds18b20_info, owb);
-        } else {
-            // associate with bus and device
-            ds18b20_init(ds18b20_info, owb, device_rom_codes[i]);
+    devicesFound = devices_found;
+
+    persist();
+
+    return devicesFound;
+}
+
+bool OneWire::restore()
+{
+    std::vector<CachedDevice> cached;
+
+    if (!romCache->load(bus->getName(), cached) || cached.empty()) {
+        return false;
+    }
+
+    // Even if it's stale, so that persist() knows to replace it
+    cachedDevices = cached;
+
+    // Targeted reads are much faster than the full search
+    for (auto &c : cached) {
+
+        bool present = false;
+
+        if (!bus->verify(c.romCode, present) || !present) {
+
+            char rom_code_s[17];
+            format_rom_code(c.romCode, rom_code_s);
+
+            ESP_LOGI(TAG, "[1-Wire] cached device %s on %s doesn't respond, falling back to the full search", rom_code_s, bus->getName());
+
+            return false;
         }
+    }
+
+    for (auto &c : cached) {
+
+        ResolutionState resolution = defaultResolution;
+
+        resolution.policy = (ResolutionPolicy) c.policy;
+        resolution.high = (Resolution) c.high;
+        resolution.low = (Resolution) c.low;
+        resolution.current = resolution.high;
 
-        // enable CRC check for temperature readings
-        ds18b20_use_crc(ds18b20_info, true);
-        ds18b20_set_resolution(ds18b20_info, DS18B20_RESOLUTION);
+        addDevice(c.romCode, cached.size() == 1, resolution);
     }
 
-    devicesFound = devices_found;
+    return true;
+}
 
-    return devicesFound;
+void OneWire::persist()
+{
+    if (romCache == NULL) {
+        return;
+    }
+
+    std::vector<CachedDevice> cached;
+
+    for (int offset = 0; offset < (int) romCodes.size(); offset++) {
+
+        // A retired device would fail the verification on every boot
+        if (!present[offset]) {
+            continue;
+        }
+
+        CachedDevice c = {};
+
+        c.romCode = romCodes[offset];
+        c.policy = (uint8_t) resolutions[offset].policy;
+        c.high = resolutions[offset].high;
+        c.low = resolutions[offset].low;
+
+        cached.push_back(c);
+    }
+
+    // Every full search ends up here, and mostly finds the same devices; spare the flash
+    if (cached.size() == cachedDevices.size()
+        && (cached.empty() || memcmp(cached.data(), cachedDevices.data(), cached.size() * sizeof(CachedDevice)) == 0)) {
+        return;
+    }
+
+    if (!romCache->store(bus->getName(), cached)) {
+        ESP_LOGW(TAG, "[1-Wire] can't cache devices on %s", bus->getName());
+        return;
+    }
+
+    cachedDevices = cached;
+}
+
+void OneWire::addDevice(const RomCode &romCode, bool solo, const ResolutionState &resolution)
+{
+    char rom_code_s[17];
+    format_rom_code(romCode, rom_code_s);
+
+    if (solo) {
+        ESP_LOGD(TAG, "[1-Wire] single device optimizations enabled");
+    }
+
+    // Devices are attached in the same order they are added, the offsets are the same
+    int offset = bus->attach(romCode, solo);
+    bus->setResolution(offset, resolution.current);
+
+    addresses.push_back(rom_code_s);
+    resolutions.push_back(resolution);
+    romCodes.push_back(romCode);
+    present.push_back(true);
+    stats.push_back({});
+}
+
+bool OneWire::rescan(int budget)
+{
+    bool found = false;
+    bool ok;
+    RomCode romCode;
+
+    if (!rescanInProgress) {
+
+        rescanFound.clear();
+        rescanInProgress = true;
+
+        ok = bus->search(true, romCode, found);
+
+    } else {
+        ok = bus->search(false, romCode, found);
+    }
+
+    for (int steps = 0; ok && found; ) {
+
+        rescanFound.push_back(romCode);
+
+        if (++steps >= budget) {
+            // To be continued between the next conversions
+            return false;
+        }
+
+        ok = bus->search(false, romCode, found);
+    }
+
+    rescanInProgress = false;
+
+    if (!ok) {
+        // A glitch is not a reason to retire everything, try again next time
+        ESP_LOGW(TAG, "[1-Wire] rescan on %s failed", bus->getName());
+        return false;
+    }
+
+    return reconcile();
+}
+
+bool OneWire::reconcile()
+{
+    bool changed = false;
+    std::vector<bool> known(rescanFound.size(), false);
+
+    for (int offset = 0; offset < (int) romCodes.size(); offset++) {
+
+        bool seen = false;
+
+        for (int found = 0; found < (int) rescanFound.size(); found++) {
+            if (memcmp(romCodes[offset].bytes, rescanFound[found].bytes, sizeof(RomCode)) == 0) {
+                seen = true;
+                known[found] = true;
+                break;
+            }
+        }
+
+        if (seen != present[offset]) {
+
+            ESP_LOGI(TAG, "[1-Wire] %s: %s", addresses[offset].c_str(), seen ? "back on the bus" : "gone, retired");
+
+            if (seen) {
+                // It may have been power cycled and lost the resolution
+                bus->setResolution(offset, resolutions[offset].current);
+                resolutions[offset].hasValue = false;
+
+                // Give it a fresh start
+                stats[offset].consecutiveFailures = 0;
+                stats[offset].quarantineLeft = 0;
+            }
+
+            present[offset] = seen;
+            changed = true;
+        }
+    }
+
+    for (int found = 0; found < (int) rescanFound.size(); found++) {
+
+        if (known[found]) {
+            continue;
+        }
+
+        if (romCodes.size() == 1 && bus->isSolo(0)) {
+            // Not alone anymore, must be addressed by the ROM code from now on
+            bus->setSolo(0, false);
+        }
+
+        addDevice(rescanFound[found], false, defaultResolution);
+        ESP_LOGI(TAG, "[1-Wire] %d: %s, new", (int) romCodes.size() - 1, addresses.back().c_str());
+
+        changed = true;
+    }
+
+    devicesFound = romCodes.size();
+
+    if (changed) {
+        persist();
+    }
+
+    return changed;
 }
 
-/**
- * Turn the LED on for the time specified in menuconfig, then turn it off.
- */
-void OneWire::flashLED()
+long OneWire::getConversionMillis(Resolution resolution)
 {
+    int divisor = 1 << (RESOLUTION_12_BIT - resolution);
 
-    if (gpioLED == GPIO_NUM_NC) {
+    return (long) (CONVERSION_MILLIS_12_BIT / divisor + 0.5);
+}
+
+long OneWire::getConversionMillis()
+{
+    Resolution highest = RESOLUTION_9_BIT;
+
+    // Devices that are not going to be read don't count
+    for (int offset = 0; offset < (int) romCodes.size(); offset++) {
+        if (present[offset] && stats[offset].quarantineLeft == 0 && resolutions[offset].current > highest) {
+            highest = resolutions[offset].current;
+        }
+    }
+
+    return getConversionMillis(highest);
+}
+
+void OneWire::setResolution(int offset, Resolution resolution)
+{
+    if (resolutions[offset].current == resolution) {
         return;
     }
 
-    gpio_pad_select_gpio(gpioLED);
-    gpio_set_direction(gpioLED, GPIO_MODE_OUTPUT);
+    ESP_LOGD(TAG, "[1-Wire] %s: resolution %d => %d bits", addresses[offset].c_str(), resolutions[offset].current, resolution);
+
+    if (bus->setResolution(offset, resolution)) {
+        resolutions[offset].current = resolution;
+    }
+}
 
-    gpio_set_level(gpioLED, 1);
+void OneWire::setResolutionPolicy(int offset, ResolutionPolicy policy, Resolution high, Resolution low)
+{
+    ResolutionState &r = resolutions[offset];
 
-    const TickType_t delayMillis = flashMillis / portTICK_PERIOD_MS;
-    vTaskDelay( delayMillis );
+    r.policy = policy;
+    r.high = high;
+    r.low = low;
+    r.stableCycles = 0;
 
-    gpio_set_level(gpioLED, 0);
+    setResolution(offset, high);
+    persist();
 }
 
-std::vector<float> OneWire::poll()
+void OneWire::adapt(int offset, float value)
 {
+    ResolutionState &r = resolutions[offset];
+
+    if (r.policy != ResolutionPolicy::adaptive) {
+        r.lastValue = value;
+        r.hasValue = true;
+        return;
+    }
 
-    flashLED();
+    // A change smaller than one low resolution step wouldn't be visible at low resolution anyway
+    float step = 0.0625f * (1 << (RESOLUTION_12_BIT - r.low));
 
-    float readings[devices.size()] = { 0 };
-    DS18B20_ERROR errors[devices.size()] = {};
+    if (r.hasValue && fabsf(value - r.lastValue) < step) {
+        r.stableCycles++;
+    } else {
+        r.stableCycles = 0;
+    }
+
+    r.lastValue = value;
+    r.hasValue = true;
+
+    setResolution(offset, r.stableCycles >= stableCycles ? r.low : r.high);
+}
+
+void OneWire::startConversion()
+{
+
+    if (led != NULL) {
+        led->flash(flashMillis);
+    }
 
     // Read temperatures more efficiently by starting conversions on all devices at the same time
-    ds18b20_convert_all(owb);
+    bus->convertAll();
+
+    // Every device's resolution determines when its conversion is complete, see collect()
+    conversionStarted = clock->micros();
+}
+
+bool OneWire::isReady()
+{
+    return conversionStarted != 0 && clock->micros() >= conversionStarted + getConversionMillis() * 1000;
+}
 
-    // In this application all devices use the same resolution,
-    // so use the first device to determine the delay
-    ds18b20_wait_for_conversion(devices[0]);
+std::vector<Reading> OneWire::collect()
+{
+
+    if (conversionStarted == 0) {
+        startConversion();
+    }
+
+    int64_t collectStarted = clock->micros();
+    int64_t waitMicros = 0;
+
+    std::vector<Reading> result(romCodes.size(), { NAN, ReadingStatus::ok, BusError::ok, RESOLUTION_12_BIT });
+
+    for (int offset = 0; offset < devicesFound; ++offset) {
+
+        if (!present[offset]) {
+            result[offset].status = ReadingStatus::retired;
+        } else if (stats[offset].quarantineLeft > 0) {
+            stats[offset].quarantineLeft--;
+            result[offset].status = ReadingStatus::quarantined;
+        }
+    }
 
+    // Devices at lower resolution are done sooner, read them as soon as they are, group by group.
     // Read the results immediately after conversion otherwise it may fail
     // (using printf before reading may take too long)
-    for (int offset = 0; offset < devicesFound; ++offset) {
-        errors[offset] = ds18b20_read_temp(devices[offset], &readings[offset]);
+    for (int resolution = RESOLUTION_9_BIT; resolution <= RESOLUTION_12_BIT; resolution++) {
+
+        bool waited = false;
+
+        for (int offset = 0; offset < devicesFound; ++offset) {
+
+            if (resolutions[offset].current != resolution || result[offset].status != ReadingStatus::ok) {
+                continue;
+            }
+
+            if (!waited) {
+                int64_t waitStarted = clock->micros();
+                clock->sleepUntil(conversionStarted + getConversionMillis((Resolution) resolution) * 1000);
+                waitMicros += clock->micros() - waitStarted;
+                waited = true;
+            }
+
+            result[offset].error = bus->read(offset, result[offset].value);
+            result[offset].resolution = (Resolution) resolution;
+        }
+    }
+
+    conversionStarted = 0;
+
+    // Only CRC failures are worth retrying, the conversion result stays in the scratchpad until the next conversion.
+    // Nothing else is, a device that doesn't respond is not going to respond a millisecond later either.
+    int64_t retryDeadline = clock->micros() + RETRY_BUDGET_MILLIS * 1000;
+
+    for (int attempt = 0; attempt < MAX_RETRIES; attempt++) {
+
+        for (int offset = 0; offset < devicesFound; ++offset) {
+
+            if (result[offset].error != BusError::crc || clock->micros() >= retryDeadline) {
+                continue;
+            }
+
+            stats[offset].failures++;
+            stats[offset].crcErrors++;
+            stats[offset].retries++;
+
+            result[offset].error = bus->read(offset, result[offset].value);
+
+            if (result[offset].error == BusError::ok) {
+                stats[offset].recovered++;
+            }
+        }
     }
 
-    int errors_count[devices.size()] = {0};
-    std::vector<float> result;
+    lastTiming.waitMicros = waitMicros;
+    lastTiming.readMicros = clock->micros() - collectStarted - waitMicros;
 
     // Report results in a separate loop, after all have been read
     for (int offset = 0; offset < devicesFound; ++offset) {
-        if (errors[offset] != DS18B20_OK) {
-            // VT: NOTE: What exactly does the error count indicate here? Need to RTFM again.
-            ++errors_count[offset];
+
+        Reading &r = result[offset];
+
+        if (r.status != ReadingStatus::ok) {
+            continue;
         }
 
-        // VT: FIXME: This will not handle errors correctly
-        result.push_back(readings[offset]);
+        if (r.error != BusError::ok) {
+
+            stats[offset].failures++;
+
+            if (r.error == BusError::crc) {
+                stats[offset].crcErrors++;
+            }
+
+            r.status = ReadingStatus::failed;
+            r.value = NAN;
+
+            account(offset, false);
+
+        } else {
+
+            account(offset, true);
+            adapt(offset, r.value);
+        }
     }
 
-    flashLED();
+    if (led != NULL) {
+        led->flash(flashMillis);
+    }
 
     return result;
 }
+
+void OneWire::account(int offset, bool ok)
+{
+    DeviceStats &s = stats[offset];
+
+    s.reads++;
+
+    if (ok) {
+
+        if (s.consecutiveFailures >= QUARANTINE_THRESHOLD) {
+            ESP_LOGI(TAG, "[1-Wire] %s: released from quarantine", addresses[offset].c_str());
+        }
+
+        s.consecutiveFailures = 0;
+
+        return;
+    }
+
+    s.consecutiveFailures++;
+
+    if (s.consecutiveFailures < QUARANTINE_THRESHOLD) {
+        return;
+    }
+
+    // Every failed attempt after the quarantine doubles it
+    int backoff = s.consecutiveFailures - QUARANTINE_THRESHOLD;
+
+    s.quarantines++;
+    s.quarantineLeft = QUARANTINE_POLLS << (backoff < QUARANTINE_MAX_BACKOFF ? backoff : QUARANTINE_MAX_BACKOFF);
+
+    ESP_LOGW(TAG, "[1-Wire] %s: failed %d polls in a row, quarantined for %d polls (%u failures, %u CRC errors, %u/%u retries recovered)",
+        addresses[offset].c_str(), s.consecutiveFailures, s.quarantineLeft, s.failures, s.crcErrors, s.recovered, s.retries);
+}
+
+std::vector<Reading> OneWire::poll()
+{
+    startConversion();
+
+    return collect();
+}
 }
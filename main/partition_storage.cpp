@@ -0,0 +1,32 @@
+#include "esp_partition.h"
+
+#include "partition_storage.h"
+
+namespace hcc_pipeline {
+
+size_t PartitionStorage::size()
+{
+    // Don't let the last partial sector, if any, confuse the sector math
+    return partition->size - partition->size % SPI_FLASH_SEC_SIZE;
+}
+
+size_t PartitionStorage::sectorSize()
+{
+    return SPI_FLASH_SEC_SIZE;
+}
+
+bool PartitionStorage::erase(size_t offset, size_t length)
+{
+    return esp_partition_erase_range(partition, offset, length) == ESP_OK;
+}
+
+bool PartitionStorage::write(size_t offset, const void *data, size_t length)
+{
+    return esp_partition_write(partition, offset, data, length) == ESP_OK;
+}
+
+bool PartitionStorage::read(size_t offset, void *data, size_t length)
+{
+    return esp_partition_read(partition, offset, data, length) == ESP_OK;
+}
+}
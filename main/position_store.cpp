@@ -0,0 +1,89 @@
+#include "position_store.h"
+
+namespace stepper {
+
+bool PositionStore::write(const PositionRecord &record, int64_t now)
+{
+    lastWrite = now;
+
+    if (!storage->save(record)) {
+        return false;
+    }
+
+    stored = record;
+    writes++;
+
+    return true;
+}
+
+bool PositionStore::restore(int &position, int &microstep)
+{
+    PositionRecord record = {};
+
+    if (!storage->load(record) || record.version != VERSION) {
+        return false;
+    }
+
+    stored = record;
+
+    if (!record.clean) {
+        return false;
+    }
+
+    position = record.position;
+    microstep = record.microstep;
+
+    return true;
+}
+
+bool PositionStore::moving(int64_t now)
+{
+    idleSince = -1;
+
+    if (!stored.clean) {
+        return true;
+    }
+
+    PositionRecord record = stored;
+
+    record.clean = 0;
+
+    return write(record, now);
+}
+
+int64_t PositionStore::idle(int position, int microstep, int64_t now)
+{
+    if (idleSince < 0) {
+        idleSince = now;
+    }
+
+    if (stored.clean && stored.position == position && stored.microstep == microstep) {
+        return -1;
+    }
+
+    int64_t due = idleSince + settleMicros;
+
+    if (lastWrite != INT64_MIN && lastWrite + intervalMicros > due) {
+        due = lastWrite + intervalMicros;
+    }
+
+    if (now < due) {
+        return due;
+    }
+
+    PositionRecord record = {};
+
+    record.version = VERSION;
+    record.clean = 1;
+    record.microstep = (uint8_t) microstep;
+    record.position = position;
+
+    if (!write(record, now)) {
+        // Try again after the interval, a failing flash doesn't need hammering
+        return now + intervalMicros;
+    }
+
+    return -1;
+}
+
+}
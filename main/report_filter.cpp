@@ -0,0 +1,53 @@
+#include <math.h>
+
+#include "report_filter.h"
+
+namespace hcc_pipeline {
+
+void ReportFilter::configure(float deadband, int64_t heartbeatMillis)
+{
+    this->deadband = deadband;
+    this->heartbeatMillis = heartbeatMillis;
+}
+
+bool ReportFilter::accept(float value, int64_t timestamp)
+{
+    bool report = !reported
+        || deadband <= 0
+        || fabsf(value - lastValue) >= deadband
+        || (heartbeatMillis > 0 && timestamp - lastTimestamp >= heartbeatMillis);
+
+    if (!report) {
+        suppressed++;
+        return false;
+    }
+
+    reported = true;
+    lastValue = value;
+    lastTimestamp = timestamp;
+
+    return true;
+}
+
+ReportFilter::State ReportFilter::save() const
+{
+    State state = {};
+
+    state.deadband = deadband;
+    state.heartbeatMillis = heartbeatMillis;
+    state.reported = reported;
+    state.lastValue = lastValue;
+    state.lastTimestamp = lastTimestamp;
+
+    return state;
+}
+
+void ReportFilter::restore(const State &state)
+{
+    deadband = state.deadband;
+    heartbeatMillis = state.heartbeatMillis;
+    reported = state.reported;
+    lastValue = state.lastValue;
+    lastTimestamp = state.lastTimestamp;
+}
+}
@@ -0,0 +1,294 @@
+#include "freertos/FreeRTOS.h"
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "esp32/rom/gpio.h"
+#include "soc/gpio_sig_map.h"
+
+#include "rmt_pulse_generator.h"
+
+namespace stepper {
+
+// 80MHz APB clock divided down to 1us ticks
+#define RMT_CLOCK_DIVIDER   80
+
+// Longest duration one half of an RMT item can hold, in ticks
+#define RMT_DURATION_MAX    32767
+
+// How long the RMT takes to report the end of a stopped run, in ticks
+#define RMT_STOP_TICKS      (10 / portTICK_PERIOD_MS + 1)
+
+/*
+ * The limit switch and the RMT interrupts are registered with ESP_INTR_FLAG_IRAM, so they are served while the flash
+ * cache is off, and nothing they run may live in flash. The handlers are in IRAM, and use the GPIO ROM functions
+ * instead of the driver. linker.lf keeps this file and the step timings in IRAM, with their vtables in DRAM.
+ */
+
+static inline bool IRAM_ATTR input_level(gpio_num_t gpio)
+{
+    return gpio < 32 ? (gpio_input_get() >> gpio) & 1 : (gpio_input_get_high() >> (gpio - 32)) & 1;
+}
+
+static inline void IRAM_ATTR output_low(gpio_num_t gpio)
+{
+    if (gpio < 32) {
+        gpio_output_set(0, 1UL << gpio, 0, 0);
+    } else {
+        gpio_output_set_high(0, 1UL << (gpio - 32), 0, 0);
+    }
+}
+
+void GpioOutputPins::setup(int pin, bool level)
+{
+    gpio_pad_select_gpio(pin);
+    gpio_set_direction((gpio_num_t) pin, GPIO_MODE_OUTPUT);
+    gpio_set_level((gpio_num_t) pin, level);
+}
+
+void GpioOutputPins::set(int pin, bool level)
+{
+    gpio_set_level((gpio_num_t) pin, level);
+}
+
+bool GpioLimitSwitch::initialize()
+{
+    gpio_pad_select_gpio(gpio);
+    gpio_set_direction(gpio, GPIO_MODE_INPUT);
+    gpio_set_pull_mode(gpio, GPIO_PULLUP_ONLY);
+    gpio_set_intr_type(gpio, GPIO_INTR_NEGEDGE);
+
+    // Someone else may have installed it already, that's fine
+    esp_err_t rc = gpio_install_isr_service(ESP_INTR_FLAG_IRAM);
+
+    if (rc != ESP_OK && rc != ESP_ERR_INVALID_STATE) {
+        return false;
+    }
+
+    return gpio_isr_handler_add(gpio, handler, this) == ESP_OK;
+}
+
+void IRAM_ATTR GpioLimitSwitch::handler(void *arg)
+{
+    GpioLimitSwitch *s = (GpioLimitSwitch *) arg;
+    PulseGenerator *pulses = s->pulses;
+
+    // The contacts bounce, every edge but the first finds the generator halted already
+    if (pulses != NULL && !input_level(s->gpio)) {
+        pulses->halt();
+        s->triggered = true;
+    }
+}
+
+bool GpioLimitSwitch::isPressed()
+{
+    return gpio_get_level(gpio) == 0;
+}
+
+void GpioLimitSwitch::arm(PulseGenerator *pulses)
+{
+    triggered = false;
+    this->pulses = pulses;
+}
+
+void GpioLimitSwitch::disarm()
+{
+    pulses = NULL;
+}
+
+bool GpioLimitSwitch::isTriggered()
+{
+    return triggered;
+}
+
+RmtPulseGenerator *RmtPulseGenerator::instance = NULL;
+
+RmtPulseGenerator::RmtPulseGenerator(gpio_num_t gpio, rmt_channel_t channel) : gpio(gpio), channel(channel), rendered(0), stopping(false)
+{
+}
+
+bool RmtPulseGenerator::initialize()
+{
+    if (instance != NULL) {
+        return false;
+    }
+
+    rmt_config_t config = {};
+
+    config.rmt_mode = RMT_MODE_TX;
+    config.channel = channel;
+    config.gpio_num = gpio;
+    config.clk_div = RMT_CLOCK_DIVIDER;
+    config.mem_block_num = 1;
+    config.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+    config.tx_config.idle_output_en = true;
+
+    if (rmt_config(&config) != ESP_OK
+        || rmt_driver_install(channel, 0, ESP_INTR_FLAG_IRAM) != ESP_OK
+        || rmt_translator_init(channel, translate) != ESP_OK) {
+        return false;
+    }
+
+    instance = this;
+
+    return true;
+}
+
+void IRAM_ATTR RmtPulseGenerator::translate(const void *src, rmt_item32_t *dest, size_t src_size, size_t wanted_num, size_t *translated_size, size_t *item_num)
+{
+    RmtPulseGenerator *g = instance;
+
+    size_t items = 0;
+    size_t pulses = 0;
+
+    while (items < wanted_num && !g->finished && !g->stopping) {
+
+        rmt_item32_t &item = dest[items];
+
+        if (g->gap > 0) {
+
+            // A zero duration ends the transmission, so both halves of the item must have some,
+            // and what's left for the next item must not be less than 2 either
+            uint32_t piece = g->gap <= 2 * RMT_DURATION_MAX ? g->gap
+                : (g->gap - 2 * RMT_DURATION_MAX >= 2 ? 2 * RMT_DURATION_MAX : RMT_DURATION_MAX);
+
+            item.level0 = 0;
+            item.duration0 = piece / 2;
+            item.level1 = 0;
+            item.duration1 = piece - piece / 2;
+
+            g->gap -= piece;
+            items++;
+            continue;
+        }
+
+        uint32_t pulse = g->rendered.load(std::memory_order_relaxed);
+        uint32_t period = pulse + 1 < g->count ? g->timing->periodAt(pulse) : 0;
+
+        // The tail of the last pulse is of no interest to anyone
+        uint32_t low = PULSE_MICROS;
+
+        if (period == 0) {
+            g->finished = true;
+        } else if (period > 2 * PULSE_MICROS) {
+            low = period - PULSE_MICROS;
+        }
+
+        uint32_t first = low <= RMT_DURATION_MAX ? low
+            : (low - RMT_DURATION_MAX >= 2 ? RMT_DURATION_MAX : RMT_DURATION_MAX - 2);
+
+        item.level0 = 1;
+        item.duration0 = PULSE_MICROS;
+        item.level1 = 0;
+        item.duration1 = first;
+
+        g->gap = low - first;
+        g->scheduled[pulse % SCHEDULE_SIZE] = g->elapsed;
+        g->elapsed += PULSE_MICROS + low;
+
+        // Publish the schedule entry before the pulse count, stop() reads them in the opposite order
+        g->rendered.store(pulse + 1, std::memory_order_release);
+
+        pulses++;
+        items++;
+    }
+
+    // Once the run is over, the rest of the source is of no use. The driver ends the run when the memory drains
+    *translated_size = g->finished || g->stopping ? src_size : pulses;
+    *item_num = items;
+}
+
+bool RmtPulseGenerator::start(uint32_t count, StepTiming *timing, uint32_t delayMicros)
+{
+    if (count == 0) {
+        return false;
+    }
+
+    if (stopping) {
+
+        // Cut the remains of the stopped run short rather than letting them drain, then get the pin back.
+        // The driver only lets go of the channel when the end of the transmission is reported
+        rmt_tx_stop(channel);
+        rmt_memory_rw_rst(channel);
+
+        if (rmt_wait_tx_done(channel, RMT_STOP_TICKS) != ESP_OK) {
+            return false;
+        }
+
+        rmt_set_pin(channel, RMT_MODE_TX, gpio);
+        stopping = false;
+
+    } else if (isBusy()) {
+        return false;
+    }
+
+    this->count = count;
+    this->timing = timing;
+
+    gap = delayMicros < PULSE_MICROS ? PULSE_MICROS : delayMicros;
+    elapsed = gap;
+    rendered = 0;
+    finished = false;
+
+    // The transmission starts inside rmt_write_sample(), and the limit switch may halt it before that returns.
+    // Every byte of the source is a pulse, the translator doesn't look at them
+    started = esp_timer_get_time();
+    rmt_write_sample(channel, (const uint8_t *) this, count, false);
+
+    return true;
+}
+
+bool RmtPulseGenerator::wait(int64_t timeoutMicros)
+{
+    // Round up, or we'll give up a tick too early
+    TickType_t ticks = timeoutMicros < 0 ? portMAX_DELAY
+        : (timeoutMicros + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+
+    return rmt_wait_tx_done(channel, ticks) == ESP_OK;
+}
+
+void IRAM_ATTR RmtPulseGenerator::halt()
+{
+    if (stopping) {
+        return;
+    }
+
+    // Take the pin away from the RMT first, so that the count can't change after it's taken
+    output_low(gpio);
+    gpio_matrix_out(gpio, SIG_GPIO_OUT_IDX, false, false);
+
+    halted = (uint32_t) (esp_timer_get_time() - started);
+    stopping.store(true, std::memory_order_release);
+}
+
+uint32_t RmtPulseGenerator::stop()
+{
+    if (!stopping && isBusy()) {
+        halt();
+    }
+
+    return getPulses();
+}
+
+uint32_t RmtPulseGenerator::getPulses()
+{
+    uint32_t emitted = rendered.load(std::memory_order_acquire);
+
+    if (!stopping.load(std::memory_order_acquire)) {
+        return emitted;
+    }
+
+    // The pulses rendered but scheduled past the halt never made it to the pin
+    uint32_t oldest = emitted > SCHEDULE_SIZE ? emitted - SCHEDULE_SIZE : 0;
+
+    while (emitted > oldest && (int32_t) (scheduled[(emitted - 1) % SCHEDULE_SIZE] - halted) > 0) {
+        emitted--;
+    }
+
+    return emitted;
+}
+
+bool RmtPulseGenerator::isBusy()
+{
+    return rmt_wait_tx_done(channel, 0) != ESP_OK;
+}
+
+}
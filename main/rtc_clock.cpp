@@ -0,0 +1,23 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp32/clk.h"
+
+#include "rtc_clock.h"
+
+namespace hcc_power {
+
+int64_t RtcClock::micros()
+{
+    return esp_clk_rtc_time();
+}
+
+void RtcClock::sleepUntil(int64_t deadline)
+{
+    int64_t remaining = deadline - esp_clk_rtc_time();
+
+    if (remaining > 0) {
+        vTaskDelay((remaining + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000));
+    }
+}
+
+}
@@ -0,0 +1,184 @@
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample_payload.h"
+
+namespace hcc_mqtt {
+
+size_t render_number(char *buffer, double value)
+{
+    if (isnan(value) || isinf(value)) {
+        strcpy(buffer, "null");
+        return 4;
+    }
+
+    // cJSON keeps a saturated integer copy of every number, and prints that if it is exact
+    int valueint = value >= INT_MAX ? INT_MAX : (value <= (double) INT_MIN ? INT_MIN : (int) value);
+
+    if (value == (double) valueint) {
+        return snprintf(buffer, NUMBER_CAPACITY, "%d", valueint);
+    }
+
+    // Try 15 significant digits first, fall back to 17 if that doesn't survive the round trip
+    size_t length = snprintf(buffer, NUMBER_CAPACITY, "%1.15g", value);
+
+    if (strtod(buffer, NULL) != value) {
+        length = snprintf(buffer, NUMBER_CAPACITY, "%1.17g", value);
+    }
+
+    return length;
+}
+
+bool SamplePayload::setup(const char *address, const char *device_id)
+{
+    int prefix = snprintf(buffer, CAPACITY,
+        "{\"entity_type\":\"sensor\",\"name\":\"%s\",\"signature\":\"T%s\",\"signal\":",
+        address, address);
+
+    if (prefix < 0 || (size_t) prefix + NUMBER_CAPACITY >= CAPACITY) {
+        return false;
+    }
+
+    int tail = snprintf(suffix, sizeof(suffix), ",\"device_id\":\"%s\"}", device_id);
+
+    if (tail < 0 || (size_t) tail >= sizeof(suffix) || prefix + NUMBER_CAPACITY + tail + TIMESTAMP_CAPACITY >= CAPACITY) {
+        return false;
+    }
+
+    signalOffset = prefix;
+    suffixLength = tail;
+
+    return true;
+}
+
+size_t SamplePayload::render(float signal)
+{
+    // Same promotion to double cJSON_AddNumberToObject() does
+    size_t offset = signalOffset + render_number(buffer + signalOffset, signal);
+
+    // Copy the terminating zero as well
+    memcpy(buffer + offset, suffix, suffixLength + 1);
+    length = offset + suffixLength;
+
+    return length;
+}
+
+size_t SamplePayload::render(float signal, int64_t timestamp)
+{
+    size_t offset = signalOffset + render_number(buffer + signalOffset, signal);
+
+    // Everything but the closing brace
+    memcpy(buffer + offset, suffix, suffixLength - 1);
+    offset += suffixLength - 1;
+
+    length = offset + snprintf(buffer + offset, CAPACITY - offset, ",\"timestamp\":%lld}", (long long) timestamp);
+
+    return length;
+}
+
+BatchPayload::~BatchPayload()
+{
+    free(buffer);
+}
+
+bool BatchPayload::setup(const char *device_id, int sensorCount)
+{
+    int rendered = snprintf(header, sizeof(header), "{\"entity_type\":\"sensor\",\"device_id\":\"%s\",\"timestamp\":", device_id);
+
+    if (rendered < 0 || (size_t) rendered >= sizeof(header)) {
+        return false;
+    }
+
+    headerLength = rendered;
+
+    free(buffer);
+    buffer = NULL;
+    capacity = 0;
+    length = 0;
+    entries = 0;
+
+    if (!reserve(sensorCount)) {
+        return false;
+    }
+
+    begin(0);
+
+    return true;
+}
+
+bool BatchPayload::reserve(int sensorCount)
+{
+    // Header, timestamp, and the closing brackets; every sample is shorter than a whole sample message
+    size_t required = headerLength + NUMBER_CAPACITY + 16 + sensorCount * SamplePayload::CAPACITY;
+
+    if (required <= capacity) {
+        return true;
+    }
+
+    // Keeps whatever was rendered so far
+    char *grown = (char *) realloc(buffer, required);
+
+    if (grown == NULL) {
+        return false;
+    }
+
+    buffer = grown;
+    capacity = required;
+
+    return true;
+}
+
+bool BatchPayload::begin(int64_t timestamp)
+{
+    length = 0;
+    entries = 0;
+
+    // Not set up, or the buffer couldn't be allocated
+    if (buffer == NULL || headerLength == 0) {
+        return false;
+    }
+
+    memcpy(buffer, header, headerLength);
+    length = headerLength;
+    length += snprintf(buffer + length, capacity - length, "%lld,\"samples\":[", (long long) timestamp);
+
+    return true;
+}
+
+bool BatchPayload::add(const SamplePayload &sample, float signal)
+{
+    // Not begun: there was no buffer for it. Separator, braces, closing brackets and the terminating zero
+    if (length == 0 || length + sample.fieldsLength() + NUMBER_CAPACITY + 6 > capacity) {
+        return false;
+    }
+
+    if (entries > 0) {
+        buffer[length++] = ',';
+    }
+
+    buffer[length++] = '{';
+    memcpy(buffer + length, sample.fields(), sample.fieldsLength());
+    length += sample.fieldsLength();
+    length += render_number(buffer + length, signal);
+    buffer[length++] = '}';
+
+    entries++;
+
+    return true;
+}
+
+size_t BatchPayload::finish()
+{
+    if (length == 0) {
+        return 0;
+    }
+
+    memcpy(buffer + length, "]}", 3);
+    length += 2;
+
+    return length;
+}
+}
@@ -0,0 +1,315 @@
+#include <algorithm>
+
+#include "esp_log.h"
+
+#include "sample_pipeline.h"
+
+namespace hcc_pipeline {
+
+bool SamplePipeline::setup(const char *deviceId, const char *batchTopic, const char *cborBatchTopic, int sensorCount)
+{
+    this->batchTopic = batchTopic;
+    this->cborBatchTopic = cborBatchTopic;
+
+    if (!config.batch) {
+        return true;
+    }
+
+    bool ok = true;
+
+    if (config.json && !batch.setup(deviceId, sensorCount)) {
+        ESP_LOGE(TAG, "[mqtt] can't allocate batch message for %d sensors", sensorCount);
+        ok = false;
+    }
+
+    if (config.cbor && !cborBatch.setup(deviceId, sensorCount)) {
+        ESP_LOGE(TAG, "[mqtt] can't allocate CBOR batch message for %d sensors", sensorCount);
+        ok = false;
+    }
+
+    return ok;
+}
+
+void SamplePipeline::sample(const std::vector<int> &sensorOffsets, const std::vector<hcc_onewire::Reading> &readings, SampleRecord &record, int64_t now)
+{
+    // The publisher had nowhere to put a sample, who knows whose
+    if (dropped.exchange(false)) {
+        forget(NULL);
+    }
+
+    int count = std::min(readings.size(), sensorOffsets.size());
+
+    for (int device = 0; device < count; device++) {
+
+        int sensorOffset = sensorOffsets[device];
+        Sensor *s = sensors->at(sensorOffset);
+        const hcc_onewire::Reading &r = readings[device];
+
+        if (s == NULL) {
+            continue;
+        }
+
+        if (r.status == hcc_onewire::ReadingStatus::failed) {
+            s->failures++;
+        }
+
+        // Failed readings are garbage, retired and quarantined devices are not read at all
+        if (r.status != hcc_onewire::ReadingStatus::ok) {
+            continue;
+        }
+
+        s->lastValue = r.value;
+        s->resolution = r.resolution;
+
+        ReportFilter::State last = s->filter.save();
+
+        if (!s->filter.accept(r.value, now)) {
+            continue;
+        }
+
+        // The publisher would drop it, it's not reported until there's a way out
+        if (store == NULL && !sink->isOnline()) {
+            s->filter.restore(last);
+            continue;
+        }
+
+        record.sensor = sensorOffset;
+        record.signal = r.value;
+
+        push(record, s, last);
+    }
+}
+
+void SamplePipeline::endCycle(SampleRecord &record)
+{
+    record.sensor = SampleRecord::CYCLE_END;
+    push(record, NULL, ReportFilter::State());
+}
+
+void SamplePipeline::push(const SampleRecord &record, Sensor *s, const ReportFilter::State &last)
+{
+    if (ring->push(record)) {
+        return;
+    }
+
+    if (ring->getPolicy() == OverflowPolicy::dropNewest) {
+
+        // This one is lost, as if it was never accepted
+        if (s != NULL) {
+            s->filter.restore(last);
+        }
+
+        return;
+    }
+
+    // An older sample is lost, this one made it
+    forget(s);
+}
+
+void SamplePipeline::forget(Sensor *except)
+{
+    for (int offset = 0; offset < sensors->size(); offset++) {
+
+        Sensor *s = sensors->at(offset);
+
+        if (s != NULL && s != except) {
+            s->filter.reset();
+        }
+    }
+}
+
+bool SamplePipeline::process()
+{
+    SampleRecord record;
+
+    while (ring->pop(record)) {
+
+        // Nothing goes out before what was stored earlier
+        if (store != NULL && (!sink->isOnline() || !store->empty())) {
+            store->push(record);
+            continue;
+        }
+
+        // There's nowhere to keep the samples until the sink is back, the filters must not count them as reported
+        if (!sink->isOnline()) {
+
+            if (record.sensor != SampleRecord::CYCLE_END) {
+                dropped.store(true);
+            }
+
+            continue;
+        }
+
+        publish(record, false);
+    }
+
+    return sink->isOnline() && store != NULL && !store->empty() && drain();
+}
+
+bool SamplePipeline::drain()
+{
+    if (drainStarted < 0) {
+        drainStarted = clock->micros();
+        drainedBefore = store->getStats().drained;
+        ESP_LOGI(TAG, "[store] draining %d samples", (int) store->size());
+    }
+
+    SampleRecord record;
+
+    for (int count = 0; count < config.drainBatch && sink->isOnline() && store->pop(record); count++) {
+        publish(record, true);
+    }
+
+    if (!store->empty()) {
+        return true;
+    }
+
+    SampleStore::Stats stats = store->getStats();
+    int64_t millis = (clock->micros() - drainStarted) / 1000;
+    uint32_t drained = stats.drained - drainedBefore;
+
+    ESP_LOGI(TAG, "[store] drained %u samples in %dms (%.1f/s), %u dropped so far, %d bytes of RAM",
+        drained, (int) millis, millis > 0 ? drained * 1000.0 / millis : 0.0, stats.dropped, (int) store->getRamBytes());
+
+    drainStarted = -1;
+
+    return false;
+}
+
+void SamplePipeline::publish(const SampleRecord &record, bool late)
+{
+    if (config.batch) {
+
+        // The end of the previous cycle may have been lost to overflow
+        if (batchOpen && record.cycle != batchCycle) {
+            sendBatch();
+            batchOpen = false;
+        }
+
+        if (!batchOpen) {
+            beginBatch(record.timestamp);
+            batchCycle = record.cycle;
+            batchOpen = true;
+        }
+    }
+
+    if (record.sensor == SampleRecord::CYCLE_END) {
+
+        // All the samples may have been suppressed, nothing to say then
+        if (config.batch && getBatchSampleCount() > 0) {
+            sendBatch();
+        }
+
+        batchOpen = false;
+        return;
+    }
+
+    Sensor *s = sensors->at(record.sensor);
+
+    if (s == NULL) {
+        ESP_LOGE(TAG, "[1-Wire] sample for unknown sensor #%d, dropped", record.sensor);
+        return;
+    }
+
+    ESP_LOGI(TAG, "[1-Wire] %s: %.1fC", s->topic, record.signal);
+
+    if (config.perSensor) {
+        sendSample(s, record, late);
+    }
+
+    if (config.batch) {
+        addToBatch(s, record.signal);
+    }
+}
+
+void SamplePipeline::sendSample(Sensor *s, const SampleRecord &record, bool late)
+{
+    // VT: NOTE: For now, we just have temperature sensors, this may change in the future
+
+    if (config.json) {
+
+        int64_t started = clock->micros();
+        size_t length = late ? s->payload.render(record.signal, record.timestamp) : s->payload.render(record.signal);
+        sink->rendered(clock->micros() - started);
+
+        ESP_LOGI(TAG, "[mqtt] %s %s", s->topic, s->payload.c_str());
+
+        sink->publish(s->topic, s->payload.c_str(), length);
+    }
+
+    if (config.cbor) {
+
+        int64_t started = clock->micros();
+        size_t length = late ? s->cborPayload.render(record.signal, record.timestamp) : s->cborPayload.render(record.signal);
+        sink->rendered(clock->micros() - started);
+
+        ESP_LOGI(TAG, "[mqtt] %s (%d bytes)", s->cborTopic, (int) length);
+
+        sink->publish(s->cborTopic, (const char *) s->cborPayload.data(), length);
+    }
+}
+
+void SamplePipeline::beginBatch(int64_t timestamp)
+{
+    // No buffer, the setup couldn't allocate it. addToBatch() tries again, for the next cycle
+    if (config.json && !batch.begin(timestamp)) {
+        ESP_LOGW(TAG, "[mqtt] no batch message buffer, this cycle is not batched");
+    }
+
+    if (config.cbor && !cborBatch.begin(timestamp)) {
+        ESP_LOGW(TAG, "[mqtt] no CBOR batch message buffer, this cycle is not batched");
+    }
+}
+
+void SamplePipeline::addToBatch(Sensor *s, float signal)
+{
+    int64_t started = clock->micros();
+
+    // The rescan may have found more sensors than the buffers were allocated for
+    if (config.json && !batch.add(s->payload, signal) && batch.reserve(sensors->size())) {
+        batch.add(s->payload, signal);
+    }
+
+    if (config.cbor && !cborBatch.add(s->cborPayload, signal) && cborBatch.reserve(sensors->size())) {
+        cborBatch.add(s->cborPayload, signal);
+    }
+
+    sink->rendered(clock->micros() - started);
+}
+
+int SamplePipeline::getBatchSampleCount()
+{
+    // Either may have failed to begin, the other still has the samples
+    return std::max(config.json ? batch.getSampleCount() : 0, config.cbor ? cborBatch.getSampleCount() : 0);
+}
+
+void SamplePipeline::sendBatch()
+{
+    if (config.json) {
+
+        int64_t started = clock->micros();
+        size_t length = batch.finish();
+        sink->rendered(clock->micros() - started);
+
+        if (length > 0) {
+            ESP_LOGI(TAG, "[mqtt] %s %s", batchTopic, batch.c_str());
+
+            sink->publish(batchTopic, batch.c_str(), length);
+        }
+    }
+
+    if (config.cbor) {
+
+        int64_t started = clock->micros();
+        size_t length = cborBatch.finish();
+        sink->rendered(clock->micros() - started);
+
+        if (length > 0) {
+            ESP_LOGI(TAG, "[mqtt] %s (%d bytes)", cborBatchTopic, (int) length);
+
+            sink->publish(cborBatchTopic, (const char *) cborBatch.data(), length);
+        }
+    }
+}
+
+}
@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "sample_store.h"
+
+namespace hcc_pipeline {
+
+size_t MemoryStorage::size()
+{
+    return data.size();
+}
+
+size_t MemoryStorage::sectorSize()
+{
+    return sector;
+}
+
+bool MemoryStorage::erase(size_t offset, size_t length)
+{
+    if (offset % sector != 0 || length % sector != 0 || offset + length > data.size()) {
+        return false;
+    }
+
+    memset(&data[offset], 0xFF, length);
+    erases++;
+
+    return true;
+}
+
+bool MemoryStorage::write(size_t offset, const void *source, size_t length)
+{
+    if (offset + length > data.size()) {
+        return false;
+    }
+
+    // Like flash, writing can only clear bits
+    const uint8_t *bytes = (const uint8_t *) source;
+
+    for (size_t offset2 = 0; offset2 < length; offset2++) {
+        data[offset + offset2] &= bytes[offset2];
+    }
+
+    writes++;
+
+    return true;
+}
+
+bool MemoryStorage::read(size_t offset, void *target, size_t length)
+{
+    if (offset + length > data.size()) {
+        return false;
+    }
+
+    memcpy(target, &data[offset], length);
+
+    return true;
+}
+
+SampleStore::SampleStore(size_t ramCapacity, SpillStorage *spill) : ramCapacity(ramCapacity), spill(spill)
+{
+    ram = new SampleRecord[ramCapacity];
+
+    if (spill != NULL) {
+
+        // Records never cross the sector boundary, the tail of every sector is wasted
+        slotsPerSector = spill->sectorSize() / sizeof(SampleRecord);
+        slotCount = (spill->size() / spill->sectorSize()) * slotsPerSector;
+
+        if (slotCount < 2 * slotsPerSector) {
+            // Can't erase one sector without losing everything, not worth it
+            slotsPerSector = 0;
+            slotCount = 0;
+        }
+    }
+}
+
+SampleStore::~SampleStore()
+{
+    delete[] ram;
+}
+
+size_t SampleStore::offsetOf(uint32_t slot)
+{
+    size_t index = slot % slotCount;
+
+    return (index / slotsPerSector) * spill->sectorSize() + (index % slotsPerSector) * sizeof(SampleRecord);
+}
+
+void SampleStore::spillOldest()
+{
+    size_t count = ramHead - ramTail;
+
+    if (count > slotsPerSector) {
+        count = slotsPerSector;
+    }
+
+    for (size_t offset = 0; offset < count; offset++) {
+
+        if (spillHead % slotsPerSector == 0) {
+
+            if (spillHead - spillTail > slotCount - slotsPerSector) {
+
+                // The sector we're about to erase still holds unread records, they are lost
+                uint32_t reused = spillHead - slotCount + slotsPerSector;
+
+                stats.dropped += reused - spillTail;
+                spillTail = reused;
+            }
+
+            spill->erase(offsetOf(spillHead), spill->sectorSize());
+        }
+
+        if (!spill->write(offsetOf(spillHead), &ram[ramTail % ramCapacity], sizeof(SampleRecord))) {
+            stats.dropped++;
+        } else {
+            spillHead++;
+            stats.spilled++;
+        }
+
+        ramTail++;
+    }
+}
+
+void SampleStore::rebase()
+{
+    if (ramTail >= ramCapacity) {
+        ramHead -= ramCapacity;
+        ramTail -= ramCapacity;
+    }
+
+    // The slot count is a whole number of sectors, the position within the sector doesn't change either
+    if (slotCount > 0 && spillTail >= slotCount) {
+        spillHead -= slotCount;
+        spillTail -= slotCount;
+    }
+}
+
+void SampleStore::push(const SampleRecord &record)
+{
+    if (ramHead - ramTail == ramCapacity) {
+
+        if (slotCount > 0) {
+            spillOldest();
+        } else {
+            ramTail++;
+            stats.dropped++;
+        }
+    }
+
+    ram[ramHead % ramCapacity] = record;
+    ramHead++;
+    stats.stored++;
+
+    rebase();
+}
+
+bool SampleStore::pop(SampleRecord &record)
+{
+    // Whatever is in the spill log is older than anything in RAM
+    while (spillHead != spillTail) {
+
+        bool ok = spill->read(offsetOf(spillTail), &record, sizeof(SampleRecord));
+        spillTail++;
+
+        if (ok) {
+            stats.drained++;
+            rebase();
+            return true;
+        }
+
+        stats.dropped++;
+    }
+
+    if (ramHead == ramTail) {
+        return false;
+    }
+
+    record = ram[ramTail % ramCapacity];
+    ramTail++;
+    stats.drained++;
+
+    rebase();
+
+    return true;
+}
+}
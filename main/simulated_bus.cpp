@@ -0,0 +1,314 @@
+#include <math.h>
+#include <string.h>
+
+#include "simulated_bus.h"
+
+namespace hcc_onewire {
+
+// DS18B20 family code
+#define FAMILY_DS18B20              0x28
+
+// Maximum 12 bit conversion time from the datasheet
+#define CONVERSION_MICROS_12_BIT    750000
+
+// What the scratchpad holds after the power up, before the first conversion
+#define POWER_ON_RESET_VALUE        85.0f
+
+int64_t SimulatedClock::micros()
+{
+    return now;
+}
+
+void SimulatedClock::sleepUntil(int64_t deadline)
+{
+    if (deadline > now) {
+        now = deadline;
+    }
+}
+
+void SimulatedClock::advance(int64_t micros)
+{
+    now += micros;
+}
+
+bool MemoryRomCache::load(const char *busName, std::vector<CachedDevice> &devices)
+{
+    auto found = buses.find(busName);
+
+    if (found == buses.end()) {
+        devices.clear();
+        return false;
+    }
+
+    devices = found->second;
+
+    return !devices.empty();
+}
+
+bool MemoryRomCache::store(const char *busName, const std::vector<CachedDevice> &devices)
+{
+    stores++;
+
+    if (devices.empty()) {
+        buses.erase(busName);
+    } else {
+        buses[busName] = devices;
+    }
+
+    return true;
+}
+
+/**
+ * Dallas/Maxim CRC8, the way the ROM code ends with.
+ */
+static uint8_t crc8(const uint8_t *data, int length)
+{
+    uint8_t crc = 0;
+
+    for (int offset = 0; offset < length; offset++) {
+
+        uint8_t byte = data[offset];
+
+        for (int bit = 0; bit < 8; bit++) {
+            uint8_t mix = (crc ^ byte) & 0x01;
+            crc >>= 1;
+            if (mix) {
+                crc ^= 0x8C;
+            }
+            byte >>= 1;
+        }
+    }
+
+    return crc;
+}
+
+SimulatedBus::SimulatedBus(const char *name, Clock *clock, const Config &config) : clock(clock), config(config)
+{
+    strncpy(this->name, name, sizeof(this->name) - 1);
+    this->name[sizeof(this->name) - 1] = 0;
+
+    // xorshift doesn't survive a zero seed
+    random = config.seed != 0 ? config.seed : 1;
+
+    for (int offset = 0; offset < config.devices; offset++) {
+        plug(20.0f + (next() % 100) / 10.0f);
+    }
+
+    nextHotPlug = config.hotPlugMicros > 0 ? clock->micros() + config.hotPlugMicros : 0;
+}
+
+uint32_t SimulatedBus::next()
+{
+    random ^= random << 13;
+    random ^= random >> 17;
+    random ^= random << 5;
+
+    return random;
+}
+
+bool SimulatedBus::chance(float probability)
+{
+    return probability > 0 && (next() % 1000000) < probability * 1000000;
+}
+
+void SimulatedBus::hotPlug()
+{
+    if (nextHotPlug == 0 || clock->micros() < nextHotPlug || devices.empty()) {
+        return;
+    }
+
+    int offset = next() % devices.size();
+    setPresent(offset, !devices[offset].present);
+
+    stats.hotPlugs++;
+    nextHotPlug = clock->micros() + config.hotPlugMicros;
+}
+
+int SimulatedBus::plug(float temperature)
+{
+    SimulatedDevice d = {};
+
+    d.romCode.bytes[0] = FAMILY_DS18B20;
+
+    for (int offset = 1; offset < 7; offset++) {
+        d.romCode.bytes[offset] = next() & 0xFF;
+    }
+
+    d.romCode.bytes[7] = crc8(d.romCode.bytes, 7);
+    d.present = true;
+    d.temperature = temperature;
+    d.resolution = RESOLUTION_12_BIT;
+    d.scratchpad = POWER_ON_RESET_VALUE;
+    d.converting = POWER_ON_RESET_VALUE;
+    d.conversionComplete = 0;
+
+    devices.push_back(d);
+
+    return devices.size() - 1;
+}
+
+void SimulatedBus::setPresent(int offset, bool present)
+{
+    SimulatedDevice &d = devices[offset];
+
+    if (present && !d.present) {
+        // Power cycled, lost everything it had
+        d.resolution = RESOLUTION_12_BIT;
+        d.scratchpad = POWER_ON_RESET_VALUE;
+        d.converting = POWER_ON_RESET_VALUE;
+        d.conversionComplete = 0;
+    }
+
+    d.present = present;
+}
+
+int SimulatedBus::find(const RomCode &romCode)
+{
+    for (int offset = 0; offset < (int) devices.size(); offset++) {
+        if (memcmp(devices[offset].romCode.bytes, romCode.bytes, sizeof(romCode.bytes)) == 0) {
+            return offset;
+        }
+    }
+
+    return -1;
+}
+
+const char *SimulatedBus::getName()
+{
+    return name;
+}
+
+bool SimulatedBus::initialize()
+{
+    return true;
+}
+
+bool SimulatedBus::search(bool first, RomCode &romCode, bool &found)
+{
+    hotPlug();
+
+    if (first) {
+        searchNext = 0;
+        stats.searches++;
+    }
+
+    while (searchNext < (int) devices.size() && !devices[searchNext].present) {
+        searchNext++;
+    }
+
+    found = searchNext < (int) devices.size();
+
+    if (found) {
+        romCode = devices[searchNext++].romCode;
+    }
+
+    return true;
+}
+
+bool SimulatedBus::verify(const RomCode &romCode, bool &present)
+{
+    int offset = find(romCode);
+
+    present = offset >= 0 && devices[offset].present;
+
+    return true;
+}
+
+int SimulatedBus::attach(const RomCode &romCode, bool solo)
+{
+    attached.push_back(find(romCode));
+    this->solo.push_back(solo);
+
+    return attached.size() - 1;
+}
+
+void SimulatedBus::setSolo(int offset, bool solo)
+{
+    this->solo[offset] = solo;
+}
+
+bool SimulatedBus::isSolo(int offset)
+{
+    return solo[offset];
+}
+
+bool SimulatedBus::setResolution(int offset, Resolution resolution)
+{
+    int index = attached[offset];
+
+    if (index < 0 || !devices[index].present) {
+        return false;
+    }
+
+    devices[index].resolution = resolution;
+
+    return true;
+}
+
+void SimulatedBus::convertAll()
+{
+    hotPlug();
+
+    stats.conversions++;
+
+    int64_t now = clock->micros();
+
+    for (auto &d : devices) {
+
+        if (!d.present) {
+            continue;
+        }
+
+        // A slow random walk, a tenth of a degree at most
+        d.temperature += ((int) (next() % 201) - 100) / 1000.0f;
+
+        // The lowest bits are undefined at lower resolutions, the real device leaves them at zero
+        float step = 0.0625f * (1 << (RESOLUTION_12_BIT - d.resolution));
+
+        if (now >= d.conversionComplete) {
+            d.scratchpad = d.converting;
+        }
+
+        d.converting = floorf(d.temperature / step) * step;
+        d.conversionComplete = now + (int64_t) (CONVERSION_MICROS_12_BIT * config.conversionScale) / (1 << (RESOLUTION_12_BIT - d.resolution));
+    }
+}
+
+BusError SimulatedBus::read(int offset, float &value)
+{
+    stats.reads++;
+
+    if (config.readMicros > 0) {
+        clock->sleepUntil(clock->micros() + config.readMicros);
+    }
+
+    int index = attached[offset];
+
+    if (index < 0 || !devices[index].present || devices[index].failing || chance(config.deviceFailureRate)) {
+        stats.deviceFailures++;
+        return BusError::device;
+    }
+
+    // Everyone answers to the skipped ROM, the answers collide
+    int presentCount = 0;
+
+    for (auto &d : devices) {
+        presentCount += d.present ? 1 : 0;
+    }
+
+    if ((solo[offset] && presentCount > 1) || chance(config.crcFailureRate)) {
+        stats.crcFailures++;
+        return BusError::crc;
+    }
+
+    SimulatedDevice &d = devices[index];
+
+    if (clock->micros() >= d.conversionComplete) {
+        d.scratchpad = d.converting;
+    }
+
+    value = d.scratchpad;
+
+    return BusError::ok;
+}
+}
@@ -0,0 +1,204 @@
+#include "simulated_stepper.h"
+
+namespace stepper {
+
+void SimulatedOutputPins::setup(int pin, bool level)
+{
+    set(pin, level);
+}
+
+void SimulatedOutputPins::set(int pin, bool level)
+{
+    if (levels[pin] != level) {
+        levels[pin] = level;
+        changed[pin] = clock->micros();
+    }
+}
+
+bool SimulatedPulseGenerator::initialize()
+{
+    return true;
+}
+
+uint32_t SimulatedPulseGenerator::ahead()
+{
+    int64_t now = clock->micros();
+    uint32_t result = 0;
+
+    for (size_t offset = pulses.size(); offset > runStart && pulses[offset - 1] > now; offset--) {
+        result++;
+    }
+
+    return result;
+}
+
+void SimulatedPulseGenerator::render()
+{
+    while (!finished && ahead() < LOOKAHEAD) {
+
+        pulses.push_back(next);
+        stats.pulses++;
+
+        if (observer != NULL) {
+
+            observer->pulse(next);
+
+            if (finished) {
+                break;
+            }
+        }
+
+        uint32_t pulse = pulses.size() - runStart - 1;
+        uint32_t period = pulse + 1 < count ? timing->periodAt(pulse) : 0;
+
+        if (period == 0) {
+            finished = true;
+            break;
+        }
+
+        // Same as the hardware does
+        period = period < 2 * PULSE_MICROS ? 2 * PULSE_MICROS : period;
+
+        if (stats.minPeriod == 0 || period < stats.minPeriod) {
+            stats.minPeriod = period;
+        }
+
+        if (period > stats.maxPeriod) {
+            stats.maxPeriod = period;
+        }
+
+        next += period;
+    }
+}
+
+bool SimulatedPulseGenerator::start(uint32_t count, StepTiming *timing, uint32_t delayMicros)
+{
+    if (count == 0 || isBusy()) {
+        return false;
+    }
+
+    this->count = count;
+    this->timing = timing;
+
+    runStart = pulses.size();
+    next = clock->micros() + (delayMicros < PULSE_MICROS ? PULSE_MICROS : delayMicros);
+    finished = false;
+
+    stats.runs++;
+
+    render();
+
+    return true;
+}
+
+bool SimulatedPulseGenerator::wait(int64_t timeoutMicros)
+{
+    int64_t deadline = timeoutMicros < 0 ? INT64_MAX : clock->micros() + timeoutMicros;
+
+    while (isBusy()) {
+
+        // Everything up to the last pulse rendered is known, go there and see what comes next
+        int64_t event = pulses.back() + (finished ? PULSE_MICROS : 0);
+
+        if (event > deadline) {
+            clock->sleepUntil(deadline);
+            return !isBusy();
+        }
+
+        clock->sleepUntil(event);
+    }
+
+    return true;
+}
+
+uint32_t SimulatedPulseGenerator::haltAt(int64_t time)
+{
+    uint32_t dropped = 0;
+
+    while (pulses.size() > runStart && pulses.back() > time) {
+        pulses.pop_back();
+        dropped++;
+    }
+
+    finished = true;
+
+    stats.pulses -= dropped;
+    stats.stops++;
+
+    return dropped;
+}
+
+uint32_t SimulatedPulseGenerator::stop()
+{
+    halt();
+
+    return getPulses();
+}
+
+void SimulatedPulseGenerator::halt()
+{
+    // The run may be fully rendered, but not emitted yet
+    if (isBusy()) {
+        haltAt(clock->micros());
+    }
+}
+
+uint32_t SimulatedPulseGenerator::getPulses()
+{
+    return pulses.size() - runStart;
+}
+
+bool SimulatedPulseGenerator::isBusy()
+{
+    render();
+
+    return !finished || (pulses.size() > runStart && clock->micros() < pulses.back() + PULSE_MICROS);
+}
+
+SimulatedLimitSwitch::SimulatedLimitSwitch(SimulatedPulseGenerator *generator, SimulatedOutputPins *pins, int dirPin, bool towards, int distance) :
+    generator(generator), pins(pins), dirPin(dirPin), towards(towards), distance(distance)
+{
+}
+
+void SimulatedLimitSwitch::pulse(int64_t time)
+{
+    position += pins->get(dirPin) == towards ? 1 : -1;
+
+    if (armed && !triggered && isPressed()) {
+
+        triggered = true;
+
+        // The pulses after this one are not going to make it
+        generator->haltAt(time + LATENCY_MICROS);
+    }
+}
+
+bool SimulatedLimitSwitch::initialize()
+{
+    generator->setObserver(this);
+
+    return true;
+}
+
+bool SimulatedLimitSwitch::isPressed()
+{
+    return position >= distance;
+}
+
+void SimulatedLimitSwitch::arm(PulseGenerator *pulses)
+{
+    triggered = false;
+    armed = true;
+}
+
+void SimulatedLimitSwitch::disarm()
+{
+    armed = false;
+}
+
+bool SimulatedLimitSwitch::isTriggered()
+{
+    return triggered;
+}
+
+}
@@ -0,0 +1,121 @@
+#include <algorithm>
+
+#include "esp_log.h"
+
+#include "sleep_retainer.h"
+
+namespace hcc_power {
+
+/**
+ * How often publish() looks whether the sink is online yet.
+ */
+#define ONLINE_POLL_MICROS (50 * 1000LL)
+
+void SleepRetainer::reset()
+{
+    counts->sensorCount = 0;
+    counts->sampleCount = 0;
+}
+
+void SleepRetainer::restore(hcc_pipeline::SensorDirectory *directory, hcc_pipeline::SampleStore *store)
+{
+    int sensorCount = std::min(counts->sensorCount, sensorCapacity);
+    int sampleCount = std::min(counts->sampleCount, sampleCapacity);
+
+    // Where the sensors are in the registry now, -1 if they are gone
+    int offsets[sensorCount > 0 ? sensorCount : 1];
+
+    for (int offset = 0; offset < sensorCount; offset++) {
+
+        hcc_pipeline::Sensor *s = directory->find(sensors[offset].romCode);
+
+        offsets[offset] = s != NULL ? directory->offsetOf(s) : -1;
+
+        if (s != NULL) {
+            s->filter.restore(sensors[offset].filter);
+        }
+    }
+
+    int dropped = 0;
+
+    for (int index = 0; index < sampleCount; index++) {
+
+        hcc_pipeline::SampleRecord record = samples[index];
+
+        if (record.sensor != hcc_pipeline::SampleRecord::CYCLE_END) {
+
+            if (record.sensor >= sensorCount || offsets[record.sensor] < 0) {
+                dropped++;
+                continue;
+            }
+
+            record.sensor = offsets[record.sensor];
+        }
+
+        store->push(record);
+    }
+
+    if (dropped > 0) {
+        ESP_LOGW(TAG, "[power] %d kept samples dropped, their sensors are gone", dropped);
+    }
+
+    counts->sampleCount = 0;
+}
+
+void SleepRetainer::retain(hcc_pipeline::SensorDirectory *directory, hcc_pipeline::SampleStore *store)
+{
+    counts->sensorCount = std::min(directory->size(), sensorCapacity);
+
+    for (int offset = 0; offset < counts->sensorCount; offset++) {
+
+        hcc_pipeline::Sensor *s = directory->at(offset);
+
+        sensors[offset].romCode = s->romCode;
+        sensors[offset].filter = s->filter.save();
+    }
+
+    int excess = (int) store->size() - sampleCapacity;
+    hcc_pipeline::SampleRecord record;
+
+    if (excess > 0) {
+        ESP_LOGW(TAG, "[power] %d samples don't fit into RTC memory, dropped", excess);
+    }
+
+    for (; excess > 0 && store->pop(record); excess--) {
+    }
+
+    counts->sampleCount = 0;
+
+    while (counts->sampleCount < sampleCapacity && store->pop(record)) {
+
+        // The samples of the sensors not retained would come back as someone else's
+        if (record.sensor != hcc_pipeline::SampleRecord::CYCLE_END && record.sensor >= counts->sensorCount) {
+            continue;
+        }
+
+        samples[counts->sampleCount++] = record;
+    }
+}
+
+bool SleepRetainer::publish(hcc_pipeline::SamplePipeline *pipeline, hcc_pipeline::SampleStore *store,
+    hcc_pipeline::MessageSink *sink, uint32_t cycle, int64_t deadline)
+{
+    while (!sink->isOnline() && clock->micros() < deadline) {
+        clock->sleepUntil(std::min<int64_t>(clock->micros() + ONLINE_POLL_MICROS, deadline));
+    }
+
+    if (!sink->isOnline()) {
+        ESP_LOGW(TAG, "[power] no broker connection in time, %d samples kept for the next wake", (int) store->size());
+        return false;
+    }
+
+    hcc_pipeline::SampleRecord record;
+
+    while (sink->isOnline() && store->pop(record)) {
+        pipeline->publish(record, record.cycle != cycle);
+    }
+
+    return true;
+}
+
+}